@@ -5,6 +5,7 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <experimental/filesystem>
+#include <cstddef>
 #include <iostream>
 #include <vector>
 
@@ -106,7 +107,8 @@ namespace paths {
 namespace ackevents {
 
 AckEventCollector::AckEventCollector(const std::shared_ptr<CallbackHandler>& cbHandler)
-    : cbHandler_(cbHandler), running_(false), events_(0), lost_events_(0) {}
+    : cbHandler_(cbHandler), running_(false), bpf_(FLAGS_kbuild_modname),
+      events_(0), lost_events_(0) {}
 
 bool
 AckEventCollector::run() {
@@ -155,6 +157,14 @@ AckEventCollector::run() {
   LOG(INFO) << folly::format(
       "Read BPF source from {}", pathToBpfSource.filename().c_str());
 
+  // every BPF function that is attached below
+  std::vector<common::BpfLoader::Program> programs = {
+      {"on_tcp_destroy_sock", BPF_PROG_TYPE_TRACEPOINT},
+      {"on_inet_sock_set_state", BPF_PROG_TYPE_TRACEPOINT},
+      {"on_tcp_rate_skb_delivered", BPF_PROG_TYPE_KPROBE},
+      {"on_tcp_trim_head", BPF_PROG_TYPE_KPROBE},
+  };
+
   // load the BPF program
   {
     const auto bpfSourceFilename = pathToBpfSource.filename().c_str();
@@ -162,7 +172,7 @@ AckEventCollector::run() {
         "Compiling and loading {} with flags {}",
         bpfSourceFilename,
         folly::join(" ", cflags));
-    auto r = ebpf_.init(fileContents, cflags);
+    auto r = bpf_.init(pathToBpfSource, fileContents, cflags, programs);
     if (r.code() != 0) {
       LOG(ERROR) << folly::format(
           "Error loading BPF program {}: {}", bpfSourceFilename, r.msg());
@@ -177,7 +187,7 @@ AckEventCollector::run() {
   {
     const std::string tracepoint = "tcp:tcp_destroy_sock";
     const std::string fn = "on_tcp_destroy_sock";
-    auto r = ebpf_.attach_tracepoint(tracepoint, fn);
+    auto r = bpf_.attachTracepoint(tracepoint, fn);
     if (r.code() != 0) {
       LOG(ERROR) << folly::format(
           "Error attaching BPF function {} to tracepoint {}: {}",
@@ -199,7 +209,7 @@ AckEventCollector::run() {
   {
     const std::string tracepoint = "sock:inet_sock_set_state";
     const std::string fn = "on_inet_sock_set_state";
-    auto r = ebpf_.attach_tracepoint(tracepoint, fn);
+    auto r = bpf_.attachTracepoint(tracepoint, fn);
     if (r.code() != 0) {
       LOG(ERROR) << folly::format(
           "Error attaching BPF function {} to tracepoint {}: {}",
@@ -216,7 +226,7 @@ AckEventCollector::run() {
   {
     const std::string kprobe = "tcp_rate_skb_delivered";
     const std::string fn = "on_tcp_rate_skb_delivered";
-    auto r = ebpf_.attach_kprobe(kprobe, fn);
+    auto r = bpf_.attachKprobe(kprobe, fn);
     if (r.code() != 0) {
       LOG(ERROR) << folly::format(
           "Error attaching BPF function {} to kprobe {}: {}",
@@ -233,7 +243,7 @@ AckEventCollector::run() {
   {
     const std::string kprobe = "tcp_trim_head";
     const std::string fn = "on_tcp_trim_head";
-    auto r = ebpf_.attach_kprobe(kprobe, fn);
+    auto r = bpf_.attachKprobe(kprobe, fn);
     if (r.code() != 0) {
       LOG(ERROR) << folly::format(
           "Error attaching BPF function {} to kprobe {}: {}",
@@ -249,7 +259,7 @@ AckEventCollector::run() {
 
   const auto perfBuffName = "events";
   {
-    auto r = ebpf_.open_perf_buffer(
+    auto r = bpf_.openPerfBuffer(
         perfBuffName,
         &handleRawPerfEvent,
         &handleRawLostPerfEvents,
@@ -263,13 +273,26 @@ AckEventCollector::run() {
     }
   }
 
+  // sweep entries leaked by missed on_tcp_destroy_sock calls
+  sweeper_ = common::BpfMapSweeper::createFromFlags(
+      bpf_.getMapFd("ht"),
+      folly::sformat("{}:ht", FLAGS_kbuild_modname),
+      offsetof(bpf::ack_state, conn_tstamp_ns),
+      std::chrono::nanoseconds(1));
+  if (sweeper_) {
+    sweeper_->start();
+  }
+
   // poll events from the perf buffer
   LOG(INFO) << folly::format(
       "Waiting for AckEvents from perf buffer {}", perfBuffName);
   while (running_.load()) {
-    ebpf_.poll_perf_buffer(perfBuffName, 1000);
+    bpf_.pollPerfBuffer(perfBuffName, 1000);
   }
   LOG(INFO) << "Exited perf buffer poll loop";
+  if (sweeper_) {
+    sweeper_->stop();
+  }
   return true;
 }
 
@@ -0,0 +1,144 @@
+/**
+ * Rows per second of the ackevents CSV export path.
+ *
+ * legacyRow reproduces the exporter before CsvRowEncoder (a vector of
+ * std::to_string and SocketAddress::describe() columns, folly::join, and a
+ * prefix string parsed on every inSubnet call); encoderRow is the current
+ * path. Run with --bm_min_usec to get stable numbers, e.g.:
+ *   buck run //src/ackevents:AckEventsCsvBenchmark -- --bm_min_usec=1000000
+ */
+#include <src/ackevents/AckEventCsv.h>
+#include <src/common/CsvRowEncoder.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <folly/Benchmark.h>
+#include <folly/IPAddress.h>
+#include <folly/String.h>
+#include <folly/init/Init.h>
+
+using namespace paths::ackevents;
+
+namespace {
+
+const std::string kMonitoredPrefix = "10.0.0.0/9";
+
+bpf::ack_event
+makeEvent() {
+  bpf::ack_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.header.ev_tstamp_ns = 1571234567890123456ULL;
+  ev.header.conn_tstamp_ns = 1571234560000000000ULL;
+
+  auto src = reinterpret_cast<struct sockaddr_in6*>(&ev.header.src);
+  src->sin6_family = AF_INET6;
+  src->sin6_port = htons(443);
+  inet_pton(AF_INET6, "::ffff:192.0.2.10", &src->sin6_addr);
+  auto dst = reinterpret_cast<struct sockaddr_in6*>(&ev.header.dst);
+  dst->sin6_family = AF_INET6;
+  dst->sin6_port = htons(51234);
+  inet_pton(AF_INET6, "::ffff:10.1.2.3", &dst->sin6_addr);
+
+  ev.fstloss.by_stats = 123;
+  ev.fstloss.by_seqnum = 4022341233U;
+  ev.segments_lost = 7;
+  ev.tcp.delivered = 87312;
+  ev.tcp.srtt_us = 35211;
+  ev.tcp.mdev_us = 1203;
+  ev.tcp.min_rtt_us = 30111;
+  ev.tcp.snd_cwnd = 212;
+  ev.tcp.mss_cache = 1448;
+  ev.tcp.rto = 232;
+  ev.stats.calls_from_rate_skb = 61342;
+  return ev;
+}
+
+size_t
+legacyRow(const bpf::ack_event& ev, const std::string& prefix) {
+  const auto dst = toSocketAddress(&ev.header.dst);
+  if (!dst.getIPAddress().inSubnet(prefix)) {
+    return 0;
+  }
+  std::vector<std::string> row;
+  row.push_back(std::to_string(ev.header.ev_tstamp_ns));
+  row.push_back(std::to_string(ev.header.conn_tstamp_ns));
+  row.push_back(toSocketAddress(&ev.header.src).describe());
+  row.push_back(dst.describe());
+  row.push_back(std::to_string(ev.fstloss.by_stats));
+  row.push_back(std::to_string(ev.fstloss.by_seqnum));
+  row.push_back(std::to_string(ev.segments_lost));
+  row.push_back(std::to_string(ev.non_spurious_retrans));
+  row.push_back(std::to_string(ev.dsack_recovered));
+  row.push_back(std::to_string(ev.timestamp_recovered));
+  row.push_back(std::to_string(ev.dsack_and_timestamp_recovered));
+  row.push_back(std::to_string(ev.dsack_or_timestamp_recovered));
+  row.push_back(std::to_string(ev.fake_dsack_recovery_induced_by_lost_tlp));
+  row.push_back(std::to_string(ev.tcp.delivered));
+  row.push_back(std::to_string(ev.tcp.lost));
+  row.push_back(std::to_string(ev.tcp.total_retrans));
+  row.push_back(std::to_string(ev.tcp.srtt_us));
+  row.push_back(std::to_string(ev.tcp.mdev_us));
+  row.push_back(std::to_string(ev.tcp.min_rtt_us));
+  row.push_back(std::to_string(ev.tcp.snd_cwnd));
+  row.push_back(std::to_string(ev.tcp.mss_cache));
+  row.push_back(std::to_string(ev.tcp.rto));
+  row.push_back(std::to_string(ev.stats.calls_from_rate_skb));
+  row.push_back(std::to_string(ev.stats.calls_from_trim_head));
+  row.push_back(std::to_string(ev.stats.calls_with_mstamp_zero));
+  row.push_back(std::to_string(ev.stats.tcpcb_sacked_retrans));
+  row.push_back(std::to_string(ev.stats.tcpcb_retrans));
+  row.push_back(std::to_string(ev.stats.spurious_tlp_retrans));
+  row.push_back(std::to_string(ev.stats.trim_from_ack));
+  row.push_back(std::to_string(ev.stats.trim_from_rtx));
+  return folly::join(",", row).size();
+}
+
+size_t
+encoderRow(
+    const bpf::ack_event& ev,
+    const folly::CIDRNetwork& network,
+    paths::common::CsvRowEncoder& encoder) {
+  const auto dst = toSocketAddress(&ev.header.dst);
+  if (!dst.getIPAddress().inSubnet(network.first, network.second)) {
+    return 0;
+  }
+  encoder.clear();
+  encodeCsvRow(ev, encoder);
+  return encoder.str().size();
+}
+
+} // namespace
+
+BENCHMARK(legacyRows, iters) {
+  bpf::ack_event ev;
+  BENCHMARK_SUSPEND {
+    ev = makeEvent();
+  }
+  for (size_t i = 0; i < iters; i++) {
+    folly::doNotOptimizeAway(legacyRow(ev, kMonitoredPrefix));
+  }
+}
+
+BENCHMARK_RELATIVE(encoderRows, iters) {
+  bpf::ack_event ev;
+  folly::CIDRNetwork network;
+  paths::common::CsvRowEncoder encoder;
+  BENCHMARK_SUSPEND {
+    ev = makeEvent();
+    network = folly::IPAddress::createNetwork(kMonitoredPrefix);
+  }
+  for (size_t i = 0; i < iters; i++) {
+    folly::doNotOptimizeAway(encoderRow(ev, network, encoder));
+  }
+}
+
+int
+main(int argc, char* argv[]) {
+  folly::init(&argc, &argv);
+  folly::runBenchmarks();
+  return 0;
+}
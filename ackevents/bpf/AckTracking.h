@@ -0,0 +1,245 @@
+#pragma once
+
+/* Per-ACK loss accounting of ackevents, shared by the ackevents program and
+ * the ack module of pathsd: the connection state is kept in a struct
+ * ack_state, updated from tcp_rate_skb_delivered and tcp_trim_head, and
+ * exported as a struct ack_event.
+ *
+ * Needs BpfStructs.h, UINT*_MAX and the _, _minmax_get and INCMAX macros of
+ * the including program. */
+
+#include "EventHeader.h"
+
+static u32 local_tcp_skb_timestamp(const struct sk_buff *skb)
+{
+  return div_u64(skb->skb_mstamp_ns, NSEC_PER_SEC / TCP_TS_HZ);
+}
+
+static int local_tcp_skb_pcount(const struct sk_buff *skb)
+{
+  struct tcp_skb_cb *scb = TCP_SKB_CB(skb);
+  /* Kernel function returns int, but tcp_gso_segs is u16 */
+  u16 pcount;
+  bpf_probe_read(&pcount, sizeof(pcount), &(scb->tcp_gso_segs));
+  return pcount;
+}
+
+static bool get_saw_tstamp(const struct tcp_sock *tp)
+{
+  u16 bitfield;
+  // There should be no padding as all fields up to the point are u32
+  u8* ptr = (u8*)&(tp->rx_opt.rcv_tsecr);
+  ptr += sizeof(tp->rx_opt.rcv_tsecr);
+  bpf_probe_read(&bitfield, sizeof(bitfield), ptr);
+  // https://elixir.bootlin.com/linux/latest/source/include/linux/tcp.h#L87
+  // We get the *last* bit because i386/amd64 is little-endian.
+  // Of course, this doesn't work on big-endian machines.
+  return (bool)(bitfield & (0x01));
+}
+
+/* Copied from the kernel because it is a static function. */
+static bool tcp_tsopt_ecr_before(const struct tcp_sock *tp, u32 when)
+{
+  bool saw_tstamp = get_saw_tstamp(tp);
+  u32 rcv_tsecr;
+  bpf_probe_read(&rcv_tsecr, sizeof(rcv_tsecr), &(tp->rx_opt.rcv_tsecr));
+  // return saw_tstamp && tp->rx_opt.rcv_tsecr &&
+  //    before(tp->rx_opt.rcv_tsecr, when);
+  return saw_tstamp && rcv_tsecr && before(rcv_tsecr, when);
+}
+
+static bool tcp_skb_spurious_retrans(u8 sacked,
+    const struct tcp_sock *tp,
+    const struct sk_buff *skb)
+{
+  return (sacked & TCPCB_RETRANS) &&
+      tcp_tsopt_ecr_before(tp, local_tcp_skb_timestamp(skb));
+}
+
+static void fill_in_tcp_data(struct ack_event *ev, const struct sock *sk)
+{
+  const struct tcp_sock* tp = tcp_sk(sk);
+  const struct inet_connection_sock* icsk = inet_csk(sk);
+  _(ev->tcp.delivered, tp->delivered);
+  _(ev->tcp.lost, tp->lost);
+  _(ev->tcp.total_retrans, tp->total_retrans);
+  _(ev->tcp.srtt_us, tp->srtt_us);
+  ev->tcp.srtt_us >>= 3;
+  _(ev->tcp.mdev_us, tp->mdev_us);
+  ev->tcp.mdev_us >>= 2;
+  _minmax_get(ev->tcp.min_rtt_us, tp->rtt_min);
+  _(ev->tcp.snd_cwnd, tp->snd_cwnd);
+  _(ev->tcp.mss_cache, tp->mss_cache);
+  _(ev->tcp.rto, icsk->icsk_rto);
+}
+
+static void clean_trim_info(struct ack_state *st) {
+  st->trim.cached = false;
+  st->trim.seq = 0;
+  st->trim.end_seq = 0;
+}
+
+static void ack_state_init(struct ack_state *st, const struct sock *sk)
+{
+  struct tcp_sock *tp = tcp_sk(sk);
+  _(st->established_snd_una, tp->snd_una);
+  _(st->prior_snd_una, tp->snd_una);
+  _(st->conn_tstamp_ns, tp->cd_init_clock_ns);
+}
+
+/* Fills ev from the per-connection state; the header and tcp snapshot are
+ * read from the socket rather than being kept in the map value. Returns -1
+ * if the socket family is not supported. */
+static int
+ack_event_fill(struct ack_event *ev, struct ack_state *st,
+    const struct sock *sk)
+{
+  if (event_hdr_init(&ev->header, sk) < 0) { return -1; }
+
+  ev->fstloss.by_stats = st->fstloss.by_stats;
+  ev->fstloss.by_seqnum = st->fstloss.by_seqnum;
+
+  ev->established_snd_una = st->established_snd_una;
+  ev->prior_snd_una = st->prior_snd_una;
+  ev->seq = 0;
+  ev->end_seq = 0;
+
+  ev->segments_lost = st->segments_lost;
+  ev->non_spurious_retrans = 0;
+  ev->dsack_recovered = st->dsack_recovered;
+  ev->timestamp_recovered = st->timestamp_recovered;
+  ev->dsack_and_timestamp_recovered = st->dsack_and_timestamp_recovered;
+  ev->dsack_or_timestamp_recovered = st->dsack_or_timestamp_recovered;
+  ev->fake_dsack_recovery_induced_by_lost_tlp =
+    st->fake_dsack_recovery_induced_by_lost_tlp;
+
+  ev->stats.calls_from_rate_skb = st->stats.calls_from_rate_skb;
+  ev->stats.calls_from_trim_head = st->stats.calls_from_trim_head;
+  ev->stats.calls_with_mstamp_zero = st->stats.calls_with_mstamp_zero;
+  ev->stats.tcpcb_sacked_retrans = st->stats.tcpcb_sacked_retrans;
+  ev->stats.tcpcb_retrans = st->stats.tcpcb_retrans;
+  ev->stats.spurious_tlp_retrans = st->stats.spurious_tlp_retrans;
+  ev->stats.trim_from_ack = st->stats.trim_from_ack;
+  ev->stats.trim_from_rtx = st->stats.trim_from_rtx;
+
+  ev->trim.cached = st->trim.cached;
+  ev->trim.seq = st->trim.seq;
+  ev->trim.end_seq = st->trim.end_seq;
+
+  fill_in_tcp_data(ev, sk);
+  return 0;
+}
+
+/* Accounts for an skb delivered by tcp_rate_skb_delivered. Returns its
+ * pcount, or -1 if the skb was already sacked and is ignored. The caller
+ * clears the trim info and saves snd_una afterwards. */
+static int
+ack_track_delivered(struct ack_state *st,
+    struct sock *sk,
+    struct sk_buff *skb)
+{
+  INCMAX(st->stats.calls_from_rate_skb, UINT16_MAX);
+
+  struct tcp_sock *tp = tcp_sk(sk);
+  struct tcp_skb_cb *scb = TCP_SKB_CB(skb);
+
+  // skb already sacked:
+  // https://github.com/torvalds/linux/blob/v5.4/net/ipv4/tcp_rate.c#L101-L106
+  if(!scb->tx.delivered_mstamp) {
+    INCMAX(st->stats.calls_with_mstamp_zero, UINT16_MAX);
+    return -1;
+  }
+
+  int pcount = local_tcp_skb_pcount(skb);
+
+  if(scb->sacked & TCPCB_RETRANS) {
+    INCMAX(st->stats.tcpcb_retrans, UINT16_MAX);
+    if(scb->sacked & TCPCB_SACKED_RETRANS) {
+      INCMAX(st->stats.tcpcb_sacked_retrans, UINT16_MAX);
+    }
+
+    // There was a retransmission and it was ruled unnecessary by timestamps.
+    // Packet needs to be cumulatively acked
+    // https://github.com/torvalds/linux/blob/v5.4/net/ipv4/tcp_input.c#L3095-L3107
+    bool timestamp_recovered = tcp_skb_spurious_retrans(scb->sacked, tp, skb);
+    timestamp_recovered &= (scb->end_seq <= tp->snd_una) ||
+      (st->trim.cached && st->trim.end_seq <= tp->snd_una);
+
+    if(scb->sacked & TCPCB_EVER_RETRANS && timestamp_recovered
+        && tp->tlp_high_seq == scb->end_seq) {
+      // There was a spurius retransmission due to TLP. To
+      // detect if it was spurious we need to check if the ack
+      // is from the original packet or from the probe.
+      INCMAX(st->stats.spurious_tlp_retrans, UINT16_MAX);
+    }
+
+    // Retransmission ruled unecessary by a dsack
+    bool dsack_recovered = !(scb->sacked & TCPCB_SACKED_RETRANS);
+    // When experiencing TLP we may lose the probe packet and the ACK
+    // is going to come with sacked without TCPCB_SACKED_RETRANS. We have
+    // to undo this dsack.
+    if(scb->sacked & TCPCB_EVER_RETRANS && !timestamp_recovered &&
+        tp->tlp_high_seq == scb->end_seq && dsack_recovered) {
+
+      INCMAX(st->fake_dsack_recovery_induced_by_lost_tlp, UINT32_MAX);
+      dsack_recovered = false;
+    }
+
+    st->dsack_recovered += dsack_recovered;
+    st->timestamp_recovered += timestamp_recovered;
+    st->dsack_and_timestamp_recovered += (dsack_recovered &&
+        timestamp_recovered);
+    st->dsack_or_timestamp_recovered += (dsack_recovered ||
+        timestamp_recovered);
+
+    if(!dsack_recovered && !timestamp_recovered) {
+      st->segments_lost += 1;
+      if(!st->fstloss.by_stats) {
+        st->fstloss.by_stats = (tp->delivered - tp->sacked_out) -
+          (pcount + st->dsack_or_timestamp_recovered);
+      }
+
+      int seq = (st->trim.cached) ? st->trim.seq : scb->seq;
+      int pkt_count = 0;
+      if(seq >= st->established_snd_una) {
+        pkt_count = (seq - st->established_snd_una) / tp->mss_cache;
+      }
+      else {
+        pkt_count = ((UINT32_MAX - st->established_snd_una) + seq)
+          / tp->mss_cache;
+      }
+      // We do this because we cant guarantee that tcp_rate_skb_delivered
+      // will process the sacked skb's in order, this causes us to
+      // sometimes overshoot the position of the loss.
+      st->fstloss.by_seqnum = (!st->fstloss.by_seqnum) ? pkt_count + 1 :
+        min((int)st->fstloss.by_seqnum, pkt_count + 1);
+    }
+  }
+
+  return pcount;
+}
+
+/* Caches the head of an skb trimmed by tcp_trim_head, which is then
+ * delivered without it. */
+static void
+ack_track_trim_head(struct ack_state *st,
+    struct sock *sk,
+    struct sk_buff *skb,
+    u32 len)
+{
+  INCMAX(st->stats.calls_from_trim_head, UINT16_MAX);
+
+  struct tcp_sock *tp = tcp_sk(sk);
+  struct tcp_skb_cb *scb = TCP_SKB_CB(skb);
+
+  st->trim.cached = true;
+  _(st->trim.seq, scb->seq);
+  st->trim.end_seq = st->trim.seq + len;
+
+  if(st->prior_snd_una == tp->snd_una) {
+    INCMAX(st->stats.trim_from_rtx, UINT16_MAX);
+  }
+  else {
+    INCMAX(st->stats.trim_from_ack, UINT16_MAX);
+  }
+}
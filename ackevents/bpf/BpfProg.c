@@ -70,37 +70,22 @@
     var = minmax_get(&mm); \
   }
 
+#include "AckTracking.h"
+
 BPF_PERF_OUTPUT(events);
 
-BPF_HASH(ht, struct sock*, struct ack_event, UINT16_MAX);
+// with --bpf_pin_path, ht is pinned so that connection state survives a
+// collector restart
+#ifdef BPF_PIN_PATH
+BPF_TABLE_PINNED("hash", struct sock*, struct ack_state, ht, UINT16_MAX,
+                 BPF_PIN_PATH "/ht");
+#else
+BPF_HASH(ht, struct sock*, struct ack_state, UINT16_MAX);
+#endif
 
-static int event_hdr_init(struct event_hdr* evh, const struct sock *sk)
-{
-  struct inet_sock* inet = inet_sk(sk);
-  struct tcp_sock *tp = tcp_sk(sk);
-  evh->ev_tstamp_ns = bpf_ktime_get_ns();
-  _(evh->conn_tstamp_ns, tp->cd_init_clock_ns);
-  _(evh->src.ss_family, sk->sk_family);
-  _(evh->dst.ss_family, sk->sk_family);
-  if (sk->sk_family == AF_INET) {
-    struct sockaddr_in* src = (struct sockaddr_in*)&evh->src;
-    struct sockaddr_in* dst = (struct sockaddr_in*)&evh->dst;
-    _(src->sin_port, inet->inet_sport);
-    _(dst->sin_port, inet->inet_dport);
-    _(src->sin_addr, inet->inet_saddr);
-    _(dst->sin_addr, inet->inet_daddr);
-  } else if (sk->sk_family == AF_INET6) {
-    struct sockaddr_in6* src = (struct sockaddr_in6*)&evh->src;
-    struct sockaddr_in6* dst = (struct sockaddr_in6*)&evh->dst;
-    _(src->sin6_port, inet->inet_sport);
-    _(dst->sin6_port, inet->inet_dport);
-    _(src->sin6_addr, sk->sk_v6_rcv_saddr);
-    _(dst->sin6_addr, sk->sk_v6_daddr);
-  } else {
-    return -1;
-  }
-  return 0;
-}
+/* struct ack_event is too large for the BPF stack once EVDEBUG fields are
+ * added; events are assembled in this per-CPU slot before submission. */
+BPF_PERCPU_ARRAY(scratch, struct ack_event, 1);
 
 static bool tcp_sock_is_tracked(struct sock *sk)
 {
@@ -108,73 +93,18 @@ static bool tcp_sock_is_tracked(struct sock *sk)
   return tp->cd_random_u16 <= RANDOM_SAMPLE_MAX;
 }
 
-static u32 local_tcp_skb_timestamp(const struct sk_buff *skb)
-{
-  return div_u64(skb->skb_mstamp_ns, NSEC_PER_SEC / TCP_TS_HZ);
-}
-
-static int local_tcp_skb_pcount(const struct sk_buff *skb)
-{
-  struct tcp_skb_cb *scb = TCP_SKB_CB(skb);
-  /* Kernel function returns int, but tcp_gso_segs is u16 */
-  u16 pcount;
-  bpf_probe_read(&pcount, sizeof(pcount), &(scb->tcp_gso_segs));
-  return pcount;
-}
-
-static bool get_saw_tstamp(const struct tcp_sock *tp)
+/* Build the exported event from the per-connection state. The header and
+ * tcp snapshot are read from the socket here rather than being kept in the
+ * map value. Returns NULL if the event cannot be built. */
+static struct ack_event *
+ack_event_assemble(struct ack_state *st, const struct sock *sk)
 {
-  u16 bitfield;
-  // There should be no padding as all fields up to the point are u32
-  u8* ptr = (u8*)&(tp->rx_opt.rcv_tsecr);
-  ptr += sizeof(tp->rx_opt.rcv_tsecr);
-  bpf_probe_read(&bitfield, sizeof(bitfield), ptr);
-  // https://elixir.bootlin.com/linux/latest/source/include/linux/tcp.h#L87
-  // We get the *last* bit because i386/amd64 is little-endian.
-  // Of course, this doesn't work on big-endian machines.
-  return (bool)(bitfield & (0x01));
-}
+  u32 zero = 0;
+  struct ack_event *ev = scratch.lookup(&zero);
+  if (!ev) { return NULL; }
 
-/* Copied from the kernel because it is a static function. */
-static bool tcp_tsopt_ecr_before(const struct tcp_sock *tp, u32 when)
-{
-  bool saw_tstamp = get_saw_tstamp(tp);
-  u32 rcv_tsecr;
-  bpf_probe_read(&rcv_tsecr, sizeof(rcv_tsecr), &(tp->rx_opt.rcv_tsecr));
-  // return saw_tstamp && tp->rx_opt.rcv_tsecr &&
-  //    before(tp->rx_opt.rcv_tsecr, when);
-  return saw_tstamp && rcv_tsecr && before(rcv_tsecr, when);
-}
-
-static bool tcp_skb_spurious_retrans(u8 sacked,
-    const struct tcp_sock *tp,
-    const struct sk_buff *skb)
-{
-  return (sacked & TCPCB_RETRANS) &&
-      tcp_tsopt_ecr_before(tp, local_tcp_skb_timestamp(skb));
-}
-
-static void fill_in_tcp_data(struct ack_event *ev, const struct sock *sk)
-{
-  const struct tcp_sock* tp = tcp_sk(sk);
-  const struct inet_connection_sock* icsk = inet_csk(sk);
-  _(ev->tcp.delivered, tp->delivered);
-  _(ev->tcp.lost, tp->lost);
-  _(ev->tcp.total_retrans, tp->total_retrans);
-  _(ev->tcp.srtt_us, tp->srtt_us);
-  ev->tcp.srtt_us >>= 3;
-  _(ev->tcp.mdev_us, tp->mdev_us);
-  ev->tcp.mdev_us >>= 2;
-  _minmax_get(ev->tcp.min_rtt_us, tp->rtt_min);
-  _(ev->tcp.snd_cwnd, tp->snd_cwnd);
-  _(ev->tcp.mss_cache, tp->mss_cache);
-  _(ev->tcp.rto, icsk->icsk_rto);
-}
-
-static void clean_trim_info(struct ack_event *ev) {
-  ev->trim.cached = false;
-  ev->trim.seq = 0;
-  ev->trim.end_seq = 0;
+  if (ack_event_fill(ev, st, sk) < 0) { return NULL; }
+  return ev;
 }
 
 /*****************************************************************************
@@ -200,28 +130,27 @@ on_inet_sock_set_state(struct tracepoint__sock__inet_sock_set_state* attrs) {
   if (!tcp_sock_is_tracked(sk)) { return 0; }
 
   if (attrs->newstate == TCP_ESTABLISHED) {
-    struct ack_event ev = { 0 };
-    if (event_hdr_init(&ev.header, sk) < 0) { return 0; }
-    _(ev.established_snd_una, tp->snd_una);
-    _(ev.prior_snd_una, tp->snd_una);
-    ht.update(&sk, &ev);
+    struct ack_state st = { 0 };
+    if (sk->sk_family != AF_INET && sk->sk_family != AF_INET6) { return 0; }
+    ack_state_init(&st, sk);
+    ht.update(&sk, &st);
   } else if (attrs->newstate == TCP_CLOSE) {
-    struct ack_event *ev = ht.lookup(&sk);
+    struct ack_state *st = ht.lookup(&sk);
+    if (!st) { return 0; }
+
+    struct ack_event *ev = ack_event_assemble(st, sk);
     if (!ev) { return 0; }
 
     ev->non_spurious_retrans = tp->total_retrans -
-      (ev->dsack_or_timestamp_recovered);
+      (st->dsack_or_timestamp_recovered);
 
-    fill_in_tcp_data(ev, sk);
-
-    ev->seq = 0;
-    ev->end_seq = 0;
 #ifdef EVDEBUG
     ev->debug.event_source = EV_SOURCE_TCP_CLOSE;
     ev->debug.pcount = 0;
     ev->debug.tcp_gso_size = 0;
     ev->debug.sacked = 0;
     ev->debug.sacked_out = 0;
+    ev->debug.tcp_snd_una = 0;
     ev->debug.tcp_flags = 0;
     ev->debug.tx_delivered = 0;
     ev->debug.tx_first_tx_mstamp = 0;
@@ -244,110 +173,37 @@ on_tcp_rate_skb_delivered(
 {
   if (!tcp_sock_is_tracked(sk)) { return 0; }
 
-  struct ack_event *ev = ht.lookup(&sk);
-  if (!ev) { return 0; }
-  INCMAX(ev->stats.calls_from_rate_skb, UINT16_MAX);
+  struct ack_state *st = ht.lookup(&sk);
+  if (!st) { return 0; }
+  int pcount = ack_track_delivered(st, sk, skb);
+  if (pcount < 0) { return 0; }
 
   struct tcp_sock *tp = tcp_sk(sk);
+#ifdef EVDEBUG
   struct tcp_skb_cb *scb = TCP_SKB_CB(skb);
-
-  // skb already sacked:
-  // https://github.com/torvalds/linux/blob/v5.4/net/ipv4/tcp_rate.c#L101-L106
-  if(!scb->tx.delivered_mstamp) {
-    INCMAX(ev->stats.calls_with_mstamp_zero, UINT16_MAX);
-    return 0;
-  }
-
-  int pcount = local_tcp_skb_pcount(skb);
-
-  if(scb->sacked & TCPCB_RETRANS) {
-    INCMAX(ev->stats.tcpcb_retrans, UINT16_MAX);
-    if(scb->sacked & TCPCB_SACKED_RETRANS) {
-      INCMAX(ev->stats.tcpcb_sacked_retrans, UINT16_MAX);
-    }
-
-    // There was a retransmission and it was ruled unnecessary by timestamps.
-    // Packet needs to be cumulatively acked
-    // https://github.com/torvalds/linux/blob/v5.4/net/ipv4/tcp_input.c#L3095-L3107
-    bool timestamp_recovered = tcp_skb_spurious_retrans(scb->sacked, tp, skb);
-    timestamp_recovered &= (scb->end_seq <= tp->snd_una) ||
-      (ev->trim.cached && ev->trim.end_seq <= tp->snd_una);
-
-    if(scb->sacked & TCPCB_EVER_RETRANS && timestamp_recovered
-        && tp->tlp_high_seq == scb->end_seq) {
-      // There was a spurius retransmission due to TLP. To
-      // detect if it was spurious we need to check if the ack
-      // is from the original packet or from the probe.
-      INCMAX(ev->stats.spurious_tlp_retrans, UINT16_MAX);
-    }
-
-    // Retransmission ruled unecessary by a dsack
-    bool dsack_recovered = !(scb->sacked & TCPCB_SACKED_RETRANS);
-    // When experiencing TLP we may lose the probe packet and the ACK
-    // is going to come with sacked without TCPCB_SACKED_RETRANS. We have
-    // to undo this dsack.
-    if(scb->sacked & TCPCB_EVER_RETRANS && !timestamp_recovered &&
-        tp->tlp_high_seq == scb->end_seq && dsack_recovered) {
-
-      INCMAX(ev->fake_dsack_recovery_induced_by_lost_tlp, UINT32_MAX);
-      dsack_recovered = false;
-    }
-
-    ev->dsack_recovered += dsack_recovered;
-    ev->timestamp_recovered += timestamp_recovered;
-    ev->dsack_and_timestamp_recovered += (dsack_recovered &&
-        timestamp_recovered);
-    ev->dsack_or_timestamp_recovered += (dsack_recovered ||
-        timestamp_recovered);
-
-    if(!dsack_recovered && !timestamp_recovered) {
-      ev->segments_lost += 1;
-      if(!ev->fstloss.by_stats) {
-        ev->fstloss.by_stats = (tp->delivered - tp->sacked_out) -
-          (pcount + ev->dsack_or_timestamp_recovered);
-      }
-
-      int seq = (ev->trim.cached) ? ev->trim.seq : scb->seq;
-      int pkt_count = 0;
-      if(seq >= ev->established_snd_una) {
-        pkt_count = (seq - ev->established_snd_una) / tp->mss_cache;
-      }
-      else {
-        pkt_count = ((UINT32_MAX - ev->established_snd_una) + seq) 
-          / tp->mss_cache;
-      }
-      // We do this because we cant guarantee that tcp_rate_skb_delivered
-      // will process the sacked skb's in order, this causes us to
-      // sometimes overshoot the position of the loss.
-      ev->fstloss.by_seqnum = (!ev->fstloss.by_seqnum) ? pkt_count + 1 :
-        min((int)ev->fstloss.by_seqnum, pkt_count + 1);
-    }
+  struct ack_event *ev = ack_event_assemble(st, sk);
+  if (ev) {
+    _(ev->seq, scb->seq);
+    _(ev->end_seq, scb->end_seq);
+
+    _(ev->debug.pcount, pcount);
+    _(ev->debug.tcp_gso_size, scb->tcp_gso_size);
+    _(ev->debug.sacked_out, tp->sacked_out);
+    _(ev->debug.tcp_snd_una, tp->snd_una);
+    _(ev->debug.tx_delivered, scb->tx.delivered);
+    _(ev->debug.tx_first_tx_mstamp, scb->tx.first_tx_mstamp);
+    _(ev->debug.tx_delivered_mstamp, scb->tx.delivered_mstamp);
+    _(ev->debug.tlp_high_seq, tp->tlp_high_seq);
+    _(ev->debug.sacked, scb->sacked);
+    _(ev->debug.tcp_flags, scb->tcp_flags);
+
+    ev->debug.event_source = EV_SOURCE_TCP_RATE_SKB_DELIVERED;
+    events.perf_submit((void *)ctx, ev, sizeof(*ev));
   }
-
-
-#ifdef EVDEBUG
-  _(ev->seq, scb->seq);
-  _(ev->end_seq, scb->end_seq);
-
-  fill_in_tcp_data(ev, sk);
-
-  _(ev->debug.pcount, pcount);
-  _(ev->debug.tcp_gso_size, scb->tcp_gso_size);
-  _(ev->debug.sacked_out, tp->sacked_out);
-  _(ev->debug.tcp_snd_una, tp->snd_una);
-  _(ev->debug.tx_delivered, scb->tx.delivered);
-  _(ev->debug.tx_first_tx_mstamp, scb->tx.first_tx_mstamp);
-  _(ev->debug.tx_delivered_mstamp, scb->tx.delivered_mstamp);
-  _(ev->debug.tlp_high_seq, tp->tlp_high_seq);
-  _(ev->debug.sacked, scb->sacked);
-  _(ev->debug.tcp_flags, scb->tcp_flags);
-
-  ev->debug.event_source = EV_SOURCE_TCP_RATE_SKB_DELIVERED;
-  events.perf_submit((void *)ctx, ev, sizeof(*ev));
 #endif
 
-  clean_trim_info(ev);
-  _(ev->prior_snd_una, tp->snd_una);
+  clean_trim_info(st);
+  _(st->prior_snd_una, tp->snd_una);
   return 0;
 }
 
@@ -360,29 +216,17 @@ on_tcp_trim_head(
 {
   if (!tcp_sock_is_tracked(sk)) { return 0; }
 
-  struct ack_event *ev = ht.lookup(&sk);
-  if (!ev) { return 0; }
-  INCMAX(ev->stats.calls_from_trim_head, UINT16_MAX);
-
-  struct tcp_sock *tp = tcp_sk(sk);
-  struct tcp_skb_cb *scb = TCP_SKB_CB(skb);
-
-  fill_in_tcp_data(ev, sk);
-
-  ev->trim.cached = true;
-  _(ev->trim.seq, scb->seq);
-  ev->trim.end_seq = ev->trim.seq + len;
-
-  if(ev->prior_snd_una == tp->snd_una) {
-    INCMAX(ev->stats.trim_from_rtx, UINT16_MAX);
-  }
-  else {
-    INCMAX(ev->stats.trim_from_ack, UINT16_MAX);
-  }
+  struct ack_state *st = ht.lookup(&sk);
+  if (!st) { return 0; }
+  ack_track_trim_head(st, sk, skb, len);
 
 #ifdef EVDEBUG
-  ev->debug.event_source = EV_SOURCE_TCP_TRIM_HEAD;
-  events.perf_submit((void *)ctx, ev, sizeof(*ev));
+  struct ack_event *ev = ack_event_assemble(st, sk);
+  if (ev) {
+    __builtin_memset(&ev->debug, 0, sizeof(ev->debug));
+    ev->debug.event_source = EV_SOURCE_TCP_TRIM_HEAD;
+    events.perf_submit((void *)ctx, ev, sizeof(*ev));
+  }
 #endif
   return 0;
 }
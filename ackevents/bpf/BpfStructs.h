@@ -22,6 +22,50 @@ struct event_hdr {
   struct sockaddr_storage dst;
 };
 
+/* Per-connection state kept in the BPF hash map.
+ *
+ * on_tcp_rate_skb_delivered and on_tcp_trim_head run on every ACK and only
+ * touch this block; the event header and the tcp snapshot are assembled
+ * into a struct ack_event when the event is submitted (on TCP_CLOSE, or on
+ * every call when built with EVDEBUG). Keep it small and keep hot fields
+ * first. */
+struct ack_state {
+  struct {
+    uint32_t by_stats;
+    uint32_t by_seqnum;
+  } fstloss;
+
+  uint32_t established_snd_una;
+  uint32_t prior_snd_una;
+
+  uint32_t segments_lost;
+  uint32_t dsack_recovered;
+  uint32_t timestamp_recovered;
+  uint32_t dsack_and_timestamp_recovered;
+  uint32_t dsack_or_timestamp_recovered;
+  uint32_t fake_dsack_recovery_induced_by_lost_tlp;
+
+  struct {
+    uint16_t calls_from_rate_skb;
+    uint16_t calls_from_trim_head;
+    uint16_t calls_with_mstamp_zero;
+    uint16_t tcpcb_sacked_retrans;
+    uint16_t tcpcb_retrans;
+    uint16_t spurious_tlp_retrans;
+    uint16_t trim_from_ack;
+    uint16_t trim_from_rtx;
+  } stats;
+
+  struct {
+    bool cached;
+    uint32_t seq;
+    uint32_t end_seq;
+  } trim;
+
+  /* cold: only read by the userspace map sweeper */
+  uint64_t conn_tstamp_ns;
+};
+
 struct ack_event {
   struct event_hdr header;
 
@@ -0,0 +1,37 @@
+#pragma once
+
+/* Fills the event_hdr of an event from the socket. Shared by the ackevents
+ * program and pathsd, whose ack and rtt modules use the same header.
+ *
+ * Needs BpfStructs.h and the _ macro of the including program. */
+
+static int event_hdr_init(struct event_hdr* evh, const struct sock *sk)
+{
+  struct inet_sock* inet = inet_sk(sk);
+  struct tcp_sock *tp = tcp_sk(sk);
+  /* events are assembled in reused per-CPU slots, clear stale address
+   * bytes */
+  __builtin_memset(evh, 0, sizeof(*evh));
+  evh->ev_tstamp_ns = bpf_ktime_get_ns();
+  _(evh->conn_tstamp_ns, tp->cd_init_clock_ns);
+  _(evh->src.ss_family, sk->sk_family);
+  _(evh->dst.ss_family, sk->sk_family);
+  if (sk->sk_family == AF_INET) {
+    struct sockaddr_in* src = (struct sockaddr_in*)&evh->src;
+    struct sockaddr_in* dst = (struct sockaddr_in*)&evh->dst;
+    _(src->sin_port, inet->inet_sport);
+    _(dst->sin_port, inet->inet_dport);
+    _(src->sin_addr, inet->inet_saddr);
+    _(dst->sin_addr, inet->inet_daddr);
+  } else if (sk->sk_family == AF_INET6) {
+    struct sockaddr_in6* src = (struct sockaddr_in6*)&evh->src;
+    struct sockaddr_in6* dst = (struct sockaddr_in6*)&evh->dst;
+    _(src->sin6_port, inet->inet_sport);
+    _(dst->sin6_port, inet->inet_dport);
+    _(src->sin6_addr, sk->sk_v6_rcv_saddr);
+    _(dst->sin6_addr, sk->sk_v6_daddr);
+  } else {
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,163 @@
+#include "AckTraceCsv.h"
+
+#include <src/common/ColumnProjection.h>
+#include <src/common/ColumnarFile.h>
+#include <src/common/SqliteWriter.h>
+
+namespace paths {
+namespace acktrace {
+
+std::vector<std::string>
+getCsvFieldNames() {
+  std::vector<std::string> row;
+  // header
+  row.push_back("ev_tstamp_ns");
+  row.push_back("conn_tstamp_ns");
+  common::appendAddressColumnNames("src", row);
+  common::appendAddressColumnNames("dst", row);
+
+  // ackevent
+  row.push_back("first_lost_packet_by_stats");
+  row.push_back("first_lost_packet_by_seqnum");
+
+  row.push_back("segments_lost");
+  row.push_back("non_spurious_retrans");
+  row.push_back("dsack_recovered");
+  row.push_back("timestamp_recovered");
+  row.push_back("dsack_and_timestamp_recovered");
+  row.push_back("dsack_or_timestamp_recovered");
+  row.push_back("fake_dsack_recovery_induced_by_lost_tlp");
+
+  // tcp info
+  row.push_back("delivered");
+  row.push_back("lost");
+  row.push_back("total_retrans");
+  row.push_back("srtt_us");
+  row.push_back("mdev_us");
+  row.push_back("min_rtt_us");
+  row.push_back("snd_cwnd");
+  row.push_back("mss_cache");
+  row.push_back("rto");
+
+  // ackevent stats
+  row.push_back("calls");
+  row.push_back("calls_with_mstamp_zero");
+  row.push_back("tcpcb_sacked_retrans");
+  row.push_back("tcpcb_retrans");
+  row.push_back("spurious_tlp_retrans");
+  row.push_back("fully_acked_after_snd_una");
+
+#ifdef EVDEBUG
+  row.push_back("established_snd_una");
+  row.push_back("seq");
+  row.push_back("end_seq");
+
+  row.push_back("event_source");
+  row.push_back("pcount");
+  row.push_back("tcp_gso_size");
+  row.push_back("sacked_out");
+  row.push_back("tcp_snd_una");
+  row.push_back("fully_acked");
+  row.push_back("tx_delivered");
+  row.push_back("tx_first_tx_mstamp");
+  row.push_back("tx_delivered_mstamp");
+  row.push_back("tlp_high_seq");
+  row.push_back("sacked");
+  row.push_back("tcp_flags");
+#endif
+
+  return row;
+}
+
+template <typename Encoder>
+void
+encodeCsvRow(const struct bpf::ack_event& ev, Encoder& encoder) {
+  // header
+  encoder.add(ev.header.ev_tstamp_ns);
+  encoder.add(ev.header.conn_tstamp_ns);
+  common::addAddressColumns(encoder, &ev.header.src);
+  common::addAddressColumns(encoder, &ev.header.dst);
+
+  // ackevent
+  encoder.add(ev.fstloss.by_stats);
+  encoder.add(ev.fstloss.by_seqnum);
+
+  encoder.add(ev.segments_lost);
+  encoder.add(ev.non_spurious_retrans);
+  encoder.add(ev.dsack_recovered);
+  encoder.add(ev.timestamp_recovered);
+  encoder.add(ev.dsack_and_timestamp_recovered);
+  encoder.add(ev.dsack_or_timestamp_recovered);
+  encoder.add(ev.fake_dsack_recovery_induced_by_lost_tlp);
+
+  // tcp info
+  encoder.add(ev.tcp.delivered);
+  encoder.add(ev.tcp.lost);
+  encoder.add(ev.tcp.total_retrans);
+  encoder.add(ev.tcp.srtt_us);
+  encoder.add(ev.tcp.mdev_us);
+  encoder.add(ev.tcp.min_rtt_us);
+  encoder.add(ev.tcp.snd_cwnd);
+  encoder.add(ev.tcp.mss_cache);
+  encoder.add(ev.tcp.rto);
+
+  // ackevent stats
+  encoder.add(ev.stats.calls);
+  encoder.add(ev.stats.calls_with_mstamp_zero);
+  encoder.add(ev.stats.tcpcb_sacked_retrans);
+  encoder.add(ev.stats.tcpcb_retrans);
+  encoder.add(ev.stats.spurious_tlp_retrans);
+  encoder.add(ev.stats.fully_acked_after_snd_una);
+
+#ifdef EVDEBUG
+  encoder.add(ev.established_snd_una);
+  encoder.add(ev.seq);
+  encoder.add(ev.end_seq);
+
+  if (ev.debug.event_source == EV_SOURCE_UNSET) {
+    encoder.addRaw("ev_source_unset");
+  } else if(ev.debug.event_source == EV_SOURCE_TCP_CLOSE) {
+    encoder.addRaw("ev_source_tcp_close");
+  } else if(ev.debug.event_source == EV_SOURCE_SKB_ACKED) {
+    encoder.addRaw("ev_source_skb_acked");
+  } else {
+    encoder.addRaw("ev_source_unknown");
+  }
+  encoder.add(ev.debug.pcount);
+  encoder.add(ev.debug.tcp_gso_size);
+  encoder.add(ev.debug.sacked_out);
+  encoder.add(ev.debug.tcp_snd_una);
+  encoder.add(ev.debug.fully_acked);
+  encoder.add(ev.debug.tx_delivered);
+  encoder.add(ev.debug.tx_first_tx_mstamp);
+  encoder.add(ev.debug.tx_delivered_mstamp);
+  encoder.add(ev.debug.tlp_high_seq);
+  encoder.add(ev.debug.sacked);
+  encoder.add(ev.debug.tcp_flags);
+#endif
+}
+
+template void encodeCsvRow(
+    const struct bpf::ack_event& ev,
+    common::CsvRowEncoder& encoder);
+template void encodeCsvRow(
+    const struct bpf::ack_event& ev,
+    common::ColumnarWriter& encoder);
+template void encodeCsvRow(
+    const struct bpf::ack_event& ev,
+    common::ColumnTypeRecorder& encoder);
+template void encodeCsvRow(
+    const struct bpf::ack_event& ev,
+    common::SqliteWriter& encoder);
+template void encodeCsvRow(
+    const struct bpf::ack_event& ev,
+    common::ProjectedRow<common::CsvRowEncoder>& encoder);
+template void encodeCsvRow(
+    const struct bpf::ack_event& ev,
+    common::ProjectedRow<common::ColumnarWriter>& encoder);
+template void encodeCsvRow(
+    const struct bpf::ack_event& ev,
+    common::ProjectedRow<common::SqliteWriter>& encoder);
+
+} // namespace acktrace
+} // namespace paths
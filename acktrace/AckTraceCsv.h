@@ -0,0 +1,27 @@
+#pragma once
+
+#include <src/common/CsvRowEncoder.h>
+#include <src/acktrace/bpf/BpfStructs.h>
+#include <string>
+#include <vector>
+
+namespace paths {
+namespace acktrace {
+
+/**
+ * Returns the CSV column names, in the order used by encodeCsvRow.
+ */
+std::vector<std::string> getCsvFieldNames();
+
+/**
+ * Appends the CSV columns of an event to the encoder. Instantiated for
+ * CsvRowEncoder, for ColumnarWriter and ColumnTypeRecorder, which fill the
+ * same columns for --export_mode=columnar, for SqliteWriter, and for a
+ * ProjectedRow of CsvRowEncoder, ColumnarWriter or SqliteWriter (--exporters
+ * fields).
+ */
+template <typename Encoder>
+void encodeCsvRow(const struct bpf::ack_event& ev, Encoder& encoder);
+
+} // namespace acktrace
+} // namespace paths
@@ -72,7 +72,14 @@
 
 BPF_PERF_OUTPUT(events);
 
+// with --bpf_pin_path, ht is pinned so that connection state survives a
+// collector restart
+#ifdef BPF_PIN_PATH
+BPF_TABLE_PINNED("hash", struct sock*, struct ack_event, ht, UINT16_MAX,
+                 BPF_PIN_PATH "/ht");
+#else
 BPF_HASH(ht, struct sock*, struct ack_event, UINT16_MAX);
+#endif
 
 static int event_hdr_init(struct event_hdr* evh, const struct sock *sk)
 {
@@ -0,0 +1,49 @@
+#include "AsyncEventQueue.h"
+
+static bool
+ValidateQueueFullPolicy(const char* flagname, const std::string& value) {
+  paths::common::QueueFullPolicy policy;
+  if (not paths::common::parseQueueFullPolicy(value, policy)) {
+    LOG(ERROR) << folly::format(
+        "--{} must be one of block, drop_newest, drop_oldest", flagname);
+    return false;
+  }
+  return true;
+}
+
+DEFINE_uint32(
+    export_queue_size,
+    16384,
+    "Number of events queued between the perf buffer polling thread and the "
+    "export thread (0 exports from the polling thread)");
+DEFINE_string(
+    export_queue_full_policy,
+    "block",
+    "What to do when the export queue is full: block (stop draining the "
+    "perf buffers), drop_newest or drop_oldest");
+DEFINE_uint32(
+    export_queue_stats_interval_s,
+    60,
+    "Interval between logs of the export queue depth and drop counters "
+    "(0 logs only on shutdown)");
+DEFINE_validator(export_queue_full_policy, &ValidateQueueFullPolicy);
+
+namespace paths {
+namespace common {
+
+bool
+parseQueueFullPolicy(const std::string& str, QueueFullPolicy& policy) {
+  if (str == "block") {
+    policy = QueueFullPolicy::BLOCK;
+  } else if (str == "drop_newest") {
+    policy = QueueFullPolicy::DROP_NEWEST;
+  } else if (str == "drop_oldest") {
+    policy = QueueFullPolicy::DROP_OLDEST;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <folly/Format.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <src/common/SpscRing.h>
+#include <pthread.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+DECLARE_uint32(export_queue_size);
+DECLARE_string(export_queue_full_policy);
+DECLARE_uint32(export_queue_stats_interval_s);
+
+namespace paths {
+namespace common {
+
+enum class QueueFullPolicy {
+  BLOCK, // wait for the writer thread (perf buffers may overflow instead)
+  DROP_NEWEST, // discard the event being queued
+  DROP_OLDEST, // discard the oldest queued event
+};
+
+/**
+ * Parses --export_queue_full_policy; returns false on unknown values.
+ */
+bool parseQueueFullPolicy(const std::string& str, QueueFullPolicy& policy);
+
+/**
+ * Moves the export of events (formatting and writing) off the thread
+ * polling the perf buffers.
+ *
+ * push() hands events to a writer thread over an SpscRing, so a stalled
+ * disk fills the queue instead of stopping the perf buffers from being
+ * drained. What happens when the queue is full is set by QueueFullPolicy.
+ * Queue depth and drop counters are logged every statsInterval and on
+ * stop().
+ *
+ * push() must always be called from the same thread.
+ */
+template <typename Event>
+class AsyncEventQueue {
+ public:
+  struct Options {
+    // Used for logging and as the writer thread name
+    std::string name;
+
+    // Maximum number of queued events
+    size_t capacity{16384};
+
+    QueueFullPolicy fullPolicy{QueueFullPolicy::BLOCK};
+
+    // Time between logs of the queue counters (0 logs only on stop)
+    std::chrono::seconds statsInterval{std::chrono::minutes(1)};
+  };
+
+  struct Stats {
+    uint64_t pushed;
+    uint64_t exported;
+    uint64_t droppedNewest;
+    uint64_t droppedOldest;
+    size_t depth;
+    size_t maxDepth;
+  };
+
+  AsyncEventQueue(
+      const Options& options,
+      std::function<void(Event&)> exportFn)
+      : options_(options), exportFn_(std::move(exportFn)),
+        ring_(options_.capacity) {}
+
+  ~AsyncEventQueue() {
+    stop();
+  }
+
+  /**
+   * Creates a queue configured from the --export_queue_* flags.
+   *
+   * Returns nullptr if the queue is disabled (--export_queue_size=0), in
+   * which case events should be exported inline.
+   */
+  static std::unique_ptr<AsyncEventQueue> createFromFlags(
+      const std::string& name,
+      std::function<void(Event&)> exportFn) {
+    QueueFullPolicy fullPolicy;
+    CHECK(parseQueueFullPolicy(FLAGS_export_queue_full_policy, fullPolicy));
+    return createFromFlags(name, fullPolicy, std::move(exportFn));
+  }
+
+  /**
+   * Same, with the full policy of an exporter of --exporters instead of
+   * --export_queue_full_policy.
+   */
+  static std::unique_ptr<AsyncEventQueue> createFromFlags(
+      const std::string& name,
+      QueueFullPolicy fullPolicy,
+      std::function<void(Event&)> exportFn) {
+    if (FLAGS_export_queue_size == 0) {
+      LOG(INFO) << folly::format(
+          "Export queue {} disabled by --export_queue_size, "
+          "exporting from the polling thread",
+          name);
+      return nullptr;
+    }
+    Options options;
+    options.name = name;
+    options.capacity = FLAGS_export_queue_size;
+    options.fullPolicy = fullPolicy;
+    options.statsInterval =
+        std::chrono::seconds(FLAGS_export_queue_stats_interval_s);
+    return std::make_unique<AsyncEventQueue>(options, std::move(exportFn));
+  }
+
+  /**
+   * Starts the writer thread.
+   */
+  void start() {
+    if (running_.exchange(true)) {
+      return;
+    }
+    thread_ = std::thread([this] { consume(); });
+  }
+
+  /**
+   * Exports the events still queued and stops the writer thread.
+   */
+  void stop() {
+    if (not running_.exchange(false)) {
+      return;
+    }
+    thread_.join();
+    logStats("stopped");
+  }
+
+  /**
+   * Queues an event for export. Returns false if the event was dropped.
+   */
+  bool push(Event event) {
+    pushed_.fetch_add(1, std::memory_order_relaxed);
+    bool queued = false;
+    switch (options_.fullPolicy) {
+    case QueueFullPolicy::BLOCK: {
+      uint32_t spins = 0;
+      while (not(queued = ring_.tryPush(event)) && running_.load()) {
+        backoff(spins);
+      }
+      break;
+    }
+    case QueueFullPolicy::DROP_NEWEST: {
+      queued = ring_.tryPush(event);
+      break;
+    }
+    case QueueFullPolicy::DROP_OLDEST: {
+      bool overwrote = false;
+      queued = ring_.pushOverwriteOldest(event, overwrote);
+      if (overwrote) {
+        droppedOldest_.fetch_add(1, std::memory_order_relaxed);
+      }
+      break;
+    }
+    }
+    if (not queued) {
+      droppedNewest_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    const auto depth = ring_.size();
+    if (depth > maxDepth_.load(std::memory_order_relaxed)) {
+      maxDepth_.store(depth, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  Stats getStats() const {
+    return Stats{pushed_.load(),
+                 exported_.load(),
+                 droppedNewest_.load(),
+                 droppedOldest_.load(),
+                 ring_.size(),
+                 maxDepth_.load()};
+  }
+
+ private:
+  static void backoff(uint32_t& spins) {
+    if (++spins < 64) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  void consume() {
+    pthread_setname_np(pthread_self(), options_.name.substr(0, 15).c_str());
+    auto nextStats = std::chrono::steady_clock::now() + options_.statsInterval;
+    Event event;
+    uint32_t spins = 0;
+    while (true) {
+      if (ring_.tryPop(event)) {
+        exportFn_(event);
+        exported_.fetch_add(1, std::memory_order_relaxed);
+        spins = 0;
+        continue;
+      }
+      // drained; running_ is checked after an empty pop so that events
+      // queued before stop() are still exported
+      if (not running_.load()) {
+        break;
+      }
+      if (options_.statsInterval.count() > 0 &&
+          std::chrono::steady_clock::now() >= nextStats) {
+        logStats("running");
+        nextStats = std::chrono::steady_clock::now() + options_.statsInterval;
+      }
+      backoff(spins);
+    }
+  }
+
+  void logStats(const char* state) const {
+    const auto stats = getStats();
+    LOG(INFO) << folly::format(
+        "Export queue {} {}: {} events queued, {} exported, "
+        "{} dropped (newest), {} dropped (oldest), depth {}/{} (max {})",
+        options_.name,
+        state,
+        stats.pushed,
+        stats.exported,
+        stats.droppedNewest,
+        stats.droppedOldest,
+        stats.depth,
+        options_.capacity,
+        stats.maxDepth);
+  }
+
+  const Options options_;
+  const std::function<void(Event&)> exportFn_;
+  SpscRing<Event> ring_;
+  std::thread thread_;
+  std::atomic<bool> running_{false};
+
+  std::atomic<uint64_t> pushed_{0};
+  std::atomic<uint64_t> exported_{0};
+  std::atomic<uint64_t> droppedNewest_{0};
+  std::atomic<uint64_t> droppedOldest_{0};
+  std::atomic<size_t> maxDepth_{0};
+};
+
+} // namespace common
+} // namespace paths
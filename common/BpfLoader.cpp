@@ -0,0 +1,509 @@
+#include "BpfLoader.h"
+
+#include <bcc/libbpf.h>
+#include <folly/Conv.h>
+#include <folly/FileUtil.h>
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <folly/hash/Hash.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <linux/bpf.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <set>
+
+DEFINE_string(
+    bpf_pin_path,
+    "",
+    "Directory in a mounted bpffs (e.g., /sys/fs/bpf/paths) under which BPF "
+    "maps are pinned and reused across restarts (empty disables pinning)");
+DEFINE_bool(
+    bpf_pin_programs,
+    false,
+    "Also pin the loaded BPF programs under --bpf_pin_path and reuse them on "
+    "restart when source and flags match, skipping compilation");
+
+namespace fs = std::experimental::filesystem;
+
+namespace {
+
+int
+mapFdById(uint32_t id) {
+  union bpf_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.map_id = id;
+  return syscall(__NR_bpf, BPF_MAP_GET_FD_BY_ID, &attr, sizeof(attr));
+}
+
+std::vector<int>
+getOnlineCpus() {
+  std::vector<int> cpus;
+  std::string online;
+  if (not folly::readFile("/sys/devices/system/cpu/online", online)) {
+    return cpus;
+  }
+  std::vector<folly::StringPiece> ranges;
+  folly::split(',', folly::trimWhitespace(online), ranges);
+  for (const auto& range : ranges) {
+    folly::StringPiece first, last;
+    if (folly::split('-', range, first, last)) {
+      for (int cpu = folly::to<int>(first); cpu <= folly::to<int>(last);
+           cpu++) {
+        cpus.push_back(cpu);
+      }
+    } else {
+      cpus.push_back(folly::to<int>(range));
+    }
+  }
+  return cpus;
+}
+
+// hash of the headers next to the BPF source, i.e., of the struct layouts
+// stored in pinned maps
+std::string
+computeLayoutVersion(
+    const fs::path& pathToBpfSource,
+    const std::vector<std::string>& cflags) {
+  std::vector<fs::path> headers;
+  for (const auto& entry :
+       fs::directory_iterator(fs::absolute(pathToBpfSource).parent_path())) {
+    if (entry.path().extension() == ".h") {
+      headers.push_back(entry.path());
+    }
+  }
+  std::sort(headers.begin(), headers.end());
+
+  uint64_t hash = folly::hash::FNV_64_HASH_START;
+  for (const auto& header : headers) {
+    std::string contents;
+    if (folly::readFile(header.c_str(), contents)) {
+      hash = folly::hash::fnv64_buf(contents.data(), contents.size(), hash);
+    }
+  }
+  // EVDEBUG adds debug fields to some of the structs kept in maps
+  if (std::find(cflags.begin(), cflags.end(), "-DEVDEBUG") != cflags.end()) {
+    hash = folly::hash::fnv64("-DEVDEBUG", hash);
+  }
+  return folly::sformat("{:016x}", hash);
+}
+
+// hashes the headers pulled in by the quoted #includes of source, resolved
+// like clang does: against the directory of the including file, then the -I
+// directories in cflags
+uint64_t
+hashIncludedHeaders(
+    const std::string& source,
+    const fs::path& dir,
+    const std::vector<fs::path>& includeDirs,
+    std::set<fs::path>& seen,
+    uint64_t hash) {
+  std::vector<folly::StringPiece> lines;
+  folly::split('\n', source, lines);
+  for (auto line : lines) {
+    line = folly::trimWhitespace(line);
+    if (not line.removePrefix("#")) {
+      continue;
+    }
+    line = folly::ltrimWhitespace(line);
+    if (not line.removePrefix("include")) {
+      continue;
+    }
+    line = folly::ltrimWhitespace(line);
+    if (not line.removePrefix("\"")) {
+      continue;
+    }
+    const auto name = line.subpiece(0, line.find('"')).str();
+
+    std::vector<fs::path> candidates{dir / name};
+    for (const auto& includeDir : includeDirs) {
+      candidates.push_back(includeDir / name);
+    }
+    for (const auto& candidate : candidates) {
+      std::string contents;
+      if (not folly::readFile(candidate.c_str(), contents)) {
+        continue;
+      }
+      const auto header = fs::canonical(candidate);
+      if (seen.insert(header).second) {
+        hash = folly::hash::fnv64_buf(contents.data(), contents.size(), hash);
+        hash = hashIncludedHeaders(
+            contents, header.parent_path(), includeDirs, seen, hash);
+      }
+      break;
+    }
+  }
+  return hash;
+}
+
+// hash of the source, the headers it includes and the flags, i.e., of the
+// compiled programs
+std::string
+computeProgramVersion(
+    const fs::path& pathToBpfSource,
+    const std::string& source,
+    const std::vector<std::string>& cflags) {
+  uint64_t hash = folly::hash::fnv64(source);
+  std::vector<fs::path> includeDirs;
+  for (const auto& cflag : cflags) {
+    hash = folly::hash::fnv64(cflag, hash);
+    folly::StringPiece flag(cflag);
+    if (flag.removePrefix("-I")) {
+      includeDirs.emplace_back(flag.str());
+    }
+  }
+  std::set<fs::path> seen;
+  hash = hashIncludedHeaders(
+      source,
+      fs::absolute(pathToBpfSource).parent_path(),
+      includeDirs,
+      seen,
+      hash);
+  return folly::sformat("{:016x}", hash);
+}
+
+} // namespace
+
+namespace paths {
+namespace common {
+
+BpfLoader::BpfLoader(const std::string& name)
+    : name_(name), pinnedPrograms_(false) {}
+
+BpfLoader::~BpfLoader() {
+  for (auto& perfReaders : perfReaders_) {
+    for (auto reader : perfReaders.second) {
+      perf_reader_free(reader);
+    }
+  }
+  for (const auto& attachment : attachments_) {
+    bpf_close_perf_event_fd(attachment.perfFd);
+    if (attachment.kprobeEvName) {
+      bpf_detach_kprobe(attachment.kprobeEvName->c_str());
+    }
+  }
+  for (const auto& progFd : progFds_) {
+    close(progFd.second);
+  }
+  for (const auto& mapFd : mapFds_) {
+    close(mapFd.second);
+  }
+}
+
+fs::path
+BpfLoader::getToolDir() const {
+  return fs::path(FLAGS_bpf_pin_path) / name_;
+}
+
+ebpf::StatusTuple
+BpfLoader::init(
+    const fs::path& pathToBpfSource,
+    const std::string& source,
+    std::vector<std::string> cflags,
+    const std::vector<Program>& programs) {
+  programs_ = programs;
+
+  if (FLAGS_bpf_pin_path.empty()) {
+    return ebpf_.init(source, cflags);
+  }
+
+  const auto mapDir = getToolDir() /
+      folly::sformat("maps-{}", computeLayoutVersion(pathToBpfSource, cflags));
+  try {
+    fs::create_directories(mapDir);
+  } catch (fs::filesystem_error& e) {
+    return ebpf::StatusTuple(
+        -1, "Unable to create %s: %s", mapDir.c_str(), e.what());
+  }
+  cflags.emplace_back(folly::sformat("-DBPF_PIN_PATH=\"{}\"", mapDir.c_str()));
+  LOG(INFO) << folly::format("Pinning BPF maps under {}", mapDir.c_str());
+
+  const auto progDir = getToolDir() /
+      folly::sformat("progs-{}", computeProgramVersion(pathToBpfSource, source, cflags));
+  if (FLAGS_bpf_pin_programs) {
+    auto r = loadPinnedPrograms(progDir, programs);
+    if (r.code() == 0) {
+      pinnedPrograms_ = true;
+      LOG(INFO) << folly::format(
+          "Reusing pinned BPF programs from {}, skipping compilation",
+          progDir.c_str());
+      return r;
+    }
+    LOG(INFO) << folly::format(
+        "No usable pinned BPF programs ({}), compiling", r.msg());
+  }
+
+  auto r = ebpf_.init(source, cflags);
+  if (r.code() != 0) {
+    return r;
+  }
+  removeStaleDirs("maps-", mapDir);
+
+  if (FLAGS_bpf_pin_programs) {
+    r = pinPrograms(progDir, programs);
+    if (r.code() != 0) {
+      // pinning is an optimization for the next start; keep running
+      LOG(WARNING) << folly::format(
+          "Unable to pin BPF programs under {}: {}", progDir.c_str(), r.msg());
+      std::error_code ec;
+      fs::remove_all(progDir, ec);
+    } else {
+      LOG(INFO) << folly::format(
+          "Pinned BPF programs under {}", progDir.c_str());
+    }
+  }
+  removeStaleDirs("progs-", progDir);
+  return ebpf::StatusTuple(0);
+}
+
+ebpf::StatusTuple
+BpfLoader::loadPinnedPrograms(
+    const fs::path& progDir,
+    const std::vector<Program>& programs) {
+  if (not fs::exists(progDir)) {
+    return ebpf::StatusTuple(-1, "%s does not exist", progDir.c_str());
+  }
+
+  for (const auto& program : programs) {
+    const auto path = progDir / program.fn;
+    int fd = bpf_obj_get(path.c_str());
+    if (fd < 0) {
+      return ebpf::StatusTuple(
+          -1, "Unable to open %s: %s", path.c_str(), std::strerror(errno));
+    }
+    progFds_[program.fn] = fd;
+  }
+
+  // find the maps referenced by the pinned programs
+  for (const auto& progFd : progFds_) {
+    struct bpf_prog_info info;
+    uint32_t infoLen = sizeof(info);
+    std::memset(&info, 0, sizeof(info));
+    if (bpf_obj_get_info(progFd.second, &info, &infoLen) != 0) {
+      return ebpf::StatusTuple(
+          -1,
+          "Unable to get info for %s: %s",
+          progFd.first.c_str(),
+          std::strerror(errno));
+    }
+    std::vector<uint32_t> mapIds(info.nr_map_ids);
+    const uint32_t nrMapIds = info.nr_map_ids;
+    infoLen = sizeof(info);
+    std::memset(&info, 0, sizeof(info));
+    info.nr_map_ids = nrMapIds;
+    info.map_ids = reinterpret_cast<uint64_t>(mapIds.data());
+    if (bpf_obj_get_info(progFd.second, &info, &infoLen) != 0) {
+      return ebpf::StatusTuple(
+          -1,
+          "Unable to get maps for %s: %s",
+          progFd.first.c_str(),
+          std::strerror(errno));
+    }
+
+    for (const auto mapId : mapIds) {
+      int mapFd = mapFdById(mapId);
+      if (mapFd < 0) {
+        return ebpf::StatusTuple(
+            -1, "Unable to open map %u: %s", mapId, std::strerror(errno));
+      }
+      struct bpf_map_info mapInfo;
+      uint32_t mapInfoLen = sizeof(mapInfo);
+      std::memset(&mapInfo, 0, sizeof(mapInfo));
+      if (bpf_obj_get_info(mapFd, &mapInfo, &mapInfoLen) != 0) {
+        close(mapFd);
+        return ebpf::StatusTuple(
+            -1, "Unable to get info for map %u: %s", mapId, std::strerror(errno));
+      }
+      const std::string mapName(mapInfo.name);
+      if (mapFds_.count(mapName)) {
+        close(mapFd);
+        continue;
+      }
+      mapFds_[mapName] = mapFd;
+    }
+  }
+  return ebpf::StatusTuple(0);
+}
+
+ebpf::StatusTuple
+BpfLoader::pinPrograms(
+    const fs::path& progDir,
+    const std::vector<Program>& programs) {
+  std::error_code ec;
+  fs::remove_all(progDir, ec);
+  fs::create_directories(progDir, ec);
+  if (ec) {
+    return ebpf::StatusTuple(
+        -1, "Unable to create %s: %s", progDir.c_str(), ec.message().c_str());
+  }
+  for (const auto& program : programs) {
+    int fd;
+    auto r = ebpf_.load_func(program.fn, program.type, fd);
+    if (r.code() != 0) {
+      return r;
+    }
+    const auto path = progDir / program.fn;
+    if (bpf_obj_pin(fd, path.c_str()) != 0) {
+      return ebpf::StatusTuple(
+          -1, "Unable to pin %s: %s", path.c_str(), std::strerror(errno));
+    }
+  }
+  return ebpf::StatusTuple(0);
+}
+
+void
+BpfLoader::removeStaleDirs(const std::string& prefix, const fs::path& current) {
+  std::error_code ec;
+  for (const auto& entry : fs::directory_iterator(getToolDir(), ec)) {
+    const auto filename = entry.path().filename().string();
+    if (filename.compare(0, prefix.size(), prefix) != 0 ||
+        entry.path() == current) {
+      continue;
+    }
+    LOG(INFO) << folly::format(
+        "Removing stale pinned BPF objects in {}", entry.path().c_str());
+    fs::remove_all(entry.path(), ec);
+  }
+}
+
+ebpf::StatusTuple
+BpfLoader::attachTracepoint(const std::string& tracepoint, const std::string& fn) {
+  if (not pinnedPrograms_) {
+    return ebpf_.attach_tracepoint(tracepoint, fn);
+  }
+
+  const int progFd = getProgFd(fn);
+  if (progFd < 0) {
+    return ebpf::StatusTuple(-1, "No pinned program %s", fn.c_str());
+  }
+  std::string category, name;
+  if (not folly::split(':', tracepoint, category, name)) {
+    return ebpf::StatusTuple(
+        -1, "Invalid tracepoint %s", tracepoint.c_str());
+  }
+  int perfFd = bpf_attach_tracepoint(progFd, category.c_str(), name.c_str());
+  if (perfFd < 0) {
+    return ebpf::StatusTuple(
+        -1, "Unable to attach to %s", tracepoint.c_str());
+  }
+  attachments_.push_back({perfFd, folly::none});
+  return ebpf::StatusTuple(0);
+}
+
+ebpf::StatusTuple
+BpfLoader::attachKprobe(const std::string& kprobe, const std::string& fn) {
+  if (not pinnedPrograms_) {
+    return ebpf_.attach_kprobe(kprobe, fn);
+  }
+
+  const int progFd = getProgFd(fn);
+  if (progFd < 0) {
+    return ebpf::StatusTuple(-1, "No pinned program %s", fn.c_str());
+  }
+  std::string evName = folly::sformat("p_{}_{}_{}", kprobe, name_, getpid());
+  std::replace(evName.begin(), evName.end(), '.', '_');
+  int perfFd = bpf_attach_kprobe(
+      progFd, BPF_PROBE_ENTRY, evName.c_str(), kprobe.c_str(), 0, 0);
+  if (perfFd < 0) {
+    return ebpf::StatusTuple(-1, "Unable to attach to %s", kprobe.c_str());
+  }
+  attachments_.push_back({perfFd, evName});
+  return ebpf::StatusTuple(0);
+}
+
+int
+BpfLoader::getProgFd(const std::string& fn) {
+  if (pinnedPrograms_) {
+    auto it = progFds_.find(fn);
+    return it == progFds_.end() ? -1 : it->second;
+  }
+
+  auto it = std::find_if(
+      programs_.begin(), programs_.end(), [&fn](const Program& program) {
+        return program.fn == fn;
+      });
+  if (it == programs_.end()) {
+    LOG(ERROR) << folly::format("BPF function {} was not declared", fn);
+    return -1;
+  }
+  int fd;
+  auto r = ebpf_.load_func(fn, it->type, fd);
+  if (r.code() != 0) {
+    LOG(ERROR) << folly::format(
+        "Error loading BPF function {}: {}", fn, r.msg());
+    return -1;
+  }
+  return fd;
+}
+
+int
+BpfLoader::getMapFd(const std::string& name) {
+  if (not pinnedPrograms_) {
+    return ebpf_.get_table(name).get_fd();
+  }
+
+  // kernel map names are truncated to BPF_OBJ_NAME_LEN - 1 characters
+  auto it = mapFds_.find(name.substr(0, BPF_OBJ_NAME_LEN - 1));
+  return it == mapFds_.end() ? -1 : it->second;
+}
+
+ebpf::StatusTuple
+BpfLoader::openPerfBuffer(
+    const std::string& name,
+    perf_reader_raw_cb rawCb,
+    perf_reader_lost_cb lostCb,
+    void* cbCookie,
+    int pageCnt) {
+  if (not pinnedPrograms_) {
+    return ebpf_.open_perf_buffer(name, rawCb, lostCb, cbCookie, pageCnt);
+  }
+
+  const int mapFd = getMapFd(name);
+  if (mapFd < 0) {
+    return ebpf::StatusTuple(-1, "No map %s", name.c_str());
+  }
+  auto& readers = perfReaders_[name];
+  for (int cpu : getOnlineCpus()) {
+    auto reader = static_cast<perf_reader*>(
+        bpf_open_perf_buffer(rawCb, lostCb, cbCookie, -1, cpu, pageCnt));
+    if (reader == nullptr) {
+      return ebpf::StatusTuple(
+          -1, "Unable to open perf buffer on CPU %d", cpu);
+    }
+    readers.push_back(reader);
+    int readerFd = perf_reader_fd(reader);
+    if (bpf_update_elem(mapFd, &cpu, &readerFd, 0) != 0) {
+      return ebpf::StatusTuple(
+          -1,
+          "Unable to install perf buffer for CPU %d: %s",
+          cpu,
+          std::strerror(errno));
+    }
+  }
+  if (readers.empty()) {
+    return ebpf::StatusTuple(-1, "Unable to determine online CPUs");
+  }
+  return ebpf::StatusTuple(0);
+}
+
+void
+BpfLoader::pollPerfBuffer(const std::string& name, int timeoutMs) {
+  if (not pinnedPrograms_) {
+    ebpf_.poll_perf_buffer(name, timeoutMs);
+    return;
+  }
+
+  auto& readers = perfReaders_[name];
+  perf_reader_poll(readers.size(), readers.data(), timeoutMs);
+}
+
+bool
+BpfLoader::usingPinnedPrograms() const {
+  return pinnedPrograms_;
+}
+
+} // namespace common
+} // namespace paths
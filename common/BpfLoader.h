@@ -0,0 +1,123 @@
+#pragma once
+
+#include <bcc/BPF.h>
+#include <bcc/perf_reader.h>
+#include <folly/Optional.h>
+#include <experimental/filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace paths {
+namespace common {
+
+/**
+ * Loads a BPF program and attaches its functions, optionally keeping maps
+ * and programs pinned in bpffs across collector restarts.
+ *
+ * Without --bpf_pin_path this is a thin wrapper around ebpf::BPF. With
+ * --bpf_pin_path, the program is compiled with -DBPF_PIN_PATH so that maps
+ * declared with BPF_TABLE_PINNED are pinned under
+ * <bpf_pin_path>/<name>/maps-<layout>/ and reused on the next start. The
+ * layout version is a hash of the headers next to the BPF source, so a
+ * restart with changed structs does not reuse an incompatible map.
+ *
+ * With --bpf_pin_programs, the loaded programs are pinned as well under
+ * <bpf_pin_path>/<name>/progs-<version>/, where the version is a hash of
+ * the source and compile flags. When a complete set of pinned programs
+ * with a matching version exists, BCC compilation is skipped: programs are
+ * attached from their pinned file descriptors and perf buffers are opened
+ * on the maps those programs reference.
+ *
+ * Methods mirror the subset of ebpf::BPF used by the collectors and return
+ * ebpf::StatusTuple in the same way.
+ */
+class BpfLoader {
+ public:
+  struct Program {
+    std::string fn;
+    bpf_prog_type type;
+  };
+
+  explicit BpfLoader(const std::string& name);
+
+  ~BpfLoader();
+
+  /**
+   * Compiles and loads the program, or reuses pinned programs.
+   *
+   * programs must list every function that will be attached, so that they
+   * can be pinned and found again on restart.
+   */
+  ebpf::StatusTuple init(
+      const std::experimental::filesystem::path& pathToBpfSource,
+      const std::string& source,
+      std::vector<std::string> cflags,
+      const std::vector<Program>& programs);
+
+  ebpf::StatusTuple attachTracepoint(
+      const std::string& tracepoint,
+      const std::string& fn);
+
+  ebpf::StatusTuple attachKprobe(
+      const std::string& kprobe,
+      const std::string& fn);
+
+  /**
+   * Returns the file descriptor of a loaded program, or -1.
+   */
+  int getProgFd(const std::string& fn);
+
+  /**
+   * Returns the file descriptor of a map, or -1.
+   */
+  int getMapFd(const std::string& name);
+
+  ebpf::StatusTuple openPerfBuffer(
+      const std::string& name,
+      perf_reader_raw_cb rawCb,
+      perf_reader_lost_cb lostCb,
+      void* cbCookie,
+      int pageCnt);
+
+  void pollPerfBuffer(const std::string& name, int timeoutMs);
+
+  /**
+   * Whether BCC compilation was skipped in favor of pinned programs.
+   */
+  bool usingPinnedPrograms() const;
+
+ private:
+  struct Attachment {
+    int perfFd;
+    folly::Optional<std::string> kprobeEvName;
+  };
+
+  std::experimental::filesystem::path getToolDir() const;
+
+  ebpf::StatusTuple loadPinnedPrograms(
+      const std::experimental::filesystem::path& progDir,
+      const std::vector<Program>& programs);
+
+  ebpf::StatusTuple pinPrograms(
+      const std::experimental::filesystem::path& progDir,
+      const std::vector<Program>& programs);
+
+  void removeStaleDirs(
+      const std::string& prefix,
+      const std::experimental::filesystem::path& current);
+
+  const std::string name_;
+  ebpf::BPF ebpf_;
+  std::vector<Program> programs_;
+  bool pinnedPrograms_;
+
+  // only used with pinned programs
+  std::map<std::string, int> progFds_;
+  std::map<std::string, int> mapFds_;
+  std::vector<Attachment> attachments_;
+  std::map<std::string, std::vector<perf_reader*>> perfReaders_;
+};
+
+} // namespace common
+} // namespace paths
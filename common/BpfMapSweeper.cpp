@@ -0,0 +1,268 @@
+#include "BpfMapSweeper.h"
+
+#include <bcc/libbpf.h>
+#include <folly/Format.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <linux/bpf.h>
+#include <time.h>
+#include <cerrno>
+#include <cstring>
+
+DEFINE_uint32(
+    bpf_map_gc_interval_s,
+    0,
+    "Interval between sweeps of stale BPF connection map entries "
+    "(0, the default, disables sweeping). Unless the collector can tell "
+    "that a connection is gone (tcpevents with --snapshot_interval_s), "
+    "entries are swept on age alone, which also drops the state of live "
+    "connections older than --bpf_map_gc_max_age_s");
+DEFINE_uint32(
+    bpf_map_gc_max_age_s,
+    86400,
+    "BPF connection map entries last known alive longer ago than this are "
+    "considered stale");
+DEFINE_uint32(
+    bpf_map_gc_batch_size,
+    1024,
+    "Number of BPF map entries read/deleted per batch operation");
+
+namespace {
+
+uint64_t
+monotonicNowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+} // namespace
+
+namespace paths {
+namespace common {
+
+BpfMapSweeper::BpfMapSweeper(int mapFd, const Options& options)
+    : mapFd_(mapFd), options_(options), running_(false), sweeps_(0),
+      scanned_(0), reclaimed_(0) {
+  struct bpf_map_info info;
+  uint32_t infoLen = sizeof(info);
+  std::memset(&info, 0, sizeof(info));
+  if (bpf_obj_get_info(mapFd_, &info, &infoLen) != 0) {
+    LOG(ERROR) << folly::format(
+        "Unable to get info for BPF map {}: {}",
+        options_.mapName,
+        folly::errnoStr(errno));
+    return;
+  }
+  keySize_ = info.key_size;
+  valueSize_ = info.value_size;
+  maxEntries_ = info.max_entries;
+  CHECK_LE(options_.tstampOffset + sizeof(uint64_t), valueSize_);
+  LOG(INFO) << folly::format(
+      "BpfMapSweeper for map {} (max {} entries): "
+      "sweeping every {}s, max entry age {}s",
+      options_.mapName,
+      maxEntries_,
+      options_.interval.count(),
+      options_.maxAge.count());
+}
+
+BpfMapSweeper::~BpfMapSweeper() {
+  stop();
+}
+
+std::unique_ptr<BpfMapSweeper>
+BpfMapSweeper::createFromFlags(
+    int mapFd,
+    const std::string& mapName,
+    size_t tstampOffset,
+    std::chrono::nanoseconds tstampUnit) {
+  if (FLAGS_bpf_map_gc_interval_s == 0) {
+    LOG(INFO) << folly::format(
+        "Sweeping of BPF map {} disabled by --bpf_map_gc_interval_s", mapName);
+    return nullptr;
+  }
+  Options options;
+  options.mapName = mapName;
+  options.tstampOffset = tstampOffset;
+  options.tstampUnit = tstampUnit;
+  options.maxAge = std::chrono::seconds(FLAGS_bpf_map_gc_max_age_s);
+  options.interval = std::chrono::seconds(FLAGS_bpf_map_gc_interval_s);
+  options.batchSize = std::max(1U, FLAGS_bpf_map_gc_batch_size);
+  return std::make_unique<BpfMapSweeper>(mapFd, options);
+}
+
+void
+BpfMapSweeper::start() {
+  if (keySize_ == 0 || running_.exchange(true)) {
+    return;
+  }
+  scheduler_.setThreadName("BpfMapSweeper");
+  scheduler_.addFunction(
+      [this] { sweep(); },
+      options_.interval,
+      folly::sformat("sweep-{}", options_.mapName),
+      options_.interval);
+  scheduler_.start();
+}
+
+void
+BpfMapSweeper::stop() {
+  if (not running_.exchange(false)) {
+    return;
+  }
+  scheduler_.shutdown();
+  LOG(INFO) << folly::format(
+      "BpfMapSweeper for map {} stopping: {} sweeps, {} entries scanned, "
+      "{} stale entries reclaimed",
+      options_.mapName,
+      sweeps_.load(),
+      scanned_.load(),
+      reclaimed_.load());
+}
+
+uint64_t
+BpfMapSweeper::getReclaimed() const {
+  return reclaimed_.load();
+}
+
+uint64_t
+BpfMapSweeper::sweep() {
+  const auto nowNs = monotonicNowNs();
+  const auto deleted =
+      batchSupported_ ? sweepBatched(nowNs) : sweepIterative(nowNs);
+  sweeps_++;
+  reclaimed_.fetch_add(deleted);
+  if (deleted) {
+    LOG(INFO) << folly::format(
+        "Reclaimed {} stale entries from BPF map {} ({} total)",
+        deleted,
+        options_.mapName,
+        reclaimed_.load());
+  }
+  return deleted;
+}
+
+bool
+BpfMapSweeper::isStale(const uint8_t* value, uint64_t nowNs) const {
+  uint64_t tstamp;
+  std::memcpy(&tstamp, value + options_.tstampOffset, sizeof(tstamp));
+  const uint64_t tstampNs = tstamp * options_.tstampUnit.count();
+  const uint64_t maxAgeNs =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(options_.maxAge)
+          .count();
+  // entries from the future or without a timestamp are left alone
+  return tstampNs && tstampNs < nowNs && nowNs - tstampNs > maxAgeNs;
+}
+
+uint64_t
+BpfMapSweeper::deleteKeys(std::vector<uint8_t>& keys, uint32_t count) {
+  if (count == 0) {
+    return 0;
+  }
+  uint32_t deleted = count;
+  if (batchSupported_ && bpf_delete_batch(mapFd_, keys.data(), &deleted) == 0) {
+    return deleted;
+  }
+  if (not batchSupported_) {
+    deleted = 0;
+  }
+
+  // batch stops at the first key that fails (e.g., deleted concurrently by
+  // on_tcp_destroy_sock); delete the remainder one by one
+  uint64_t result = deleted;
+  for (uint32_t i = deleted; i < count; i++) {
+    if (bpf_delete_elem(mapFd_, keys.data() + i * keySize_) == 0) {
+      result++;
+    }
+  }
+  return result;
+}
+
+uint64_t
+BpfMapSweeper::sweepBatched(uint64_t nowNs) {
+  const uint32_t batchSize = options_.batchSize;
+  std::vector<uint8_t> keys(keySize_ * batchSize);
+  std::vector<uint8_t> values(valueSize_ * batchSize);
+  std::vector<uint8_t> staleKeys(keySize_ * batchSize);
+
+  uint64_t deleted = 0;
+  uint32_t inBatch = 0;
+  uint32_t outBatch = 0;
+  bool first = true;
+  while (true) {
+    uint32_t count = batchSize;
+    const int r = bpf_lookup_batch(
+        mapFd_,
+        first ? nullptr : &inBatch,
+        &outBatch,
+        keys.data(),
+        values.data(),
+        &count);
+    const int err = errno;
+    if (r != 0 && err != ENOENT) {
+      if (first && (err == EINVAL || err == ENOTSUP || err == EOPNOTSUPP)) {
+        LOG(WARNING) << folly::format(
+            "BPF batch operations not supported for map {}, "
+            "falling back to per-element sweeping",
+            options_.mapName);
+        batchSupported_ = false;
+        return sweepIterative(nowNs);
+      }
+      LOG(ERROR) << folly::format(
+          "Error reading BPF map {} in batch: {}",
+          options_.mapName,
+          folly::errnoStr(err));
+      break;
+    }
+
+    uint32_t numStale = 0;
+    for (uint32_t i = 0; i < count; i++) {
+      if (isStale(values.data() + i * valueSize_, nowNs)) {
+        std::memcpy(
+            staleKeys.data() + numStale * keySize_,
+            keys.data() + i * keySize_,
+            keySize_);
+        numStale++;
+      }
+    }
+    scanned_.fetch_add(count);
+    deleted += deleteKeys(staleKeys, numStale);
+
+    if (r != 0) {
+      break; // ENOENT, reached the end of the map
+    }
+    inBatch = outBatch;
+    first = false;
+  }
+  return deleted;
+}
+
+uint64_t
+BpfMapSweeper::sweepIterative(uint64_t nowNs) {
+  std::vector<uint8_t> key(keySize_);
+  std::vector<uint8_t> nextKey(keySize_);
+  std::vector<uint8_t> value(valueSize_);
+  std::vector<uint8_t> staleKeys;
+
+  // collect first, deleting while iterating restarts hash map iteration
+  uint32_t numStale = 0;
+  const void* prevKey = nullptr;
+  while (bpf_get_next_key(mapFd_, const_cast<void*>(prevKey), nextKey.data()) ==
+         0) {
+    key.swap(nextKey);
+    prevKey = key.data();
+    if (bpf_lookup_elem(mapFd_, key.data(), value.data()) != 0) {
+      continue;
+    }
+    scanned_++;
+    if (isStale(value.data(), nowNs)) {
+      staleKeys.insert(staleKeys.end(), key.begin(), key.end());
+      numStale++;
+    }
+  }
+  return deleteKeys(staleKeys, numStale);
+}
+
+} // namespace common
+} // namespace paths
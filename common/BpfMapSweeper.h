@@ -0,0 +1,115 @@
+#pragma once
+
+#include <folly/experimental/FunctionScheduler.h>
+#include <gflags/gflags.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+DECLARE_uint32(bpf_map_gc_interval_s);
+DECLARE_uint32(bpf_map_gc_max_age_s);
+
+namespace paths {
+namespace common {
+
+/**
+ * Periodically removes stale entries from a per-connection BPF hash map.
+ *
+ * Entries are normally deleted by on_tcp_destroy_sock. When that tracepoint
+ * is missed the entry leaks, and over days the map fills up and tracking of
+ * new connections silently stops. The sweeper walks the map with
+ * BPF_MAP_LOOKUP_BATCH and removes entries older than a maximum age with
+ * BPF_MAP_DELETE_BATCH, falling back to per-element operations on kernels
+ * without batch support (< 5.6).
+ *
+ * The age of an entry is computed from a timestamp stored in the map value
+ * at tstampOffset. The timestamp must be CLOCK_MONOTONIC time (as returned
+ * by bpf_ktime_get_ns and tcp_clock_ns), in units of tstampUnit; entries
+ * with a zero timestamp are never deleted. If the BPF program refreshes the
+ * timestamp while the connection is alive, only entries of connections that
+ * are gone become stale. If it does not (e.g., it is the connection start
+ * time), live connections older than the maximum age are deleted too, which
+ * is why sweeping is disabled unless --bpf_map_gc_interval_s is set.
+ */
+class BpfMapSweeper {
+ public:
+  struct Options {
+    // Map name, used for logging only
+    std::string mapName;
+
+    // Offset and unit of the u64 timestamp inside the map value
+    size_t tstampOffset{0};
+    std::chrono::nanoseconds tstampUnit{1};
+
+    // Entries whose timestamp is older than this are deleted
+    std::chrono::seconds maxAge{std::chrono::hours(24)};
+
+    // Time between sweeps
+    std::chrono::seconds interval{std::chrono::minutes(5)};
+
+    // Number of entries read and deleted per batch operation
+    uint32_t batchSize{1024};
+  };
+
+  BpfMapSweeper(int mapFd, const Options& options);
+
+  ~BpfMapSweeper();
+
+  /**
+   * Creates a sweeper configured from the --bpf_map_gc_* flags.
+   *
+   * Returns nullptr if sweeping is disabled (--bpf_map_gc_interval_s=0).
+   */
+  static std::unique_ptr<BpfMapSweeper> createFromFlags(
+      int mapFd,
+      const std::string& mapName,
+      size_t tstampOffset,
+      std::chrono::nanoseconds tstampUnit);
+
+  /**
+   * Starts sweeping on a background thread.
+   */
+  void start();
+
+  /**
+   * Stops the background thread and logs how much was reclaimed.
+   */
+  void stop();
+
+  /**
+   * Runs a single sweep. Returns the number of entries deleted.
+   */
+  uint64_t sweep();
+
+  /**
+   * Total number of entries deleted since construction.
+   */
+  uint64_t getReclaimed() const;
+
+ private:
+  bool isStale(const uint8_t* value, uint64_t nowNs) const;
+
+  uint64_t deleteKeys(std::vector<uint8_t>& keys, uint32_t count);
+
+  uint64_t sweepBatched(uint64_t nowNs);
+
+  uint64_t sweepIterative(uint64_t nowNs);
+
+  const int mapFd_;
+  const Options options_;
+  uint32_t keySize_{0};
+  uint32_t valueSize_{0};
+  uint32_t maxEntries_{0};
+  bool batchSupported_{true};
+
+  folly::FunctionScheduler scheduler_;
+  std::atomic<bool> running_;
+  std::atomic<uint64_t> sweeps_;
+  std::atomic<uint64_t> scanned_;
+  std::atomic<uint64_t> reclaimed_;
+};
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,207 @@
+#include "BufferedWriter.h"
+
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+
+DEFINE_uint32(
+    output_buffer_bytes,
+    1 << 20,
+    "Exported lines are buffered and written out once the buffer holds this "
+    "many bytes (0 writes every line immediately)");
+DEFINE_uint32(
+    output_flush_interval_ms,
+    1000,
+    "Maximum time exported lines are buffered before being written out "
+    "(0 flushes only when the buffer is full and on shutdown)");
+
+namespace {
+
+// smallest buffer handed out by the sink, also used with
+// --output_buffer_bytes=0 (lines are then flushed one by one)
+constexpr size_t kMinSinkBufferSize = 64 * 1024;
+
+} // namespace
+
+namespace paths {
+namespace common {
+
+BufferedWriter::BufferedWriter(
+    folly::Optional<folly::File>&& outputFileOpt,
+    const Options& options,
+    std::unique_ptr<SegmentRotator> rotator)
+    : outputFileOpt_(std::move(outputFileOpt)),
+      fd_(outputFileOpt_.hasValue() ? outputFileOpt_->fd() : STDOUT_FILENO),
+      options_(options),
+      // leave room for lines that end past bufferSize
+      sinkBufferSize_(
+          std::max(options_.bufferSize + 4096, kMinSinkBufferSize)),
+      rotator_(std::move(rotator)),
+      bytesWritten_(0),
+      flushes_(0) {
+  CHECK(!rotator_ || outputFileOpt_.hasValue());
+  sink_ = OutputSink::createFromFlags(fd_, sinkBufferSize_);
+  buf_ = sink_->getBuffer();
+  if (options_.flushInterval.count() > 0) {
+    scheduler_.setThreadName("BufferedWriter");
+    scheduler_.addFunction(
+        [this] {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (rotator_ && rotator_->isExpired()) {
+            rotateLocked();
+          }
+          flushLocked();
+          sink_->timerTick();
+        },
+        options_.flushInterval,
+        "flush",
+        options_.flushInterval);
+    scheduler_.start();
+  }
+}
+
+BufferedWriter::~BufferedWriter() {
+  scheduler_.shutdown();
+  flush();
+  sink_->drain();
+  if (rotator_) {
+    sink_.reset();
+    rotator_->closeSegment(std::move(*outputFileOpt_));
+  }
+  VLOG(1) << folly::format(
+      "BufferedWriter: {} bytes written in {} flushes",
+      bytesWritten_.load(),
+      flushes_.load());
+}
+
+std::unique_ptr<BufferedWriter>
+BufferedWriter::createFromFlags(folly::Optional<folly::File>&& outputFileOpt) {
+  Options options;
+  options.bufferSize = FLAGS_output_buffer_bytes;
+  options.flushInterval =
+      std::chrono::milliseconds(FLAGS_output_flush_interval_ms);
+  return std::make_unique<BufferedWriter>(std::move(outputFileOpt), options);
+}
+
+std::unique_ptr<BufferedWriter>
+BufferedWriter::createFromFlags(const std::string& path) {
+  if (path.empty()) {
+    return createFromFlags(folly::none);
+  }
+
+  Options options;
+  options.bufferSize = FLAGS_output_buffer_bytes;
+  options.flushInterval =
+      std::chrono::milliseconds(FLAGS_output_flush_interval_ms);
+  auto rotator = SegmentRotator::createFromFlags(path);
+  if (rotator) {
+    auto file = rotator->openSegment();
+    return std::make_unique<BufferedWriter>(
+        std::move(file), options, std::move(rotator));
+  }
+
+  auto fileExpect = folly::File::makeFile(path, O_WRONLY | O_TRUNC | O_CREAT);
+  if (fileExpect.hasError()) {
+    LOG(FATAL) << folly::sformat(
+        "Unable to open file {} for export, error = {}",
+        path,
+        folly::exceptionStr(fileExpect.error()));
+  }
+  LOG(INFO) << folly::sformat("Opened file {} for export", path);
+  return std::make_unique<BufferedWriter>(
+      std::move(fileExpect.value()), options);
+}
+
+void
+BufferedWriter::setHeader(folly::StringPiece header) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  header_ = header.str();
+  appendLocked(header_.data(), header_.size());
+  maybeFlushLocked();
+}
+
+void
+BufferedWriter::write(folly::StringPiece data) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  appendLocked(data.data(), data.size());
+  maybeFlushLocked();
+}
+
+void
+BufferedWriter::writeLine(folly::StringPiece line) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  appendLocked(line.data(), line.size());
+  appendLocked("\n", 1);
+  maybeFlushLocked();
+}
+
+void
+BufferedWriter::flush() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  flushLocked();
+}
+
+uint64_t
+BufferedWriter::getBytesWritten() const {
+  return bytesWritten_.load();
+}
+
+void
+BufferedWriter::appendLocked(const char* data, size_t size) {
+  const auto capacity = sink_->getBufferSize();
+  while (size > 0) {
+    if (used_ == capacity) {
+      flushLocked();
+    }
+    const auto n = std::min(size, capacity - used_);
+    std::memcpy(buf_ + used_, data, n);
+    used_ += n;
+    data += n;
+    size -= n;
+  }
+}
+
+void
+BufferedWriter::maybeFlushLocked() {
+  if (rotator_ && rotator_->isFull(segmentBytes_ + used_)) {
+    rotateLocked();
+  } else if (used_ >= options_.bufferSize) {
+    flushLocked();
+  }
+}
+
+void
+BufferedWriter::flushLocked() {
+  if (used_ == 0) {
+    return;
+  }
+  sink_->submit(buf_, used_);
+  bytesWritten_.fetch_add(used_);
+  segmentBytes_ += used_;
+  flushes_++;
+  buf_ = sink_->getBuffer();
+  used_ = 0;
+}
+
+void
+BufferedWriter::rotateLocked() {
+  flushLocked();
+  sink_->drain();
+  sink_.reset();
+  rotator_->closeSegment(std::move(*outputFileOpt_));
+
+  outputFileOpt_ = rotator_->openSegment();
+  fd_ = outputFileOpt_->fd();
+  sink_ = OutputSink::createFromFlags(fd_, sinkBufferSize_);
+  buf_ = sink_->getBuffer();
+  segmentBytes_ = 0;
+  appendLocked(header_.data(), header_.size());
+}
+
+} // namespace common
+} // namespace paths
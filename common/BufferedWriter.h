@@ -0,0 +1,124 @@
+#pragma once
+
+#include <folly/File.h>
+#include <folly/Optional.h>
+#include <folly/Range.h>
+#include <folly/experimental/FunctionScheduler.h>
+#include <src/common/OutputSink.h>
+#include <src/common/SegmentRotator.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace paths {
+namespace common {
+
+/**
+ * Buffers exported lines and writes them to a file (or stdout) in batches.
+ *
+ * Lines are appended to a buffer provided by the OutputSink (selected with
+ * --output_sink), which is handed back to the sink to be written out once
+ * it holds bufferSize bytes, every flushInterval (from a background
+ * thread, so that data does not sit in the buffer when events are rare),
+ * and on flush() / destruction. Data is therefore lost on a crash only if
+ * it was written in the last flushInterval.
+ *
+ * With a SegmentRotator, the output file is split into segments; a new
+ * segment is started between two write() / writeLine() calls once the
+ * size limit is reached (or, checked every flushInterval, the time limit),
+ * and starts with the header set by setHeader().
+ */
+class BufferedWriter {
+ public:
+  struct Options {
+    // Buffer is written out once it holds this many bytes (0 writes every
+    // line immediately)
+    size_t bufferSize{1 << 20};
+
+    // Maximum time a line stays in the buffer (0 disables periodic flushes)
+    std::chrono::milliseconds flushInterval{std::chrono::seconds(1)};
+  };
+
+  /**
+   * Writes to outputFileOpt, or to stdout if not set. If rotator is set,
+   * outputFileOpt must be a segment it opened.
+   */
+  BufferedWriter(
+      folly::Optional<folly::File>&& outputFileOpt,
+      const Options& options,
+      std::unique_ptr<SegmentRotator> rotator = nullptr);
+
+  ~BufferedWriter();
+
+  /**
+   * Creates a writer configured from the --output_* flags.
+   */
+  static std::unique_ptr<BufferedWriter> createFromFlags(
+      folly::Optional<folly::File>&& outputFileOpt);
+
+  /**
+   * Creates a writer for the export file at path (stdout if empty),
+   * configured from the --output_* flags and rotated as set by the
+   * --export_rotate_* flags.
+   */
+  static std::unique_ptr<BufferedWriter> createFromFlags(
+      const std::string& path);
+
+  /**
+   * Writes header (e.g. CSV column names, with line terminator), and
+   * writes it again at the start of every later segment.
+   */
+  void setHeader(folly::StringPiece header);
+
+  /**
+   * Appends data to the buffer, without line terminator.
+   */
+  void write(folly::StringPiece data);
+
+  /**
+   * Appends a line to the buffer, followed by "\n".
+   */
+  void writeLine(folly::StringPiece line);
+
+  /**
+   * Hands everything buffered so far to the sink.
+   */
+  void flush();
+
+  uint64_t getBytesWritten() const;
+
+ private:
+  void appendLocked(const char* data, size_t size);
+
+  void maybeFlushLocked();
+
+  void flushLocked();
+
+  void rotateLocked();
+
+  folly::Optional<folly::File> outputFileOpt_;
+  int fd_;
+  const Options options_;
+  const size_t sinkBufferSize_;
+
+  std::mutex mutex_;
+  // declared after outputFileOpt_ so that it is drained before the file is
+  // closed
+  std::unique_ptr<OutputSink> sink_;
+  char* buf_{nullptr};
+  size_t used_{0};
+
+  const std::unique_ptr<SegmentRotator> rotator_;
+  std::string header_;
+  // bytes handed to the sink since the segment was opened
+  uint64_t segmentBytes_{0};
+
+  folly::FunctionScheduler scheduler_;
+  std::atomic<uint64_t> bytesWritten_;
+  std::atomic<uint64_t> flushes_;
+};
+
+} // namespace common
+} // namespace paths
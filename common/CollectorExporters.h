@@ -0,0 +1,406 @@
+#pragma once
+
+#include <folly/Format.h>
+#include <folly/IPAddress.h>
+#include <folly/String.h>
+#include <folly/io/async/EventBase.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <src/common/AsyncEventQueue.h>
+#include <src/common/BufferedWriter.h>
+#include <src/common/ColumnarFile.h>
+#include <src/common/ColumnProjection.h>
+#include <src/common/CsvRowEncoder.h>
+#include <src/common/EventRing.h>
+#include <src/common/EventStream.h>
+#include <src/common/ExporterSpec.h>
+#include <src/common/PrefixMatcher.h>
+#include <src/common/RecordFile.h>
+#include <src/common/SignalHandler.h>
+#include <src/common/SqliteWriter.h>
+#include <sys/socket.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// defined by each collector
+DECLARE_double(bpf_connection_sampling_rate);
+
+namespace paths {
+namespace common {
+
+/**
+ * Exporters of the collectors of a single fixed-size event type (ackevents,
+ * acktrace, rtttrace, rttevents), and the main loop running them, so that the
+ * main of each tool only defines its flags. A tool describes itself with a
+ * struct passed as Tool:
+ *
+ *   struct AckEventsTool {
+ *     using Collector = AckEventCollector; // run(), stop(), CallbackHandler
+ *     using Event = bpf::ack_event;        // passed to handleEvent
+ *     // names record files, rings, queues, columnar batches and tables
+ *     static constexpr const char* kName = "ackevents";
+ *     // whether --export_mode=record, --event_ring_path and
+ *     // --stream_socket_path are supported: the decoder knows the events
+ *     static constexpr bool kRawEvents = true;
+ *     // type of the events for stream subscribers, if kRawEvents
+ *     static constexpr const char* kStreamType = "ack";
+ *     static constexpr bool kEvdebug = false;
+ *     static std::vector<std::string> getCsvFieldNames();
+ *     template <typename Encoder>
+ *     static void encodeCsvRow(const Event& ev, Encoder& encoder);
+ *   };
+ *
+ * encodeCsvRow is called with CsvRowEncoder, ColumnarWriter, SqliteWriter,
+ * ProjectedRow of each of them and ColumnTypeRecorder, plus EventStreamRow
+ * if kRawEvents.
+ */
+template <typename Tool>
+using EventHandler = typename Tool::Collector::CallbackHandler;
+
+/**
+ * Validator of --export_mode, and of the modes of --exporters.
+ */
+template <typename Tool>
+bool validateEventExportMode(const char* flagname, const std::string& mode) {
+  if (mode == "csv" || mode == "columnar" || mode == "sqlite" ||
+      (Tool::kRawEvents && mode == "record")) {
+    return true;
+  }
+  LOG(ERROR) << folly::format(
+      "{} must be {}",
+      flagname,
+      Tool::kRawEvents ? "csv, columnar, sqlite or record"
+                       : "csv, columnar or sqlite");
+  return false;
+}
+
+/**
+ * Exports the events to the clients of an exporter as CSV rows, columnar
+ * record batches or SQLite rows, from the thread of its export queue.
+ */
+template <typename Tool>
+class CsvEventExporter : public EventHandler<Tool> {
+ public:
+  using Event = typename Tool::Event;
+
+  CsvEventExporter(
+      std::unique_ptr<BufferedWriter> writer,
+      const ExporterSpec& spec,
+      const std::string& queueName,
+      const std::shared_ptr<const PrefixMatcher>& clients)
+      : writer_(std::move(writer)),
+        clients_(getExporterClients(spec, clients)) {
+    LOG(INFO) << folly::format(
+        "Monitoring events to clients in {}", clients_->describe());
+    const auto allColumns = Tool::getCsvFieldNames();
+    std::string error;
+    if (!selectColumns(allColumns, spec.fields, columns_, error)) {
+      LOG(FATAL) << folly::format(
+          "Unable to export {}: {}", spec.mode, error);
+    }
+    projected_ = !spec.fields.empty();
+    if (spec.mode == "columnar" || spec.mode == "sqlite") {
+      ColumnTypeRecorder recorder;
+      Tool::encodeCsvRow(Event(), recorder);
+      const auto allSpecs = ColumnarWriter::makeColumns(allColumns, recorder);
+      std::vector<ColumnSpec> columns;
+      for (size_t i = 0; i < allSpecs.size(); i++) {
+        if (columns_[i]) {
+          columns.push_back(allSpecs[i]);
+        }
+      }
+      if (spec.mode == "sqlite") {
+        sqlite_ = SqliteWriter::createFromFlags(
+            spec.path,
+            Tool::kName,
+            std::move(columns),
+            {"ev_tstamp_ns", "dst"});
+      } else {
+        columnar_ = ColumnarWriter::createFromFlags(
+            *writer_, Tool::kName, std::move(columns));
+      }
+    } else {
+      std::vector<std::string> row;
+      for (size_t i = 0; i < allColumns.size(); i++) {
+        if (columns_[i]) {
+          row.push_back(allColumns[i]);
+        }
+      }
+      writer_->setHeader(folly::join(",", row) + "\n");
+    }
+
+    queue_ = AsyncEventQueue<Event>::createFromFlags(
+        queueName, spec.queueFull, [this](Event& ev) { exportEvent(ev); });
+    if (queue_) {
+      queue_->start();
+    }
+  }
+
+  void handleEvent(const Event& ev) override {
+    if (!clients_->match(
+            reinterpret_cast<const struct sockaddr*>(&ev.header.dst))) {
+      return;
+    }
+    if (queue_) {
+      queue_->push(ev);
+      return;
+    }
+    exportEvent(ev);
+  }
+
+ private:
+  void exportEvent(const Event& ev) {
+    if (columnar_) {
+      columnar_->beginRow();
+      encodeRow(ev, *columnar_);
+      columnar_->endRow();
+      return;
+    }
+    if (sqlite_) {
+      sqlite_->beginRow();
+      encodeRow(ev, *sqlite_);
+      sqlite_->endRow();
+      return;
+    }
+    encoder_.clear();
+    encodeRow(ev, encoder_);
+    writer_->writeLine(encoder_.str());
+  }
+
+  template <typename Encoder>
+  void encodeRow(const Event& ev, Encoder& encoder) {
+    if (projected_) {
+      ProjectedRow<Encoder> row(encoder, columns_);
+      Tool::encodeCsvRow(ev, row);
+      return;
+    }
+    Tool::encodeCsvRow(ev, encoder);
+  }
+
+  std::unique_ptr<BufferedWriter> writer_;
+  std::shared_ptr<const PrefixMatcher> clients_;
+  // columns of getCsvFieldNames() exported, all of them unless projected_
+  std::vector<bool> columns_;
+  bool projected_{false};
+  CsvRowEncoder encoder_;
+  // set with mode columnar, writes to writer_ instead of encoder_
+  std::unique_ptr<ColumnarWriter> columnar_;
+  // set with mode sqlite, replaces writer_
+  std::unique_ptr<SqliteWriter> sqlite_;
+  // declared last so that it is drained before the members above go away
+  std::unique_ptr<AsyncEventQueue<Event>> queue_;
+};
+
+/**
+ * Writes every raw event, unfiltered, for RecordDecoder (mode record).
+ */
+template <typename Tool>
+class RecordEventExporter : public EventHandler<Tool> {
+ public:
+  using Event = typename Tool::Event;
+
+  explicit RecordEventExporter(std::unique_ptr<BufferedWriter> writer)
+      : writer_(std::move(writer)) {
+    LOG(INFO) << "Recording raw events, client prefix is not applied";
+    writeRecordFileHeader(
+        *writer_,
+        Tool::kName,
+        sizeof(Event),
+        Tool::kEvdebug,
+        FLAGS_bpf_connection_sampling_rate);
+  }
+
+  void handleEvent(const Event& ev) override {
+    writeRecord(*writer_, ev);
+  }
+
+ private:
+  std::unique_ptr<BufferedWriter> writer_;
+};
+
+/**
+ * Publishes every event to the --event_ring_path ring, then passes it on.
+ */
+template <typename Tool>
+class RingEventPublisher : public EventHandler<Tool> {
+ public:
+  RingEventPublisher(
+      std::unique_ptr<EventRingWriter> ring,
+      std::shared_ptr<EventHandler<Tool>> next)
+      : ring_(std::move(ring)), next_(std::move(next)) {}
+
+  void handleEvent(const typename Tool::Event& ev) override {
+    ring_->writeRecord(ev);
+    next_->handleEvent(ev);
+  }
+
+ private:
+  std::unique_ptr<EventRingWriter> ring_;
+  std::shared_ptr<EventHandler<Tool>> next_;
+};
+
+/**
+ * Queues every event for the --stream_socket_path subscribers, then passes
+ * it on.
+ */
+template <typename Tool>
+class StreamEventPublisher : public EventHandler<Tool> {
+ public:
+  using Event = typename Tool::Event;
+
+  StreamEventPublisher(
+      std::unique_ptr<EventStreamPublisher<Event>> stream,
+      std::shared_ptr<EventHandler<Tool>> next)
+      : stream_(std::move(stream)), next_(std::move(next)) {}
+
+  void handleEvent(const Event& ev) override {
+    stream_->publish(ev);
+    next_->handleEvent(ev);
+  }
+
+ private:
+  std::unique_ptr<EventStreamPublisher<Event>> stream_;
+  std::shared_ptr<EventHandler<Tool>> next_;
+};
+
+/**
+ * Passes every event to each exporter of --exporters, which filters it and
+ * queues it for its own thread.
+ */
+template <typename Tool>
+class FanoutEventExporter : public EventHandler<Tool> {
+ public:
+  explicit FanoutEventExporter(
+      std::vector<std::shared_ptr<EventHandler<Tool>>> exporters)
+      : exporters_(std::move(exporters)) {}
+
+  void handleEvent(const typename Tool::Event& ev) override {
+    for (const auto& exporter : exporters_) {
+      exporter->handleEvent(ev);
+    }
+  }
+
+ private:
+  const std::vector<std::shared_ptr<EventHandler<Tool>>> exporters_;
+};
+
+/**
+ * Creates the exporter of a spec, writing to its file (rotated if
+ * --export_rotate_* are set) or stdout; fails hard if it cannot.
+ */
+template <typename Tool>
+std::shared_ptr<EventHandler<Tool>> makeEventExporter(
+    const ExporterSpec& spec,
+    const std::string& queueName,
+    const std::shared_ptr<const PrefixMatcher>& clients) {
+  if (!validateEventExportMode<Tool>("exporters mode", spec.mode)) {
+    LOG(FATAL) << folly::format("Unknown export mode {}", spec.mode);
+  }
+  if (!spec.types.empty()) {
+    LOG(FATAL) << folly::format(
+        "--exporters types is not supported, {} has a single event type",
+        Tool::kName);
+  }
+
+  // sqlite writes to its own database instead
+  std::unique_ptr<BufferedWriter> writer;
+  if (spec.mode != "sqlite") {
+    writer = BufferedWriter::createFromFlags(spec.path);
+  }
+  if (spec.mode == "record") {
+    return std::make_shared<RecordEventExporter<Tool>>(std::move(writer));
+  }
+  return std::make_shared<CsvEventExporter<Tool>>(
+      std::move(writer), spec, queueName, clients);
+}
+
+/**
+ * Runs the collector of a tool until SIGINT or SIGTERM, exporting its events
+ * to --exporters, or to the single exporter of exportMode and
+ * exportFilePath, for the clients of --client_prefixes_file or
+ * clientPrefix. Returns the exit status of the tool.
+ */
+template <typename Tool>
+int runEventCollector(
+    const std::string& exportMode,
+    const std::string& exportFilePath,
+    const std::string& clientPrefix) {
+  using Event = typename Tool::Event;
+
+  auto specs = getExporterSpecsFromFlags();
+  if (specs.empty()) {
+    ExporterSpec spec;
+    spec.mode = exportMode;
+    spec.path = exportFilePath;
+    CHECK(parseQueueFullPolicy(
+        FLAGS_export_queue_full_policy, spec.queueFull));
+    specs.push_back(spec);
+  }
+  const std::shared_ptr<const PrefixMatcher> clients =
+      PrefixMatcher::createFromFlags(clientPrefix);
+  if (!clients) {
+    LOG(FATAL) << "Unable to load the monitored client prefixes";
+  }
+  std::vector<std::shared_ptr<EventHandler<Tool>>> exporters;
+  for (size_t i = 0; i < specs.size(); i++) {
+    exporters.push_back(makeEventExporter<Tool>(
+        specs[i],
+        getExporterQueueName(Tool::kName, i, specs.size()),
+        clients));
+  }
+
+  std::shared_ptr<EventHandler<Tool>> handler;
+  if (exporters.size() == 1) {
+    handler = exporters.front();
+  } else {
+    handler = std::make_shared<FanoutEventExporter<Tool>>(std::move(exporters));
+  }
+  if constexpr (Tool::kRawEvents) {
+    auto ring = EventRingWriter::createFromFlags(
+        Tool::kName, sizeof(Event), Tool::kEvdebug);
+    if (ring) {
+      handler =
+          std::make_shared<RingEventPublisher<Tool>>(std::move(ring), handler);
+    }
+    auto stream = EventStreamPublisher<Event>::createFromFlags(
+        Tool::kName,
+        std::make_unique<CsvEventStreamSchema<Event>>(
+            Tool::kStreamType,
+            Tool::getCsvFieldNames(),
+            &Tool::template encodeCsvRow<EventStreamRow>));
+    if (stream) {
+      handler = std::make_shared<StreamEventPublisher<Tool>>(
+          std::move(stream), handler);
+    }
+  } else if (
+      !FLAGS_event_ring_path.empty() || !FLAGS_stream_socket_path.empty()) {
+    LOG(FATAL) << folly::format(
+        "--event_ring_path and --stream_socket_path are not supported by {}",
+        Tool::kName);
+  }
+  typename Tool::Collector collector(handler);
+
+  // setup shutdown handler
+  const auto stopServices = [&]() { collector.stop(); };
+  folly::EventBase eventBase;
+  ShutdownSignalHandler signalHandler(&eventBase, stopServices);
+
+  // run the collector, wait for termination signal
+  std::thread threadObj([&] {
+    eventBase.waitUntilRunning();
+    collector.run();
+    LOG(INFO) << folly::format(
+        "{} collector returned, shutting down", Tool::kName);
+    eventBase.terminateLoopSoon();
+  });
+  eventBase.loopForever();
+  threadObj.join();
+
+  LOG(INFO) << "Done";
+  return 0;
+}
+
+} // namespace common
+} // namespace paths
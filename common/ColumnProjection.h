@@ -0,0 +1,74 @@
+#pragma once
+
+#include <folly/Range.h>
+#include <sys/socket.h>
+#include <type_traits>
+#include <vector>
+
+namespace paths {
+namespace common {
+
+/**
+ * Row encoder that passes only the selected columns of a row on to another
+ * encoder (CsvRowEncoder, ColumnarWriter, SqliteWriter), for exporters that
+ * write a subset of the fields of a tool (see ExporterSpec).
+ *
+ * Columns are counted as values are added, so an address added as three raw
+ * columns (--export_raw_addresses) is selected column by column, as it is
+ * named.
+ */
+template <typename Encoder>
+class ProjectedRow {
+ public:
+  ProjectedRow(Encoder& encoder, const std::vector<bool>& selected)
+      : encoder_(encoder), selected_(selected) {}
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value>::type add(T value) {
+    if (next()) {
+      encoder_.add(value);
+    }
+  }
+
+  void add(bool value) {
+    if (next()) {
+      encoder_.add(value);
+    }
+  }
+
+  void addRaw(folly::StringPiece value) {
+    if (next()) {
+      encoder_.addRaw(value);
+    }
+  }
+
+  void addString(folly::StringPiece value) {
+    if (next()) {
+      encoder_.addString(value);
+    }
+  }
+
+  void addAddress(const struct sockaddr_storage* sas) {
+    if (next()) {
+      encoder_.addAddress(sas);
+    }
+  }
+
+  void addNull() {
+    if (next()) {
+      encoder_.addNull();
+    }
+  }
+
+ private:
+  bool next() {
+    return selected_[column_++];
+  }
+
+  Encoder& encoder_;
+  const std::vector<bool>& selected_;
+  size_t column_{0};
+};
+
+} // namespace common
+} // namespace paths
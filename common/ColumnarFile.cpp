@@ -0,0 +1,421 @@
+#include "ColumnarFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <src/common/CsvRowEncoder.h>
+
+static bool
+ValidateBatchRows(const char* flagname, uint32_t value) {
+  if (value == 0) {
+    LOG(ERROR) << folly::format("--{} must be > 0", flagname);
+    return false;
+  }
+  return true;
+}
+
+DEFINE_uint32(
+    columnar_batch_rows,
+    65536,
+    "Columnar export: rows per record batch");
+DEFINE_validator(columnar_batch_rows, &ValidateBatchRows);
+DEFINE_uint32(
+    columnar_batch_interval_ms,
+    10000,
+    "Columnar export: maximum time a record batch stays open before it is "
+    "written (0 = write batches by size only)");
+
+namespace paths {
+namespace common {
+
+namespace {
+
+size_t
+padded(size_t size) {
+  return (size + 7) & ~size_t(7);
+}
+
+void
+appendPadding(std::string& out) {
+  out.resize(padded(out.size()), '\0');
+}
+
+template <typename T>
+void
+appendStruct(std::string& out, const T& value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// whether size bytes at offset fit in a batch of batchSize bytes
+bool
+inBatch(uint64_t offset, uint64_t size, uint64_t batchSize) {
+  return offset <= batchSize && size <= batchSize - offset;
+}
+
+// why the buffers of a complete batch do not fit in it, or an empty string
+std::string
+checkBatchBuffers(const char* batch, const std::vector<ColumnSpec>& columns) {
+  const auto header = reinterpret_cast<const ColumnarBatchHeader*>(batch);
+  const auto refs = reinterpret_cast<const ColumnarBufferRefs*>(
+      batch + sizeof(ColumnarBatchHeader));
+  const uint64_t buffersStart = padded(
+      sizeof(ColumnarBatchHeader) +
+      columns.size() * sizeof(ColumnarBufferRefs));
+  for (size_t i = 0; i < columns.size(); i++) {
+    const auto& ref = refs[i];
+    if (ref.validityOffset < buffersStart || ref.validityOffset % 8 ||
+        ref.valuesOffset % 8 ||
+        !inBatch(
+            ref.validityOffset, (header->rowCount + 7) / 8, header->batchSize) ||
+        !inBatch(
+            ref.valuesOffset,
+            uint64_t(header->rowCount) * sizeof(uint64_t),
+            header->batchSize) ||
+        !inBatch(ref.dataOffset, ref.dataSize, header->batchSize)) {
+      return folly::sformat("buffers of column {} out of bounds", i);
+    }
+    if (columns[i].type != ColumnType::STRING) {
+      continue;
+    }
+    // getString() reads the strings between consecutive end offsets
+    const auto ends =
+        reinterpret_cast<const uint64_t*>(batch + ref.valuesOffset);
+    uint64_t begin = 0;
+    for (uint32_t row = 0; row < header->rowCount; row++) {
+      if (ends[row] < begin || ends[row] > ref.dataSize) {
+        return folly::sformat("string {} of column {} out of bounds", row, i);
+      }
+      begin = ends[row];
+    }
+  }
+  return "";
+}
+
+} // namespace
+
+std::unique_ptr<ColumnarWriter>
+ColumnarWriter::createFromFlags(
+    BufferedWriter& writer,
+    folly::StringPiece tool,
+    std::vector<ColumnSpec> columns) {
+  Options options;
+  options.batchRows = FLAGS_columnar_batch_rows;
+  options.batchInterval =
+      std::chrono::milliseconds(FLAGS_columnar_batch_interval_ms);
+  return std::make_unique<ColumnarWriter>(
+      writer, tool, std::move(columns), options);
+}
+
+std::vector<ColumnSpec>
+ColumnarWriter::makeColumns(
+    const std::vector<std::string>& names,
+    const ColumnTypeRecorder& recorder) {
+  const auto& types = recorder.getTypes();
+  CHECK_EQ(names.size(), types.size());
+  std::vector<ColumnSpec> columns;
+  for (size_t i = 0; i < names.size(); i++) {
+    columns.push_back(ColumnSpec{names[i], types[i]});
+  }
+  return columns;
+}
+
+ColumnarWriter::ColumnarWriter(
+    BufferedWriter& writer,
+    folly::StringPiece tool,
+    std::vector<ColumnSpec> columns,
+    const Options& options)
+    : writer_(writer), options_(options) {
+  std::string schema;
+  ColumnarFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kColumnarFileMagic, sizeof(header.magic));
+  header.version = kColumnarFileVersion;
+  CHECK_LT(tool.size(), sizeof(header.tool));
+  memcpy(header.tool, tool.data(), tool.size());
+  header.columnCount = columns.size();
+  appendStruct(schema, header);
+  for (const auto& column : columns) {
+    appendStruct(
+        schema,
+        ColumnarColumnHeader{column.type, uint32_t(column.name.size())});
+    schema.append(column.name);
+    appendPadding(schema);
+  }
+  reinterpret_cast<ColumnarFileHeader*>(&schema[0])->headerSize =
+      schema.size();
+  writer_.setHeader(schema);
+
+  for (auto& spec : columns) {
+    columns_.push_back(Column{std::move(spec), {}, {}, {}});
+    columns_.back().values.reserve(options_.batchRows);
+  }
+}
+
+ColumnarWriter::~ColumnarWriter() {
+  flush();
+}
+
+ColumnarWriter::Column&
+ColumnarWriter::nextColumn(bool valid) {
+  DCHECK_LT(next_, columns_.size());
+  auto& column = columns_[next_++];
+  if (rows_ % 8 == 0) {
+    column.validity.push_back(0);
+  }
+  if (valid) {
+    column.validity.back() |= 1 << (rows_ % 8);
+  }
+  return column;
+}
+
+void
+ColumnarWriter::addString(folly::StringPiece value) {
+  auto& column = nextColumn(true);
+  DCHECK(column.spec.type == ColumnType::STRING) << column.spec.name;
+  column.data.append(value.data(), value.size());
+  column.values.push_back(column.data.size());
+}
+
+void
+ColumnarWriter::addAddress(const struct sockaddr_storage* sas) {
+  char tmp[kMaxFormattedAddressLength];
+  const auto len = formatAddress(sas, tmp);
+  if (len == 0) {
+    addString("<uninitialized address>");
+    return;
+  }
+  addString(folly::StringPiece(tmp, len));
+}
+
+void
+ColumnarWriter::addNull() {
+  auto& column = nextColumn(false);
+  column.values.push_back(
+      column.spec.type == ColumnType::STRING ? column.data.size() : 0);
+}
+
+void
+ColumnarWriter::endRow() {
+  CHECK_EQ(next_, columns_.size()) << "Row does not match the schema";
+  if (rows_++ == 0) {
+    batchStart_ = std::chrono::steady_clock::now();
+  }
+  if (rows_ >= options_.batchRows ||
+      (options_.batchInterval.count() > 0 &&
+       std::chrono::steady_clock::now() - batchStart_ >=
+           options_.batchInterval)) {
+    flush();
+  }
+}
+
+void
+ColumnarWriter::flush() {
+  if (rows_ == 0) {
+    return;
+  }
+
+  // lay out the buffers after the headers
+  std::vector<ColumnarBufferRefs> refs(columns_.size());
+  uint64_t offset = padded(
+      sizeof(ColumnarBatchHeader) +
+      columns_.size() * sizeof(ColumnarBufferRefs));
+  for (size_t i = 0; i < columns_.size(); i++) {
+    const auto& column = columns_[i];
+    refs[i].validityOffset = offset;
+    offset += padded(column.validity.size());
+    refs[i].valuesOffset = offset;
+    offset += column.values.size() * sizeof(uint64_t);
+    refs[i].dataOffset = offset;
+    refs[i].dataSize = column.data.size();
+    offset += padded(column.data.size());
+  }
+
+  ColumnarBatchHeader header;
+  memcpy(header.magic, kColumnarBatchMagic, sizeof(header.magic));
+  header.batchSize = offset;
+  header.rowCount = rows_;
+  header.columnCount = columns_.size();
+
+  batch_.clear();
+  batch_.reserve(offset);
+  appendStruct(batch_, header);
+  for (const auto& ref : refs) {
+    appendStruct(batch_, ref);
+  }
+  appendPadding(batch_);
+  for (auto& column : columns_) {
+    batch_.append(
+        reinterpret_cast<const char*>(column.validity.data()),
+        column.validity.size());
+    appendPadding(batch_);
+    batch_.append(
+        reinterpret_cast<const char*>(column.values.data()),
+        column.values.size() * sizeof(uint64_t));
+    batch_.append(column.data);
+    appendPadding(batch_);
+
+    column.validity.clear();
+    column.values.clear();
+    column.data.clear();
+  }
+  CHECK_EQ(batch_.size(), offset);
+
+  // a single write, so that a batch never spans two segments
+  writer_.write(batch_);
+  bytesWritten_ += batch_.size();
+  rows_ = 0;
+}
+
+std::unique_ptr<ColumnarFileReader>
+ColumnarFileReader::open(const std::string& path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG(ERROR) << folly::format(
+        "Unable to open {}: {}", path, folly::errnoStr(errno));
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    LOG(ERROR) << folly::format(
+        "Unable to stat {}: {}", path, folly::errnoStr(errno));
+    close(fd);
+    return nullptr;
+  }
+  const size_t size = st.st_size;
+  if (size < sizeof(ColumnarFileHeader)) {
+    LOG(ERROR) << folly::format("{} is too short to be a columnar file", path);
+    close(fd);
+    return nullptr;
+  }
+  void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    LOG(ERROR) << folly::format(
+        "Unable to map {}: {}", path, folly::errnoStr(errno));
+    return nullptr;
+  }
+  const auto base = static_cast<const char*>(mapped);
+
+  ColumnarFileHeader header;
+  memcpy(&header, base, sizeof(header));
+  std::string error;
+  std::vector<ColumnSpec> columns;
+  if (memcmp(header.magic, kColumnarFileMagic, sizeof(header.magic)) != 0) {
+    error = "bad magic";
+  } else if (header.version != kColumnarFileVersion) {
+    error = folly::sformat("unsupported version {}", header.version);
+  } else if (
+      header.headerSize < sizeof(header) || header.headerSize > size ||
+      header.headerSize % 8 || header.tool[sizeof(header.tool) - 1] != '\0') {
+    error = "corrupt header";
+  } else {
+    size_t offset = sizeof(header);
+    for (uint32_t i = 0; i < header.columnCount && error.empty(); i++) {
+      ColumnarColumnHeader column;
+      if (offset + sizeof(column) > header.headerSize) {
+        error = "corrupt schema";
+        break;
+      }
+      memcpy(&column, base + offset, sizeof(column));
+      offset += sizeof(column);
+      if (offset + column.nameSize > header.headerSize) {
+        error = "corrupt schema";
+        break;
+      }
+      columns.push_back(ColumnSpec{
+          std::string(base + offset, column.nameSize), column.type});
+      offset = padded(offset + column.nameSize);
+    }
+  }
+  if (!error.empty()) {
+    LOG(ERROR) << folly::format("{} is not a columnar file: {}", path, error);
+    munmap(mapped, size);
+    return nullptr;
+  }
+
+  // index the complete batches
+  std::vector<size_t> batches;
+  const uint64_t minBatchSize = padded(
+      sizeof(ColumnarBatchHeader) +
+      columns.size() * sizeof(ColumnarBufferRefs));
+  size_t offset = header.headerSize;
+  while (offset + sizeof(ColumnarBatchHeader) <= size) {
+    const auto batch =
+        reinterpret_cast<const ColumnarBatchHeader*>(base + offset);
+    if (memcmp(batch->magic, kColumnarBatchMagic, sizeof(batch->magic)) != 0 ||
+        batch->columnCount != columns.size()) {
+      error = "bad batch header";
+    } else if (batch->batchSize < minBatchSize || batch->batchSize % 8) {
+      error = folly::sformat("bad batch size {}", batch->batchSize);
+    } else if (batch->batchSize > size - offset) {
+      LOG(WARNING) << folly::format(
+          "Ignoring {} trailing bytes of a partial batch", size - offset);
+      break;
+    } else {
+      error = checkBatchBuffers(base + offset, columns);
+    }
+    if (!error.empty()) {
+      LOG(ERROR) << folly::format(
+          "Corrupt batch at offset {} of {} ({}), ignoring the rest",
+          offset,
+          path,
+          error);
+      break;
+    }
+    batches.push_back(offset);
+    offset += batch->batchSize;
+  }
+
+  return std::unique_ptr<ColumnarFileReader>(new ColumnarFileReader(
+      base,
+      size,
+      std::string(header.tool, strnlen(header.tool, sizeof(header.tool))),
+      std::move(columns),
+      std::move(batches)));
+}
+
+ColumnarFileReader::ColumnarFileReader(
+    const char* base,
+    size_t size,
+    std::string tool,
+    std::vector<ColumnSpec> columns,
+    std::vector<size_t> batches)
+    : base_(base),
+      size_(size),
+      tool_(std::move(tool)),
+      columns_(std::move(columns)),
+      batches_(std::move(batches)) {}
+
+ColumnarFileReader::~ColumnarFileReader() {
+  munmap(const_cast<char*>(base_), size_);
+}
+
+int
+ColumnarFileReader::findColumn(folly::StringPiece name) const {
+  for (size_t i = 0; i < columns_.size(); i++) {
+    if (name == columns_[i].name) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+folly::StringPiece
+ColumnarFileReader::getString(size_t batch, size_t column, uint32_t row)
+    const {
+  const auto& refs = bufferRefs(batch, column);
+  const auto ends = getUint64s(batch, column);
+  const uint64_t begin = row ? ends[row - 1] : 0;
+  return folly::StringPiece(
+      base_ + batches_[batch] + refs.dataOffset + begin, ends[row] - begin);
+}
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,340 @@
+#pragma once
+
+#include <folly/Range.h>
+#include <src/common/BufferedWriter.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace paths {
+namespace common {
+
+constexpr char kColumnarFileMagic[8] = {'P', 'A', 'T', 'H', 'S', 'C', 'O', 'L'};
+constexpr char kColumnarBatchMagic[8] = {'P', 'C', 'O', 'L', 'B', 'A', 'T', 'C'};
+constexpr uint32_t kColumnarFileVersion = 1;
+
+enum class ColumnType : uint32_t {
+  // 64-bit two's complement integers
+  INT64 = 1,
+  UINT64 = 2,
+  // UTF-8 strings (CSV text of enums, addresses)
+  STRING = 3,
+};
+
+struct ColumnSpec {
+  std::string name;
+  ColumnType type;
+};
+
+/**
+ * Columnar export files (--export_mode=columnar).
+ *
+ * The layout follows the Arrow IPC format, simplified: a schema followed by
+ * record batches, each holding the values of a few thousand rows column by
+ * column. All integers are little-endian and every buffer starts at a
+ * multiple of 8 bytes from the start of the file, so a reader can mmap the
+ * file and use the value buffers of the columns it needs in place, without
+ * parsing the others.
+ *
+ *   ColumnarFileHeader
+ *   per column: ColumnarColumnHeader, name, zero padding to 8 bytes
+ *   record batches, until the end of the file:
+ *     ColumnarBatchHeader
+ *     per column: ColumnarBufferRefs
+ *     buffers, each padded to 8 bytes
+ *
+ * A column has a validity bitmap (bit i set if row i is not null, LSB
+ * first) and one 8-byte value per row. For STRING columns the value is the
+ * end offset of the string in the data buffer of the column (it starts at
+ * the end of the previous row's string, or at 0).
+ *
+ * The schema is repeated at the start of every segment of a rotated export
+ * file, so each segment can be read on its own. Compressed output
+ * (--output_compression) must be decompressed before it is mapped.
+ */
+struct ColumnarFileHeader {
+  char magic[8];
+  uint32_t version;
+  // batches start at this offset
+  uint32_t headerSize;
+  char tool[16];
+  uint32_t columnCount;
+  uint32_t reserved;
+};
+static_assert(sizeof(ColumnarFileHeader) == 40, "ColumnarFileHeader changed");
+
+struct ColumnarColumnHeader {
+  ColumnType type;
+  uint32_t nameSize;
+};
+
+struct ColumnarBatchHeader {
+  char magic[8];
+  // including this header
+  uint64_t batchSize;
+  uint32_t rowCount;
+  uint32_t columnCount;
+};
+static_assert(sizeof(ColumnarBatchHeader) == 24, "ColumnarBatchHeader changed");
+
+// offsets are relative to the start of the batch
+struct ColumnarBufferRefs {
+  uint64_t validityOffset;
+  uint64_t valuesOffset;
+  uint64_t dataOffset;
+  uint64_t dataSize;
+};
+
+/**
+ * Row encoder (with the interface of CsvRowEncoder) that records the type of
+ * each column instead of its value.
+ *
+ * Encoding any event with it yields the column types of a CSV encoding
+ * function, so that the same function can fill a ColumnarWriter.
+ */
+class ColumnTypeRecorder {
+ public:
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value>::type add(T /* v */) {
+    types_.push_back(
+        std::is_signed<T>::value ? ColumnType::INT64 : ColumnType::UINT64);
+  }
+
+  void add(bool /* value */) {
+    types_.push_back(ColumnType::UINT64);
+  }
+
+  void addRaw(folly::StringPiece /* value */) {
+    types_.push_back(ColumnType::STRING);
+  }
+
+  void addString(folly::StringPiece /* value */) {
+    types_.push_back(ColumnType::STRING);
+  }
+
+  void addAddress(const struct sockaddr_storage* /* sas */) {
+    types_.push_back(ColumnType::STRING);
+  }
+
+  const std::vector<ColumnType>& getTypes() const {
+    return types_;
+  }
+
+ private:
+  std::vector<ColumnType> types_;
+};
+
+/**
+ * Buffers rows into typed columns and writes them as record batches.
+ *
+ * Values are added in column order with the interface of CsvRowEncoder, so
+ * the CSV encoding functions of the tools can fill it:
+ *   columnar.beginRow();
+ *   encodeCsvRow(ev, columnar);
+ *   columnar.endRow();
+ *
+ * A batch is written once it holds batchRows rows or has been open for
+ * batchInterval, and on destruction. Not thread-safe.
+ */
+class ColumnarWriter {
+ public:
+  struct Options {
+    size_t batchRows{65536};
+
+    // 0 closes batches by size only
+    std::chrono::milliseconds batchInterval{std::chrono::seconds(10)};
+  };
+
+  /**
+   * Creates a writer configured from the --columnar_* flags.
+   */
+  static std::unique_ptr<ColumnarWriter> createFromFlags(
+      BufferedWriter& writer,
+      folly::StringPiece tool,
+      std::vector<ColumnSpec> columns);
+
+  /**
+   * Pairs column names with the types recorded by a ColumnTypeRecorder.
+   */
+  static std::vector<ColumnSpec> makeColumns(
+      const std::vector<std::string>& names,
+      const ColumnTypeRecorder& recorder);
+
+  /**
+   * Sets the schema as the header of writer.
+   */
+  ColumnarWriter(
+      BufferedWriter& writer,
+      folly::StringPiece tool,
+      std::vector<ColumnSpec> columns,
+      const Options& options);
+
+  /**
+   * Writes the open batch.
+   */
+  ~ColumnarWriter();
+
+  ColumnarWriter(const ColumnarWriter&) = delete;
+  ColumnarWriter& operator=(const ColumnarWriter&) = delete;
+
+  void beginRow() {
+    next_ = 0;
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value>::type add(T value) {
+    // sign extension keeps the two's complement value of signed types
+    appendValue(static_cast<uint64_t>(value), true);
+  }
+
+  void add(bool value) {
+    appendValue(value, true);
+  }
+
+  void addRaw(folly::StringPiece value) {
+    addString(value);
+  }
+
+  void addString(folly::StringPiece value);
+
+  void addAddress(const struct sockaddr_storage* sas);
+
+  void addNull();
+
+  /**
+   * Ends the row; all columns must have been added.
+   */
+  void endRow();
+
+  /**
+   * Writes the open batch, if any.
+   */
+  void flush();
+
+  /**
+   * Bytes of batches written so far (excluding the schema).
+   */
+  uint64_t getBytesWritten() const {
+    return bytesWritten_;
+  }
+
+ private:
+  struct Column {
+    ColumnSpec spec;
+    std::vector<uint8_t> validity;
+    std::vector<uint64_t> values;
+    std::string data;
+  };
+
+  Column& nextColumn(bool valid);
+
+  void appendValue(uint64_t value, bool valid) {
+    nextColumn(valid).values.push_back(value);
+  }
+
+  BufferedWriter& writer_;
+  const Options options_;
+  std::vector<Column> columns_;
+  size_t next_{0};
+  uint32_t rows_{0};
+  std::chrono::steady_clock::time_point batchStart_;
+  std::string batch_;
+  uint64_t bytesWritten_{0};
+};
+
+/**
+ * Read-only view of a columnar export file.
+ *
+ * The file is mapped into memory, and column values are returned in place.
+ * A partial batch at the end of the file (e.g., the collector was killed
+ * mid-write) is ignored, and so is everything from the first batch whose
+ * sizes or buffer offsets do not fit.
+ */
+class ColumnarFileReader {
+ public:
+  /**
+   * Opens and maps a file, checking its schema and indexing its batches.
+   * Returns nullptr (and logs the reason) if it cannot be read.
+   */
+  static std::unique_ptr<ColumnarFileReader> open(const std::string& path);
+
+  ~ColumnarFileReader();
+
+  ColumnarFileReader(const ColumnarFileReader&) = delete;
+  ColumnarFileReader& operator=(const ColumnarFileReader&) = delete;
+
+  const std::string& getTool() const {
+    return tool_;
+  }
+
+  const std::vector<ColumnSpec>& getColumns() const {
+    return columns_;
+  }
+
+  // index of the column with the given name, or -1
+  int findColumn(folly::StringPiece name) const;
+
+  size_t getBatchCount() const {
+    return batches_.size();
+  }
+
+  uint32_t getRowCount(size_t batch) const {
+    return batchHeader(batch).rowCount;
+  }
+
+  bool isNull(size_t batch, size_t column, uint32_t row) const {
+    const auto validity = base_ + batches_[batch] +
+        bufferRefs(batch, column).validityOffset;
+    return !(validity[row / 8] & (1 << (row % 8)));
+  }
+
+  // values of an INT64 column
+  const int64_t* getInt64s(size_t batch, size_t column) const {
+    return reinterpret_cast<const int64_t*>(values(batch, column));
+  }
+
+  // values of an UINT64 column
+  const uint64_t* getUint64s(size_t batch, size_t column) const {
+    return reinterpret_cast<const uint64_t*>(values(batch, column));
+  }
+
+  // value of a STRING column
+  folly::StringPiece
+  getString(size_t batch, size_t column, uint32_t row) const;
+
+ private:
+  ColumnarFileReader(
+      const char* base,
+      size_t size,
+      std::string tool,
+      std::vector<ColumnSpec> columns,
+      std::vector<size_t> batches);
+
+  const ColumnarBatchHeader& batchHeader(size_t batch) const {
+    return *reinterpret_cast<const ColumnarBatchHeader*>(
+        base_ + batches_[batch]);
+  }
+
+  const ColumnarBufferRefs& bufferRefs(size_t batch, size_t column) const {
+    return reinterpret_cast<const ColumnarBufferRefs*>(
+        base_ + batches_[batch] + sizeof(ColumnarBatchHeader))[column];
+  }
+
+  const char* values(size_t batch, size_t column) const {
+    return base_ + batches_[batch] + bufferRefs(batch, column).valuesOffset;
+  }
+
+  const char* const base_;
+  const size_t size_;
+  const std::string tool_;
+  const std::vector<ColumnSpec> columns_;
+  // offset of each complete batch
+  const std::vector<size_t> batches_;
+};
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,209 @@
+/**
+ * Writes columnar files with ColumnarWriter and reads them back with
+ * ColumnarFileReader, intact and with corrupt batches. Run with:
+ *   buck test //src/common:ColumnarFileTest
+ */
+#include <src/common/BufferedWriter.h>
+#include <src/common/ColumnarFile.h>
+
+#include <unistd.h>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <folly/FileUtil.h>
+#include <folly/Format.h>
+#include <gtest/gtest.h>
+
+using paths::common::BufferedWriter;
+using paths::common::ColumnarBatchHeader;
+using paths::common::ColumnarBufferRefs;
+using paths::common::ColumnarFileHeader;
+using paths::common::ColumnarFileReader;
+using paths::common::ColumnarWriter;
+using paths::common::ColumnSpec;
+using paths::common::ColumnType;
+
+namespace {
+
+constexpr size_t kRows = 7;
+constexpr size_t kBatchRows = 3;
+
+class ColumnarFileTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = folly::sformat(
+        "{}/ColumnarFileTest.{}.{}",
+        ::testing::TempDir(),
+        getpid(),
+        ::testing::UnitTest::GetInstance()->current_test_info()->name());
+  }
+
+  void TearDown() override {
+    unlink(path_.c_str());
+  }
+
+  // row i: (i - 3, i * 1000, "row<i>"), the string of row 4 null
+  void writeFile() {
+    const auto writer = BufferedWriter::createFromFlags(path_);
+    ColumnarWriter::Options options;
+    options.batchRows = kBatchRows;
+    options.batchInterval = std::chrono::milliseconds(0);
+    ColumnarWriter columnar(
+        *writer,
+        "test",
+        {{"signed", ColumnType::INT64},
+         {"unsigned", ColumnType::UINT64},
+         {"name", ColumnType::STRING}},
+        options);
+    for (size_t i = 0; i < kRows; i++) {
+      columnar.beginRow();
+      columnar.add(int64_t(i) - 3);
+      columnar.add(uint64_t(i * 1000));
+      if (i == 4) {
+        columnar.addNull();
+      } else {
+        columnar.addString(folly::sformat("row{}", i));
+      }
+      columnar.endRow();
+    }
+    columnar.flush();
+    writer->flush();
+  }
+
+  std::string readContents() {
+    std::string contents;
+    EXPECT_TRUE(folly::readFile(path_.c_str(), contents));
+    return contents;
+  }
+
+  void writeContents(const std::string& contents) {
+    ASSERT_TRUE(folly::writeFile(contents, path_.c_str()));
+  }
+
+  // offset of the batch-th batch of a file written by writeFile()
+  static size_t batchOffset(const std::string& contents, size_t batch) {
+    ColumnarFileHeader header;
+    memcpy(&header, contents.data(), sizeof(header));
+    size_t offset = header.headerSize;
+    for (size_t i = 0; i < batch; i++) {
+      ColumnarBatchHeader batchHeader;
+      memcpy(&batchHeader, contents.data() + offset, sizeof(batchHeader));
+      offset += batchHeader.batchSize;
+    }
+    return offset;
+  }
+
+  static ColumnarBufferRefs*
+  bufferRefs(std::string& contents, size_t batch, size_t column) {
+    return reinterpret_cast<ColumnarBufferRefs*>(
+               &contents[batchOffset(contents, batch) +
+                         sizeof(ColumnarBatchHeader)]) +
+        column;
+  }
+
+  std::string path_;
+};
+
+} // namespace
+
+TEST_F(ColumnarFileTest, RoundTrip) {
+  writeFile();
+  const auto reader = ColumnarFileReader::open(path_);
+  ASSERT_TRUE(reader);
+  EXPECT_EQ("test", reader->getTool());
+  ASSERT_EQ(3, reader->getColumns().size());
+  EXPECT_EQ("unsigned", reader->getColumns()[1].name);
+  EXPECT_EQ(ColumnType::STRING, reader->getColumns()[2].type);
+  EXPECT_EQ(2, reader->findColumn("name"));
+  EXPECT_EQ(-1, reader->findColumn("missing"));
+
+  ASSERT_EQ((kRows + kBatchRows - 1) / kBatchRows, reader->getBatchCount());
+  size_t i = 0;
+  for (size_t batch = 0; batch < reader->getBatchCount(); batch++) {
+    const auto signedValues = reader->getInt64s(batch, 0);
+    const auto unsignedValues = reader->getUint64s(batch, 1);
+    for (uint32_t row = 0; row < reader->getRowCount(batch); row++, i++) {
+      EXPECT_FALSE(reader->isNull(batch, 0, row));
+      EXPECT_EQ(int64_t(i) - 3, signedValues[row]);
+      EXPECT_EQ(i * 1000, unsignedValues[row]);
+      if (i == 4) {
+        EXPECT_TRUE(reader->isNull(batch, 2, row));
+        EXPECT_EQ("", reader->getString(batch, 2, row));
+      } else {
+        EXPECT_FALSE(reader->isNull(batch, 2, row));
+        EXPECT_EQ(folly::sformat("row{}", i), reader->getString(batch, 2, row));
+      }
+    }
+  }
+  EXPECT_EQ(kRows, i);
+}
+
+TEST_F(ColumnarFileTest, PartialBatchIgnored) {
+  writeFile();
+  auto contents = readContents();
+  contents.resize(contents.size() - 8);
+  writeContents(contents);
+  const auto reader = ColumnarFileReader::open(path_);
+  ASSERT_TRUE(reader);
+  EXPECT_EQ(2, reader->getBatchCount());
+}
+
+TEST_F(ColumnarFileTest, BadBatchSizeEndsFile) {
+  writeFile();
+  const auto contents = readContents();
+  for (const uint64_t batchSize : {0, 8, 12}) {
+    auto corrupt = contents;
+    auto header = reinterpret_cast<ColumnarBatchHeader*>(
+        &corrupt[batchOffset(contents, 1)]);
+    header->batchSize = batchSize;
+    writeContents(corrupt);
+    const auto reader = ColumnarFileReader::open(path_);
+    ASSERT_TRUE(reader);
+    EXPECT_EQ(1, reader->getBatchCount()) << batchSize;
+  }
+}
+
+TEST_F(ColumnarFileTest, BufferOutOfBatchEndsFile) {
+  writeFile();
+  const auto contents = readContents();
+  ColumnarBatchHeader header;
+  memcpy(&header, contents.data() + batchOffset(contents, 0), sizeof(header));
+
+  const std::vector<std::function<void(ColumnarBufferRefs*)>> corruptions{
+      [&](ColumnarBufferRefs* refs) { refs->validityOffset = 0; },
+      [&](ColumnarBufferRefs* refs) {
+        refs->validityOffset = header.batchSize;
+      },
+      [&](ColumnarBufferRefs* refs) { refs->valuesOffset = header.batchSize; },
+      [&](ColumnarBufferRefs* refs) { refs->valuesOffset += 4; },
+      [&](ColumnarBufferRefs* refs) { refs->dataSize = header.batchSize; },
+      [&](ColumnarBufferRefs* refs) { refs->dataOffset = ~uint64_t(0); },
+  };
+  for (size_t i = 0; i < corruptions.size(); i++) {
+    auto corrupt = contents;
+    corruptions[i](bufferRefs(corrupt, 0, 2));
+    writeContents(corrupt);
+    const auto reader = ColumnarFileReader::open(path_);
+    ASSERT_TRUE(reader);
+    EXPECT_EQ(0, reader->getBatchCount()) << "corruption " << i;
+  }
+}
+
+TEST_F(ColumnarFileTest, StringOutOfDataEndsFile) {
+  writeFile();
+  auto contents = readContents();
+  const auto refs = *bufferRefs(contents, 1, 2);
+  uint64_t end = refs.dataSize + 1;
+  memcpy(
+      &contents[batchOffset(contents, 1) + refs.valuesOffset],
+      &end,
+      sizeof(end));
+  writeContents(contents);
+  const auto reader = ColumnarFileReader::open(path_);
+  ASSERT_TRUE(reader);
+  EXPECT_EQ(1, reader->getBatchCount());
+}
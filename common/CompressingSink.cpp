@@ -0,0 +1,435 @@
+#include "CompressingSink.h"
+
+#include <time.h>
+#include <algorithm>
+#include <cstring>
+
+#include <folly/Format.h>
+#include <glog/logging.h>
+#include <lz4frame.h>
+#include <zstd.h>
+
+namespace paths {
+namespace common {
+
+namespace {
+
+constexpr auto kStatsInterval = std::chrono::seconds(60);
+
+std::chrono::nanoseconds
+threadCpuTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+// passes data to sink in buffers of its size
+void
+writeToSink(OutputSink& sink, const std::string& data) {
+  const auto bufferSize = sink.getBufferSize();
+  for (size_t offset = 0; offset < data.size(); offset += bufferSize) {
+    const auto n = std::min(bufferSize, data.size() - offset);
+    char* buf = sink.getBuffer();
+    memcpy(buf, data.data() + offset, n);
+    sink.submit(buf, n);
+  }
+}
+
+void
+logCompressionStats(
+    const std::string& name,
+    uint64_t bytesIn,
+    uint64_t bytesOut,
+    uint64_t frames,
+    std::chrono::nanoseconds cpuTime) {
+  if (bytesIn == 0) {
+    return;
+  }
+  const auto cpuSec = std::chrono::duration<double>(cpuTime).count();
+  LOG(INFO) << folly::format(
+      "{}: {} bytes compressed to {} in {} frames, "
+      "ratio {:.2f}, {:.3f} CPU seconds ({:.1f} MB/s)",
+      name,
+      bytesIn,
+      bytesOut,
+      frames,
+      bytesOut ? double(bytesIn) / bytesOut : 0.0,
+      cpuSec,
+      cpuSec > 0 ? bytesIn / cpuSec / 1e6 : 0.0);
+}
+
+class ZstdFrameEncoder : public FrameEncoder {
+ public:
+  explicit ZstdFrameEncoder(int level) : cctx_(ZSTD_createCCtx()) {
+    CHECK(cctx_);
+    if (level) {
+      const auto ret =
+          ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level);
+      CHECK(!ZSTD_isError(ret)) << ZSTD_getErrorName(ret);
+    }
+  }
+
+  ~ZstdFrameEncoder() override {
+    ZSTD_freeCCtx(cctx_);
+  }
+
+  void beginFrame(std::string& /* out */) override {}
+
+  void update(const char* data, size_t size, std::string& out) override {
+    ZSTD_inBuffer in{data, size, 0};
+    while (in.pos < in.size) {
+      compress(in, ZSTD_e_continue, out);
+    }
+  }
+
+  void endFrame(std::string& out) override {
+    ZSTD_inBuffer in{nullptr, 0, 0};
+    while (compress(in, ZSTD_e_end, out) != 0) {
+    }
+  }
+
+ private:
+  size_t compress(ZSTD_inBuffer& in, ZSTD_EndDirective op, std::string& out) {
+    const auto used = out.size();
+    out.resize(used + ZSTD_CStreamOutSize());
+    ZSTD_outBuffer outBuf{&out[used], out.size() - used, 0};
+    const auto ret = ZSTD_compressStream2(cctx_, &outBuf, &in, op);
+    CHECK(!ZSTD_isError(ret)) << ZSTD_getErrorName(ret);
+    out.resize(used + outBuf.pos);
+    return ret;
+  }
+
+  ZSTD_CCtx* const cctx_;
+};
+
+class Lz4FrameEncoder : public FrameEncoder {
+ public:
+  explicit Lz4FrameEncoder(int level) {
+    const auto ret = LZ4F_createCompressionContext(&cctx_, LZ4F_VERSION);
+    CHECK(!LZ4F_isError(ret)) << LZ4F_getErrorName(ret);
+    memset(&prefs_, 0, sizeof(prefs_));
+    prefs_.compressionLevel = level;
+    prefs_.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+  }
+
+  ~Lz4FrameEncoder() override {
+    LZ4F_freeCompressionContext(cctx_);
+  }
+
+  void beginFrame(std::string& out) override {
+    call(LZ4F_HEADER_SIZE_MAX, out, [&](char* dst, size_t capacity) {
+      return LZ4F_compressBegin(cctx_, dst, capacity, &prefs_);
+    });
+  }
+
+  void update(const char* data, size_t size, std::string& out) override {
+    call(LZ4F_compressBound(size, &prefs_), out, [&](char* dst, size_t cap) {
+      return LZ4F_compressUpdate(cctx_, dst, cap, data, size, nullptr);
+    });
+  }
+
+  void endFrame(std::string& out) override {
+    call(LZ4F_compressBound(0, &prefs_), out, [&](char* dst, size_t cap) {
+      return LZ4F_compressEnd(cctx_, dst, cap, nullptr);
+    });
+  }
+
+ private:
+  template <typename F>
+  void call(size_t bound, std::string& out, F&& f) {
+    const auto used = out.size();
+    out.resize(used + bound);
+    const auto ret = f(&out[used], bound);
+    CHECK(!LZ4F_isError(ret)) << LZ4F_getErrorName(ret);
+    out.resize(used + ret);
+  }
+
+  LZ4F_cctx* cctx_{nullptr};
+  LZ4F_preferences_t prefs_;
+};
+
+} // namespace
+
+std::unique_ptr<FrameEncoder>
+FrameEncoder::create(Compression compression, int level) {
+  switch (compression) {
+  case Compression::ZSTD:
+    return std::make_unique<ZstdFrameEncoder>(level);
+  case Compression::LZ4:
+    return std::make_unique<Lz4FrameEncoder>(level);
+  }
+  LOG(FATAL) << "Unknown compression";
+  return nullptr;
+}
+
+CompressingSink::CompressingSink(
+    std::unique_ptr<OutputSink> inner,
+    size_t bufferSize,
+    const Options& options)
+    : OutputSink(bufferSize),
+      inner_(std::move(inner)),
+      options_(options),
+      encoder_(FrameEncoder::create(options.compression, options.level)),
+      buf_(bufferSize),
+      lastStats_(std::chrono::steady_clock::now()) {}
+
+CompressingSink::~CompressingSink() {
+  drain();
+  logStats();
+}
+
+char*
+CompressingSink::getBuffer() {
+  return buf_.data();
+}
+
+void
+CompressingSink::submit(char* buf, size_t size) {
+  const auto cpuStart = threadCpuTime();
+  if (!frameOpen_) {
+    encoder_->beginFrame(out_);
+    frameOpen_ = true;
+    frameIn_ = 0;
+    frameStart_ = std::chrono::steady_clock::now();
+  }
+  encoder_->update(buf, size, out_);
+  frameIn_ += size;
+  bytesIn_ += size;
+  cpuTime_ += threadCpuTime() - cpuStart;
+
+  if (frameIn_ >= options_.frameBytes) {
+    endFrame();
+  } else {
+    // only whole inner buffers are written while the frame is open
+    const auto innerSize = inner_->getBufferSize();
+    if (out_.size() >= innerSize) {
+      const auto tail = out_.size() % innerSize;
+      std::string rest = out_.substr(out_.size() - tail);
+      out_.resize(out_.size() - tail);
+      writeOut();
+      out_ = std::move(rest);
+    }
+  }
+  timerTick();
+}
+
+void
+CompressingSink::drain() {
+  if (frameOpen_) {
+    endFrame();
+  }
+  inner_->drain();
+}
+
+void
+CompressingSink::timerTick() {
+  const auto now = std::chrono::steady_clock::now();
+  if (frameOpen_ && options_.frameInterval.count() > 0 &&
+      now - frameStart_ >= options_.frameInterval) {
+    endFrame();
+  }
+  if (now - lastStats_ >= kStatsInterval) {
+    logStats();
+    lastStats_ = now;
+  }
+}
+
+void
+CompressingSink::endFrame() {
+  const auto cpuStart = threadCpuTime();
+  encoder_->endFrame(out_);
+  cpuTime_ += threadCpuTime() - cpuStart;
+  frameOpen_ = false;
+  frames_++;
+  writeOut();
+}
+
+void
+CompressingSink::writeOut() {
+  writeToSink(*inner_, out_);
+  bytesOut_ += out_.size();
+  out_.clear();
+}
+
+void
+CompressingSink::logStats() const {
+  logCompressionStats(
+      "CompressingSink", bytesIn_, bytesOut_, frames_, cpuTime_);
+}
+
+ParallelCompressingSink::ParallelCompressingSink(
+    std::unique_ptr<OutputSink> inner,
+    size_t bufferSize,
+    const CompressingSink::Options& options,
+    size_t workers,
+    size_t maxInFlightBytes)
+    : OutputSink(bufferSize),
+      inner_(std::move(inner)),
+      options_(options),
+      maxInFlightBytes_(maxInFlightBytes),
+      buf_(bufferSize),
+      lastStats_(std::chrono::steady_clock::now()) {
+  CHECK_GT(workers, 0);
+  for (size_t i = 0; i < workers; i++) {
+    workers_.emplace_back([this] { work(); });
+  }
+}
+
+ParallelCompressingSink::~ParallelCompressingSink() {
+  drain();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  workCv_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  logStats();
+}
+
+char*
+ParallelCompressingSink::getBuffer() {
+  return buf_.data();
+}
+
+void
+ParallelCompressingSink::submit(char* buf, size_t size) {
+  const char* end = buf + size;
+  while (buf < end) {
+    if (!open_) {
+      openChunk();
+    }
+    const auto n = std::min<size_t>(
+        end - buf, options_.frameBytes - open_->in.size());
+    open_->in.append(buf, n);
+    buf += n;
+    bytesIn_ += n;
+    if (open_->in.size() >= options_.frameBytes) {
+      closeChunk();
+    }
+  }
+  writeCompressed(false);
+  timerTick();
+}
+
+void
+ParallelCompressingSink::drain() {
+  if (open_) {
+    closeChunk();
+  }
+  writeCompressed(true);
+  inner_->drain();
+}
+
+void
+ParallelCompressingSink::timerTick() {
+  const auto now = std::chrono::steady_clock::now();
+  if (open_ && options_.frameInterval.count() > 0 &&
+      now - openStart_ >= options_.frameInterval) {
+    closeChunk();
+  }
+  writeCompressed(false);
+  if (now - lastStats_ >= kStatsInterval) {
+    logStats();
+    lastStats_ = now;
+  }
+}
+
+void
+ParallelCompressingSink::openChunk() {
+  if (spare_.empty()) {
+    open_ = std::make_unique<Chunk>();
+    open_->in.reserve(options_.frameBytes);
+  } else {
+    open_ = std::move(spare_.back());
+    spare_.pop_back();
+    open_->in.clear();
+  }
+  openStart_ = std::chrono::steady_clock::now();
+}
+
+void
+ParallelCompressingSink::closeChunk() {
+  Chunk* chunk = open_.get();
+  inFlightBytes_ += chunk->in.size();
+  frames_++;
+  pending_.push_back(std::move(open_));
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    chunk->done = false;
+    queue_.push_back(chunk);
+  }
+  workCv_.notify_one();
+}
+
+void
+ParallelCompressingSink::writeCompressed(bool all) {
+  while (!pending_.empty()) {
+    auto& chunk = pending_.front();
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (!chunk->done) {
+        if (!all && inFlightBytes_ <= maxInFlightBytes_) {
+          return;
+        }
+        doneCv_.wait(lock, [&chunk] { return chunk->done; });
+      }
+    }
+    writeToSink(*inner_, chunk->out);
+    bytesOut_ += chunk->out.size();
+    inFlightBytes_ -= chunk->in.size();
+    // enough buffers to refill the workers without allocating
+    if (spare_.size() <= workers_.size()) {
+      spare_.push_back(std::move(chunk));
+    }
+    pending_.pop_front();
+  }
+}
+
+void
+ParallelCompressingSink::work() {
+  const auto encoder =
+      FrameEncoder::create(options_.compression, options_.level);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    workCv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      return;
+    }
+    Chunk* chunk = queue_.front();
+    queue_.pop_front();
+    lock.unlock();
+
+    const auto cpuStart = threadCpuTime();
+    chunk->out.clear();
+    encoder->beginFrame(chunk->out);
+    encoder->update(chunk->in.data(), chunk->in.size(), chunk->out);
+    encoder->endFrame(chunk->out);
+    const auto cpuTime = threadCpuTime() - cpuStart;
+
+    lock.lock();
+    cpuTime_ += cpuTime;
+    chunk->done = true;
+    // only the thread flushing the writer waits
+    doneCv_.notify_one();
+  }
+}
+
+void
+ParallelCompressingSink::logStats() {
+  std::chrono::nanoseconds cpuTime;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cpuTime = cpuTime_;
+  }
+  logCompressionStats(
+      folly::sformat("ParallelCompressingSink ({} workers)", workers_.size()),
+      bytesIn_,
+      bytesOut_,
+      frames_,
+      cpuTime);
+}
+
+} // namespace common
+} // namespace paths
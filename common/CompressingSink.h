@@ -0,0 +1,184 @@
+#pragma once
+
+#include <src/common/OutputSink.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace paths {
+namespace common {
+
+enum class Compression { ZSTD, LZ4 };
+
+/**
+ * Encoder of one compression format, producing independent frames.
+ */
+class FrameEncoder {
+ public:
+  virtual ~FrameEncoder() = default;
+
+  static std::unique_ptr<FrameEncoder> create(
+      Compression compression,
+      int level);
+
+  // each call appends its compressed output to out
+  virtual void beginFrame(std::string& out) = 0;
+  virtual void update(const char* data, size_t size, std::string& out) = 0;
+  virtual void endFrame(std::string& out) = 0;
+};
+
+/**
+ * Sink that compresses the data submitted by BufferedWriter and passes the
+ * compressed stream on to another sink.
+ *
+ * The stream is a sequence of independent zstd or lz4 frames (which the
+ * zstd and lz4 tools decompress as a single file). A frame is closed once
+ * it holds frameBytes of uncompressed data, once it has been open for
+ * frameInterval, and on drain(), so a crash loses at most the open frame.
+ * Compression runs on the thread that flushes the writer.
+ */
+class CompressingSink : public OutputSink {
+ public:
+  struct Options {
+    Compression compression{Compression::ZSTD};
+
+    // codec specific, 0 uses the codec default
+    int level{0};
+
+    // uncompressed bytes per frame
+    size_t frameBytes{8 << 20};
+
+    // maximum time a frame stays open (0 closes frames by size only)
+    std::chrono::milliseconds frameInterval{std::chrono::seconds(10)};
+  };
+
+  CompressingSink(
+      std::unique_ptr<OutputSink> inner,
+      size_t bufferSize,
+      const Options& options);
+
+  ~CompressingSink() override;
+
+  char* getBuffer() override;
+
+  void submit(char* buf, size_t size) override;
+
+  void drain() override;
+
+  void timerTick() override;
+
+ private:
+  void endFrame();
+
+  void writeOut();
+
+  void logStats() const;
+
+  const std::unique_ptr<OutputSink> inner_;
+  const Options options_;
+  const std::unique_ptr<FrameEncoder> encoder_;
+  std::vector<char> buf_;
+  std::string out_;
+
+  bool frameOpen_{false};
+  size_t frameIn_{0};
+  std::chrono::steady_clock::time_point frameStart_;
+  std::chrono::steady_clock::time_point lastStats_;
+
+  uint64_t bytesIn_{0};
+  uint64_t bytesOut_{0};
+  uint64_t frames_{0};
+  std::chrono::nanoseconds cpuTime_{0};
+};
+
+/**
+ * CompressingSink that compresses on a pool of worker threads, for outputs
+ * that a single thread cannot compress as fast as they are written.
+ *
+ * The data is cut into chunks of frameBytes (shorter when closed by
+ * frameInterval or drain()), each compressed by a worker as an independent
+ * frame, so the output has the same format. Compressed frames are passed
+ * to the inner sink in order, from the thread that flushes the writer.
+ *
+ * At most maxInFlightBytes of uncompressed data wait for compression or to
+ * be written, besides the open chunk; past that, submit() waits for the
+ * oldest frame. A crash loses the open chunk and the frames in flight.
+ */
+class ParallelCompressingSink : public OutputSink {
+ public:
+  ParallelCompressingSink(
+      std::unique_ptr<OutputSink> inner,
+      size_t bufferSize,
+      const CompressingSink::Options& options,
+      size_t workers,
+      size_t maxInFlightBytes);
+
+  ~ParallelCompressingSink() override;
+
+  char* getBuffer() override;
+
+  void submit(char* buf, size_t size) override;
+
+  void drain() override;
+
+  void timerTick() override;
+
+ private:
+  struct Chunk {
+    std::string in;
+    std::string out;
+    // set by the worker once out holds the frame, guarded by mutex_
+    bool done{false};
+  };
+
+  void openChunk();
+
+  // hands the open chunk to the workers
+  void closeChunk();
+
+  // writes out the compressed chunks at the head of pending_; waits for
+  // them while more than maxInFlightBytes_ are in flight, or if all is set
+  void writeCompressed(bool all);
+
+  void work();
+
+  void logStats();
+
+  const std::unique_ptr<OutputSink> inner_;
+  const CompressingSink::Options options_;
+  const size_t maxInFlightBytes_;
+  std::vector<char> buf_;
+
+  std::unique_ptr<Chunk> open_;
+  std::chrono::steady_clock::time_point openStart_;
+
+  // chunks being compressed or waiting to be written, in output order
+  std::deque<std::unique_ptr<Chunk>> pending_;
+  size_t inFlightBytes_{0};
+
+  // written chunks, kept to reuse their buffers
+  std::vector<std::unique_ptr<Chunk>> spare_;
+
+  std::mutex mutex_;
+  std::condition_variable workCv_;
+  std::condition_variable doneCv_;
+  // chunks to be compressed, guarded by mutex_
+  std::deque<Chunk*> queue_;
+  bool stopping_{false};
+  std::vector<std::thread> workers_;
+
+  std::chrono::steady_clock::time_point lastStats_;
+  uint64_t bytesIn_{0};
+  uint64_t bytesOut_{0};
+  uint64_t frames_{0};
+  // summed over the workers, guarded by mutex_
+  std::chrono::nanoseconds cpuTime_{0};
+};
+
+} // namespace common
+} // namespace paths
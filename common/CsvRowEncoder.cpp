@@ -0,0 +1,187 @@
+#include "CsvRowEncoder.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <algorithm>
+#include <cstring>
+
+#include <folly/Bits.h>
+#include <folly/Conv.h>
+
+DEFINE_uint32(
+    address_format_cache_entries,
+    4096,
+    "Exported addresses: number of formatted IP addresses cached per thread, "
+    "so that frequent peers are rendered once (0 disables the cache)");
+DEFINE_bool(
+    export_raw_addresses,
+    false,
+    "Export each address as three integer columns <name>_ip_hi, "
+    "<name>_ip_lo (the IPv6 address, IPv4 as ::ffff:a.b.c.d, in two "
+    "big-endian halves) and <name>_port, instead of a string");
+
+namespace paths {
+namespace common {
+
+namespace {
+
+// writes the IP address of sas as formatAddress() does, without the port
+size_t
+formatIp(const struct sockaddr_storage* sas, char* buf) {
+  if (sas->ss_family == AF_INET) {
+    const auto sin = reinterpret_cast<const struct sockaddr_in*>(sas);
+    inet_ntop(AF_INET, &sin->sin_addr, buf, INET6_ADDRSTRLEN);
+    return strlen(buf);
+  }
+  if (sas->ss_family == AF_INET6) {
+    const auto sin6 = reinterpret_cast<const struct sockaddr_in6*>(sas);
+    if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+      inet_ntop(AF_INET, &sin6->sin6_addr.s6_addr[12], buf, INET6_ADDRSTRLEN);
+      return strlen(buf);
+    }
+    buf[0] = '[';
+    inet_ntop(AF_INET6, &sin6->sin6_addr, buf + 1, INET6_ADDRSTRLEN);
+    size_t len = strlen(buf);
+    buf[len++] = ']';
+    return len;
+  }
+  return 0;
+}
+
+uint16_t
+getPort(const struct sockaddr_storage* sas) {
+  if (sas->ss_family == AF_INET) {
+    return ntohs(reinterpret_cast<const struct sockaddr_in*>(sas)->sin_port);
+  }
+  return ntohs(reinterpret_cast<const struct sockaddr_in6*>(sas)->sin6_port);
+}
+
+} // namespace
+
+CsvRowEncoder::CsvRowEncoder(size_t initialCapacity) {
+  buf_.reserve(initialCapacity);
+}
+
+void
+CsvRowEncoder::addString(folly::StringPiece value) {
+  startField();
+  if (value.find_first_of(",\"\r\n") == folly::StringPiece::npos) {
+    buf_.append(value.data(), value.size());
+    return;
+  }
+  buf_.push_back('"');
+  for (const char c : value) {
+    if (c == '"') {
+      buf_.push_back('"');
+    }
+    buf_.push_back(c);
+  }
+  buf_.push_back('"');
+}
+
+void
+CsvRowEncoder::addAddress(const struct sockaddr_storage* sas) {
+  char tmp[kMaxFormattedAddressLength];
+  const auto len = formatAddress(sas, tmp);
+  if (len == 0) {
+    addRaw("<uninitialized address>");
+    return;
+  }
+  startField();
+  buf_.append(tmp, len);
+}
+
+AddressFormatCache::AddressFormatCache(size_t maxAddresses)
+    : maxAddresses_(std::max<size_t>(maxAddresses, 1)),
+      entries_(folly::nextPowTwo(maxAddresses_ * 2)),
+      mask_(entries_.size() - 1) {}
+
+folly::StringPiece
+AddressFormatCache::lookup(const struct sockaddr_storage* sas) {
+  if (sas->ss_family != AF_INET && sas->ss_family != AF_INET6) {
+    return folly::StringPiece();
+  }
+  const auto raw = toRawAddress(sas);
+  uint64_t hash = raw.lo ^ (raw.hi * 0x9e3779b97f4a7c15);
+  hash = (hash ^ (hash >> 33)) * 0xff51afd7ed558ccd;
+  hash ^= hash >> 33;
+
+  size_t i = hash & mask_;
+  for (; entries_[i].size != 0; i = (i + 1) & mask_) {
+    const auto& entry = entries_[i];
+    if (entry.hi == raw.hi && entry.lo == raw.lo) {
+      hits_++;
+      return folly::StringPiece(entry.text, entry.size);
+    }
+  }
+  misses_++;
+  if (addresses_ == maxAddresses_) {
+    for (auto& entry : entries_) {
+      entry.size = 0;
+    }
+    addresses_ = 0;
+    i = hash & mask_;
+  }
+  addresses_++;
+  auto& entry = entries_[i];
+  entry.hi = raw.hi;
+  entry.lo = raw.lo;
+  entry.size = formatIp(sas, entry.text);
+  return folly::StringPiece(entry.text, entry.size);
+}
+
+size_t
+formatAddress(const struct sockaddr_storage* sas, char* buf) {
+  const auto end = buf + kMaxFormattedAddressLength;
+  size_t len = 0;
+  if (FLAGS_address_format_cache_entries > 0) {
+    thread_local AddressFormatCache cache(FLAGS_address_format_cache_entries);
+    const auto ip = cache.lookup(sas);
+    memcpy(buf, ip.data(), ip.size());
+    len = ip.size();
+  } else {
+    len = formatIp(sas, buf);
+  }
+  if (len == 0) {
+    return 0;
+  }
+  buf[len++] = ':';
+  const auto res = std::to_chars(buf + len, end, getPort(sas));
+  return res.ptr - buf;
+}
+
+RawAddress
+toRawAddress(const struct sockaddr_storage* sas) {
+  RawAddress raw;
+  if (sas->ss_family == AF_INET) {
+    const auto sin = reinterpret_cast<const struct sockaddr_in*>(sas);
+    raw.lo = 0xffff00000000 | ntohl(sin->sin_addr.s_addr);
+  } else if (sas->ss_family == AF_INET6) {
+    const auto sin6 = reinterpret_cast<const struct sockaddr_in6*>(sas);
+    const auto bytes = sin6->sin6_addr.s6_addr;
+    for (size_t i = 0; i < 8; i++) {
+      raw.hi = (raw.hi << 8) | bytes[i];
+      raw.lo = (raw.lo << 8) | bytes[i + 8];
+    }
+  } else {
+    return raw;
+  }
+  raw.port = getPort(sas);
+  return raw;
+}
+
+void
+appendAddressColumnNames(
+    folly::StringPiece name,
+    std::vector<std::string>& names) {
+  if (!FLAGS_export_raw_addresses) {
+    names.push_back(name.str());
+    return;
+  }
+  names.push_back(folly::to<std::string>(name, "_ip_hi"));
+  names.push_back(folly::to<std::string>(name, "_ip_lo"));
+  names.push_back(folly::to<std::string>(name, "_port"));
+}
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <folly/Range.h>
+#include <gflags/gflags.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+DECLARE_bool(export_raw_addresses);
+
+namespace paths {
+namespace common {
+
+// large enough for any address formatted by formatAddress()
+constexpr size_t kMaxFormattedAddressLength = INET6_ADDRSTRLEN + 8;
+
+/**
+ * Writes an address in the format of folly::SocketAddress::describe() after
+ * tryConvertToIPv4() into buf (of at least kMaxFormattedAddressLength bytes)
+ * and returns its length, or 0 if the address is neither IPv4 nor IPv6.
+ *
+ * IP addresses are rendered once and then copied from a per-thread
+ * AddressFormatCache of --address_format_cache_entries entries.
+ */
+size_t formatAddress(const struct sockaddr_storage* sas, char* buf);
+
+/**
+ * Address as integers: the IPv6 address (IPv4 addresses mapped to
+ * ::ffff:a.b.c.d, as after tryConvertToIPv4()) in two big-endian halves,
+ * and the port. All zero if the address is neither IPv4 nor IPv6.
+ */
+struct RawAddress {
+  uint64_t hi{0};
+  uint64_t lo{0};
+  uint16_t port{0};
+};
+
+RawAddress toRawAddress(const struct sockaddr_storage* sas);
+
+/**
+ * Bounded cache of formatted IP addresses (without port), keyed on the raw
+ * address, for the few thousand peers that show up in most rows.
+ *
+ * An open addressing table that is at most half full, so that lookups take
+ * a probe or two and never allocate. Once it holds maxAddresses addresses,
+ * it is cleared and refilled with the addresses seen next. Not thread-safe.
+ */
+class AddressFormatCache {
+ public:
+  explicit AddressFormatCache(size_t maxAddresses);
+
+  /**
+   * Returns the IP address of sas as formatted by formatAddress(), or an
+   * empty string if it is neither IPv4 nor IPv6. Valid until the next call.
+   */
+  folly::StringPiece lookup(const struct sockaddr_storage* sas);
+
+  uint64_t getHits() const {
+    return hits_;
+  }
+
+  uint64_t getMisses() const {
+    return misses_;
+  }
+
+ private:
+  struct Entry {
+    uint64_t hi{0};
+    uint64_t lo{0};
+    uint8_t size{0}; // 0 if unused
+    char text[INET6_ADDRSTRLEN + 2]; // with brackets for IPv6
+  };
+
+  const size_t maxAddresses_;
+  std::vector<Entry> entries_;
+  const size_t mask_;
+  size_t addresses_{0};
+  uint64_t hits_{0};
+  uint64_t misses_{0};
+};
+
+/**
+ * Appends the names of the columns of address column name: name, or with
+ * --export_raw_addresses <name>_ip_hi, <name>_ip_lo and <name>_port.
+ */
+void appendAddressColumnNames(
+    folly::StringPiece name,
+    std::vector<std::string>& names);
+
+/**
+ * Adds an address to a row encoder: with addAddress(), or with
+ * --export_raw_addresses as the three integers of toRawAddress().
+ */
+template <typename Encoder>
+void
+addAddressColumns(Encoder& encoder, const struct sockaddr_storage* sas) {
+  if (!FLAGS_export_raw_addresses) {
+    encoder.addAddress(sas);
+    return;
+  }
+  const auto raw = toRawAddress(sas);
+  encoder.add(raw.hi);
+  encoder.add(raw.lo);
+  encoder.add(raw.port);
+}
+
+/**
+ * Encodes CSV rows into a buffer that is reused across rows.
+ *
+ * Integers are written with std::to_chars and addresses with inet_ntop
+ * straight into the buffer, so once the buffer has grown to the size of the
+ * longest row, encoding a row performs no heap allocations. Fields are
+ * separated by commas; the row is not newline terminated.
+ *
+ * Usage:
+ *   encoder.clear();
+ *   encoder.add(ev.header.ev_tstamp_ns);
+ *   encoder.addAddress(&ev.header.src);
+ *   write(encoder.str());
+ */
+class CsvRowEncoder {
+ public:
+  explicit CsvRowEncoder(size_t initialCapacity = 1024);
+
+  void clear() {
+    buf_.clear();
+    fields_ = 0;
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value>::type add(T value) {
+    char tmp[24]; // fits any 64-bit integer with sign
+    const auto res = std::to_chars(tmp, tmp + sizeof(tmp), value);
+    startField();
+    buf_.append(tmp, res.ptr - tmp);
+  }
+
+  // same output as std::to_string(bool)
+  void add(bool value) {
+    addRaw(value ? "1" : "0");
+  }
+
+  /**
+   * Appends a field verbatim; the caller guarantees that it contains no
+   * separator, quote or newline (e.g. constant column names and enum
+   * strings).
+   */
+  void addRaw(folly::StringPiece value) {
+    startField();
+    buf_.append(value.data(), value.size());
+  }
+
+  /**
+   * Appends a field, quoting it (RFC 4180) only if it contains a separator,
+   * quote or newline.
+   */
+  void addString(folly::StringPiece value);
+
+  /**
+   * Appends an address in the format of folly::SocketAddress::describe()
+   * after tryConvertToIPv4(): "a.b.c.d:port" for IPv4 and IPv4-mapped IPv6
+   * addresses, "[v6addr]:port" for IPv6.
+   */
+  void addAddress(const struct sockaddr_storage* sas);
+
+  void addFields(const std::vector<std::string>& fields) {
+    for (const auto& field : fields) {
+      addString(field);
+    }
+  }
+
+  const std::string& str() const {
+    return buf_;
+  }
+
+ private:
+  void startField() {
+    if (fields_++ > 0) {
+      buf_.push_back(',');
+    }
+  }
+
+  std::string buf_;
+  size_t fields_{0};
+};
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,296 @@
+#include "EventRing.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstring>
+#include <new>
+
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+static bool
+ValidateEventRingBytes(const char* flagname, uint64_t value) {
+  if (value < (1 << 16) || (value & (value - 1)) != 0) {
+    LOG(ERROR) << folly::format(
+        "--{} must be a power of two, at least 65536", flagname);
+    return false;
+  }
+  return true;
+}
+
+DEFINE_string(
+    event_ring_path,
+    "",
+    "Also publish the raw events to a shared-memory ring at this path "
+    "(e.g. /dev/shm/ackevents.ring), for local readers [no ring]");
+DEFINE_uint64(
+    event_ring_bytes,
+    64 << 20,
+    "Size of the data area of the --event_ring_path ring; readers that fall "
+    "this far behind skip ahead");
+DEFINE_validator(event_ring_bytes, &ValidateEventRingBytes);
+
+namespace paths {
+namespace common {
+
+namespace {
+
+constexpr size_t kHeaderSize = 4096;
+static_assert(sizeof(EventRingHeader) <= kHeaderSize, "EventRingHeader");
+
+uint64_t
+frameSize(size_t recordSize) {
+  return (sizeof(EventRingRecordHeader) + recordSize + 15) & ~uint64_t(15);
+}
+
+} // namespace
+
+std::unique_ptr<EventRingWriter>
+EventRingWriter::createFromFlags(
+    folly::StringPiece tool,
+    uint32_t recordSize,
+    bool evdebug) {
+  if (FLAGS_event_ring_path.empty()) {
+    return nullptr;
+  }
+  return std::make_unique<EventRingWriter>(
+      FLAGS_event_ring_path, tool, recordSize, evdebug, FLAGS_event_ring_bytes);
+}
+
+EventRingWriter::EventRingWriter(
+    const std::string& path,
+    folly::StringPiece tool,
+    uint32_t recordSize,
+    bool evdebug,
+    uint64_t capacity)
+    : path_(path), capacity_(capacity) {
+  CHECK_EQ(capacity_ & (capacity_ - 1), 0) << "capacity must be a power of 2";
+  CHECK_LE(frameSize(recordSize) * 4, capacity_) << "records are too large";
+  CHECK_LT(tool.size(), sizeof(header_->tool));
+
+  // set up the ring under a temporary name, so readers never see it partial
+  const auto tmpPath = path_ + ".tmp";
+  const int fd =
+      ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  mappedSize_ = kHeaderSize + capacity_;
+  if (fd < 0 || ftruncate(fd, mappedSize_) != 0) {
+    LOG(FATAL) << folly::format(
+        "Unable to create event ring {}: {}", tmpPath, folly::errnoStr(errno));
+  }
+  void* mapped =
+      mmap(nullptr, mappedSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    LOG(FATAL) << folly::format(
+        "Unable to map event ring {}: {}", tmpPath, folly::errnoStr(errno));
+  }
+
+  header_ = new (mapped) EventRingHeader();
+  memcpy(header_->magic, kEventRingMagic, sizeof(header_->magic));
+  header_->version = kEventRingVersion;
+  header_->headerSize = kHeaderSize;
+  memcpy(header_->tool, tool.data(), tool.size());
+  header_->recordSize = recordSize;
+  header_->flags = evdebug ? kEventRingFlagEvdebug : 0;
+  header_->capacity = capacity_;
+  header_->startRealtimeNs =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count();
+  header_->reserved.store(0, std::memory_order_relaxed);
+  header_->head.store(0, std::memory_order_release);
+  data_ = static_cast<char*>(mapped) + kHeaderSize;
+
+  if (rename(tmpPath.c_str(), path_.c_str()) != 0) {
+    LOG(FATAL) << folly::format(
+        "Unable to rename {} to {}: {}",
+        tmpPath,
+        path_,
+        folly::errnoStr(errno));
+  }
+  LOG(INFO) << folly::format(
+      "Publishing events to ring {} ({} bytes)", path_, capacity_);
+}
+
+EventRingWriter::~EventRingWriter() {
+  munmap(header_, mappedSize_);
+}
+
+void
+EventRingWriter::write(folly::StringPiece record) {
+  const uint64_t frame = frameSize(record.size());
+  DCHECK_LE(frame * 4, capacity_);
+  uint64_t pos = head_;
+  uint64_t offset = pos & (capacity_ - 1);
+  const uint64_t filler = offset + frame > capacity_ ? capacity_ - offset : 0;
+  const uint64_t end = pos + filler + frame;
+
+  // readers of the region below end - capacity_ now know it is being reused
+  header_->reserved.store(end, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  if (filler) {
+    // frames are 16-byte aligned, so there is room for the filler header
+    const EventRingRecordHeader wrap{
+        uint32_t(filler - sizeof(EventRingRecordHeader)),
+        kEventRingRecordWrap,
+        seq_};
+    memcpy(data_ + offset, &wrap, sizeof(wrap));
+    offset = 0;
+  }
+  const EventRingRecordHeader header{uint32_t(record.size()), 0, seq_++};
+  memcpy(data_ + offset, &header, sizeof(header));
+  memcpy(data_ + offset + sizeof(header), record.data(), record.size());
+
+  head_ = end;
+  header_->head.store(end, std::memory_order_release);
+}
+
+std::unique_ptr<EventRingReader>
+EventRingReader::open(const std::string& path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG(ERROR) << folly::format(
+        "Unable to open {}: {}", path, folly::errnoStr(errno));
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    LOG(ERROR) << folly::format(
+        "Unable to stat {}: {}", path, folly::errnoStr(errno));
+    close(fd);
+    return nullptr;
+  }
+  const size_t size = st.st_size;
+  if (size < kHeaderSize) {
+    LOG(ERROR) << folly::format("{} is too short to be an event ring", path);
+    close(fd);
+    return nullptr;
+  }
+  void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    LOG(ERROR) << folly::format(
+        "Unable to map {}: {}", path, folly::errnoStr(errno));
+    return nullptr;
+  }
+
+  const auto header = static_cast<const EventRingHeader*>(mapped);
+  std::string error;
+  if (memcmp(header->magic, kEventRingMagic, sizeof(header->magic)) != 0) {
+    error = "bad magic";
+  } else if (header->version != kEventRingVersion) {
+    error = folly::sformat("unsupported version {}", header->version);
+  } else if (
+      header->headerSize < sizeof(EventRingHeader) ||
+      header->capacity == 0 ||
+      (header->capacity & (header->capacity - 1)) != 0 ||
+      header->headerSize + header->capacity != size ||
+      header->tool[sizeof(header->tool) - 1] != '\0') {
+    error = "corrupt header";
+  }
+  if (!error.empty()) {
+    LOG(ERROR) << folly::format("{} is not an event ring: {}", path, error);
+    munmap(mapped, size);
+    return nullptr;
+  }
+  return std::unique_ptr<EventRingReader>(new EventRingReader(
+      path, static_cast<const char*>(mapped), size, st.st_ino));
+}
+
+EventRingReader::EventRingReader(
+    const std::string& path,
+    const char* base,
+    size_t size,
+    ino_t inode)
+    : path_(path),
+      base_(base),
+      size_(size),
+      inode_(inode),
+      header_(reinterpret_cast<const EventRingHeader*>(base)),
+      data_(base + header_->headerSize),
+      capacity_(header_->capacity),
+      pos_(header_->head.load(std::memory_order_acquire)) {}
+
+EventRingReader::~EventRingReader() {
+  munmap(const_cast<char*>(base_), size_);
+}
+
+std::string
+EventRingReader::getTool() const {
+  return std::string(
+      header_->tool, strnlen(header_->tool, sizeof(header_->tool)));
+}
+
+bool
+EventRingReader::isOverwritten(uint64_t pos) const {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return header_->reserved.load(std::memory_order_relaxed) > pos + capacity_;
+}
+
+void
+EventRingReader::skipToHead() {
+  pos_ = header_->head.load(std::memory_order_acquire);
+}
+
+bool
+EventRingReader::next(folly::StringPiece& record) {
+  while (true) {
+    if (pos_ >= header_->head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    if (isOverwritten(pos_)) {
+      skipToHead();
+      continue;
+    }
+    const uint64_t offset = pos_ & (capacity_ - 1);
+    EventRingRecordHeader header;
+    memcpy(&header, data_ + offset, sizeof(header));
+    if (isOverwritten(pos_)) {
+      skipToHead();
+      continue;
+    }
+    if (offset + frameSize(header.size) > capacity_) {
+      LOG(ERROR) << folly::format(
+          "Corrupt record at position {} of {}, skipping to the head",
+          pos_,
+          path_);
+      skipToHead();
+      continue;
+    }
+    if (header.flags & kEventRingRecordWrap) {
+      pos_ += capacity_ - offset;
+      continue;
+    }
+
+    if (haveSeq_ && header.seq > nextSeq_) {
+      dropped_ += header.seq - nextSeq_;
+    }
+    haveSeq_ = true;
+    nextSeq_ = header.seq + 1;
+    current_ = pos_;
+    pos_ += frameSize(header.size);
+    record = folly::StringPiece(
+        data_ + offset + sizeof(header), header.size);
+    return true;
+  }
+}
+
+bool
+EventRingReader::isValid() const {
+  return !isOverwritten(current_);
+}
+
+bool
+EventRingReader::isReplaced() const {
+  struct stat st;
+  return stat(path_.c_str(), &st) != 0 || st.st_ino != inode_;
+}
+
+} // namespace common
+} // namespace paths
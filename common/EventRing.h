@@ -0,0 +1,225 @@
+#pragma once
+
+#include <folly/Range.h>
+#include <gflags/gflags.h>
+#include <sys/types.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+DECLARE_string(event_ring_path);
+
+namespace paths {
+namespace common {
+
+constexpr char kEventRingMagic[8] = {'P', 'A', 'T', 'H', 'S', 'R', 'N', 'G'};
+constexpr uint32_t kEventRingVersion = 1;
+
+// set in EventRingHeader::flags if the tool was built with -DEVDEBUG
+constexpr uint32_t kEventRingFlagEvdebug = 1;
+
+// set in EventRingRecordHeader::flags for the filler at the end of the ring
+constexpr uint32_t kEventRingRecordWrap = 1;
+
+/**
+ * Shared-memory ring of events (--event_ring_path).
+ *
+ * A collector publishes each raw event (the records of --export_mode=record)
+ * into a ring file, typically under /dev/shm, that any number of local
+ * processes map read-only and follow, so they get the event stream without
+ * loading their own probes.
+ *
+ * Positions are byte offsets that grow monotonically and map to offset %
+ * capacity in the data area. The producer never waits for readers: it
+ * announces the end of the region it is about to overwrite in reserved,
+ * writes the record, and then publishes it by advancing head. Each reader
+ * keeps its own position in its own memory; a record it reads is intact if,
+ * once it is done reading, reserved is still within one capacity of the
+ * record's position (the seqlock protocol, with reserved as the sequence).
+ * A reader that falls more than a capacity behind skips to head and counts
+ * the records it missed.
+ *
+ * Records are framed by an EventRingRecordHeader and padded to 16 bytes, so
+ * a frame never wraps around: if a record does not fit before the end of the
+ * data area, a wrap filler takes the rest of it.
+ */
+struct EventRingHeader {
+  char magic[8];
+  uint32_t version;
+  // the data area starts at this offset
+  uint32_t headerSize;
+  char tool[16];
+  uint32_t recordSize;
+  uint32_t flags;
+  uint64_t capacity;
+  uint64_t startRealtimeNs;
+
+  // written by the producer only
+  alignas(64) std::atomic<uint64_t> reserved;
+  alignas(64) std::atomic<uint64_t> head;
+};
+static_assert(
+    std::atomic<uint64_t>::is_always_lock_free,
+    "EventRing needs lock-free 64-bit atomics to share them between processes");
+
+struct EventRingRecordHeader {
+  uint32_t size;
+  uint32_t flags;
+  // sequence number of the record, to count the records a reader missed
+  uint64_t seq;
+};
+static_assert(sizeof(EventRingRecordHeader) == 16, "EventRingRecordHeader");
+
+/**
+ * Producer side of a ring. Not thread-safe: events are published from the
+ * thread that polls the perf buffer.
+ */
+class EventRingWriter {
+ public:
+  /**
+   * Creates the ring at --event_ring_path if it is set; returns nullptr
+   * otherwise.
+   */
+  static std::unique_ptr<EventRingWriter>
+  createFromFlags(folly::StringPiece tool, uint32_t recordSize, bool evdebug);
+
+  /**
+   * Creates a ring of capacity bytes (a power of two) at path, replacing any
+   * existing ring: the new file is renamed into place, so readers of the old
+   * one are not disturbed (see EventRingReader::isReplaced). Fails hard if
+   * the ring cannot be created, as the collectors do for the export file.
+   */
+  EventRingWriter(
+      const std::string& path,
+      folly::StringPiece tool,
+      uint32_t recordSize,
+      bool evdebug,
+      uint64_t capacity);
+
+  /**
+   * Unmaps the ring; the file is left for readers to drain.
+   */
+  ~EventRingWriter();
+
+  EventRingWriter(const EventRingWriter&) = delete;
+  EventRingWriter& operator=(const EventRingWriter&) = delete;
+
+  void write(folly::StringPiece record);
+
+  template <typename T>
+  void writeRecord(const T& event) {
+    write(folly::StringPiece(
+        reinterpret_cast<const char*>(&event), sizeof(event)));
+  }
+
+  uint64_t getRecordsWritten() const {
+    return seq_;
+  }
+
+ private:
+  const std::string path_;
+  const uint64_t capacity_;
+  size_t mappedSize_{0};
+  EventRingHeader* header_{nullptr};
+  char* data_{nullptr};
+  // producer copies of header_->head and of the next sequence number
+  uint64_t head_{0};
+  uint64_t seq_{0};
+};
+
+/**
+ * Reader side of a ring. Each reader follows the ring on its own, from the
+ * records published after it was opened.
+ *
+ * Records are returned in place, without copying:
+ *   folly::StringPiece record;
+ *   while (reader->next(record)) {
+ *     bpf::ack_event ev;
+ *     memcpy(&ev, record.data(), sizeof(ev));
+ *     if (!reader->isValid()) {
+ *       continue; // overwritten while it was read
+ *     }
+ *     ...
+ *   }
+ * next() returns false once the reader caught up with the producer; readers
+ * poll it again later. Not thread-safe.
+ */
+class EventRingReader {
+ public:
+  /**
+   * Opens and maps a ring, checking its header. Returns nullptr (and logs
+   * the reason) if the file cannot be read or is not a ring.
+   */
+  static std::unique_ptr<EventRingReader> open(const std::string& path);
+
+  ~EventRingReader();
+
+  EventRingReader(const EventRingReader&) = delete;
+  EventRingReader& operator=(const EventRingReader&) = delete;
+
+  const EventRingHeader& getHeader() const {
+    return *header_;
+  }
+
+  std::string getTool() const;
+
+  bool isEvdebug() const {
+    return header_->flags & kEventRingFlagEvdebug;
+  }
+
+  /**
+   * Sets record to the next record and returns true, or returns false if
+   * there is none yet. The record stays in the ring and can be overwritten
+   * at any time; check isValid() once done reading it.
+   */
+  bool next(folly::StringPiece& record);
+
+  /**
+   * Whether the record returned by the last call to next() was intact until
+   * now, i.e., whether what was read from it can be used.
+   */
+  bool isValid() const;
+
+  /**
+   * Records overwritten before this reader got to them.
+   */
+  uint64_t getDropped() const {
+    return dropped_;
+  }
+
+  /**
+   * Whether the ring file was replaced (e.g., the collector restarted), in
+   * which case no more records will show up in this one.
+   */
+  bool isReplaced() const;
+
+ private:
+  EventRingReader(
+      const std::string& path,
+      const char* base,
+      size_t size,
+      ino_t inode);
+
+  // whether the producer may have overwritten the frame at position pos
+  bool isOverwritten(uint64_t pos) const;
+
+  // skips to the head of the ring, after falling behind
+  void skipToHead();
+
+  const std::string path_;
+  const char* const base_;
+  const size_t size_;
+  const ino_t inode_;
+  const EventRingHeader* const header_;
+  const char* const data_;
+  const uint64_t capacity_;
+  uint64_t pos_;
+  uint64_t current_{0};
+  uint64_t nextSeq_{0};
+  bool haveSeq_{false};
+  uint64_t dropped_{0};
+};
+
+} // namespace common
+} // namespace paths
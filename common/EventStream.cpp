@@ -0,0 +1,464 @@
+#include "EventStream.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <src/common/CsvRowEncoder.h>
+
+static bool
+ValidatePositive(const char* flagname, uint32_t value) {
+  if (value == 0) {
+    LOG(ERROR) << folly::format("--{} must be > 0", flagname);
+    return false;
+  }
+  return true;
+}
+
+DEFINE_string(
+    stream_socket_path,
+    "",
+    "Also stream the events to subscribers of a Unix domain socket at this "
+    "path (see common/EventStream.h) [no stream]");
+DEFINE_uint32(
+    stream_queue_size,
+    16384,
+    "Number of events queued between the perf buffer polling thread and the "
+    "stream thread; events are dropped when it is full");
+DEFINE_validator(stream_queue_size, &ValidatePositive);
+DEFINE_uint32(
+    stream_batch_rows,
+    256,
+    "Maximum number of events in a batch sent to a subscriber");
+DEFINE_validator(stream_batch_rows, &ValidatePositive);
+DEFINE_uint32(
+    stream_batch_interval_ms,
+    100,
+    "Maximum time an event waits in a batch before it is sent");
+DEFINE_validator(stream_batch_interval_ms, &ValidatePositive);
+DEFINE_uint32(
+    stream_subscriber_queue_bytes,
+    4 << 20,
+    "Bytes of batches queued for a subscriber; batches are dropped for "
+    "subscribers with a full queue");
+DEFINE_uint32(
+    stream_max_subscribers,
+    16,
+    "Maximum number of connected subscribers");
+
+namespace paths {
+namespace common {
+
+namespace {
+
+// a filter line longer than this is rejected
+constexpr size_t kMaxFilterLength = 4096;
+
+} // namespace
+
+void
+EventStreamRow::setDst(const struct sockaddr_storage* sas) {
+  folly::SocketAddress dst;
+  dst.setFromSockaddr(reinterpret_cast<const struct sockaddr*>(sas));
+  dst.tryConvertToIPv4();
+  dst_ = dst.getIPAddress();
+}
+
+void
+EventStreamRow::addAddress(const struct sockaddr_storage* sas) {
+  char tmp[kMaxFormattedAddressLength];
+  const auto len = formatAddress(sas, tmp);
+  if (len == 0) {
+    addString("<uninitialized address>");
+    return;
+  }
+  addString(folly::StringPiece(tmp, len));
+}
+
+void
+EventStreamRow::appendValue(const Value& value, std::string& out) const {
+  out.push_back(static_cast<char>(value.type));
+  switch (value.type) {
+  case EventStreamValue::NULL_VALUE:
+    break;
+  case EventStreamValue::INT64:
+  case EventStreamValue::UINT64:
+    out.append(reinterpret_cast<const char*>(&value.value), sizeof(uint64_t));
+    break;
+  case EventStreamValue::STRING: {
+    const uint32_t size = value.size;
+    out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    out.append(data_, value.value, value.size);
+    break;
+  }
+  }
+}
+
+void
+EventStreamRow::appendTo(const std::vector<size_t>& columns, std::string& out)
+    const {
+  if (columns.empty()) {
+    for (const auto& value : values_) {
+      appendValue(value, out);
+    }
+    return;
+  }
+  for (const auto column : columns) {
+    appendValue(values_[column], out);
+  }
+}
+
+EventStreamServer::Options
+EventStreamServer::getOptionsFromFlags() {
+  Options options;
+  options.path = FLAGS_stream_socket_path;
+  options.batchRows = FLAGS_stream_batch_rows;
+  options.batchInterval =
+      std::chrono::milliseconds(FLAGS_stream_batch_interval_ms);
+  options.queueBytes = FLAGS_stream_subscriber_queue_bytes;
+  options.maxSubscribers = FLAGS_stream_max_subscribers;
+  return options;
+}
+
+EventStreamServer::EventStreamServer(
+    const Options& options,
+    std::unique_ptr<const EventStreamSchema> schema)
+    : options_(options),
+      schema_(std::move(schema)),
+      fieldNames_(schema_->getFieldNames()) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  CHECK_LT(options_.path.size(), sizeof(addr.sun_path))
+      << "--stream_socket_path is too long";
+  memcpy(addr.sun_path, options_.path.data(), options_.path.size());
+
+  unlink(options_.path.c_str());
+  listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listenFd_ < 0 ||
+      bind(listenFd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) !=
+          0 ||
+      listen(listenFd_, 16) != 0) {
+    LOG(FATAL) << folly::format(
+        "Unable to listen on {}: {}", options_.path, folly::errnoStr(errno));
+  }
+  wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  PCHECK(wakeFd_ >= 0) << "eventfd";
+
+  LOG(INFO) << folly::format("Streaming events on {}", options_.path);
+  thread_ = std::thread([this] { serve(); });
+}
+
+EventStreamServer::~EventStreamServer() {
+  stopping_ = true;
+  wake();
+  thread_.join();
+  for (const auto& subscriber : subscribers_) {
+    close(subscriber->fd);
+  }
+  close(wakeFd_);
+  close(listenFd_);
+  unlink(options_.path.c_str());
+}
+
+void
+EventStreamServer::wake() {
+  const uint64_t one = 1;
+  // fails only if the counter would overflow, in which case it is set anyway
+  (void)!write(wakeFd_, &one, sizeof(one));
+}
+
+void
+EventStreamServer::dispatch(const void* record) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  bool decoded = false;
+  bool sealed = false;
+  for (auto& subscriber : subscribers_) {
+    if (!subscriber->subscribed || subscriber->closing) {
+      continue;
+    }
+    if (!decoded) {
+      row_.clear();
+      schema_->decode(record, row_);
+      decoded = true;
+    }
+    if (!subscriber->types.empty() &&
+        !subscriber->types.count(row_.getType())) {
+      continue;
+    }
+    if (subscriber->prefix.hasValue() &&
+        !row_.getDst().inSubnet(
+            subscriber->prefix->first, subscriber->prefix->second)) {
+      continue;
+    }
+    if (subscriber->batchRows == 0) {
+      subscriber->batchStart = std::chrono::steady_clock::now();
+    }
+    row_.appendTo(subscriber->columns, subscriber->batch);
+    if (++subscriber->batchRows >= options_.batchRows) {
+      sealBatch(*subscriber);
+      sealed = true;
+    }
+  }
+  if (sealed) {
+    wake();
+  }
+}
+
+void
+EventStreamServer::queueFrame(
+    Subscriber& subscriber,
+    EventStreamFrame kind,
+    folly::StringPiece payload,
+    uint32_t rows) {
+  const EventStreamFrameHeader header{
+      uint32_t(payload.size()), kind, rows, subscriber.droppedSinceBatch};
+  std::string frame;
+  frame.reserve(sizeof(header) + payload.size());
+  frame.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  frame.append(payload.data(), payload.size());
+  subscriber.queuedBytes += frame.size();
+  subscriber.queue.push_back(std::move(frame));
+}
+
+void
+EventStreamServer::sealBatch(Subscriber& subscriber) {
+  const auto rows = subscriber.batchRows;
+  if (subscriber.queuedBytes + sizeof(EventStreamFrameHeader) +
+          subscriber.batch.size() >
+      options_.queueBytes) {
+    subscriber.rowsDropped += rows;
+    subscriber.droppedSinceBatch += rows;
+  } else {
+    queueFrame(subscriber, EventStreamFrame::BATCH, subscriber.batch, rows);
+    subscriber.rowsSent += rows;
+    subscriber.droppedSinceBatch = 0;
+  }
+  subscriber.batch.clear();
+  subscriber.batchRows = 0;
+}
+
+void
+EventStreamServer::serve() {
+  pthread_setname_np(pthread_self(), "event-stream");
+  std::vector<struct pollfd> fds;
+  while (!stopping_) {
+    fds.clear();
+    fds.push_back({listenFd_, POLLIN, 0});
+    fds.push_back({wakeFd_, POLLIN, 0});
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const auto& subscriber : subscribers_) {
+        short events = POLLIN;
+        if (!subscriber->queue.empty()) {
+          events |= POLLOUT;
+        }
+        fds.push_back({subscriber->fd, events, 0});
+      }
+    }
+    // the subscribers only change on this thread, so fds stays in sync
+    const int ready = poll(fds.data(), fds.size(), options_.batchInterval.count());
+    if (ready < 0 && errno != EINTR) {
+      PLOG(ERROR) << "poll";
+    }
+    if (fds[1].revents & POLLIN) {
+      uint64_t count;
+      (void)!read(wakeFd_, &count, sizeof(count));
+    }
+    if (fds[0].revents & POLLIN) {
+      accept();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i + 2 < fds.size(); i++) {
+      auto& subscriber = *subscribers_[i];
+      const auto revents = fds[i + 2].revents;
+      if ((revents & (POLLIN | POLLHUP | POLLERR)) && !receive(subscriber)) {
+        subscriber.closing = true;
+        subscriber.queue.clear();
+        continue;
+      }
+      if (subscriber.batchRows &&
+          now - subscriber.batchStart >= options_.batchInterval) {
+        sealBatch(subscriber);
+      }
+      if (!subscriber.queue.empty() && !send(subscriber)) {
+        subscriber.closing = true;
+        subscriber.queue.clear();
+      }
+    }
+
+    // drop the subscribers that left, or that were sent their error
+    for (auto it = subscribers_.begin(); it != subscribers_.end();) {
+      auto& subscriber = **it;
+      if (!subscriber.closing || !subscriber.queue.empty()) {
+        ++it;
+        continue;
+      }
+      LOG(INFO) << folly::format(
+          "Stream subscriber {} disconnected: {} events sent, {} dropped",
+          subscriber.id,
+          subscriber.rowsSent,
+          subscriber.rowsDropped);
+      if (subscriber.subscribed) {
+        subscribed_--;
+      }
+      close(subscriber.fd);
+      it = subscribers_.erase(it);
+    }
+  }
+}
+
+void
+EventStreamServer::accept() {
+  while (true) {
+    const int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        PLOG(ERROR) << "accept";
+      }
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (subscribers_.size() >= options_.maxSubscribers) {
+      LOG(WARNING) << folly::format(
+          "Refusing stream subscriber, {} are connected",
+          subscribers_.size());
+      close(fd);
+      continue;
+    }
+    auto subscriber = std::make_unique<Subscriber>();
+    subscriber->fd = fd;
+    subscriber->id = nextId_++;
+    subscribers_.push_back(std::move(subscriber));
+  }
+}
+
+bool
+EventStreamServer::receive(Subscriber& subscriber) {
+  char buf[1024];
+  while (true) {
+    const ssize_t n = read(subscriber.fd, buf, sizeof(buf));
+    if (n == 0) {
+      return false;
+    }
+    if (n < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    // anything after the filter line is ignored
+    if (subscriber.subscribed || subscriber.closing) {
+      continue;
+    }
+    subscriber.input.append(buf, n);
+    const auto eol = subscriber.input.find('\n');
+    if (eol != std::string::npos) {
+      subscriber.input.resize(eol);
+      subscribe(subscriber, subscriber.input);
+      subscriber.input.clear();
+    } else if (subscriber.input.size() > kMaxFilterLength) {
+      queueFrame(
+          subscriber, EventStreamFrame::ERROR, "filter line is too long", 0);
+      subscriber.closing = true;
+    }
+  }
+}
+
+bool
+EventStreamServer::subscribe(Subscriber& subscriber, folly::StringPiece filter) {
+  std::string error;
+  std::vector<folly::StringPiece> terms;
+  folly::split(' ', folly::trimWhitespace(filter), terms, true);
+  for (const auto& term : terms) {
+    folly::StringPiece key, value;
+    if (!folly::split('=', term, key, value)) {
+      error = folly::sformat("expected key=value, got {}", term);
+      break;
+    }
+    std::vector<folly::StringPiece> items;
+    folly::split(',', value, items, true);
+    if (key == "prefix") {
+      const auto network = folly::IPAddress::tryCreateNetwork(value);
+      if (network.hasError()) {
+        error = folly::sformat("{} is not a prefix", value);
+        break;
+      }
+      subscriber.prefix = network.value();
+    } else if (key == "types") {
+      for (const auto& item : items) {
+        subscriber.types.insert(item.str());
+      }
+    } else if (key == "fields") {
+      for (const auto& item : items) {
+        const auto it =
+            std::find(fieldNames_.begin(), fieldNames_.end(), item);
+        if (it == fieldNames_.end()) {
+          error = folly::sformat("unknown field {}", item);
+          break;
+        }
+        subscriber.columns.push_back(it - fieldNames_.begin());
+      }
+    } else {
+      error = folly::sformat("unknown key {}", key);
+    }
+    if (!error.empty()) {
+      break;
+    }
+  }
+  if (!error.empty()) {
+    LOG(WARNING) << folly::format(
+        "Rejecting stream subscriber {}: {}", subscriber.id, error);
+    queueFrame(subscriber, EventStreamFrame::ERROR, error, 0);
+    subscriber.closing = true;
+    return false;
+  }
+
+  std::vector<folly::StringPiece> names;
+  if (subscriber.columns.empty()) {
+    names.assign(fieldNames_.begin(), fieldNames_.end());
+  } else {
+    for (const auto column : subscriber.columns) {
+      names.push_back(fieldNames_[column]);
+    }
+  }
+  queueFrame(
+      subscriber, EventStreamFrame::SCHEMA, folly::join(",", names), 0);
+  LOG(INFO) << folly::format(
+      "Stream subscriber {} subscribed: {}", subscriber.id, filter);
+  subscriber.subscribed = true;
+  subscribed_++;
+  return true;
+}
+
+bool
+EventStreamServer::send(Subscriber& subscriber) {
+  while (!subscriber.queue.empty()) {
+    const auto& frame = subscriber.queue.front();
+    const ssize_t n = ::send(
+        subscriber.fd,
+        frame.data() + subscriber.sent,
+        frame.size() - subscriber.sent,
+        MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    subscriber.sent += n;
+    if (subscriber.sent < frame.size()) {
+      return true;
+    }
+    subscriber.queuedBytes -= frame.size();
+    subscriber.queue.pop_front();
+    subscriber.sent = 0;
+  }
+  return true;
+}
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,388 @@
+#pragma once
+
+#include <folly/IPAddress.h>
+#include <folly/Optional.h>
+#include <folly/Range.h>
+#include <folly/SocketAddress.h>
+#include <src/common/AsyncEventQueue.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+
+DECLARE_string(stream_socket_path);
+DECLARE_uint32(stream_queue_size);
+
+namespace paths {
+namespace common {
+
+/**
+ * Event streaming over a Unix domain socket (--stream_socket_path).
+ *
+ * A subscriber connects and sends one line with its filter, e.g.
+ *   prefix=10.0.0.0/9 types=ack fields=ev_tstamp_ns,dst,srtt_us\n
+ * where every key is optional (an empty line subscribes to everything).
+ * The server answers with a SCHEMA frame naming the columns of the stream
+ * (the CSV columns of the tool, or the projected ones), and then sends BATCH
+ * frames of up to --stream_batch_rows matching events, each written at most
+ * --stream_batch_interval_ms after its first event. A filter that cannot be
+ * parsed gets an ERROR frame, and the connection is closed.
+ *
+ * Every frame is an EventStreamFrameHeader followed by size bytes. A batch
+ * holds rows of tagged values: a EventStreamValue byte, then 8 bytes for
+ * integers or a uint32_t length and the bytes for strings, nothing for
+ * nulls. All integers are little-endian.
+ *
+ * Each subscriber has its own queue of batches, bounded by
+ * --stream_subscriber_queue_bytes. When a subscriber does not read fast
+ * enough, its new batches are dropped and counted (and reported in the
+ * dropped field of its next batch), so that it never holds back the
+ * collector or other subscribers.
+ */
+enum class EventStreamFrame : uint32_t {
+  SCHEMA = 1, // column names, comma separated
+  BATCH = 2,
+  ERROR = 3, // error message
+};
+
+struct EventStreamFrameHeader {
+  // bytes following this header
+  uint32_t size;
+  EventStreamFrame kind;
+  // BATCH only: rows in the batch
+  uint32_t rows;
+  // BATCH only: rows dropped for this subscriber since its previous batch
+  uint32_t dropped;
+};
+static_assert(sizeof(EventStreamFrameHeader) == 16, "EventStreamFrameHeader");
+
+enum class EventStreamValue : uint8_t {
+  NULL_VALUE = 0,
+  INT64 = 1,
+  UINT64 = 2,
+  STRING = 3,
+};
+
+/**
+ * Decoded event, with the row encoder interface of CsvRowEncoder (and of
+ * ColumnarWriter, for addNull), plus the properties subscribers filter on.
+ */
+class EventStreamRow {
+ public:
+  void clear() {
+    type_.clear();
+    dst_ = folly::IPAddress();
+    values_.clear();
+    data_.clear();
+  }
+
+  const std::string& getType() const {
+    return type_;
+  }
+
+  void setType(folly::StringPiece type) {
+    type_.assign(type.data(), type.size());
+  }
+
+  const folly::IPAddress& getDst() const {
+    return dst_;
+  }
+
+  void setDst(const folly::IPAddress& dst) {
+    dst_ = dst;
+  }
+
+  void setDst(const struct sockaddr_storage* sas);
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value>::type add(T value) {
+    values_.push_back(Value{
+        std::is_signed<T>::value ? EventStreamValue::INT64
+                                 : EventStreamValue::UINT64,
+        static_cast<uint64_t>(value)});
+  }
+
+  void add(bool value) {
+    values_.push_back(Value{EventStreamValue::UINT64, value});
+  }
+
+  void addRaw(folly::StringPiece value) {
+    addString(value);
+  }
+
+  void addString(folly::StringPiece value) {
+    values_.push_back(Value{EventStreamValue::STRING, data_.size(), value.size()});
+    data_.append(value.data(), value.size());
+  }
+
+  void addAddress(const struct sockaddr_storage* sas);
+
+  void addNull() {
+    values_.push_back(Value{EventStreamValue::NULL_VALUE, 0});
+  }
+
+  /**
+   * Appends the values of the given columns (of all columns if empty) to
+   * out, in the encoding of BATCH frames.
+   */
+  void appendTo(const std::vector<size_t>& columns, std::string& out) const;
+
+ private:
+  struct Value {
+    EventStreamValue type;
+    // integer value, or offset of the string in data_
+    uint64_t value;
+    size_t size{0};
+  };
+
+  void appendValue(const Value& value, std::string& out) const;
+
+  std::string type_;
+  folly::IPAddress dst_;
+  std::vector<Value> values_;
+  std::string data_;
+};
+
+/**
+ * What a tool exposes to subscribers: its columns, and how to decode its
+ * records.
+ */
+class EventStreamSchema {
+ public:
+  virtual ~EventStreamSchema() = default;
+
+  virtual std::vector<std::string> getFieldNames() const = 0;
+
+  /**
+   * Sets the type and destination of a record, and adds its columns.
+   */
+  virtual void decode(const void* record, EventStreamRow& row) const = 0;
+};
+
+/**
+ * Schema of the tools that encode their raw events with a CSV encoding
+ * function (ackevents, rtttrace): a single event type, and the destination
+ * in event.header.dst.
+ */
+template <typename Event>
+class CsvEventStreamSchema : public EventStreamSchema {
+ public:
+  using EncodeFn = void (*)(const Event&, EventStreamRow&);
+
+  CsvEventStreamSchema(
+      std::string type,
+      std::vector<std::string> fieldNames,
+      EncodeFn encode)
+      : type_(std::move(type)),
+        fieldNames_(std::move(fieldNames)),
+        encode_(encode) {}
+
+  std::vector<std::string> getFieldNames() const override {
+    return fieldNames_;
+  }
+
+  void decode(const void* record, EventStreamRow& row) const override {
+    const auto& ev = *static_cast<const Event*>(record);
+    row.setType(type_);
+    row.setDst(&ev.header.dst);
+    encode_(ev, row);
+  }
+
+ private:
+  const std::string type_;
+  const std::vector<std::string> fieldNames_;
+  const EncodeFn encode_;
+};
+
+/**
+ * Serves the stream on a Unix domain socket. Connections are handled by a
+ * thread of the server; dispatch() is called by a single other thread.
+ */
+class EventStreamServer {
+ public:
+  struct Options {
+    std::string path;
+
+    // a batch is sent once it holds this many rows
+    size_t batchRows{256};
+
+    // ... or once its first row is this old
+    std::chrono::milliseconds batchInterval{100};
+
+    // batches queued for a subscriber, beyond which new ones are dropped
+    size_t queueBytes{4 << 20};
+
+    size_t maxSubscribers{16};
+  };
+
+  /**
+   * Options set by the --stream_* flags.
+   */
+  static Options getOptionsFromFlags();
+
+  /**
+   * Listens on options.path, replacing any socket there. Fails hard if the
+   * socket cannot be created, as the collectors do for the export file.
+   */
+  EventStreamServer(
+      const Options& options,
+      std::unique_ptr<const EventStreamSchema> schema);
+
+  /**
+   * Disconnects the subscribers and removes the socket.
+   */
+  ~EventStreamServer();
+
+  EventStreamServer(const EventStreamServer&) = delete;
+  EventStreamServer& operator=(const EventStreamServer&) = delete;
+
+  /**
+   * Adds a record to the batches of the subscribers it matches.
+   */
+  void dispatch(const void* record);
+
+  /**
+   * Whether any subscriber is streaming (records can be skipped otherwise).
+   */
+  bool hasSubscribers() const {
+    return subscribed_.load(std::memory_order_relaxed) > 0;
+  }
+
+ private:
+  struct Subscriber {
+    int fd;
+    uint64_t id;
+    // filter line, until it is complete
+    std::string input;
+    bool subscribed{false};
+    bool closing{false};
+
+    folly::Optional<folly::CIDRNetwork> prefix;
+    std::unordered_set<std::string> types;
+    std::vector<size_t> columns;
+
+    std::string batch;
+    uint32_t batchRows{0};
+    std::chrono::steady_clock::time_point batchStart;
+
+    std::deque<std::string> queue;
+    size_t queuedBytes{0};
+    // bytes of queue.front() already sent
+    size_t sent{0};
+
+    uint64_t rowsSent{0};
+    uint64_t rowsDropped{0};
+    uint32_t droppedSinceBatch{0};
+  };
+
+  void serve();
+
+  void accept();
+
+  // returns false if the subscriber is gone
+  bool receive(Subscriber& subscriber);
+
+  bool subscribe(Subscriber& subscriber, folly::StringPiece filter);
+
+  // returns false if the subscriber is gone
+  bool send(Subscriber& subscriber);
+
+  void queueFrame(
+      Subscriber& subscriber,
+      EventStreamFrame kind,
+      folly::StringPiece payload,
+      uint32_t rows);
+
+  void sealBatch(Subscriber& subscriber);
+
+  void wake();
+
+  const Options options_;
+  const std::unique_ptr<const EventStreamSchema> schema_;
+  const std::vector<std::string> fieldNames_;
+  int listenFd_{-1};
+  int wakeFd_{-1};
+  uint64_t nextId_{0};
+
+  // subscribers_ is shared by dispatch() and the server thread
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Subscriber>> subscribers_;
+  std::atomic<size_t> subscribed_{0};
+  EventStreamRow row_;
+
+  std::atomic<bool> stopping_{false};
+  std::thread thread_;
+};
+
+/**
+ * Streams the events of a tool from the thread polling its perf buffers.
+ *
+ * publish() only copies the event into an AsyncEventQueue (dropping it if
+ * the queue is full), and only while there are subscribers; events are
+ * decoded and batched by the queue's thread, and sent by the server's.
+ */
+template <typename Event>
+class EventStreamPublisher {
+ public:
+  /**
+   * Creates a publisher serving --stream_socket_path if it is set; returns
+   * nullptr otherwise.
+   */
+  static std::unique_ptr<EventStreamPublisher> createFromFlags(
+      const std::string& name,
+      std::unique_ptr<const EventStreamSchema> schema) {
+    if (FLAGS_stream_socket_path.empty()) {
+      return nullptr;
+    }
+    return std::make_unique<EventStreamPublisher>(
+        name, EventStreamServer::getOptionsFromFlags(), std::move(schema));
+  }
+
+  EventStreamPublisher(
+      const std::string& name,
+      const EventStreamServer::Options& options,
+      std::unique_ptr<const EventStreamSchema> schema)
+      : server_(options, std::move(schema)),
+        queue_(makeQueueOptions(name), [this](Event& event) {
+          server_.dispatch(&event);
+        }) {
+    queue_.start();
+  }
+
+  /**
+   * Queues an event for the subscribers. Returns false if it was dropped.
+   */
+  bool publish(const Event& event) {
+    if (!server_.hasSubscribers()) {
+      return true;
+    }
+    return queue_.push(event);
+  }
+
+ private:
+  static typename AsyncEventQueue<Event>::Options makeQueueOptions(
+      const std::string& name) {
+    typename AsyncEventQueue<Event>::Options options;
+    options.name = name + "-stream";
+    options.capacity = FLAGS_stream_queue_size;
+    options.fullPolicy = QueueFullPolicy::DROP_NEWEST;
+    options.statsInterval =
+        std::chrono::seconds(FLAGS_export_queue_stats_interval_s);
+    return options;
+  }
+
+  EventStreamServer server_;
+  // declared last so that it is drained before the server goes away
+  AsyncEventQueue<Event> queue_;
+};
+
+} // namespace common
+} // namespace paths
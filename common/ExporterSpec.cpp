@@ -0,0 +1,159 @@
+#include "ExporterSpec.h"
+
+#include <algorithm>
+
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <glog/logging.h>
+
+static bool
+ValidateExporters(const char* flagname, const std::string& value) {
+  std::vector<paths::common::ExporterSpec> specs;
+  std::string error;
+  if (not paths::common::parseExporterSpecs(value, specs, error)) {
+    LOG(ERROR) << folly::format("--{}: {}", flagname, error);
+    return false;
+  }
+  return true;
+}
+
+DEFINE_string(
+    exporters,
+    "",
+    "Export each event to several exporters, separated by ';', e.g. "
+    "\"mode=csv path=/data/a.csv; mode=json path=/run/a.fifo "
+    "prefix=10.1.0.0/16\"; replaces --export_mode and --export_file_path "
+    "(see common/ExporterSpec.h) [single exporter]");
+DEFINE_validator(exporters, &ValidateExporters);
+
+namespace paths {
+namespace common {
+
+bool
+parseExporterSpecs(
+    folly::StringPiece str,
+    std::vector<ExporterSpec>& specs,
+    std::string& error) {
+  std::vector<folly::StringPiece> exporters;
+  folly::split(';', str, exporters);
+  for (const auto& exporter : exporters) {
+    std::vector<folly::StringPiece> terms;
+    folly::split(' ', folly::trimWhitespace(exporter), terms, true);
+    if (terms.empty()) {
+      continue;
+    }
+    ExporterSpec spec;
+    for (const auto& term : terms) {
+      folly::StringPiece key, value;
+      if (!folly::split('=', term, key, value)) {
+        error = folly::sformat("expected key=value, got {}", term);
+        return false;
+      }
+      std::vector<folly::StringPiece> items;
+      folly::split(',', value, items, true);
+      if (key == "mode") {
+        spec.mode = value.str();
+      } else if (key == "path") {
+        spec.path = value.str();
+      } else if (key == "prefix") {
+        const auto network = folly::IPAddress::tryCreateNetwork(value);
+        if (network.hasError()) {
+          error = folly::sformat("{} is not a prefix", value);
+          return false;
+        }
+        spec.prefix = network.value();
+      } else if (key == "types") {
+        for (const auto& item : items) {
+          spec.types.insert(item.str());
+        }
+      } else if (key == "fields") {
+        for (const auto& item : items) {
+          spec.fields.push_back(item.str());
+        }
+      } else if (key == "queue_full") {
+        if (!parseQueueFullPolicy(value.str(), spec.queueFull)) {
+          error = folly::sformat(
+              "queue_full must be one of block, drop_newest, drop_oldest, "
+              "got {}",
+              value);
+          return false;
+        }
+      } else {
+        error = folly::sformat("unknown key {}", key);
+        return false;
+      }
+    }
+    if (spec.mode.empty()) {
+      error = folly::sformat("no mode in exporter {}", exporter);
+      return false;
+    }
+    specs.push_back(std::move(spec));
+  }
+  return true;
+}
+
+std::vector<ExporterSpec>
+getExporterSpecsFromFlags() {
+  std::vector<ExporterSpec> specs;
+  std::string error;
+  CHECK(parseExporterSpecs(FLAGS_exporters, specs, error)) << error;
+
+  for (size_t i = 0; i < specs.size(); i++) {
+    // exporters writing to the same file would interleave their output
+    for (size_t j = 0; j < i; j++) {
+      if (specs[i].path == specs[j].path) {
+        LOG(FATAL) << folly::format(
+            "--exporters {} and {} both write to {}",
+            j,
+            i,
+            specs[i].path.empty() ? "stdout" : specs[i].path);
+      }
+    }
+    if (specs[i].queueFull == QueueFullPolicy::BLOCK && specs.size() > 1) {
+      LOG(WARNING) << folly::format(
+          "Exporter {} blocks when its queue is full, "
+          "which holds back the other exporters",
+          i);
+    }
+  }
+  return specs;
+}
+
+std::string
+getExporterQueueName(folly::StringPiece tool, size_t index, size_t count) {
+  if (count == 1) {
+    return tool.str();
+  }
+  return folly::sformat("{}.{}", tool, index);
+}
+
+std::shared_ptr<const PrefixMatcher>
+getExporterClients(
+    const ExporterSpec& spec,
+    const std::shared_ptr<const PrefixMatcher>& clients) {
+  if (!spec.prefix) {
+    return clients;
+  }
+  return PrefixMatcher::create({spec.prefix.value()}, {});
+}
+
+bool
+selectColumns(
+    const std::vector<std::string>& columns,
+    const std::vector<std::string>& fields,
+    std::vector<bool>& selected,
+    std::string& error) {
+  selected.assign(columns.size(), fields.empty());
+  for (const auto& field : fields) {
+    const auto it = std::find(columns.begin(), columns.end(), field);
+    if (it == columns.end()) {
+      error = folly::sformat("unknown field {}", field);
+      return false;
+    }
+    selected[it - columns.begin()] = true;
+  }
+  return true;
+}
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <folly/IPAddress.h>
+#include <folly/Optional.h>
+#include <folly/Range.h>
+#include <gflags/gflags.h>
+#include <src/common/AsyncEventQueue.h>
+#include <src/common/PrefixMatcher.h>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+DECLARE_string(exporters);
+
+namespace paths {
+namespace common {
+
+/**
+ * One of the exporters of a tool run with --exporters.
+ *
+ * --exporters lists exporters separated by ';', each a list of key=value
+ * terms separated by spaces, as the filters of stream subscribers:
+ *   mode=csv path=/data/tcp.csv; mode=json path=/run/tcp.fifo prefix=10.1.0.0/16
+ * Keys:
+ *   mode        export mode, as --export_mode (required)
+ *   path        export file, as --export_file_path [stdout]
+ *   prefix      only events to clients in this prefix
+ *               [--client_prefix or --client_prefixes_file]
+ *   types       only events of these types, comma separated (tcpevents)
+ *   fields      only these fields, comma separated [all]; tcpevents
+ *               always exports its header, state and detail fields, and
+ *               only accepts stats here (replacing --stats_to_print)
+ *   queue_full  policy of the exporter's queue, as --export_queue_full_policy
+ *               [drop_newest]
+ *
+ * Every exporter has its own export queue (and thread), writer and buffer,
+ * so that a slow exporter drops its own events instead of holding back the
+ * others; queue_full=block gives that up for a lossless exporter.
+ */
+struct ExporterSpec {
+  std::string mode;
+
+  // export file, stdout if empty
+  std::string path;
+
+  // clients whose events are exported, the tool's clients if not set
+  folly::Optional<folly::CIDRNetwork> prefix;
+
+  // names of the event types exported, all if empty
+  std::unordered_set<std::string> types;
+
+  // names of the fields exported, in the order of the tool, all if empty
+  // (tcpevents: of the stats exported)
+  std::vector<std::string> fields;
+
+  QueueFullPolicy queueFull{QueueFullPolicy::DROP_NEWEST};
+};
+
+/**
+ * Parses a list of exporters in the syntax of --exporters. Returns false,
+ * with a message in error, if it cannot be parsed.
+ */
+bool parseExporterSpecs(
+    folly::StringPiece str,
+    std::vector<ExporterSpec>& specs,
+    std::string& error);
+
+/**
+ * The exporters listed by --exporters; empty if it is not set, in which case
+ * the tool has the single exporter set by --export_mode and
+ * --export_file_path.
+ */
+std::vector<ExporterSpec> getExporterSpecsFromFlags();
+
+/**
+ * Name of the export queue of the index-th exporter of a tool: the tool name
+ * alone if it has a single exporter.
+ */
+std::string getExporterQueueName(
+    folly::StringPiece tool,
+    size_t index,
+    size_t count);
+
+/**
+ * Clients whose events an exporter exports: its prefix if set, else
+ * clients (those of --client_prefix or --client_prefixes_file).
+ */
+std::shared_ptr<const PrefixMatcher> getExporterClients(
+    const ExporterSpec& spec,
+    const std::shared_ptr<const PrefixMatcher>& clients);
+
+/**
+ * Flags the columns named in fields, for a ProjectedRow. Returns all columns
+ * if fields is empty, and false, with a message in error, if a field is not
+ * a column.
+ */
+bool selectColumns(
+    const std::vector<std::string>& columns,
+    const std::vector<std::string>& fields,
+    std::vector<bool>& selected,
+    std::string& error);
+
+} // namespace common
+} // namespace paths
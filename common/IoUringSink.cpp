@@ -0,0 +1,172 @@
+#include "IoUringSink.h"
+
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <glog/logging.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+
+namespace paths {
+namespace common {
+
+std::unique_ptr<IoUringSink>
+IoUringSink::create(int fd, size_t bufferSize, uint32_t depth) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || not S_ISREG(st.st_mode)) {
+    LOG(INFO) << "io_uring output sink requires a regular file";
+    return nullptr;
+  }
+  const off_t offset = lseek(fd, 0, SEEK_CUR);
+  if (offset < 0) {
+    LOG(ERROR) << folly::format(
+        "Unable to get output file offset: {}", folly::errnoStr(errno));
+    return nullptr;
+  }
+  std::unique_ptr<IoUringSink> sink(
+      new IoUringSink(fd, bufferSize, depth, offset));
+  if (not sink->init()) {
+    return nullptr;
+  }
+  LOG(INFO) << folly::format(
+      "Writing output with io_uring: {} registered buffers of {} bytes",
+      depth,
+      bufferSize);
+  return sink;
+}
+
+IoUringSink::IoUringSink(
+    int fd,
+    size_t bufferSize,
+    uint32_t depth,
+    off_t offset)
+    : OutputSink(bufferSize), fd_(fd), depth_(depth), offset_(offset),
+      writes_(depth) {}
+
+IoUringSink::~IoUringSink() {
+  if (not ringInitialized_) {
+    return;
+  }
+  drain();
+  // writes were issued at explicit offsets, leave the file position at the
+  // end of the data as a sequence of write() calls would have
+  lseek(fd_, offset_, SEEK_SET);
+  io_uring_queue_exit(&ring_);
+}
+
+bool
+IoUringSink::init() {
+  const int ret = io_uring_queue_init(depth_, &ring_, 0);
+  if (ret < 0) {
+    LOG(WARNING) << folly::format(
+        "io_uring_queue_init failed: {}", folly::errnoStr(-ret));
+    return false;
+  }
+  ringInitialized_ = true;
+
+  for (uint32_t i = 0; i < depth_; i++) {
+    buffers_.emplace_back(new char[bufferSize_]);
+    iovecs_.push_back({buffers_.back().get(), bufferSize_});
+    freeBuffers_.push_back(depth_ - 1 - i);
+  }
+  const int reg = io_uring_register_buffers(&ring_, iovecs_.data(), depth_);
+  if (reg < 0) {
+    LOG(WARNING) << folly::format(
+        "io_uring_register_buffers failed: {}", folly::errnoStr(-reg));
+    io_uring_queue_exit(&ring_);
+    ringInitialized_ = false;
+    return false;
+  }
+  return true;
+}
+
+char*
+IoUringSink::getBuffer() {
+  // collect finished writes without blocking
+  while (inFlight_ && reap(false)) {
+  }
+  while (freeBuffers_.empty()) {
+    reap(true);
+  }
+  const auto index = freeBuffers_.back();
+  freeBuffers_.pop_back();
+  return buffers_[index].get();
+}
+
+void
+IoUringSink::submit(char* buf, size_t size) {
+  uint32_t index = 0;
+  while (buffers_[index].get() != buf) {
+    index++;
+    CHECK_LT(index, depth_) << "buffer not owned by this sink";
+  }
+  if (size == 0) {
+    freeBuffers_.push_back(index);
+    return;
+  }
+  writes_[index] = Write{offset_, size, 0};
+  offset_ += size;
+  inFlight_++;
+  queueWrite(index);
+}
+
+void
+IoUringSink::drain() {
+  while (inFlight_) {
+    reap(true);
+  }
+}
+
+void
+IoUringSink::queueWrite(uint32_t index) {
+  const auto& write = writes_[index];
+  struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+  // at most depth_ writes are in flight, and the ring has depth_ entries
+  CHECK(sqe != nullptr);
+  io_uring_prep_write_fixed(
+      sqe,
+      fd_,
+      buffers_[index].get() + write.written,
+      write.size - write.written,
+      write.offset + write.written,
+      index);
+  io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(uintptr_t(index)));
+  const int ret = io_uring_submit(&ring_);
+  CHECK_EQ(1, ret) << folly::format(
+      "io_uring_submit failed: {}", folly::errnoStr(-ret));
+}
+
+bool
+IoUringSink::reap(bool wait) {
+  struct io_uring_cqe* cqe = nullptr;
+  const int ret =
+      wait ? io_uring_wait_cqe(&ring_, &cqe) : io_uring_peek_cqe(&ring_, &cqe);
+  if (ret == -EAGAIN || ret == -EINTR) {
+    return false;
+  }
+  CHECK_EQ(0, ret) << folly::format(
+      "Waiting for io_uring completion failed: {}", folly::errnoStr(-ret));
+  const auto index =
+      static_cast<uint32_t>(reinterpret_cast<uintptr_t>(
+          io_uring_cqe_get_data(cqe)));
+  const int res = cqe->res;
+  io_uring_cqe_seen(&ring_, cqe);
+
+  CHECK_GE(res, 0) << folly::format(
+      "io_uring write to output failed: {}", folly::errnoStr(-res));
+  auto& write = writes_[index];
+  write.written += res;
+  if (write.written < write.size) {
+    // short write (e.g. disk full is reported on the retry), send the rest
+    CHECK_GT(res, 0);
+    queueWrite(index);
+    return true;
+  }
+  inFlight_--;
+  freeBuffers_.push_back(index);
+  return true;
+}
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <liburing.h>
+#include <src/common/OutputSink.h>
+#include <sys/uio.h>
+#include <memory>
+#include <vector>
+
+namespace paths {
+namespace common {
+
+/**
+ * Writes buffers to a regular file with io_uring.
+ *
+ * depth buffers are registered with the ring (IORING_REGISTER_BUFFERS) and
+ * written with IORING_OP_WRITE_FIXED at explicit file offsets, so up to
+ * depth writes are in flight while the writer fills the next buffer.
+ * Completions are reaped without blocking whenever a buffer is requested;
+ * getBuffer() waits only when every buffer is in flight.
+ */
+class IoUringSink : public OutputSink {
+ public:
+  /**
+   * Returns nullptr if fd is not a regular file or io_uring is not
+   * available (kernel < 5.1, or disabled).
+   */
+  static std::unique_ptr<IoUringSink>
+  create(int fd, size_t bufferSize, uint32_t depth);
+
+  ~IoUringSink() override;
+
+  char* getBuffer() override;
+
+  void submit(char* buf, size_t size) override;
+
+  void drain() override;
+
+ private:
+  struct Write {
+    off_t offset;
+    size_t size;
+    size_t written;
+  };
+
+  IoUringSink(int fd, size_t bufferSize, uint32_t depth, off_t offset);
+
+  bool init();
+
+  void queueWrite(uint32_t index);
+
+  // handles one completion; waits for it if wait is set
+  bool reap(bool wait);
+
+  const int fd_;
+  const uint32_t depth_;
+  off_t offset_;
+
+  struct io_uring ring_;
+  bool ringInitialized_{false};
+  std::vector<std::unique_ptr<char[]>> buffers_;
+  std::vector<struct iovec> iovecs_;
+  std::vector<Write> writes_;
+  std::vector<uint32_t> freeBuffers_;
+  uint32_t inFlight_{0};
+};
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,74 @@
+#include "JsonRowEncoder.h"
+
+#include <src/common/CsvRowEncoder.h>
+
+namespace paths {
+namespace common {
+
+JsonRowEncoder::JsonRowEncoder(size_t initialCapacity) {
+  buf_.reserve(initialCapacity);
+  clear();
+}
+
+std::string
+JsonRowEncoder::makeKey(folly::StringPiece name) {
+  std::string key;
+  key.push_back('"');
+  appendEscaped(name, key);
+  key.append("\":");
+  return key;
+}
+
+void
+JsonRowEncoder::addAddress(const struct sockaddr_storage* sas) {
+  char tmp[kMaxFormattedAddressLength];
+  const auto len = formatAddress(sas, tmp);
+  if (len == 0) {
+    addString("<uninitialized address>");
+    return;
+  }
+  // addresses never need escaping
+  buf_.push_back('"');
+  buf_.append(tmp, len);
+  buf_.push_back('"');
+}
+
+void
+JsonRowEncoder::appendEscaped(folly::StringPiece value, std::string& out) {
+  static constexpr char kHex[] = "0123456789abcdef";
+  auto runStart = value.begin();
+  for (auto it = value.begin(); it != value.end(); ++it) {
+    const unsigned char c = *it;
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    out.append(runStart, it);
+    runStart = it + 1;
+    switch (c) {
+    case '"':
+      out.append("\\\"");
+      break;
+    case '\\':
+      out.append("\\\\");
+      break;
+    case '\n':
+      out.append("\\n");
+      break;
+    case '\r':
+      out.append("\\r");
+      break;
+    case '\t':
+      out.append("\\t");
+      break;
+    default: {
+      const char escaped[] = {
+          '\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 0xf]};
+      out.append(escaped, sizeof(escaped));
+    }
+    }
+  }
+  out.append(runStart, value.end());
+}
+
+} // namespace common
+} // namespace paths
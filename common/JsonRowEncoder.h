@@ -0,0 +1,99 @@
+#pragma once
+
+#include <folly/Range.h>
+#include <sys/socket.h>
+#include <charconv>
+#include <string>
+#include <type_traits>
+
+namespace paths {
+namespace common {
+
+/**
+ * Encodes one JSON object per row into a buffer that is reused across rows.
+ *
+ * The counterpart of CsvRowEncoder for JSON lines: numbers are written with
+ * std::to_chars as JSON numbers, strings are escaped in place, and keys are
+ * escaped once up front (makeKey), so encoding a row builds no DOM and, once
+ * the buffer has grown, performs no heap allocations. The row is not newline
+ * terminated.
+ *
+ * Usage:
+ *   const auto key = JsonRowEncoder::makeKey("event_ns");  // once
+ *   encoder.clear();
+ *   encoder.addKey(key);
+ *   encoder.add(ev.header.ev_tstamp_ns);
+ *   write(encoder.finish());
+ */
+class JsonRowEncoder {
+ public:
+  explicit JsonRowEncoder(size_t initialCapacity = 2048);
+
+  /**
+   * Returns the escaped, quoted key followed by a colon, for addKey().
+   */
+  static std::string makeKey(folly::StringPiece name);
+
+  void clear() {
+    buf_.clear();
+    buf_.push_back('{');
+    fields_ = 0;
+  }
+
+  /**
+   * Starts a member; key must come from makeKey().
+   */
+  void addKey(folly::StringPiece key) {
+    if (fields_++ > 0) {
+      buf_.push_back(',');
+    }
+    buf_.append(key.data(), key.size());
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value>::type add(T value) {
+    char tmp[24]; // fits any 64-bit integer with sign
+    const auto res = std::to_chars(tmp, tmp + sizeof(tmp), value);
+    buf_.append(tmp, res.ptr - tmp);
+  }
+
+  void add(bool value) {
+    buf_.append(value ? "true" : "false");
+  }
+
+  void addNull() {
+    buf_.append("null");
+  }
+
+  /**
+   * Appends a quoted string, escaping quotes, backslashes and control
+   * characters.
+   */
+  void addString(folly::StringPiece value) {
+    buf_.push_back('"');
+    appendEscaped(value, buf_);
+    buf_.push_back('"');
+  }
+
+  /**
+   * Appends an address as a string, in the format of CsvRowEncoder.
+   */
+  void addAddress(const struct sockaddr_storage* sas);
+
+  /**
+   * Closes the object and returns the row.
+   */
+  const std::string& finish() {
+    buf_.push_back('}');
+    return buf_;
+  }
+
+ private:
+  static void appendEscaped(folly::StringPiece value, std::string& out);
+
+  std::string buf_;
+  size_t fields_{0};
+};
+
+} // namespace common
+} // namespace paths
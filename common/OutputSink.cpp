@@ -0,0 +1,128 @@
+#include "OutputSink.h"
+
+#include <folly/FileUtil.h>
+#include <folly/Format.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <src/common/CompressingSink.h>
+#include <src/common/IoUringSink.h>
+
+static bool
+ValidateOutputSink(const char* flagname, const std::string& value) {
+  if (value != "write" && value != "io_uring") {
+    LOG(ERROR) << folly::format("--{} must be write or io_uring", flagname);
+    return false;
+  }
+  return true;
+}
+
+DEFINE_string(
+    output_sink,
+    "write",
+    "How exported data is written: write (blocking write calls) or io_uring "
+    "(asynchronous writes from registered buffers, regular files only; "
+    "falls back to write if unavailable)");
+DEFINE_uint32(
+    output_io_uring_depth,
+    4,
+    "Number of registered buffers, and thus writes in flight, of the "
+    "io_uring output sink");
+DEFINE_validator(output_sink, &ValidateOutputSink);
+
+static bool
+ValidateOutputCompression(const char* flagname, const std::string& value) {
+  if (value != "none" && value != "zstd" && value != "lz4") {
+    LOG(ERROR) << folly::format("--{} must be none, zstd or lz4", flagname);
+    return false;
+  }
+  return true;
+}
+
+DEFINE_string(
+    output_compression,
+    "none",
+    "Compress exported data: none, zstd or lz4. Output is a sequence of "
+    "independent frames that zstd -d / lz4 -d decompress as one file");
+DEFINE_int32(
+    output_compression_level,
+    0,
+    "Compression level (0 uses the zstd or lz4 default)");
+DEFINE_uint32(
+    output_frame_bytes,
+    8 << 20,
+    "A compressed frame is closed after this many uncompressed bytes");
+DEFINE_uint32(
+    output_frame_interval_ms,
+    10000,
+    "A compressed frame is closed after being open this long (checked on "
+    "every --output_flush_interval_ms); a crash loses at most the open "
+    "frame");
+DEFINE_uint32(
+    output_compression_threads,
+    0,
+    "Compress frames of --output_frame_bytes on this many worker threads, "
+    "written in order (0 compresses on the thread flushing the output)");
+DEFINE_uint32(
+    output_compression_inflight_bytes,
+    64 << 20,
+    "With --output_compression_threads, maximum uncompressed bytes waiting "
+    "to be compressed or written; the writer waits for the oldest frame "
+    "beyond that");
+DEFINE_validator(output_compression, &ValidateOutputCompression);
+
+namespace paths {
+namespace common {
+
+std::unique_ptr<OutputSink>
+OutputSink::createFromFlags(int fd, size_t bufferSize) {
+  std::unique_ptr<OutputSink> sink;
+  if (FLAGS_output_sink == "io_uring") {
+    sink = IoUringSink::create(
+        fd, bufferSize, std::max(1U, FLAGS_output_io_uring_depth));
+    if (!sink) {
+      LOG(WARNING) << "io_uring output sink unavailable, using write";
+    }
+  }
+  if (!sink) {
+    sink = std::make_unique<WriteSink>(fd, bufferSize);
+  }
+
+  if (FLAGS_output_compression != "none") {
+    CompressingSink::Options options;
+    options.compression = FLAGS_output_compression == "zstd"
+        ? Compression::ZSTD
+        : Compression::LZ4;
+    options.level = FLAGS_output_compression_level;
+    options.frameBytes = std::max(1U, FLAGS_output_frame_bytes);
+    options.frameInterval =
+        std::chrono::milliseconds(FLAGS_output_frame_interval_ms);
+    if (FLAGS_output_compression_threads > 0) {
+      sink = std::make_unique<ParallelCompressingSink>(
+          std::move(sink),
+          bufferSize,
+          options,
+          FLAGS_output_compression_threads,
+          FLAGS_output_compression_inflight_bytes);
+    } else {
+      sink = std::make_unique<CompressingSink>(
+          std::move(sink), bufferSize, options);
+    }
+  }
+  return sink;
+}
+
+WriteSink::WriteSink(int fd, size_t bufferSize)
+    : OutputSink(bufferSize), fd_(fd), buf_(bufferSize) {}
+
+char*
+WriteSink::getBuffer() {
+  return buf_.data();
+}
+
+void
+WriteSink::submit(char* buf, size_t size) {
+  CHECK_EQ(size, folly::writeFull(fd_, buf, size));
+}
+
+} // namespace common
+} // namespace paths
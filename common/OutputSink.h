@@ -0,0 +1,79 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+namespace paths {
+namespace common {
+
+/**
+ * Destination of the buffers filled by BufferedWriter.
+ *
+ * The writer fills a buffer obtained from getBuffer() and hands it back
+ * with submit(); the sink owns the buffer again from then on, so that it
+ * can keep it until an asynchronous write completes.
+ */
+class OutputSink {
+ public:
+  explicit OutputSink(size_t bufferSize) : bufferSize_(bufferSize) {}
+
+  virtual ~OutputSink() = default;
+
+  /**
+   * Creates the sink selected by --output_sink for fd, falling back to
+   * plain writes if it is unavailable.
+   */
+  static std::unique_ptr<OutputSink> createFromFlags(
+      int fd,
+      size_t bufferSize);
+
+  /**
+   * Returns an empty buffer of getBufferSize() bytes. May wait for an
+   * earlier write to complete.
+   */
+  virtual char* getBuffer() = 0;
+
+  /**
+   * Writes the first size bytes of a buffer returned by getBuffer().
+   */
+  virtual void submit(char* buf, size_t size) = 0;
+
+  /**
+   * Waits until everything submitted so far has been written.
+   */
+  virtual void drain() = 0;
+
+  /**
+   * Called on every periodic flush of the writer, even if nothing was
+   * written, for sinks with time-based policies.
+   */
+  virtual void timerTick() {}
+
+  size_t getBufferSize() const {
+    return bufferSize_;
+  }
+
+ protected:
+  const size_t bufferSize_;
+};
+
+/**
+ * Writes each buffer synchronously with write(2).
+ */
+class WriteSink : public OutputSink {
+ public:
+  WriteSink(int fd, size_t bufferSize);
+
+  char* getBuffer() override;
+
+  void submit(char* buf, size_t size) override;
+
+  void drain() override {}
+
+ private:
+  const int fd_;
+  std::vector<char> buf_;
+};
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,144 @@
+/**
+ * Throughput of BufferedWriter with the write and io_uring output sinks,
+ * and with zstd compression.
+ *
+ * Each iteration writes one 200 byte line (about the size of an rtttrace
+ * row) to a file in --benchmark_dir; compare the bytes/sec of the two
+ * benchmarks, e.g.:
+ *   buck run //src/common:OutputSinkBenchmark -- \
+ *       --benchmark_dir=/data/tmp --bm_min_usec=2000000
+ *
+ * The zstd benchmarks write CSV-like lines with --output_compression=zstd
+ * at --benchmark_zstd_level, compressed on the flushing thread and on 2 and
+ * 4 worker threads (--output_compression_threads).
+ */
+#include <src/common/BufferedWriter.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <folly/Benchmark.h>
+#include <folly/Format.h>
+#include <folly/init/Init.h>
+#include <gflags/gflags.h>
+
+DEFINE_string(
+    benchmark_dir,
+    "/tmp",
+    "Directory for the files written by the benchmark (use the disk the "
+    "collectors export to)");
+DEFINE_int32(
+    benchmark_zstd_level,
+    9,
+    "Compression level of the zstd benchmarks");
+
+DECLARE_string(output_sink);
+DECLARE_string(output_compression);
+DECLARE_int32(output_compression_level);
+DECLARE_uint32(output_compression_threads);
+
+namespace {
+
+const std::string kLine(199, 'x');
+
+// rows of random numbers and addresses, which compress about as well as
+// the collectors' CSV output
+std::vector<std::string>
+makeLines() {
+  std::mt19937 rng(1);
+  std::vector<std::string> lines;
+  for (size_t i = 0; i < 4096; i++) {
+    lines.push_back(folly::sformat(
+        "{},{},10.1.{}.{}:{},{},{},{}",
+        1571234567890123456ULL + rng() % 1000000,
+        rng() % 65536,
+        rng() % 256,
+        rng() % 256,
+        rng() % 65536,
+        rng() % 1000000,
+        rng() % 100,
+        rng()));
+  }
+  return lines;
+}
+
+void
+runSink(const std::string& sink, size_t iters) {
+  std::unique_ptr<paths::common::BufferedWriter> writer;
+  std::string path;
+  BENCHMARK_SUSPEND {
+    FLAGS_output_sink = sink;
+    path = folly::sformat(
+        "{}/OutputSinkBenchmark.{}", FLAGS_benchmark_dir, sink);
+    writer = paths::common::BufferedWriter::createFromFlags(
+        folly::File(path.c_str(), O_WRONLY | O_TRUNC | O_CREAT));
+  }
+  for (size_t i = 0; i < iters; i++) {
+    writer->writeLine(kLine);
+  }
+  // includes waiting for the writes still in flight
+  writer.reset();
+  BENCHMARK_SUSPEND {
+    unlink(path.c_str());
+  }
+}
+
+void
+runCompression(uint32_t threads, size_t iters) {
+  std::unique_ptr<paths::common::BufferedWriter> writer;
+  std::vector<std::string> lines;
+  std::string path;
+  BENCHMARK_SUSPEND {
+    lines = makeLines();
+    FLAGS_output_sink = "write";
+    FLAGS_output_compression = "zstd";
+    FLAGS_output_compression_level = FLAGS_benchmark_zstd_level;
+    FLAGS_output_compression_threads = threads;
+    path = folly::sformat(
+        "{}/OutputSinkBenchmark.zstd{}", FLAGS_benchmark_dir, threads);
+    writer = paths::common::BufferedWriter::createFromFlags(
+        folly::File(path.c_str(), O_WRONLY | O_TRUNC | O_CREAT));
+  }
+  for (size_t i = 0; i < iters; i++) {
+    writer->writeLine(lines[i % lines.size()]);
+  }
+  // includes compressing and writing the frames still in flight
+  writer.reset();
+  BENCHMARK_SUSPEND {
+    FLAGS_output_compression = "none";
+    FLAGS_output_compression_threads = 0;
+    unlink(path.c_str());
+  }
+}
+
+} // namespace
+
+BENCHMARK(writeSink, iters) {
+  runSink("write", iters);
+}
+
+BENCHMARK_RELATIVE(ioUringSink, iters) {
+  runSink("io_uring", iters);
+}
+
+BENCHMARK(zstdInline, iters) {
+  runCompression(0, iters);
+}
+
+BENCHMARK_RELATIVE(zstdThreads2, iters) {
+  runCompression(2, iters);
+}
+
+BENCHMARK_RELATIVE(zstdThreads4, iters) {
+  runCompression(4, iters);
+}
+
+int
+main(int argc, char* argv[]) {
+  folly::init(&argc, &argv);
+  folly::runBenchmarks();
+  return 0;
+}
@@ -0,0 +1,428 @@
+#include "PrefixMatcher.h"
+
+#include <netinet/in.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include <folly/Bits.h>
+#include <folly/FileUtil.h>
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <glog/logging.h>
+
+DEFINE_string(
+    client_prefixes_file,
+    "",
+    "File of monitored client prefixes, IPv4 and IPv6, one per line; a line "
+    "starting with ! excludes the prefix (events are exported if the longest "
+    "prefix containing the client is included). Replaces --client_prefix");
+
+namespace paths {
+namespace common {
+
+namespace {
+
+constexpr size_t kFanout = 256;
+
+// terminal nodes, whose entries point to themselves
+constexpr uint32_t kNoMatch = 0;
+constexpr uint32_t kIncluded = 1;
+constexpr uint32_t kExcluded = 2;
+constexpr uint32_t kTerminals = 3;
+
+// set by PrefixMatcher::next() when it returns a leaf instead of a node
+constexpr uint32_t kLeaf = uint32_t(1) << 31;
+
+// addresses looked up together by matchBatch()
+constexpr size_t kBatchLanes = 16;
+
+const uint8_t kV4MappedPrefix[12] =
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+struct Prefix {
+  uint8_t key[16];
+  uint8_t bits;
+  uint32_t terminal;
+};
+
+void
+addPrefixes(
+    const std::vector<folly::CIDRNetwork>& networks,
+    uint32_t terminal,
+    std::vector<Prefix>& prefixes) {
+  for (const auto& network : networks) {
+    Prefix prefix;
+    memset(prefix.key, 0, sizeof(prefix.key));
+    if (network.first.isV4()) {
+      memcpy(prefix.key, kV4MappedPrefix, sizeof(kV4MappedPrefix));
+      memcpy(prefix.key + 12, network.first.bytes(), 4);
+      prefix.bits = 96 + std::min<uint8_t>(network.second, 32);
+    } else {
+      memcpy(prefix.key, network.first.bytes(), 16);
+      prefix.bits = std::min<uint8_t>(network.second, 128);
+    }
+    prefix.terminal = terminal;
+    prefixes.push_back(prefix);
+  }
+}
+
+// address family and bytes of a sockaddr_in or sockaddr_in6, which may be
+// unaligned; false for other families
+bool
+readSockaddr(const void* addr, uint8_t* key, bool& v4) {
+  sa_family_t family;
+  memcpy(&family, addr, sizeof(family));
+  const auto bytes = static_cast<const char*>(addr);
+  if (family == AF_INET) {
+    memcpy(key, kV4MappedPrefix, sizeof(kV4MappedPrefix));
+    memcpy(key + 12, bytes + offsetof(struct sockaddr_in, sin_addr), 4);
+    v4 = true;
+    return true;
+  }
+  if (family == AF_INET6) {
+    memcpy(key, bytes + offsetof(struct sockaddr_in6, sin6_addr), 16);
+    v4 = memcmp(key, kV4MappedPrefix, sizeof(kV4MappedPrefix)) == 0;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * The trie before compression: each node is an array of 256 node indices,
+ * one per value of the next address byte, and the terminal nodes point to
+ * themselves.
+ */
+class TrieBuilder {
+ public:
+  TrieBuilder() {
+    for (uint32_t terminal = 0; terminal < kTerminals; terminal++) {
+      addNode(terminal);
+    }
+    root = addNode(kNoMatch);
+  }
+
+  // key is a 16 byte IPv6 (or IPv4-mapped) address
+  void
+  insert(const uint8_t* key, uint8_t bits, uint32_t terminal) {
+    // walk (or create) the nodes of the bytes the prefix covers fully
+    uint32_t node = root;
+    size_t depth = 0;
+    for (; bits > 8 * (depth + 1); depth++) {
+      node = getChild(node, key[depth]);
+    }
+    // expand the remaining bits to all the entries they cover
+    const uint8_t spare = 8 * (depth + 1) - bits;
+    const size_t begin = (key[depth] >> spare) << spare;
+    for (size_t i = begin; i < begin + (size_t(1) << spare); i++) {
+      fill(node * kFanout + i, terminal);
+    }
+  }
+
+  // the node of the entry of byte in node, created if it is terminal
+  uint32_t
+  getChild(uint32_t node, uint8_t byte) {
+    const size_t entry = node * kFanout + byte;
+    if (nodes[entry] < kTerminals) {
+      // leaf pushing: the new node inherits the match of its entry
+      const auto child = addNode(nodes[entry]);
+      nodes[entry] = child;
+    }
+    return nodes[entry];
+  }
+
+  std::vector<uint32_t> nodes;
+  uint32_t root;
+
+ private:
+  uint32_t
+  addNode(uint32_t fill) {
+    const uint32_t node = nodes.size() / kFanout;
+    nodes.resize(nodes.size() + kFanout, fill);
+    return node;
+  }
+
+  // sets the entry, or every terminal entry below it, to terminal
+  void
+  fill(size_t entry, uint32_t terminal) {
+    const auto child = nodes[entry];
+    if (child < kTerminals) {
+      nodes[entry] = terminal;
+      return;
+    }
+    for (size_t i = 0; i < kFanout; i++) {
+      fill(child * kFanout + i, terminal);
+    }
+  }
+};
+
+} // namespace
+
+std::unique_ptr<PrefixMatcher>
+PrefixMatcher::create(
+    const std::vector<folly::CIDRNetwork>& include,
+    const std::vector<folly::CIDRNetwork>& exclude) {
+  std::unique_ptr<PrefixMatcher> matcher(new PrefixMatcher());
+  TrieBuilder builder;
+
+  // with shorter prefixes first, a prefix only has to overwrite what it
+  // covers; excluded prefixes go after the same prefixes included
+  std::vector<Prefix> prefixes;
+  addPrefixes(include, kIncluded, prefixes);
+  addPrefixes(exclude, kExcluded, prefixes);
+  std::stable_sort(
+      prefixes.begin(), prefixes.end(), [](const auto& a, const auto& b) {
+        return a.bits < b.bits ||
+            (a.bits == b.bits && a.terminal < b.terminal);
+      });
+  for (const auto& prefix : prefixes) {
+    builder.insert(prefix.key, prefix.bits, prefix.terminal);
+  }
+
+  // the node of ::ffff:0:0/96, where IPv4 addresses start
+  uint32_t v4Root = builder.root;
+  for (const auto byte : kV4MappedPrefix) {
+    v4Root = builder.getChild(v4Root, byte);
+  }
+
+  // compress the nodes breadth first, so that the children of each node are
+  // contiguous; order[i] is the builder node of nodes_[i]
+  std::vector<uint32_t> order{builder.root};
+  uint32_t v4Node = 0;
+  for (size_t i = 0; i < order.size(); i++) {
+    if (order[i] == v4Root) {
+      v4Node = i;
+    }
+    Node node;
+    memset(&node, 0, sizeof(node));
+    node.childBase = order.size();
+    node.leafBase = matcher->leaves_.size();
+    uint32_t leaf = kTerminals;
+    for (size_t byte = 0; byte < kFanout; byte++) {
+      const uint64_t bit = uint64_t(1) << (byte % 64);
+      const auto entry = builder.nodes[order[i] * kFanout + byte];
+      if (entry >= kTerminals) {
+        node.childBits[byte / 64] |= bit;
+        order.push_back(entry);
+      } else if (entry != leaf) {
+        node.leafBits[byte / 64] |= bit;
+        matcher->leaves_.push_back(entry);
+        leaf = entry;
+      }
+    }
+    for (size_t word = 1; word < 4; word++) {
+      node.childRank[word] =
+          node.childRank[word - 1] + folly::popcount(node.childBits[word - 1]);
+      node.leafRank[word] =
+          node.leafRank[word - 1] + folly::popcount(node.leafBits[word - 1]);
+    }
+    matcher->nodes_.push_back(node);
+  }
+  matcher->root_ = 0;
+
+  // lookups of IPv4 addresses start from the node or leaf of their first
+  // two bytes
+  matcher->v4Direct_.resize(kFanout * kFanout);
+  for (size_t i = 0; i < matcher->v4Direct_.size(); i++) {
+    uint32_t node = matcher->next(v4Node, i >> 8);
+    if (!(node & kLeaf)) {
+      node = matcher->next(node, i & 0xff);
+    }
+    matcher->v4Direct_[i] = node;
+  }
+
+  if (include.size() == 1 && exclude.empty()) {
+    matcher->description_ =
+        folly::IPAddress::networkToString(include.front());
+  } else {
+    matcher->description_ = folly::sformat(
+        "{} prefixes ({} excluded)",
+        include.size() + exclude.size(),
+        exclude.size());
+  }
+  return matcher;
+}
+
+std::unique_ptr<PrefixMatcher>
+PrefixMatcher::parse(folly::StringPiece text, std::string& error) {
+  std::vector<folly::StringPiece> lines;
+  folly::split('\n', text, lines);
+  std::vector<folly::CIDRNetwork> include;
+  std::vector<folly::CIDRNetwork> exclude;
+  for (size_t i = 0; i < lines.size(); i++) {
+    auto line = lines[i];
+    const auto comment = line.find('#');
+    if (comment != folly::StringPiece::npos) {
+      line = line.subpiece(0, comment);
+    }
+    line = folly::trimWhitespace(line);
+    if (line.empty()) {
+      continue;
+    }
+    auto& networks = line.front() == '!' ? exclude : include;
+    if (line.front() == '!') {
+      line = folly::trimWhitespace(line.subpiece(1));
+    }
+    const auto network = folly::IPAddress::tryCreateNetwork(line);
+    if (network.hasError()) {
+      error = folly::sformat("line {}: {} is not a prefix", i + 1, line);
+      return nullptr;
+    }
+    networks.push_back(network.value());
+  }
+  return create(include, exclude);
+}
+
+std::unique_ptr<PrefixMatcher>
+PrefixMatcher::createFromFlags(const std::string& clientPrefix) {
+  if (FLAGS_client_prefixes_file.empty()) {
+    return create({folly::IPAddress::createNetwork(clientPrefix)}, {});
+  }
+  std::string text;
+  if (not folly::readFile(FLAGS_client_prefixes_file.c_str(), text)) {
+    LOG(ERROR) << folly::format(
+        "Unable to read --client_prefixes_file {}",
+        FLAGS_client_prefixes_file);
+    return nullptr;
+  }
+  std::string error;
+  auto matcher = parse(text, error);
+  if (!matcher) {
+    LOG(ERROR) << folly::format(
+        "Invalid --client_prefixes_file {}: {}",
+        FLAGS_client_prefixes_file,
+        error);
+    return nullptr;
+  }
+  LOG(INFO) << folly::format(
+      "Loaded {} from {}, {} bytes of lookup tables",
+      matcher->describe(),
+      FLAGS_client_prefixes_file,
+      matcher->getMemoryBytes());
+  return matcher;
+}
+
+bool
+PrefixMatcher::match(const folly::IPAddress& addr) const {
+  if (addr.isV4()) {
+    return lookupV4(addr.bytes());
+  }
+  if (addr.isV6()) {
+    return lookupV6(addr.bytes());
+  }
+  return false;
+}
+
+bool
+PrefixMatcher::match(const struct sockaddr* addr) const {
+  uint8_t key[16];
+  bool v4;
+  if (not readSockaddr(addr, key, v4)) {
+    return false;
+  }
+  return v4 ? lookupV4(key + 12) : lookupV6(key);
+}
+
+void
+PrefixMatcher::matchBatch(
+    const void* addrs,
+    size_t stride,
+    size_t count,
+    bool* matches) const {
+  const auto bytes = static_cast<const char*>(addrs);
+  // IPv4 address bytes of each lane
+  const uint8_t* keys[kBatchLanes];
+  uint32_t lanes[kBatchLanes];
+  size_t first = 0;
+  for (; first + kBatchLanes <= count; first += kBatchLanes) {
+    bool allV4 = true;
+    for (size_t i = 0; i < kBatchLanes && allV4; i++) {
+      const auto addr = bytes + (first + i) * stride;
+      sa_family_t family;
+      memcpy(&family, addr, sizeof(family));
+      const auto sin6Addr = reinterpret_cast<const uint8_t*>(
+          addr + offsetof(struct sockaddr_in6, sin6_addr));
+      if (family == AF_INET) {
+        keys[i] = reinterpret_cast<const uint8_t*>(
+            addr + offsetof(struct sockaddr_in, sin_addr));
+      } else if (
+          family == AF_INET6 &&
+          memcmp(sin6Addr, kV4MappedPrefix, sizeof(kV4MappedPrefix)) == 0) {
+        keys[i] = sin6Addr + 12;
+      } else {
+        allV4 = false;
+      }
+    }
+    if (!allV4) {
+      // IPv6 addresses take 16 levels: not worth a lockstep walk
+      for (size_t i = 0; i < kBatchLanes; i++) {
+        matches[first + i] = match(reinterpret_cast<const struct sockaddr*>(
+            bytes + (first + i) * stride));
+      }
+      continue;
+    }
+    for (size_t i = 0; i < kBatchLanes; i++) {
+      lanes[i] = v4Direct_[keys[i][0] << 8 | keys[i][1]];
+    }
+    for (size_t depth = 2; depth < 4; depth++) {
+      for (size_t i = 0; i < kBatchLanes; i++) {
+        if (!(lanes[i] & kLeaf)) {
+          lanes[i] = next(lanes[i], keys[i][depth]);
+        }
+      }
+    }
+    for (size_t i = 0; i < kBatchLanes; i++) {
+      matches[first + i] = lanes[i] == (kLeaf | kIncluded);
+    }
+  }
+  for (; first < count; first++) {
+    matches[first] = match(
+        reinterpret_cast<const struct sockaddr*>(bytes + first * stride));
+  }
+}
+
+uint32_t
+PrefixMatcher::next(uint32_t node, uint8_t byte) const {
+  const auto& n = nodes_[node];
+  const size_t word = byte / 64;
+  const uint64_t bit = uint64_t(1) << (byte % 64);
+  if (n.childBits[word] & bit) {
+    return n.childBase + n.childRank[word] +
+        folly::popcount(n.childBits[word] & (bit - 1));
+  }
+  // the run of leaves that byte is in started at the last leaf bit up to it
+  const auto run = n.leafRank[word] +
+      folly::popcount(n.leafBits[word] & (bit | (bit - 1))) - 1;
+  return kLeaf | leaves_[n.leafBase + run];
+}
+
+bool
+PrefixMatcher::lookupV4(const uint8_t* addr) const {
+  uint32_t node = v4Direct_[addr[0] << 8 | addr[1]];
+  for (size_t i = 2; i < 4 && !(node & kLeaf); i++) {
+    node = next(node, addr[i]);
+  }
+  return node == (kLeaf | kIncluded);
+}
+
+bool
+PrefixMatcher::lookupV6(const uint8_t* addr) const {
+  uint32_t node = root_;
+  for (size_t i = 0; i < 16 && !(node & kLeaf); i++) {
+    node = next(node, addr[i]);
+  }
+  return node == (kLeaf | kIncluded);
+}
+
+bool
+validateClientPrefix(const char* flagname, const std::string& pfx) {
+  const auto cidrnetExpect = folly::IPAddress::tryCreateNetwork(pfx);
+  if (cidrnetExpect.hasError()) {
+    LOG(ERROR) << folly::format("{} is not a prefix", flagname);
+    return false;
+  }
+  return true;
+}
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <folly/IPAddress.h>
+#include <folly/Range.h>
+#include <gflags/gflags.h>
+#include <sys/socket.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+DECLARE_string(client_prefixes_file);
+
+namespace paths {
+namespace common {
+
+/**
+ * Set of client prefixes, IPv4 and IPv6, built once from include and
+ * exclude lists. An address matches if the longest prefix that contains it
+ * is included, so that excluded prefixes carve holes in included ones (and
+ * the other way around); an excluded prefix wins over the same prefix
+ * included. IPv4 addresses, and IPv4-mapped IPv6 addresses, are matched as
+ * IPv4-mapped addresses: they are in the IPv6 prefixes that contain
+ * ::ffff:0:0/96.
+ *
+ * The prefixes are compiled into a multibit trie of 8-bit strides with
+ * leaf pushing, stored compressed as in Poptrie: for each value of the next
+ * address byte, a node has either a child node or a leaf (the match of all
+ * the addresses below), marked in two 256-bit bitmaps. Children are stored
+ * contiguously, and so are leaves, runs of equal leaves sharing one; an
+ * entry is found from the popcount of the bitmap below it. Also as in
+ * Poptrie, a direct table (256 KiB) maps the first 16 bits of IPv4
+ * addresses to their node or leaf. A lookup is then at most one node per
+ * remaining address byte (2 for IPv4, 16 for IPv6), stopping at the first
+ * leaf. Nodes take 80 bytes plus a byte per leaf run; a prefix of n bits
+ * adds at most (n - 1) / 8 of them (IPv4 prefixes count 96 bits more). The
+ * trie is built uncompressed (1 KiB per node) first.
+ */
+class PrefixMatcher {
+ public:
+  static std::unique_ptr<PrefixMatcher> create(
+      const std::vector<folly::CIDRNetwork>& include,
+      const std::vector<folly::CIDRNetwork>& exclude);
+
+  /**
+   * Parses a prefix list: one prefix per line, excluded if it starts with
+   * '!'; '#' starts a comment. Returns nullptr, with a message in error, if
+   * a prefix cannot be parsed.
+   */
+  static std::unique_ptr<PrefixMatcher> parse(
+      folly::StringPiece text,
+      std::string& error);
+
+  /**
+   * The prefixes of --client_prefixes_file if it is set, else clientPrefix
+   * (--client_prefix). Returns nullptr if the file cannot be read or parsed.
+   */
+  static std::unique_ptr<PrefixMatcher> createFromFlags(
+      const std::string& clientPrefix);
+
+  bool match(const folly::IPAddress& addr) const;
+
+  /**
+   * Matches a struct sockaddr_in or sockaddr_in6, such as the endpoints of
+   * bpf events; false for other address families.
+   */
+  bool match(const struct sockaddr* addr) const;
+
+  /**
+   * Matches count addresses (as match(const struct sockaddr*)) stored
+   * stride bytes apart, e.g. &events[0].header.dst and sizeof(events[0])
+   * for the destinations of a batch of events; sets matches[i] for the i-th.
+   *
+   * Addresses are looked up in groups, one trie level at a time across the
+   * group, so that the loads of different addresses overlap instead of
+   * each lookup waiting for its own.
+   */
+  void matchBatch(
+      const void* addrs,
+      size_t stride,
+      size_t count,
+      bool* matches) const;
+
+  /**
+   * The prefix, for a single included one, else the number of prefixes.
+   */
+  const std::string& describe() const {
+    return description_;
+  }
+
+  size_t getMemoryBytes() const {
+    return nodes_.size() * sizeof(nodes_[0]) + leaves_.size() +
+        v4Direct_.size() * sizeof(v4Direct_[0]);
+  }
+
+ private:
+  struct Node {
+    // entries of the next byte that have a child node, and those that
+    // start a run of leaves
+    uint64_t childBits[4];
+    uint64_t leafBits[4];
+    uint32_t childBase;
+    uint32_t leafBase;
+    // set bits of childBits and leafBits in the words before each word
+    uint8_t childRank[4];
+    uint8_t leafRank[4];
+  };
+
+  PrefixMatcher() = default;
+
+  // the child node of the entry of byte in node, or kLeaf with the match
+  uint32_t next(uint32_t node, uint8_t byte) const;
+
+  bool lookupV4(const uint8_t* addr) const;
+
+  bool lookupV6(const uint8_t* addr) const;
+
+  std::vector<Node> nodes_;
+  // leaf runs, each the match (no match, included, excluded) of a range of
+  // entries of a node
+  std::vector<uint8_t> leaves_;
+  uint32_t root_{0};
+  // node (or leaf) of each value of the first two bytes of IPv4 addresses,
+  // from the node of ::ffff:0:0/96
+  std::vector<uint32_t> v4Direct_;
+  std::string description_;
+};
+
+/**
+ * Validator of --client_prefix.
+ */
+bool validateClientPrefix(const char* flagname, const std::string& pfx);
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,192 @@
+/**
+ * Lookups per second of the client prefix filter.
+ *
+ * socketAddressInSubnet is the filter before PrefixMatcher (a
+ * folly::SocketAddress built from the event's sockaddr, then inSubnet on
+ * the single --client_prefix network). The matcher benchmarks look up the
+ * same IPv4-mapped destinations with one prefix and with --bm_prefixes /24
+ * prefixes (a tenth of them with an excluded /28), one address at a time
+ * and with matchBatch(), and IPv6 destinations with --bm_prefixes /48
+ * prefixes (a tenth of them with an excluded /64). Run with e.g.:
+ *   buck run //src/common:PrefixMatcherBenchmark -- --bm_min_usec=1000000
+ */
+#include <src/common/PrefixMatcher.h>
+
+#include <netinet/in.h>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <folly/Benchmark.h>
+#include <folly/IPAddress.h>
+#include <folly/SocketAddress.h>
+#include <folly/init/Init.h>
+#include <gflags/gflags.h>
+
+DEFINE_uint32(bm_prefixes, 10000, "Number of prefixes of the large matcher");
+
+using paths::common::PrefixMatcher;
+
+namespace {
+
+const std::string kClientPrefix = "10.0.0.0/9";
+
+// destinations of a batch of events, as the collectors receive them
+std::vector<struct sockaddr_in6>
+makeAddresses() {
+  std::mt19937 rng(1);
+  std::vector<struct sockaddr_in6> addrs(4096);
+  for (auto& addr : addrs) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr.s6_addr[10] = 0xff;
+    addr.sin6_addr.s6_addr[11] = 0xff;
+    addr.sin6_addr.s6_addr[12] = 10;
+    for (size_t i = 13; i < 16; i++) {
+      addr.sin6_addr.s6_addr[i] = rng();
+    }
+  }
+  return addrs;
+}
+
+// IPv6 destinations, in the /32 of the prefixes of makeLargeV6Matcher()
+std::vector<struct sockaddr_in6>
+makeV6Addresses() {
+  std::mt19937 rng(3);
+  std::vector<struct sockaddr_in6> addrs(4096);
+  for (auto& addr : addrs) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr.s6_addr[0] = 0x20;
+    addr.sin6_addr.s6_addr[1] = 0x01;
+    addr.sin6_addr.s6_addr[2] = 0x0d;
+    addr.sin6_addr.s6_addr[3] = 0xb8;
+    for (size_t i = 4; i < 16; i++) {
+      addr.sin6_addr.s6_addr[i] = rng();
+    }
+  }
+  return addrs;
+}
+
+std::unique_ptr<PrefixMatcher>
+makeLargeMatcher() {
+  std::mt19937 rng(2);
+  std::vector<folly::CIDRNetwork> include;
+  std::vector<folly::CIDRNetwork> exclude;
+  for (size_t i = 0; i < FLAGS_bm_prefixes; i++) {
+    uint8_t addr[4] = {10, uint8_t(rng()), uint8_t(rng()), 0};
+    include.emplace_back(folly::IPAddress::fromBytes(addr, 4), 24);
+    if (i % 10 == 0) {
+      addr[3] = rng() & 0xf0;
+      exclude.emplace_back(folly::IPAddress::fromBytes(addr, 4), 28);
+    }
+  }
+  return PrefixMatcher::create(include, exclude);
+}
+
+std::unique_ptr<PrefixMatcher>
+makeLargeV6Matcher() {
+  std::mt19937 rng(4);
+  std::vector<folly::CIDRNetwork> include;
+  std::vector<folly::CIDRNetwork> exclude;
+  for (size_t i = 0; i < FLAGS_bm_prefixes; i++) {
+    uint8_t addr[16] = {0x20, 0x01, 0x0d, 0xb8, uint8_t(rng()), uint8_t(rng())};
+    include.emplace_back(folly::IPAddress::fromBytes(addr, 16), 48);
+    if (i % 10 == 0) {
+      addr[6] = rng();
+      addr[7] = rng();
+      exclude.emplace_back(folly::IPAddress::fromBytes(addr, 16), 64);
+    }
+  }
+  return PrefixMatcher::create(include, exclude);
+}
+
+void
+runMatcher(
+    const PrefixMatcher& matcher,
+    std::vector<struct sockaddr_in6> (*makeAddrs)(),
+    size_t iters,
+    bool batch) {
+  std::vector<struct sockaddr_in6> addrs;
+  std::unique_ptr<bool[]> matches;
+  BENCHMARK_SUSPEND {
+    addrs = makeAddrs();
+    matches.reset(new bool[addrs.size()]);
+  }
+  size_t matched = 0;
+  for (size_t i = 0; i < iters; i += addrs.size()) {
+    if (batch) {
+      matcher.matchBatch(
+          addrs.data(), sizeof(addrs[0]), addrs.size(), matches.get());
+      matched += matches[i % addrs.size()];
+      continue;
+    }
+    for (const auto& addr : addrs) {
+      matched +=
+          matcher.match(reinterpret_cast<const struct sockaddr*>(&addr));
+    }
+  }
+  folly::doNotOptimizeAway(matched);
+}
+
+} // namespace
+
+BENCHMARK(socketAddressInSubnet, iters) {
+  std::vector<struct sockaddr_in6> addrs;
+  folly::CIDRNetwork network;
+  BENCHMARK_SUSPEND {
+    addrs = makeAddresses();
+    network = folly::IPAddress::createNetwork(kClientPrefix);
+  }
+  size_t matched = 0;
+  for (size_t i = 0; i < iters; i += addrs.size()) {
+    for (const auto& addr : addrs) {
+      folly::SocketAddress dst;
+      dst.setFromSockaddr(reinterpret_cast<const struct sockaddr*>(&addr));
+      dst.tryConvertToIPv4();
+      matched += dst.getIPAddress().inSubnet(network.first, network.second);
+    }
+  }
+  folly::doNotOptimizeAway(matched);
+}
+
+BENCHMARK_RELATIVE(matcherOnePrefix, iters) {
+  std::unique_ptr<PrefixMatcher> matcher;
+  BENCHMARK_SUSPEND {
+    matcher = PrefixMatcher::create(
+        {folly::IPAddress::createNetwork(kClientPrefix)}, {});
+  }
+  runMatcher(*matcher, makeAddresses, iters, false);
+}
+
+BENCHMARK_RELATIVE(matcherManyPrefixes, iters) {
+  std::unique_ptr<PrefixMatcher> matcher;
+  BENCHMARK_SUSPEND {
+    matcher = makeLargeMatcher();
+  }
+  runMatcher(*matcher, makeAddresses, iters, false);
+}
+
+BENCHMARK_RELATIVE(matcherManyPrefixesBatch, iters) {
+  std::unique_ptr<PrefixMatcher> matcher;
+  BENCHMARK_SUSPEND {
+    matcher = makeLargeMatcher();
+  }
+  runMatcher(*matcher, makeAddresses, iters, true);
+}
+
+BENCHMARK_RELATIVE(matcherManyV6Prefixes, iters) {
+  std::unique_ptr<PrefixMatcher> matcher;
+  BENCHMARK_SUSPEND {
+    matcher = makeLargeV6Matcher();
+  }
+  runMatcher(*matcher, makeV6Addresses, iters, false);
+}
+
+int
+main(int argc, char* argv[]) {
+  folly::init(&argc, &argv);
+  folly::runBenchmarks();
+  return 0;
+}
@@ -0,0 +1,361 @@
+/**
+ * Checks PrefixMatcher against a brute-force longest-prefix match over the
+ * same include and exclude lists. Run with:
+ *   buck test //src/common:PrefixMatcherTest
+ */
+#include <src/common/PrefixMatcher.h>
+
+#include <netinet/in.h>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <folly/IPAddress.h>
+#include <gtest/gtest.h>
+
+using paths::common::PrefixMatcher;
+
+namespace {
+
+const uint8_t kV4MappedPrefix[12] =
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+// an address or prefix as the 16 bytes of its IPv6 (or IPv4-mapped) form
+struct Key {
+  uint8_t bytes[16];
+  uint8_t bits;
+};
+
+Key
+toKey(const folly::IPAddress& addr, uint8_t bits) {
+  Key key;
+  memset(key.bytes, 0, sizeof(key.bytes));
+  if (addr.isV4()) {
+    memcpy(key.bytes, kV4MappedPrefix, sizeof(kV4MappedPrefix));
+    memcpy(key.bytes + 12, addr.bytes(), 4);
+    key.bits = 96 + bits;
+  } else {
+    memcpy(key.bytes, addr.bytes(), 16);
+    key.bits = bits;
+  }
+  return key;
+}
+
+bool
+contains(const Key& prefix, const Key& addr) {
+  for (size_t bit = 0; bit < prefix.bits; bit++) {
+    const uint8_t mask = 0x80 >> (bit % 8);
+    if ((prefix.bytes[bit / 8] & mask) != (addr.bytes[bit / 8] & mask)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// longest prefix containing addr decides; exclude wins a tie
+class ReferenceMatcher {
+ public:
+  ReferenceMatcher(
+      const std::vector<folly::CIDRNetwork>& include,
+      const std::vector<folly::CIDRNetwork>& exclude) {
+    for (const auto& network : include) {
+      prefixes_.push_back({toKey(network.first, network.second), true});
+    }
+    for (const auto& network : exclude) {
+      prefixes_.push_back({toKey(network.first, network.second), false});
+    }
+  }
+
+  bool match(const folly::IPAddress& addr) const {
+    const auto key = toKey(addr, addr.isV4() ? 32 : 128);
+    int bestBits = -1;
+    bool included = false;
+    for (const auto& prefix : prefixes_) {
+      if (!contains(prefix.first, key)) {
+        continue;
+      }
+      if (prefix.first.bits > bestBits) {
+        bestBits = prefix.first.bits;
+        included = prefix.second;
+      } else if (prefix.first.bits == bestBits && !prefix.second) {
+        included = false;
+      }
+    }
+    return included;
+  }
+
+ private:
+  std::vector<std::pair<Key, bool>> prefixes_;
+};
+
+struct sockaddr_in
+toSockaddrIn(const folly::IPAddress& addr) {
+  struct sockaddr_in sin;
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  memcpy(&sin.sin_addr, addr.bytes(), 4);
+  return sin;
+}
+
+// IPv4 addresses as IPv4-mapped, as the bpf programs report them
+struct sockaddr_in6
+toSockaddrIn6(const folly::IPAddress& addr) {
+  struct sockaddr_in6 sin6;
+  memset(&sin6, 0, sizeof(sin6));
+  sin6.sin6_family = AF_INET6;
+  if (addr.isV4()) {
+    memcpy(sin6.sin6_addr.s6_addr, kV4MappedPrefix, sizeof(kV4MappedPrefix));
+    memcpy(sin6.sin6_addr.s6_addr + 12, addr.bytes(), 4);
+  } else {
+    memcpy(sin6.sin6_addr.s6_addr, addr.bytes(), 16);
+  }
+  return sin6;
+}
+
+folly::IPAddress
+randomAddress(std::mt19937& rng, bool v4) {
+  uint8_t bytes[16];
+  for (auto& byte : bytes) {
+    byte = rng();
+  }
+  return folly::IPAddress::fromBytes(bytes, v4 ? 4 : 16);
+}
+
+// an address inside network, so that lookups hit the prefixes
+folly::IPAddress
+randomAddressIn(std::mt19937& rng, const folly::CIDRNetwork& network) {
+  const size_t len = network.first.isV4() ? 4 : 16;
+  uint8_t bytes[16];
+  memcpy(bytes, network.first.bytes(), len);
+  for (size_t bit = network.second; bit < len * 8; bit++) {
+    const uint8_t mask = 0x80 >> (bit % 8);
+    bytes[bit / 8] = (rng() & 1) ? (bytes[bit / 8] | mask)
+                                 : (bytes[bit / 8] & ~mask);
+  }
+  return folly::IPAddress::fromBytes(bytes, len);
+}
+
+// nested IPv4 and IPv6 prefixes of all lengths, a third of them excluded
+void
+makeRandomPrefixes(
+    std::mt19937& rng,
+    std::vector<folly::CIDRNetwork>& include,
+    std::vector<folly::CIDRNetwork>& exclude) {
+  std::vector<folly::CIDRNetwork> all;
+  for (size_t i = 0; i < 600; i++) {
+    const bool v4 = i % 2 == 0;
+    folly::CIDRNetwork network;
+    if (!all.empty() && rng() % 2) {
+      // inside an earlier prefix, to nest includes and excludes
+      const auto& parent = all[rng() % all.size()];
+      const uint8_t maxBits = parent.first.isV4() ? 32 : 128;
+      network.first = randomAddressIn(rng, parent);
+      network.second =
+          parent.second + rng() % (maxBits - parent.second + 1);
+    } else {
+      network.first = randomAddress(rng, v4);
+      network.second = rng() % (v4 ? 33 : 129);
+    }
+    all.push_back(network);
+    (rng() % 3 ? include : exclude).push_back(network);
+  }
+}
+
+// addresses in the prefixes, random ones, and some of both families
+std::vector<folly::IPAddress>
+makeRandomAddresses(
+    std::mt19937& rng,
+    const std::vector<folly::CIDRNetwork>& include,
+    const std::vector<folly::CIDRNetwork>& exclude) {
+  std::vector<folly::IPAddress> addrs;
+  for (size_t i = 0; i < 20000; i++) {
+    switch (rng() % 4) {
+      case 0:
+        addrs.push_back(randomAddressIn(rng, include[rng() % include.size()]));
+        break;
+      case 1:
+        addrs.push_back(randomAddressIn(rng, exclude[rng() % exclude.size()]));
+        break;
+      default:
+        addrs.push_back(randomAddress(rng, rng() % 2));
+    }
+  }
+  return addrs;
+}
+
+} // namespace
+
+TEST(PrefixMatcherTest, MatchesReference) {
+  std::mt19937 rng(1);
+  std::vector<folly::CIDRNetwork> include;
+  std::vector<folly::CIDRNetwork> exclude;
+  makeRandomPrefixes(rng, include, exclude);
+  const auto matcher = PrefixMatcher::create(include, exclude);
+  const ReferenceMatcher reference(include, exclude);
+
+  for (const auto& addr : makeRandomAddresses(rng, include, exclude)) {
+    const bool expected = reference.match(addr);
+    EXPECT_EQ(expected, matcher->match(addr)) << addr.str();
+    const auto sin6 = toSockaddrIn6(addr);
+    EXPECT_EQ(
+        expected,
+        matcher->match(reinterpret_cast<const struct sockaddr*>(&sin6)))
+        << addr.str();
+    if (addr.isV4()) {
+      const auto sin = toSockaddrIn(addr);
+      EXPECT_EQ(
+          expected,
+          matcher->match(reinterpret_cast<const struct sockaddr*>(&sin)))
+          << addr.str();
+    }
+  }
+}
+
+TEST(PrefixMatcherTest, MatchBatchMatchesReference) {
+  std::mt19937 rng(2);
+  std::vector<folly::CIDRNetwork> include;
+  std::vector<folly::CIDRNetwork> exclude;
+  makeRandomPrefixes(rng, include, exclude);
+  const auto matcher = PrefixMatcher::create(include, exclude);
+  const ReferenceMatcher reference(include, exclude);
+  const auto addrs = makeRandomAddresses(rng, include, exclude);
+
+  // mixed families, so most groups take the scalar path
+  std::vector<struct sockaddr_in6> mixed;
+  // IPv4 only, as both sockaddr_in and IPv4-mapped sockaddr_in6, so that
+  // groups take the lockstep path; the count is not a multiple of a group
+  std::vector<struct sockaddr_storage> v4;
+  std::vector<folly::IPAddress> v4Addrs;
+  for (const auto& addr : addrs) {
+    mixed.push_back(toSockaddrIn6(addr));
+    if (!addr.isV4()) {
+      continue;
+    }
+    struct sockaddr_storage storage;
+    memset(&storage, 0, sizeof(storage));
+    if (v4.size() % 2) {
+      const auto sin = toSockaddrIn(addr);
+      memcpy(&storage, &sin, sizeof(sin));
+    } else {
+      const auto sin6 = toSockaddrIn6(addr);
+      memcpy(&storage, &sin6, sizeof(sin6));
+    }
+    v4.push_back(storage);
+    v4Addrs.push_back(addr);
+  }
+  if (v4.size() % 16 == 0) {
+    v4.pop_back();
+    v4Addrs.pop_back();
+  }
+
+  std::unique_ptr<bool[]> matches(new bool[mixed.size()]);
+  matcher->matchBatch(
+      mixed.data(), sizeof(mixed[0]), mixed.size(), matches.get());
+  for (size_t i = 0; i < addrs.size(); i++) {
+    EXPECT_EQ(reference.match(addrs[i]), matches[i]) << addrs[i].str();
+  }
+
+  matches.reset(new bool[v4.size()]);
+  matcher->matchBatch(v4.data(), sizeof(v4[0]), v4.size(), matches.get());
+  for (size_t i = 0; i < v4Addrs.size(); i++) {
+    EXPECT_EQ(reference.match(v4Addrs[i]), matches[i]) << v4Addrs[i].str();
+  }
+}
+
+TEST(PrefixMatcherTest, ExcludeWinsSamePrefix) {
+  const auto network = folly::IPAddress::createNetwork("10.1.0.0/16");
+  const auto matcher = PrefixMatcher::create(
+      {folly::IPAddress::createNetwork("10.0.0.0/8"), network}, {network});
+  EXPECT_TRUE(matcher->match(folly::IPAddress("10.2.3.4")));
+  EXPECT_FALSE(matcher->match(folly::IPAddress("10.1.3.4")));
+  const auto sin6 = toSockaddrIn6(folly::IPAddress("10.1.3.4"));
+  EXPECT_FALSE(
+      matcher->match(reinterpret_cast<const struct sockaddr*>(&sin6)));
+}
+
+TEST(PrefixMatcherTest, LongestPrefixWins) {
+  const auto matcher = PrefixMatcher::create(
+      {folly::IPAddress::createNetwork("10.0.0.0/8"),
+       folly::IPAddress::createNetwork("10.1.2.0/24")},
+      {folly::IPAddress::createNetwork("10.1.0.0/16")});
+  EXPECT_TRUE(matcher->match(folly::IPAddress("10.2.0.1")));
+  EXPECT_FALSE(matcher->match(folly::IPAddress("10.1.3.1")));
+  EXPECT_TRUE(matcher->match(folly::IPAddress("10.1.2.1")));
+  EXPECT_FALSE(matcher->match(folly::IPAddress("11.0.0.1")));
+}
+
+TEST(PrefixMatcherTest, IPv4MappedAddresses) {
+  // IPv6 prefixes that contain ::ffff:0:0/96 contain IPv4 addresses
+  const auto matcher = PrefixMatcher::create(
+      {folly::IPAddress::createNetwork("::ffff:0:0/96")},
+      {folly::IPAddress::createNetwork("192.168.0.0/16")});
+  EXPECT_TRUE(matcher->match(folly::IPAddress("10.0.0.1")));
+  EXPECT_TRUE(matcher->match(folly::IPAddress("::ffff:10.0.0.1")));
+  EXPECT_FALSE(matcher->match(folly::IPAddress("192.168.1.1")));
+  EXPECT_FALSE(matcher->match(folly::IPAddress("::ffff:192.168.1.1")));
+  EXPECT_FALSE(matcher->match(folly::IPAddress("2001:db8::1")));
+
+  // and IPv4 prefixes contain IPv4-mapped addresses
+  const auto v4 = PrefixMatcher::create(
+      {folly::IPAddress::createNetwork("10.0.0.0/9")}, {});
+  const auto mapped = toSockaddrIn6(folly::IPAddress("10.1.2.3"));
+  EXPECT_TRUE(v4->match(reinterpret_cast<const struct sockaddr*>(&mapped)));
+  EXPECT_TRUE(v4->match(folly::IPAddress("::ffff:10.1.2.3")));
+  EXPECT_FALSE(v4->match(folly::IPAddress("::a01:203")));
+}
+
+TEST(PrefixMatcherTest, OtherFamiliesDoNotMatch) {
+  const auto matcher =
+      PrefixMatcher::create({folly::IPAddress::createNetwork("::/0")}, {});
+  struct sockaddr_storage storage;
+  memset(&storage, 0, sizeof(storage));
+  storage.ss_family = AF_UNIX;
+  EXPECT_FALSE(
+      matcher->match(reinterpret_cast<const struct sockaddr*>(&storage)));
+  bool matches[1];
+  matcher->matchBatch(&storage, sizeof(storage), 1, matches);
+  EXPECT_FALSE(matches[0]);
+}
+
+TEST(PrefixMatcherTest, Parse) {
+  std::string error;
+  const auto matcher = PrefixMatcher::parse(
+      "# monitored clients\n"
+      "10.0.0.0/9\n"
+      "\n"
+      "  ! 10.1.2.0/24   # lab hosts\n"
+      "2001:db8::/32\n"
+      "!10.1.0.0/16\n"
+      "10.1.0.0/16\n",
+      error);
+  ASSERT_TRUE(matcher) << error;
+  EXPECT_EQ("5 prefixes (2 excluded)", matcher->describe());
+  EXPECT_TRUE(matcher->match(folly::IPAddress("10.2.0.1")));
+  EXPECT_FALSE(matcher->match(folly::IPAddress("10.1.2.1")));
+  // the same prefix included and excluded is excluded, in any order
+  EXPECT_FALSE(matcher->match(folly::IPAddress("10.1.3.1")));
+  EXPECT_TRUE(matcher->match(folly::IPAddress("2001:db8::1")));
+  EXPECT_FALSE(matcher->match(folly::IPAddress("2001:db9::1")));
+
+  const ReferenceMatcher reference(
+      {folly::IPAddress::createNetwork("10.0.0.0/9"),
+       folly::IPAddress::createNetwork("2001:db8::/32"),
+       folly::IPAddress::createNetwork("10.1.0.0/16")},
+      {folly::IPAddress::createNetwork("10.1.2.0/24"),
+       folly::IPAddress::createNetwork("10.1.0.0/16")});
+  std::mt19937 rng(3);
+  for (size_t i = 0; i < 1000; i++) {
+    auto addr = randomAddressIn(
+        rng, folly::IPAddress::createNetwork(i % 2 ? "10.0.0.0/8" : "::/0"));
+    EXPECT_EQ(reference.match(addr), matcher->match(addr)) << addr.str();
+  }
+}
+
+TEST(PrefixMatcherTest, ParseError) {
+  std::string error;
+  EXPECT_FALSE(PrefixMatcher::parse("10.0.0.0/9\n10.0.0.0/40\n", error));
+  EXPECT_EQ("line 2: 10.0.0.0/40 is not a prefix", error);
+  EXPECT_FALSE(PrefixMatcher::parse("10.0.0.0/9\n!\n", error));
+}
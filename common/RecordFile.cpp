@@ -0,0 +1,131 @@
+#include "RecordFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <cstring>
+
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <glog/logging.h>
+
+namespace paths {
+namespace common {
+
+namespace {
+
+uint64_t
+clockNs(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+} // namespace
+
+void
+writeRecordFileHeader(
+    BufferedWriter& writer,
+    folly::StringPiece tool,
+    uint32_t recordSize,
+    bool evdebug,
+    double samplingRate) {
+  RecordFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kRecordFileMagic, sizeof(header.magic));
+  header.version = kRecordFileVersion;
+  header.headerSize = sizeof(header);
+  CHECK_LT(tool.size(), sizeof(header.tool));
+  memcpy(header.tool, tool.data(), tool.size());
+  header.recordSize = recordSize;
+  header.flags = evdebug ? kRecordFileFlagEvdebug : 0;
+  header.samplingRate = samplingRate;
+  header.startRealtimeNs = clockNs(CLOCK_REALTIME);
+  header.startMonotonicNs = clockNs(CLOCK_MONOTONIC);
+  writer.setHeader(folly::StringPiece(
+      reinterpret_cast<const char*>(&header), sizeof(header)));
+}
+
+std::unique_ptr<RecordFileReader>
+RecordFileReader::open(const std::string& path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG(ERROR) << folly::format(
+        "Unable to open {}: {}", path, folly::errnoStr(errno));
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    LOG(ERROR) << folly::format(
+        "Unable to stat {}: {}", path, folly::errnoStr(errno));
+    close(fd);
+    return nullptr;
+  }
+  const size_t size = st.st_size;
+  if (size < sizeof(RecordFileHeader)) {
+    LOG(ERROR) << folly::format("{} is too short to be a capture", path);
+    close(fd);
+    return nullptr;
+  }
+  void* base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    LOG(ERROR) << folly::format(
+        "Unable to map {}: {}", path, folly::errnoStr(errno));
+    return nullptr;
+  }
+  madvise(base, size, MADV_SEQUENTIAL);
+
+  RecordFileHeader header;
+  memcpy(&header, base, sizeof(header));
+  std::string error;
+  if (memcmp(header.magic, kRecordFileMagic, sizeof(header.magic)) != 0) {
+    error = "bad magic";
+  } else if (header.version != kRecordFileVersion) {
+    error = folly::sformat("unsupported version {}", header.version);
+  } else if (
+      header.headerSize < sizeof(header) || header.headerSize > size ||
+      header.recordSize == 0) {
+    error = "corrupt header";
+  } else if (header.tool[sizeof(header.tool) - 1] != '\0') {
+    error = "corrupt tool name";
+  }
+  if (!error.empty()) {
+    LOG(ERROR) << folly::format("{} is not a capture: {}", path, error);
+    munmap(base, size);
+    return nullptr;
+  }
+
+  return std::unique_ptr<RecordFileReader>(
+      new RecordFileReader(static_cast<const char*>(base), size, header));
+}
+
+RecordFileReader::RecordFileReader(
+    const char* base,
+    size_t size,
+    const RecordFileHeader& header)
+    : base_(base),
+      size_(size),
+      header_(header),
+      recordCount_((size - header.headerSize) / header.recordSize) {
+  const size_t trailing = (size - header_.headerSize) % header_.recordSize;
+  if (trailing) {
+    LOG(WARNING) << folly::format(
+        "Ignoring {} trailing bytes of a partial record", trailing);
+  }
+}
+
+RecordFileReader::~RecordFileReader() {
+  munmap(const_cast<char*>(base_), size_);
+}
+
+std::string
+RecordFileReader::getTool() const {
+  return std::string(
+      header_.tool, strnlen(header_.tool, sizeof(header_.tool)));
+}
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <folly/Range.h>
+#include <src/common/BufferedWriter.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace paths {
+namespace common {
+
+constexpr char kRecordFileMagic[8] = {'P', 'A', 'T', 'H', 'S', 'R', 'E', 'C'};
+constexpr uint32_t kRecordFileVersion = 1;
+
+// set in RecordFileHeader::flags if the tool was built with -DEVDEBUG
+constexpr uint32_t kRecordFileFlagEvdebug = 1;
+
+/**
+ * Header of a raw event capture (--export_mode=record).
+ *
+ * A capture is this header followed by fixed-size event structs, exactly as
+ * read from the perf buffer. The structs are only meaningful to a decoder
+ * built with the same struct definitions, so the header records the tool,
+ * the record size and the EVDEBUG flag, which the decoder checks before
+ * reading any record. Event timestamps come from bpf_ktime_get_ns(); the
+ * realtime and monotonic clocks at capture start are stored so that they
+ * can be converted offline.
+ */
+struct RecordFileHeader {
+  char magic[8];
+  uint32_t version;
+  // records start at this offset
+  uint32_t headerSize;
+  char tool[16];
+  uint32_t recordSize;
+  uint32_t flags;
+  double samplingRate;
+  uint64_t startRealtimeNs;
+  uint64_t startMonotonicNs;
+};
+static_assert(sizeof(RecordFileHeader) == 64, "RecordFileHeader changed");
+
+/**
+ * Writes the header of a capture of records of recordSize bytes (repeated
+ * at the start of every segment if the output is rotated).
+ */
+void writeRecordFileHeader(
+    BufferedWriter& writer,
+    folly::StringPiece tool,
+    uint32_t recordSize,
+    bool evdebug,
+    double samplingRate);
+
+/**
+ * Appends one raw event to a capture.
+ */
+template <typename T>
+void writeRecord(BufferedWriter& writer, const T& event) {
+  writer.write(folly::StringPiece(
+      reinterpret_cast<const char*>(&event), sizeof(event)));
+}
+
+/**
+ * Read-only view of a capture file.
+ *
+ * The file is mapped into memory, so records can be read from any number of
+ * threads. A partial record at the end of the file (e.g., the collector was
+ * killed mid-write) is ignored.
+ */
+class RecordFileReader {
+ public:
+  /**
+   * Opens and maps a capture, checking its header. Returns nullptr (and logs
+   * the reason) if the file cannot be read or is not a capture.
+   */
+  static std::unique_ptr<RecordFileReader> open(const std::string& path);
+
+  ~RecordFileReader();
+
+  RecordFileReader(const RecordFileReader&) = delete;
+  RecordFileReader& operator=(const RecordFileReader&) = delete;
+
+  const RecordFileHeader& getHeader() const {
+    return header_;
+  }
+
+  std::string getTool() const;
+
+  bool isEvdebug() const {
+    return header_.flags & kRecordFileFlagEvdebug;
+  }
+
+  size_t getRecordCount() const {
+    return recordCount_;
+  }
+
+  const char* getRecord(size_t index) const {
+    return base_ + header_.headerSize + index * header_.recordSize;
+  }
+
+ private:
+  RecordFileReader(const char* base, size_t size, const RecordFileHeader& hdr);
+
+  const char* const base_;
+  const size_t size_;
+  const RecordFileHeader header_;
+  const size_t recordCount_;
+};
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,325 @@
+#include "SegmentRotator.h"
+
+#include <fcntl.h>
+#include <openssl/evp.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include <folly/FileUtil.h>
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <src/common/CompressingSink.h>
+
+static bool
+ValidateSegmentFinalize(const char* flagname, const std::string& value) {
+  std::vector<folly::StringPiece> steps;
+  folly::split(',', value, steps, true);
+  for (const auto& step : steps) {
+    if (step != "zstd" && step != "sha256") {
+      LOG(ERROR) << folly::format(
+          "--{}: unknown step {} (options: zstd, sha256)", flagname, step);
+      return false;
+    }
+  }
+  return true;
+}
+
+DEFINE_uint64(
+    export_rotate_bytes,
+    0,
+    "Start a new export file segment once the current one holds this many "
+    "bytes (0 = no size limit)");
+DEFINE_uint32(
+    export_rotate_interval_s,
+    0,
+    "Start a new export file segment after this many seconds "
+    "(0 = no time limit)");
+DEFINE_string(
+    export_segment_finalize,
+    "",
+    "Comma separated steps applied to closed segments in the background: "
+    "zstd (compress, replacing the segment), sha256 (write a .sha256 file)");
+DEFINE_validator(export_segment_finalize, &ValidateSegmentFinalize);
+
+DECLARE_string(output_compression);
+
+namespace paths {
+namespace common {
+
+namespace {
+
+constexpr size_t kFinalizeChunkSize = 1 << 20;
+
+// writes to path + ".tmp" and renames, so that path is complete if it exists
+bool
+writeFileAtomically(const std::string& path, folly::StringPiece contents) {
+  const auto tmpPath = path + ".tmp";
+  if (!folly::writeFile(contents, tmpPath.c_str())) {
+    LOG(ERROR) << folly::format(
+        "Unable to write {}: {}", tmpPath, folly::errnoStr(errno));
+    return false;
+  }
+  if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+    LOG(ERROR) << folly::format(
+        "Unable to rename {}: {}", tmpPath, folly::errnoStr(errno));
+    unlink(tmpPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+// compresses path into path + ".zst"; returns the name of the file to keep
+std::string
+compressSegment(const std::string& path) {
+  const auto compressedPath = path + ".zst";
+  const auto tmpPath = compressedPath + ".tmp";
+  const int in = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  const int out =
+      open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (in < 0 || out < 0) {
+    LOG(ERROR) << folly::format(
+        "Unable to compress {}: {}", path, folly::errnoStr(errno));
+    if (in >= 0) {
+      close(in);
+    }
+    if (out >= 0) {
+      close(out);
+    }
+    return path;
+  }
+
+  const auto encoder = FrameEncoder::create(Compression::ZSTD, 0);
+  std::vector<char> buf(kFinalizeChunkSize);
+  std::string compressed;
+  bool ok = true;
+  encoder->beginFrame(compressed);
+  while (ok) {
+    const auto n = folly::readFull(in, buf.data(), buf.size());
+    if (n < 0) {
+      ok = false;
+      break;
+    }
+    if (n == 0) {
+      encoder->endFrame(compressed);
+    } else {
+      encoder->update(buf.data(), n, compressed);
+    }
+    if (n == 0 || compressed.size() >= kFinalizeChunkSize) {
+      ok = folly::writeFull(out, compressed.data(), compressed.size()) ==
+          static_cast<ssize_t>(compressed.size());
+      compressed.clear();
+    }
+    if (n == 0) {
+      break;
+    }
+  }
+  ok = close(out) == 0 && ok;
+  close(in);
+  if (!ok || rename(tmpPath.c_str(), compressedPath.c_str()) != 0) {
+    LOG(ERROR) << folly::format(
+        "Unable to compress {}: {}", path, folly::errnoStr(errno));
+    unlink(tmpPath.c_str());
+    return path;
+  }
+  unlink(path.c_str());
+  return compressedPath;
+}
+
+bool
+checksumSegment(const std::string& path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG(ERROR) << folly::format(
+        "Unable to checksum {}: {}", path, folly::errnoStr(errno));
+    return false;
+  }
+  EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+  EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr);
+  std::vector<char> buf(kFinalizeChunkSize);
+  ssize_t n;
+  while ((n = folly::readFull(fd, buf.data(), buf.size())) > 0) {
+    EVP_DigestUpdate(ctx, buf.data(), n);
+  }
+  close(fd);
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digestLen = 0;
+  EVP_DigestFinal_ex(ctx, digest, &digestLen);
+  EVP_MD_CTX_free(ctx);
+  if (n < 0) {
+    LOG(ERROR) << folly::format(
+        "Unable to checksum {}: {}", path, folly::errnoStr(errno));
+    return false;
+  }
+
+  const auto slash = path.rfind('/');
+  const auto basename =
+      slash == std::string::npos ? path : path.substr(slash + 1);
+  return writeFileAtomically(
+      path + ".sha256",
+      folly::sformat(
+          "{}  {}\n",
+          folly::hexlify(folly::ByteRange(digest, digestLen)),
+          basename));
+}
+
+} // namespace
+
+std::unique_ptr<SegmentRotator>
+SegmentRotator::createFromFlags(const std::string& path) {
+  if (FLAGS_export_rotate_bytes == 0 && FLAGS_export_rotate_interval_s == 0) {
+    return nullptr;
+  }
+  Options options;
+  options.path = path;
+  options.rotateBytes = FLAGS_export_rotate_bytes;
+  options.rotateInterval = std::chrono::seconds(FLAGS_export_rotate_interval_s);
+  std::vector<folly::StringPiece> steps;
+  folly::split(',', FLAGS_export_segment_finalize, steps, true);
+  for (const auto& step : steps) {
+    options.compress |= step == "zstd";
+    options.checksum |= step == "sha256";
+  }
+  if (options.compress && FLAGS_output_compression != "none") {
+    LOG(WARNING) << "Segments are compressed by --output_compression, "
+                 << "ignoring zstd in --export_segment_finalize";
+    options.compress = false;
+  }
+  return std::make_unique<SegmentRotator>(options);
+}
+
+SegmentRotator::SegmentRotator(const Options& options)
+    : options_(options), inProgressPath_(options.path + ".inprogress") {
+  LOG(INFO) << folly::format(
+      "Rotating {} every {} bytes / {} s",
+      options_.path,
+      options_.rotateBytes,
+      options_.rotateInterval.count());
+
+  // keep the segment left open by a previous run that did not shut down
+  if (access(inProgressPath_.c_str(), F_OK) == 0) {
+    const auto name = segmentName(std::chrono::system_clock::now());
+    if (rename(inProgressPath_.c_str(), name.c_str()) == 0) {
+      LOG(WARNING) << folly::format(
+          "Found unfinished segment {}, kept as {}", inProgressPath_, name);
+    }
+  }
+  finalizer_ = std::thread([this] { finalizeLoop(); });
+}
+
+SegmentRotator::~SegmentRotator() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_one();
+  finalizer_.join();
+}
+
+folly::File
+SegmentRotator::openSegment() {
+  auto fileExpect = folly::File::makeFile(
+      inProgressPath_, O_WRONLY | O_TRUNC | O_CREAT);
+  if (fileExpect.hasError()) {
+    LOG(FATAL) << folly::sformat(
+        "Unable to open file {} for export, error = {}",
+        inProgressPath_,
+        folly::exceptionStr(fileExpect.error()));
+  }
+  segmentStart_ = std::chrono::steady_clock::now();
+  segmentStartWall_ = std::chrono::system_clock::now();
+  return std::move(fileExpect.value());
+}
+
+void
+SegmentRotator::closeSegment(folly::File&& file) {
+  file.close();
+  const auto name = segmentName(segmentStartWall_);
+  if (rename(inProgressPath_.c_str(), name.c_str()) != 0) {
+    LOG(ERROR) << folly::format(
+        "Unable to rename {} to {}: {}",
+        inProgressPath_,
+        name,
+        folly::errnoStr(errno));
+    return;
+  }
+  LOG(INFO) << folly::format("Closed export segment {}", name);
+  if (options_.compress || options_.checksum) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push_back(name);
+    cv_.notify_one();
+  }
+}
+
+bool
+SegmentRotator::isExpired() const {
+  return options_.rotateInterval.count() > 0 &&
+      std::chrono::steady_clock::now() - segmentStart_ >=
+      options_.rotateInterval;
+}
+
+std::string
+SegmentRotator::segmentName(std::chrono::system_clock::time_point start) {
+  const auto& path = options_.path;
+  const auto slash = path.rfind('/');
+  const auto dot = path.rfind('.');
+  const bool hasExt = dot != std::string::npos &&
+      (slash == std::string::npos || dot > slash + 1);
+  const auto stem = hasExt ? path.substr(0, dot) : path;
+  const auto ext = hasExt ? path.substr(dot) : std::string();
+
+  const time_t t = std::chrono::system_clock::to_time_t(start);
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  char ts[32];
+  strftime(ts, sizeof(ts), "%Y%m%dT%H%M%SZ", &tm);
+
+  // segments closed within the same second get a sequence number
+  auto name = folly::sformat("{}.{}{}", stem, ts, ext);
+  for (int seq = 1; access(name.c_str(), F_OK) == 0 ||
+       access((name + ".zst").c_str(), F_OK) == 0;
+       seq++) {
+    name = folly::sformat("{}.{}.{}{}", stem, ts, seq, ext);
+  }
+  return name;
+}
+
+void
+SegmentRotator::finalizeLoop() {
+  while (true) {
+    std::string path;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+      if (pending_.empty()) {
+        return;
+      }
+      path = std::move(pending_.front());
+      pending_.pop_front();
+    }
+    finalize(path);
+  }
+}
+
+void
+SegmentRotator::finalize(const std::string& segment) const {
+  const auto start = std::chrono::steady_clock::now();
+  auto path = segment;
+  if (options_.compress) {
+    path = compressSegment(path);
+  }
+  if (options_.checksum) {
+    checksumSegment(path);
+  }
+  LOG(INFO) << folly::format(
+      "Finalized export segment {} in {} ms",
+      path,
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
+}
+
+} // namespace common
+} // namespace paths
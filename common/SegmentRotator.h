@@ -0,0 +1,106 @@
+#pragma once
+
+#include <folly/File.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace paths {
+namespace common {
+
+/**
+ * Splits an export file into segments (--export_rotate_*).
+ *
+ * The open segment is written to <path>.inprogress. Once closed, it is
+ * renamed to <stem>.<UTC start time><ext> (e.g. ack.20191016T142501Z.csv),
+ * so readers never see a partial segment under its final name. Closed
+ * segments are then compressed and/or checksummed by a background thread
+ * (--export_segment_finalize), so that the writer never waits for them.
+ */
+class SegmentRotator {
+ public:
+  struct Options {
+    std::string path;
+
+    // a segment is closed once it holds this many bytes (0 = no limit)
+    size_t rotateBytes{0};
+
+    // a segment is closed once it has been open this long (0 = no limit)
+    std::chrono::seconds rotateInterval{0};
+
+    // replace closed segments with a <segment>.zst
+    bool compress{false};
+
+    // write <segment>.sha256, in the format of sha256sum
+    bool checksum{false};
+  };
+
+  /**
+   * Creates a rotator for path if --export_rotate_bytes or
+   * --export_rotate_interval_s is set; returns nullptr otherwise.
+   */
+  static std::unique_ptr<SegmentRotator> createFromFlags(
+      const std::string& path);
+
+  explicit SegmentRotator(const Options& options);
+
+  /**
+   * Waits for queued segments to be finalized.
+   */
+  ~SegmentRotator();
+
+  /**
+   * Opens a new segment. Fails hard if the file cannot be created, as the
+   * collectors do for the export file.
+   */
+  folly::File openSegment();
+
+  /**
+   * Closes the open segment, renames it and queues it for finalization.
+   */
+  void closeSegment(folly::File&& file);
+
+  /**
+   * Whether the open segment, holding segmentBytes, reached the size limit.
+   */
+  bool isFull(size_t segmentBytes) const {
+    return options_.rotateBytes && segmentBytes >= options_.rotateBytes;
+  }
+
+  /**
+   * Whether the open segment reached the time limit.
+   */
+  bool isExpired() const;
+
+  /**
+   * Path of the open segment, for writers that reopen it by name.
+   */
+  const std::string& getInProgressPath() const {
+    return inProgressPath_;
+  }
+
+ private:
+  std::string segmentName(std::chrono::system_clock::time_point start);
+
+  void finalizeLoop();
+
+  void finalize(const std::string& path) const;
+
+  const Options options_;
+  const std::string inProgressPath_;
+  std::chrono::steady_clock::time_point segmentStart_;
+  std::chrono::system_clock::time_point segmentStartWall_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::string> pending_;
+  bool stopping_{false};
+  std::thread finalizer_;
+};
+
+} // namespace common
+} // namespace paths
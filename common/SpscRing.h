@@ -0,0 +1,127 @@
+#pragma once
+
+#include <glog/logging.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace paths {
+namespace common {
+
+/**
+ * Bounded lock-free queue for one producer thread and one consumer thread.
+ *
+ * Indices grow monotonically and map to slot index % capacity. The consumer
+ * claims the element at head_ with a CAS, moves it out, and then advances
+ * released_; the producer only writes to a slot once its previous element
+ * has been released, so a slot is never written while it is being read.
+ *
+ * pushOverwriteOldest() lets the producer discard the oldest element when
+ * the ring is full. It claims the oldest element with the same CAS the
+ * consumer uses, so it fails (and the caller should drop the new element
+ * instead) only if the consumer is reading that element at the same time.
+ *
+ * T must be default constructible and move assignable.
+ */
+template <typename T>
+class SpscRing {
+ public:
+  explicit SpscRing(size_t capacity) : capacity_(capacity), slots_(capacity) {
+    CHECK_GT(capacity_, 0);
+  }
+
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  /**
+   * Producer only. Returns false, leaving value untouched, if the ring is
+   * full.
+   */
+  bool tryPush(T& value) {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - released_.load(std::memory_order_acquire) >= capacity_) {
+      return false;
+    }
+    slots_[tail % capacity_] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Producer only. Like tryPush(), but if the ring is full the oldest
+   * element is discarded to make room. Returns false, leaving value
+   * untouched, if the oldest element is being read by the consumer.
+   * Sets overwrote if an element was discarded.
+   */
+  bool pushOverwriteOldest(T& value, bool& overwrote) {
+    overwrote = false;
+    if (tryPush(value)) {
+      return true;
+    }
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    uint64_t oldest = tail - capacity_;
+    if (not head_.compare_exchange_strong(
+            oldest, oldest + 1, std::memory_order_acq_rel)) {
+      return false;
+    }
+    // slot of oldest is now owned by the producer; it is the slot of tail
+    slots_[tail % capacity_] = std::move(value);
+    advanceReleased(oldest + 1);
+    tail_.store(tail + 1, std::memory_order_release);
+    overwrote = true;
+    return true;
+  }
+
+  /**
+   * Consumer only. Returns false if the ring is empty.
+   */
+  bool tryPop(T& value) {
+    auto head = head_.load(std::memory_order_acquire);
+    do {
+      if (head == tail_.load(std::memory_order_acquire)) {
+        return false;
+      }
+    } while (not head_.compare_exchange_weak(
+        head, head + 1, std::memory_order_acq_rel));
+    value = std::move(slots_[head % capacity_]);
+    advanceReleased(head + 1);
+    return true;
+  }
+
+  /**
+   * Number of queued elements (approximate while other threads run).
+   */
+  size_t size() const {
+    const auto head = head_.load(std::memory_order_acquire);
+    const auto tail = tail_.load(std::memory_order_acquire);
+    return tail > head ? tail - head : 0;
+  }
+
+  size_t capacity() const {
+    return capacity_;
+  }
+
+ private:
+  // released_ only moves forward; producer and consumer may both advance it
+  void advanceReleased(uint64_t to) {
+    auto cur = released_.load(std::memory_order_relaxed);
+    while (cur < to &&
+           not released_.compare_exchange_weak(
+               cur, to, std::memory_order_release)) {
+    }
+  }
+
+  const size_t capacity_;
+  std::vector<T> slots_;
+
+  // next index to be claimed (consumer, or producer when overwriting)
+  alignas(64) std::atomic<uint64_t> head_{0};
+  // all slots of indices below released_ may be overwritten
+  alignas(64) std::atomic<uint64_t> released_{0};
+  // next index to be written (producer)
+  alignas(64) std::atomic<uint64_t> tail_{0};
+};
+
+} // namespace common
+} // namespace paths
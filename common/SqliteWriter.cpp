@@ -0,0 +1,414 @@
+#include "SqliteWriter.h"
+
+#include <fcntl.h>
+#include <sqlite3.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <src/common/CsvRowEncoder.h>
+
+static bool
+ValidateTransactionRows(const char* flagname, uint32_t value) {
+  if (value == 0) {
+    LOG(ERROR) << folly::format("--{} must be > 0", flagname);
+    return false;
+  }
+  return true;
+}
+
+DEFINE_uint32(
+    sqlite_transaction_rows,
+    10000,
+    "SQLite export: rows inserted per transaction");
+DEFINE_validator(sqlite_transaction_rows, &ValidateTransactionRows);
+DEFINE_uint32(
+    sqlite_transaction_interval_ms,
+    1000,
+    "SQLite export: maximum time a transaction stays open before it is "
+    "committed (0 = commit by size only)");
+DEFINE_uint32(
+    sqlite_stats_interval_s,
+    60,
+    "SQLite export: interval between logs of the ingest rate "
+    "(0 logs only when a database is closed)");
+
+namespace paths {
+namespace common {
+
+namespace {
+
+// a tick of the background thread when transactions are committed by size
+constexpr std::chrono::seconds kDefaultTickInterval{1};
+
+std::string
+quoteIdentifier(folly::StringPiece name) {
+  std::string quoted = "\"";
+  for (const char c : name) {
+    quoted.push_back(c);
+    if (c == '"') {
+      quoted.push_back(c);
+    }
+  }
+  quoted.push_back('"');
+  return quoted;
+}
+
+off_t
+fileSize(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+double
+toMs(std::chrono::steady_clock::duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+// checkpoints the WAL of a database left open by a previous run, so that
+// the rows it committed end up in the database file itself
+void
+recoverDatabase(const std::string& path) {
+  if (access((path + "-wal").c_str(), F_OK) != 0) {
+    return;
+  }
+  sqlite3* db = nullptr;
+  if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr) ==
+          SQLITE_OK &&
+      sqlite3_exec(
+          db, "PRAGMA wal_checkpoint(TRUNCATE)", nullptr, nullptr, nullptr) ==
+          SQLITE_OK) {
+    LOG(WARNING) << folly::format("Recovered unfinished database {}", path);
+  } else {
+    LOG(ERROR) << folly::format(
+        "Unable to recover unfinished database {}: {}",
+        path,
+        db ? sqlite3_errmsg(db) : "out of memory");
+  }
+  sqlite3_close(db);
+}
+
+} // namespace
+
+std::unique_ptr<SqliteWriter>
+SqliteWriter::createFromFlags(
+    const std::string& path,
+    folly::StringPiece table,
+    std::vector<ColumnSpec> columns,
+    std::vector<std::string> indexColumns) {
+  if (path.empty()) {
+    LOG(FATAL) << "--export_mode=sqlite requires --export_file_path";
+  }
+  Options options;
+  options.path = path;
+  options.table = table.str();
+  // columns can be left out by a projection, or split by
+  // --export_raw_addresses, in which case the address is indexed on its
+  // _ip_hi and _ip_lo columns
+  const auto hasColumn = [&columns](const std::string& name) {
+    return std::any_of(
+        columns.begin(), columns.end(), [&name](const ColumnSpec& spec) {
+          return spec.name == name;
+        });
+  };
+  for (const auto& column : indexColumns) {
+    if (hasColumn(column)) {
+      options.indexes.push_back({column});
+      continue;
+    }
+    std::vector<std::string> names;
+    appendAddressColumnNames(column, names);
+    if (names.size() == 3 && hasColumn(names[0]) && hasColumn(names[1])) {
+      options.indexes.push_back({names[0], names[1]});
+    }
+  }
+  options.transactionRows = FLAGS_sqlite_transaction_rows;
+  options.transactionInterval =
+      std::chrono::milliseconds(FLAGS_sqlite_transaction_interval_ms);
+  options.statsInterval = std::chrono::seconds(FLAGS_sqlite_stats_interval_s);
+
+  // before the rotator keeps the segment of a previous run as it is
+  recoverDatabase(path + ".inprogress");
+  auto rotator = SegmentRotator::createFromFlags(path);
+  return std::make_unique<SqliteWriter>(
+      options, std::move(columns), std::move(rotator));
+}
+
+SqliteWriter::SqliteWriter(
+    const Options& options,
+    std::vector<ColumnSpec> columns,
+    std::unique_ptr<SegmentRotator> rotator)
+    : options_(options),
+      columns_(std::move(columns)),
+      rotator_(std::move(rotator)),
+      rowLock_(mutex_, std::defer_lock) {
+  CHECK(!columns_.empty());
+  if (rotator_) {
+    segmentFile_ = rotator_->openSegment();
+    openLocked(rotator_->getInProgressPath());
+  } else {
+    unlink(options_.path.c_str());
+    openLocked(options_.path);
+  }
+  lastStats_ = std::chrono::steady_clock::now();
+
+  const auto tick = options_.transactionInterval.count() > 0
+      ? options_.transactionInterval
+      : std::chrono::milliseconds(kDefaultTickInterval);
+  scheduler_.setThreadName("SqliteWriter");
+  scheduler_.addFunction(
+      [this] {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto now = std::chrono::steady_clock::now();
+        if (transactionRows_ > 0 &&
+            options_.transactionInterval.count() > 0 &&
+            now - transactionStart_ >= options_.transactionInterval) {
+          commitLocked();
+        }
+        if (rotator_ && rotator_->isExpired()) {
+          rotateLocked();
+        }
+        if (options_.statsInterval.count() > 0 &&
+            now - lastStats_ >= options_.statsInterval) {
+          logStatsLocked("ingest");
+        }
+      },
+      tick,
+      "commit",
+      tick);
+  scheduler_.start();
+}
+
+SqliteWriter::~SqliteWriter() {
+  scheduler_.shutdown();
+  std::lock_guard<std::mutex> lock(mutex_);
+  closeLocked();
+  if (rotator_) {
+    rotator_->closeSegment(std::move(*segmentFile_));
+  }
+}
+
+void
+SqliteWriter::openLocked(const std::string& path) {
+  // a WAL left next to a new database would be replayed into it
+  unlink((path + "-wal").c_str());
+  unlink((path + "-shm").c_str());
+  dbPath_ = path;
+  if (sqlite3_open_v2(
+          path.c_str(),
+          &db_,
+          SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX,
+          nullptr) != SQLITE_OK) {
+    LOG(FATAL) << folly::format(
+        "Unable to open database {} for export, error = {}",
+        path,
+        db_ ? sqlite3_errmsg(db_) : "out of memory");
+  }
+
+  std::vector<std::string> definitions;
+  for (const auto& column : columns_) {
+    definitions.push_back(folly::sformat(
+        "{} {}",
+        quoteIdentifier(column.name),
+        column.type == ColumnType::STRING ? "TEXT" : "INTEGER"));
+  }
+  const auto table = quoteIdentifier(options_.table);
+  const auto insert = folly::sformat(
+      "INSERT INTO {} VALUES (?{})",
+      table,
+      folly::join("", std::vector<std::string>(columns_.size() - 1, ",?")));
+  if (!exec("PRAGMA journal_mode=WAL") ||
+      !exec("PRAGMA synchronous=NORMAL") ||
+      !exec(folly::sformat(
+          "CREATE TABLE {} ({})", table, folly::join(", ", definitions))) ||
+      sqlite3_prepare_v3(
+          db_,
+          insert.c_str(),
+          insert.size(),
+          SQLITE_PREPARE_PERSISTENT,
+          &insert_,
+          nullptr) != SQLITE_OK ||
+      !exec("BEGIN")) {
+    LOG(FATAL) << folly::format(
+        "Unable to set up database {} for export, error = {}",
+        path,
+        sqlite3_errmsg(db_));
+  }
+  transactionRows_ = 0;
+  LOG(INFO) << folly::format("Opened database {} for export", path);
+}
+
+void
+SqliteWriter::closeLocked() {
+  const auto commitStart = std::chrono::steady_clock::now();
+  exec("COMMIT");
+  if (transactionRows_ > 0) {
+    commitTime_ += std::chrono::steady_clock::now() - commitStart;
+    commits_++;
+    transactionRows_ = 0;
+  }
+
+  // each index is built in one pass over the table, instead of on every insert
+  const auto start = std::chrono::steady_clock::now();
+  for (const auto& index : options_.indexes) {
+    std::vector<std::string> quoted;
+    for (const auto& column : index) {
+      quoted.push_back(quoteIdentifier(column));
+    }
+    exec(folly::sformat(
+        "CREATE INDEX {} ON {} ({})",
+        quoteIdentifier(folly::sformat(
+            "{}_{}", options_.table, folly::join("_", index))),
+        quoteIdentifier(options_.table),
+        folly::join(", ", quoted)));
+  }
+  const auto indexTime = std::chrono::steady_clock::now() - start;
+  logStatsLocked("closed");
+  LOG(INFO) << folly::format(
+      "Indexed database {} in {:.1f} ms", dbPath_, toMs(indexTime));
+
+  sqlite3_finalize(insert_);
+  insert_ = nullptr;
+  // the last connection checkpoints the WAL into the database and removes it
+  if (sqlite3_close(db_) != SQLITE_OK) {
+    LOG(ERROR) << folly::format(
+        "Unable to close database {}: {}", dbPath_, sqlite3_errmsg(db_));
+  }
+  db_ = nullptr;
+}
+
+void
+SqliteWriter::commitLocked() {
+  if (transactionRows_ == 0) {
+    return;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  exec("COMMIT");
+  exec("BEGIN");
+  commitTime_ += std::chrono::steady_clock::now() - start;
+  commits_++;
+  transactionRows_ = 0;
+
+  if (rotator_ &&
+      rotator_->isFull(fileSize(dbPath_) + fileSize(dbPath_ + "-wal"))) {
+    rotateLocked();
+  }
+}
+
+void
+SqliteWriter::commit() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  commitLocked();
+}
+
+void
+SqliteWriter::rotateLocked() {
+  closeLocked();
+  rotator_->closeSegment(std::move(*segmentFile_));
+  segmentFile_ = rotator_->openSegment();
+  openLocked(rotator_->getInProgressPath());
+}
+
+void
+SqliteWriter::logStatsLocked(const char* event) {
+  const auto now = std::chrono::steady_clock::now();
+  const double seconds =
+      std::chrono::duration<double>(now - lastStats_).count();
+  const uint64_t rows = rowsWritten_.load(std::memory_order_relaxed);
+  const uint64_t commits = commits_ - lastCommits_;
+  LOG(INFO) << folly::format(
+      "SqliteWriter {} ({}): {} rows in {:.1f} s ({:.0f} rows/s), "
+      "{} transactions ({:.2f} ms per commit); {} rows total, {} failed",
+      dbPath_,
+      event,
+      rows - lastRowsWritten_,
+      seconds,
+      seconds > 0 ? (rows - lastRowsWritten_) / seconds : 0.0,
+      commits,
+      commits ? toMs(commitTime_ - lastCommitTime_) / commits : 0.0,
+      rows,
+      rowsFailed_);
+  lastRowsWritten_ = rows;
+  lastCommits_ = commits_;
+  lastCommitTime_ = commitTime_;
+  lastStats_ = now;
+}
+
+bool
+SqliteWriter::exec(const std::string& sql) {
+  char* error = nullptr;
+  if (sqlite3_exec(db_, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK) {
+    LOG(ERROR) << folly::format(
+        "{} failed on {}: {}", sql, dbPath_, error ? error : "unknown error");
+    sqlite3_free(error);
+    return false;
+  }
+  return true;
+}
+
+void
+SqliteWriter::beginRow() {
+  rowLock_.lock();
+  next_ = 0;
+}
+
+int
+SqliteWriter::nextColumn() {
+  DCHECK_LT(next_, int(columns_.size()));
+  // parameters are numbered from 1
+  return ++next_;
+}
+
+void
+SqliteWriter::bindInt64(int64_t value) {
+  sqlite3_bind_int64(insert_, nextColumn(), value);
+}
+
+void
+SqliteWriter::addString(folly::StringPiece value) {
+  sqlite3_bind_text(
+      insert_, nextColumn(), value.data(), value.size(), SQLITE_TRANSIENT);
+}
+
+void
+SqliteWriter::addAddress(const struct sockaddr_storage* sas) {
+  char tmp[kMaxFormattedAddressLength];
+  const auto len = formatAddress(sas, tmp);
+  if (len == 0) {
+    addString("<uninitialized address>");
+    return;
+  }
+  addString(folly::StringPiece(tmp, len));
+}
+
+void
+SqliteWriter::addNull() {
+  sqlite3_bind_null(insert_, nextColumn());
+}
+
+void
+SqliteWriter::endRow() {
+  CHECK_EQ(next_, int(columns_.size())) << "Row does not match the schema";
+  if (sqlite3_step(insert_) == SQLITE_DONE) {
+    rowsWritten_.fetch_add(1, std::memory_order_relaxed);
+    if (transactionRows_++ == 0) {
+      transactionStart_ = std::chrono::steady_clock::now();
+    }
+  } else if (rowsFailed_++ == 0) {
+    // later failures are counted in the ingest statistics
+    LOG(ERROR) << folly::format(
+        "Unable to insert into {}: {}", dbPath_, sqlite3_errmsg(db_));
+  }
+  sqlite3_reset(insert_);
+  if (transactionRows_ >= options_.transactionRows) {
+    commitLocked();
+  }
+  rowLock_.unlock();
+}
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <folly/File.h>
+#include <folly/Optional.h>
+#include <folly/Range.h>
+#include <folly/experimental/FunctionScheduler.h>
+#include <src/common/ColumnarFile.h>
+#include <src/common/SegmentRotator.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace paths {
+namespace common {
+
+/**
+ * Writes rows to a SQLite database (--export_mode=sqlite).
+ *
+ * The database has a single table, named after the tool, with one column per
+ * exported field: INTEGER for integer columns (UINT64 values above INT64_MAX
+ * are stored as their two's complement, SQLite integers being signed), TEXT
+ * for the others. Rows are inserted with a prepared statement, in
+ * transactions that are committed once they hold transactionRows rows or
+ * have been open for transactionInterval (checked from a background thread,
+ * so that rows do not sit in an open transaction when events are rare). The
+ * database is in WAL mode with synchronous=NORMAL, so commits do not wait for
+ * the disk; a crash loses at most the rows of the open transaction.
+ *
+ * Indexes on indexColumns (the timestamp and destination of the events) are
+ * only created when the database is closed, so inserts never update them.
+ * An address split by --export_raw_addresses is indexed on its
+ * <name>_ip_hi and <name>_ip_lo columns together.
+ *
+ * With a SegmentRotator, each segment is a database of its own, written to
+ * <path>.inprogress and indexed before it is renamed; the size limit applies
+ * to the database and its WAL, and is checked at each commit.
+ *
+ * Values are added in column order with the interface of CsvRowEncoder, so
+ * the CSV encoding functions of the tools can fill it:
+ *   sqlite.beginRow();
+ *   encodeCsvRow(ev, sqlite);
+ *   sqlite.endRow();
+ * beginRow() holds the lock of the writer until endRow(); rows must be added
+ * from a single thread.
+ */
+class SqliteWriter {
+ public:
+  struct Options {
+    std::string path;
+
+    // table name, also the prefix of the index names
+    std::string table;
+
+    // indexes created when the database is closed, each on these columns
+    std::vector<std::vector<std::string>> indexes;
+
+    // a transaction is committed once it holds this many rows
+    size_t transactionRows{10000};
+
+    // ... or once it has been open this long
+    std::chrono::milliseconds transactionInterval{std::chrono::seconds(1)};
+
+    // ingest rates are logged this often (0 = only when a database is closed)
+    std::chrono::seconds statsInterval{60};
+  };
+
+  /**
+   * Creates a writer for the export file at path, configured from the
+   * --sqlite_* flags and rotated as set by the --export_rotate_* flags.
+   * indexColumns that are not in columns (nor split into raw address
+   * columns) are not indexed. Fails hard if path is empty or the database
+   * cannot be created.
+   */
+  static std::unique_ptr<SqliteWriter> createFromFlags(
+      const std::string& path,
+      folly::StringPiece table,
+      std::vector<ColumnSpec> columns,
+      std::vector<std::string> indexColumns);
+
+  /**
+   * Creates the database at options.path (replacing any file there), or the
+   * first segment of rotator.
+   */
+  SqliteWriter(
+      const Options& options,
+      std::vector<ColumnSpec> columns,
+      std::unique_ptr<SegmentRotator> rotator = nullptr);
+
+  /**
+   * Commits the open transaction, indexes and closes the database.
+   */
+  ~SqliteWriter();
+
+  SqliteWriter(const SqliteWriter&) = delete;
+  SqliteWriter& operator=(const SqliteWriter&) = delete;
+
+  void beginRow();
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value>::type add(T value) {
+    // sign extension keeps the two's complement value of signed types
+    bindInt64(static_cast<int64_t>(value));
+  }
+
+  void add(bool value) {
+    bindInt64(value);
+  }
+
+  void addRaw(folly::StringPiece value) {
+    addString(value);
+  }
+
+  void addString(folly::StringPiece value);
+
+  void addAddress(const struct sockaddr_storage* sas);
+
+  void addNull();
+
+  void endRow();
+
+  /**
+   * Commits the open transaction.
+   */
+  void commit();
+
+  uint64_t getRowsWritten() const {
+    return rowsWritten_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  void openLocked(const std::string& path);
+
+  void closeLocked();
+
+  void commitLocked();
+
+  void rotateLocked();
+
+  void logStatsLocked(const char* event);
+
+  // runs sql, logging (and returning false) if it fails
+  bool exec(const std::string& sql);
+
+  void bindInt64(int64_t value);
+
+  int nextColumn();
+
+  const Options options_;
+  const std::vector<ColumnSpec> columns_;
+  const std::unique_ptr<SegmentRotator> rotator_;
+  folly::Optional<folly::File> segmentFile_;
+
+  sqlite3* db_{nullptr};
+  sqlite3_stmt* insert_{nullptr};
+  std::string dbPath_;
+
+  // held from beginRow() to endRow(), and by the background thread
+  std::mutex mutex_;
+  std::unique_lock<std::mutex> rowLock_;
+  int next_{0};
+
+  // rows of the open transaction
+  size_t transactionRows_{0};
+  std::chrono::steady_clock::time_point transactionStart_;
+
+  // ingest statistics, since the start and since they were last logged
+  std::atomic<uint64_t> rowsWritten_{0};
+  uint64_t rowsFailed_{0};
+  uint64_t commits_{0};
+  std::chrono::steady_clock::duration commitTime_{0};
+  uint64_t lastRowsWritten_{0};
+  uint64_t lastCommits_{0};
+  std::chrono::steady_clock::duration lastCommitTime_{0};
+  std::chrono::steady_clock::time_point lastStats_;
+
+  folly::FunctionScheduler scheduler_;
+};
+
+} // namespace common
+} // namespace paths
@@ -0,0 +1,494 @@
+/**
+ * Converts captures written with --export_mode=record to the output of the
+ * collectors (CSV or columnar for ackevents and rtttrace; CSV, JSON, TXT or
+ * columnar for tcpevents).
+ *
+ * Records are decoded in chunks of --decode_chunk_records on
+ * --decode_threads threads and written in capture order, e.g.:
+ *   RecordDecoder --input_path=ack.rec --export_file_path=ack.csv
+ * Columnar output is written by a single thread, as its record batches
+ * span chunks.
+ */
+#include <src/ackevents/AckEventCsv.h>
+#include <src/common/BufferedWriter.h>
+#include <src/common/ColumnarFile.h>
+#include <src/common/CsvRowEncoder.h>
+#include <src/common/Init.h>
+#include <src/common/PrefixMatcher.h>
+#include <src/common/RecordFile.h>
+#include <src/rtttrace/RttEventCsv.h>
+#include <src/tcpevents/collector/TcpEvent.h>
+#include <src/tcpevents/handlers/TcpEventColumnarExporter.h>
+#include <src/tcpevents/handlers/TcpEventExporter.h>
+
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <folly/gen/Base.h>
+#include <folly/gen/String.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+static bool
+ValidateInputPath(const char* flagname, const std::string& path) {
+  if (path.empty()) {
+    LOG(ERROR) << folly::format("{} is required", flagname);
+    return false;
+  }
+  return true;
+}
+
+DEFINE_string(input_path, "", "Capture written with --export_mode=record");
+DEFINE_validator(input_path, &ValidateInputPath);
+DEFINE_string(
+    export_file_path,
+    "",
+    "Path of file to export events to [stdout].");
+DEFINE_string(
+    export_mode,
+    "csv",
+    "Export mode (options: csv, columnar; json and txt for tcpevents "
+    "captures)");
+DEFINE_string(
+    stats_to_print,
+    "all",
+    "tcpevents only: comma separated list of stats to print for each event, "
+    "or 'all'");
+DEFINE_string(
+    client_prefix,
+    "::/0",
+    "Only export events to clients in this prefix [all clients]");
+DEFINE_validator(client_prefix, &paths::common::validateClientPrefix);
+DEFINE_bool(
+    all_tcp_events,
+    false,
+    "tcpevents only: export every event instead of the connection closes "
+    "(and snapshots) exported by TcpEventsBaseClient");
+DEFINE_uint32(
+    decode_threads,
+    0,
+    "Number of decoding threads [number of CPUs]");
+DEFINE_uint32(
+    decode_chunk_records,
+    65536,
+    "Number of records decoded by a thread at a time");
+
+#ifdef EVDEBUG
+static constexpr bool kEvdebug = true;
+#else
+static constexpr bool kEvdebug = false;
+#endif
+
+using namespace paths;
+
+using folly::gen::as;
+using folly::gen::eachTo;
+using folly::gen::filter;
+using folly::gen::map;
+using folly::gen::split;
+
+namespace {
+
+/**
+ * Calls fn(record) for the records [begin, end) of the capture sent to the
+ * monitored clients. The destinations of the range are matched with a
+ * single matchBatch() call; matches has room for end - begin entries.
+ */
+template <typename Event, typename Fn>
+void
+forEachMonitored(
+    const common::RecordFileReader& reader,
+    const common::PrefixMatcher& clients,
+    size_t begin,
+    size_t end,
+    bool* matches,
+    Fn&& fn) {
+  if (begin == end) {
+    return;
+  }
+  // records are not necessarily aligned in the capture; matchBatch does
+  // not need them to be
+  clients.matchBatch(
+      reader.getRecord(begin) + offsetof(Event, header.dst),
+      reader.getHeader().recordSize,
+      end - begin,
+      matches);
+  for (size_t r = begin; r < end; r++) {
+    if (matches[r - begin]) {
+      fn(reader.getRecord(r));
+    }
+  }
+}
+
+/**
+ * Formats ackevents and rtttrace records with their CSV encoders.
+ */
+template <typename EventT>
+class CsvFormatter {
+ public:
+  using Event = EventT;
+  using EncodeFn = void (*)(const Event&, common::CsvRowEncoder&);
+
+  explicit CsvFormatter(EncodeFn encode) : encode_(encode) {}
+
+  void append(const char* record, std::string& out) {
+    // records are not necessarily aligned in the capture
+    Event ev;
+    memcpy(&ev, record, sizeof(ev));
+    encoder_.clear();
+    encode_(ev, encoder_);
+    out.append(encoder_.str());
+    out.push_back('\n');
+  }
+
+ private:
+  EncodeFn encode_;
+  common::CsvRowEncoder encoder_;
+};
+
+/**
+ * Formats tcpevents records with a TcpEventExporter.
+ */
+class TcpEventFormatter {
+ public:
+  using Event = tcpevents::bpf::tcp_event_t;
+
+  TcpEventFormatter(
+      const std::shared_ptr<const tcpevents::TcpEventExporter>& exporter,
+      bool allEvents)
+      : exporter_(exporter), allEvents_(allEvents) {}
+
+  void append(const char* record, std::string& out) {
+    tcpevents::bpf::tcp_event_t raw;
+    memcpy(&raw, record, sizeof(raw));
+    const tcpevents::TcpEvent event(raw);
+    if (!isExported(event)) {
+      return;
+    }
+    out.append(exporter_->format(event));
+    out.push_back('\n');
+  }
+
+  bool isExported(const tcpevents::TcpEvent& event) const {
+    return allEvents_ || isConnectionClose(event);
+  }
+
+ private:
+  // the events exported by BaseTcpEventHandler
+  static bool isConnectionClose(const tcpevents::TcpEvent& event) {
+    if (event.type == tcpevents::TcpEvent::Type::TCP_SNAPSHOT) {
+      return true;
+    }
+    const auto& change = event.details.state_change;
+    return (int)change.new_state.skt_state == TCP_CLOSE &&
+        (int)change.old_state.skt_state != TCP_CLOSE &&
+        (int)change.old_state.skt_state != TCP_LISTEN;
+  }
+
+  std::shared_ptr<const tcpevents::TcpEventExporter> exporter_;
+  bool allEvents_;
+};
+
+/**
+ * Decodes the records of the capture sent to the monitored clients and
+ * passes the output of each chunk, in capture order, to writeChunk. Each
+ * thread works on its own copy of prototype. Returns the number of bytes of
+ * output.
+ */
+template <typename Formatter>
+uint64_t
+decodeRecords(
+    const common::RecordFileReader& reader,
+    const common::PrefixMatcher& clients,
+    const Formatter& prototype,
+    const std::function<void(folly::StringPiece)>& writeChunk) {
+  const size_t threads = FLAGS_decode_threads
+      ? FLAGS_decode_threads
+      : std::max(1U, std::thread::hardware_concurrency());
+  const size_t chunkRecords = std::max(1U, FLAGS_decode_chunk_records);
+  const size_t records = reader.getRecordCount();
+  const size_t chunks = (records + chunkRecords - 1) / chunkRecords;
+
+  // a round decodes a few chunks per thread, and is then written out
+  std::vector<std::string> outputs(threads * 4);
+  uint64_t bytes = 0;
+  for (size_t first = 0; first < chunks; first += outputs.size()) {
+    const size_t roundChunks = std::min(outputs.size(), chunks - first);
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < std::min(threads, roundChunks); t++) {
+      workers.emplace_back([&]() {
+        Formatter formatter(prototype);
+        std::unique_ptr<bool[]> matches(new bool[chunkRecords]);
+        for (size_t i = next++; i < roundChunks; i = next++) {
+          auto& out = outputs[i];
+          out.clear();
+          const size_t begin = (first + i) * chunkRecords;
+          const size_t end = std::min(begin + chunkRecords, records);
+          forEachMonitored<typename Formatter::Event>(
+              reader,
+              clients,
+              begin,
+              end,
+              matches.get(),
+              [&](const char* record) { formatter.append(record, out); });
+        }
+      });
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    for (size_t i = 0; i < roundChunks; i++) {
+      writeChunk(outputs[i]);
+      bytes += outputs[i].size();
+    }
+  }
+  return bytes;
+}
+
+template <typename Event>
+uint64_t
+decodeCsv(
+    const common::RecordFileReader& reader,
+    typename CsvFormatter<Event>::EncodeFn encode,
+    const std::vector<std::string>& fieldNames,
+    const common::PrefixMatcher& clients) {
+  const auto writer =
+      common::BufferedWriter::createFromFlags(FLAGS_export_file_path);
+  writer->setHeader(folly::join(",", fieldNames) + "\n");
+  return decodeRecords(
+      reader,
+      clients,
+      CsvFormatter<Event>(encode),
+      [&writer](folly::StringPiece chunk) { writer->write(chunk); });
+}
+
+/**
+ * Decodes all records of the capture into a columnar file, with the columns
+ * of the CSV output.
+ */
+template <typename Event>
+uint64_t
+decodeColumnar(
+    const common::RecordFileReader& reader,
+    void (*encode)(const Event&, common::ColumnarWriter&),
+    void (*recordTypes)(const Event&, common::ColumnTypeRecorder&),
+    const std::vector<std::string>& fieldNames,
+    const common::PrefixMatcher& clients) {
+  const auto writer =
+      common::BufferedWriter::createFromFlags(FLAGS_export_file_path);
+  common::ColumnTypeRecorder recorder;
+  recordTypes(Event(), recorder);
+  const auto columnar = common::ColumnarWriter::createFromFlags(
+      *writer,
+      reader.getTool(),
+      common::ColumnarWriter::makeColumns(fieldNames, recorder));
+  const size_t chunkRecords = std::max(1U, FLAGS_decode_chunk_records);
+  std::unique_ptr<bool[]> matches(new bool[chunkRecords]);
+  for (size_t begin = 0; begin < reader.getRecordCount();
+       begin += chunkRecords) {
+    const size_t end =
+        std::min(begin + chunkRecords, reader.getRecordCount());
+    forEachMonitored<Event>(
+        reader, clients, begin, end, matches.get(), [&](const char* record) {
+          Event ev;
+          memcpy(&ev, record, sizeof(ev));
+          columnar->beginRow();
+          encode(ev, *columnar);
+          columnar->endRow();
+        });
+  }
+  columnar->flush();
+  return columnar->getBytesWritten();
+}
+
+template <typename Event>
+uint64_t
+decode(
+    const common::RecordFileReader& reader,
+    void (*encodeCsv)(const Event&, common::CsvRowEncoder&),
+    void (*encodeColumnar)(const Event&, common::ColumnarWriter&),
+    void (*recordTypes)(const Event&, common::ColumnTypeRecorder&),
+    const std::vector<std::string>& fieldNames,
+    const common::PrefixMatcher& clients) {
+  if (FLAGS_export_mode == "columnar") {
+    return decodeColumnar(
+        reader, encodeColumnar, recordTypes, fieldNames, clients);
+  }
+  return decodeCsv<Event>(reader, encodeCsv, fieldNames, clients);
+}
+
+uint64_t
+decodeTcpEvents(
+    const common::RecordFileReader& reader,
+    const common::PrefixMatcher& clients) {
+  folly::Optional<std::unordered_set<std::string>> statsToPrintOpt;
+  if (FLAGS_stats_to_print != "all") {
+    statsToPrintOpt = split(FLAGS_stats_to_print, ',') |
+        map([](const auto& str) { return folly::trimWhitespace(str); }) |
+        eachTo<std::string>() |
+        filter([](const auto& str) { return str.size(); }) |
+        as<std::unordered_set<std::string>>();
+  }
+
+  if (FLAGS_export_mode == "columnar") {
+    const auto exporter =
+        std::make_shared<const tcpevents::TcpEventColumnarExporter>(
+            common::BufferedWriter::createFromFlags(FLAGS_export_file_path),
+            statsToPrintOpt);
+    const TcpEventFormatter formatter(exporter, FLAGS_all_tcp_events);
+    const size_t chunkRecords = std::max(1U, FLAGS_decode_chunk_records);
+    std::unique_ptr<bool[]> matches(new bool[chunkRecords]);
+    for (size_t begin = 0; begin < reader.getRecordCount();
+         begin += chunkRecords) {
+      const size_t end =
+          std::min(begin + chunkRecords, reader.getRecordCount());
+      forEachMonitored<TcpEventFormatter::Event>(
+          reader, clients, begin, end, matches.get(), [&](const char* record) {
+            tcpevents::bpf::tcp_event_t raw;
+            memcpy(&raw, record, sizeof(raw));
+            const tcpevents::TcpEvent event(raw);
+            if (formatter.isExported(event)) {
+              exporter->write(event);
+            }
+          });
+    }
+    exporter->flush();
+    return exporter->getBytesWritten();
+  }
+
+  tcpevents::TcpEventExporterType exportMode;
+  if (FLAGS_export_mode == "csv") {
+    exportMode = tcpevents::TcpEventExporterType::CSV;
+  } else if (FLAGS_export_mode == "json") {
+    exportMode = tcpevents::TcpEventExporterType::JSON;
+  } else {
+    exportMode = tcpevents::TcpEventExporterType::TXT;
+  }
+
+  const std::shared_ptr<const tcpevents::TcpEventExporter> exporter =
+      tcpevents::TcpEventExporter::createExporter(
+          exportMode,
+          common::BufferedWriter::createFromFlags(FLAGS_export_file_path),
+          statsToPrintOpt);
+  return decodeRecords(
+      reader,
+      clients,
+      TcpEventFormatter(exporter, FLAGS_all_tcp_events),
+      [&exporter](folly::StringPiece chunk) {
+        exporter->writeFormatted(chunk);
+      });
+}
+
+bool
+checkLayout(
+    const common::RecordFileReader& reader,
+    size_t recordSize,
+    bool evdebug) {
+  const auto& header = reader.getHeader();
+  if (header.recordSize != recordSize || reader.isEvdebug() != evdebug) {
+    LOG(ERROR) << folly::format(
+        "Capture of {} byte records{} cannot be decoded by this build "
+        "({} byte records{})",
+        header.recordSize,
+        reader.isEvdebug() ? " (EVDEBUG)" : "",
+        recordSize,
+        evdebug ? " (EVDEBUG)" : "");
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[]) {
+  paths::init(argc, argv);
+
+  const auto reader = common::RecordFileReader::open(FLAGS_input_path);
+  if (!reader) {
+    return 1;
+  }
+  const auto& header = reader->getHeader();
+  const auto tool = reader->getTool();
+  LOG(INFO) << folly::format(
+      "{} capture: {} records, sampling rate {}, started at {} ns "
+      "(monotonic {} ns)",
+      tool,
+      reader->getRecordCount(),
+      header.samplingRate,
+      header.startRealtimeNs,
+      header.startMonotonicNs);
+
+  if (FLAGS_export_mode != "csv" && FLAGS_export_mode != "json" &&
+      FLAGS_export_mode != "txt" && FLAGS_export_mode != "columnar") {
+    LOG(ERROR) << folly::format("Unknown export mode {}", FLAGS_export_mode);
+    return 1;
+  }
+  if (tool != "tcpevents" && FLAGS_export_mode != "csv" &&
+      FLAGS_export_mode != "columnar") {
+    LOG(ERROR) << folly::format(
+        "{} captures can only be exported to csv or columnar", tool);
+    return 1;
+  }
+
+  const auto clients =
+      common::PrefixMatcher::createFromFlags(FLAGS_client_prefix);
+  if (!clients) {
+    return 1;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  uint64_t bytes = 0;
+  if (tool == "ackevents") {
+    if (!checkLayout(*reader, sizeof(ackevents::bpf::ack_event), kEvdebug)) {
+      return 1;
+    }
+    bytes = decode<ackevents::bpf::ack_event>(
+        *reader,
+        &ackevents::encodeCsvRow<common::CsvRowEncoder>,
+        &ackevents::encodeCsvRow<common::ColumnarWriter>,
+        &ackevents::encodeCsvRow<common::ColumnTypeRecorder>,
+        ackevents::getCsvFieldNames(),
+        *clients);
+  } else if (tool == "rtttrace") {
+    if (!checkLayout(*reader, sizeof(rtttrace::bpf::rtt_event), false)) {
+      return 1;
+    }
+    bytes = decode<rtttrace::bpf::rtt_event>(
+        *reader,
+        &rtttrace::encodeCsvRow<common::CsvRowEncoder>,
+        &rtttrace::encodeCsvRow<common::ColumnarWriter>,
+        &rtttrace::encodeCsvRow<common::ColumnTypeRecorder>,
+        rtttrace::getCsvFieldNames(),
+        *clients);
+  } else if (tool == "tcpevents") {
+    if (!checkLayout(*reader, sizeof(tcpevents::bpf::tcp_event_t), false)) {
+      return 1;
+    }
+    bytes = decodeTcpEvents(*reader, *clients);
+  } else {
+    LOG(ERROR) << folly::format("Captures of {} are not supported", tool);
+    return 1;
+  }
+
+  const auto elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start);
+  LOG(INFO) << folly::format(
+      "Decoded {} records ({} bytes of output) in {:.3f} s, {:.0f} records/s",
+      reader->getRecordCount(),
+      bytes,
+      elapsed.count(),
+      reader->getRecordCount() / std::max(elapsed.count(), 1e-9));
+  return 0;
+}
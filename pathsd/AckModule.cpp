@@ -0,0 +1,67 @@
+#include "AckModule.h"
+
+#include <folly/Format.h>
+#include <glog/logging.h>
+#include <src/ackevents/AckEventCsv.h>
+#include <src/pathsd/bpf/BpfStructs.h>
+
+namespace paths {
+namespace pathsd {
+
+AckModule::AckModule(std::shared_ptr<const common::PrefixMatcher> clients)
+    : clients_(std::move(clients)) {}
+
+std::string
+AckModule::getName() const {
+  return "ack";
+}
+
+std::string
+AckModule::getCflag() const {
+  return "-DMODULE_ACK";
+}
+
+std::vector<Module::Probe>
+AckModule::getProbes() const {
+  return {
+      {Probe::Type::KPROBE,
+       "tcp_rate_skb_delivered",
+       "on_tcp_rate_skb_delivered",
+       true},
+      {Probe::Type::KPROBE, "tcp_trim_head", "on_tcp_trim_head", true},
+  };
+}
+
+uint32_t
+AckModule::getRecordType() const {
+  return RECORD_ACK_EVENT;
+}
+
+std::vector<std::string>
+AckModule::getFieldNames() const {
+  return ackevents::getCsvFieldNames();
+}
+
+bool
+AckModule::encodeRow(
+    const void* data,
+    size_t size,
+    common::CsvRowEncoder& encoder) const {
+  if (size < sizeof(ackevents::bpf::ack_event)) {
+    LOG(ERROR) << folly::format(
+        "Received {} bytes for an ack_event, expected {}",
+        size,
+        sizeof(ackevents::bpf::ack_event));
+    return false;
+  }
+  const auto& ev = *static_cast<const ackevents::bpf::ack_event*>(data);
+  if (!clients_->match(
+          reinterpret_cast<const struct sockaddr*>(&ev.header.dst))) {
+    return false;
+  }
+  ackevents::encodeCsvRow(ev, encoder);
+  return true;
+}
+
+} // namespace pathsd
+} // namespace paths
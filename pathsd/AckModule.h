@@ -0,0 +1,32 @@
+#pragma once
+
+#include <src/common/PrefixMatcher.h>
+#include <src/pathsd/Module.h>
+
+namespace paths {
+namespace pathsd {
+
+/**
+ * ackevents: first lost packet and spurious retransmissions, exported when
+ * the connection closes.
+ */
+class AckModule : public Module {
+ public:
+  explicit AckModule(std::shared_ptr<const common::PrefixMatcher> clients);
+
+  std::string getName() const override;
+  std::string getCflag() const override;
+  std::vector<Probe> getProbes() const override;
+  uint32_t getRecordType() const override;
+  std::vector<std::string> getFieldNames() const override;
+  bool encodeRow(
+      const void* data,
+      size_t size,
+      common::CsvRowEncoder& encoder) const override;
+
+ private:
+  const std::shared_ptr<const common::PrefixMatcher> clients_;
+};
+
+} // namespace pathsd
+} // namespace paths
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <src/common/CsvRowEncoder.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace paths {
+namespace pathsd {
+
+/**
+ * An analysis run by pathsd on top of the shared connection table.
+ *
+ * Each module corresponds to a section of pathsd/bpf/BpfProg.c enabled by
+ * getCflag(), lists the probes it needs in addition to the shared
+ * establish/close path, and encodes the records it emits into rows of the
+ * common output pipeline.
+ */
+class Module {
+ public:
+  struct Probe {
+    enum class Type { TRACEPOINT, KPROBE };
+    Type type;
+    std::string target; // tracepoint (category:name) or kernel function
+    std::string fn;
+    bool required;
+  };
+
+  virtual ~Module() = default;
+
+  /**
+   * Name used by --modules and as the name of the module's output stream.
+   */
+  virtual std::string getName() const = 0;
+
+  /**
+   * Compile flag that enables the module in the BPF program.
+   */
+  virtual std::string getCflag() const = 0;
+
+  virtual std::vector<Probe> getProbes() const = 0;
+
+  /**
+   * Type of the records emitted by the module (RECORD_* in bpf/BpfStructs.h).
+   */
+  virtual uint32_t getRecordType() const = 0;
+
+  /**
+   * Column names of the module's output stream.
+   */
+  virtual std::vector<std::string> getFieldNames() const = 0;
+
+  /**
+   * Appends the columns of a record payload to the encoder. Returns false,
+   * without touching the encoder, if the record is filtered out.
+   */
+  virtual bool encodeRow(
+      const void* data,
+      size_t size,
+      common::CsvRowEncoder& encoder) const = 0;
+};
+
+} // namespace pathsd
+} // namespace paths
@@ -0,0 +1,61 @@
+#include "OutputPipeline.h"
+
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <glog/logging.h>
+
+namespace paths {
+namespace pathsd {
+
+OutputPipeline::OutputPipeline(const std::string& exportDir)
+    : exportDir_(exportDir) {}
+
+size_t
+OutputPipeline::addStream(
+    const std::string& name,
+    const std::vector<std::string>& fieldNames) {
+  Stream stream{name, nullptr, nullptr, 0};
+  const auto header = folly::join(",", fieldNames);
+  if (exportDir_.size()) {
+    const auto path = folly::sformat("{}/{}.csv", exportDir_, name);
+    LOG(INFO) << folly::sformat("Exporting module {} to {}", name, path);
+    stream.fileWriter = common::BufferedWriter::createFromFlags(path);
+    stream.writer = stream.fileWriter.get();
+    // repeated in every segment if --export_rotate_* are set
+    stream.writer->setHeader(header + "\n");
+  } else {
+    if (not stdoutWriter_) {
+      stdoutWriter_ = common::BufferedWriter::createFromFlags(folly::none);
+    }
+    stream.writer = stdoutWriter_.get();
+    writeLine(stream, header);
+  }
+  streams_.push_back(std::move(stream));
+  return streams_.size() - 1;
+}
+
+void
+OutputPipeline::write(size_t streamId, const std::string& row) {
+  auto& stream = streams_.at(streamId);
+  writeLine(stream, row);
+  stream.rows++;
+}
+
+uint64_t
+OutputPipeline::getRowsWritten(size_t streamId) const {
+  return streams_.at(streamId).rows;
+}
+
+void
+OutputPipeline::writeLine(const Stream& stream, const std::string& line) {
+  if (stream.fileWriter) {
+    stream.writer->writeLine(line);
+  } else {
+    stream.writer->write(stream.name);
+    stream.writer->write(",");
+    stream.writer->writeLine(line);
+  }
+}
+
+} // namespace pathsd
+} // namespace paths
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <src/common/BufferedWriter.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace paths {
+namespace pathsd {
+
+/**
+ * Output shared by all pathsd modules.
+ *
+ * Each module writes rows to its own stream. If an export directory is set,
+ * stream <name> is written to <export_dir>/<name>.csv; otherwise all streams
+ * go to a single stdout writer and every line is prefixed with the stream
+ * name. Rows are buffered by common::BufferedWriter.
+ */
+class OutputPipeline {
+ public:
+  explicit OutputPipeline(const std::string& exportDir);
+
+  /**
+   * Registers a stream and writes its header. Returns the stream id.
+   */
+  size_t addStream(
+      const std::string& name,
+      const std::vector<std::string>& fieldNames);
+
+  /**
+   * Writes an encoded row (without line terminator) to a stream.
+   */
+  void write(size_t streamId, const std::string& row);
+
+  uint64_t getRowsWritten(size_t streamId) const;
+
+ private:
+  struct Stream {
+    std::string name;
+    // owned by the stream, or stdoutWriter_
+    std::unique_ptr<common::BufferedWriter> fileWriter;
+    common::BufferedWriter* writer;
+    uint64_t rows;
+  };
+
+  void writeLine(const Stream& stream, const std::string& line);
+
+  const std::string exportDir_;
+  std::unique_ptr<common::BufferedWriter> stdoutWriter_;
+  std::vector<Stream> streams_;
+};
+
+} // namespace pathsd
+} // namespace paths
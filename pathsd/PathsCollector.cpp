@@ -0,0 +1,370 @@
+#include "PathsCollector.h"
+
+#include <folly/FileUtil.h>
+#include <folly/Format.h>
+#include <folly/String.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <src/pathsd/bpf/BpfStructs.h>
+#include <experimental/filesystem>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+namespace fs = std::experimental::filesystem;
+
+static bool
+ValidatePath(const char* flagname, const std::string& flagPath) {
+  if (flagPath.empty()) {
+    LOG(INFO) << folly::format("Flag --{} must be set", flagname);
+    return false;
+  }
+
+  // check that the path exists
+  fs::path path(flagPath);
+  if (not fs::exists(path)) {
+    LOG(INFO) << folly::format(
+        "Path set by --{} ({}) does not exist", flagname, flagPath);
+    return false;
+  }
+
+  return true;
+}
+
+static bool
+ValidateFilePath(const char* flagname, const std::string& flagPath) {
+  if (flagPath.empty()) {
+    LOG(INFO) << folly::format("Flag --{} must be set", flagname);
+    return false;
+  }
+
+  // check that the path exists
+  fs::path path(flagPath);
+  if (not fs::exists(path)) {
+    LOG(INFO) << folly::format(
+        "Path set by --{} ({}) does not exist", flagname, flagPath);
+    return false;
+  }
+
+  // if it's a real file, it should have a size
+  try {
+    fs::file_size(flagPath);
+  } catch (fs::filesystem_error& e) {
+    LOG(INFO) << folly::format(
+        "Path set by --{} ({}) is not valid: {}", flagname, flagPath, e.what());
+    return false;
+  }
+
+  return true;
+}
+
+static bool
+ValidateSamplingRate(const char* flagname, double sampling_rate) {
+  if (sampling_rate < 0 || sampling_rate > 1) {
+    LOG(ERROR) << folly::format("0 < sampling_rate <= 1 required");
+    return false;
+  }
+
+  return true;
+}
+
+DEFINE_string(
+    path_bpf_include_headers,
+    "",
+    "Root of the source tree (the directory holding ackevents/, rtttrace/, "
+    "tcpevents/ and pathsd/); the combined BPF program includes the "
+    "structs of each tool from there");
+DEFINE_string(path_bpf_source, "", "Path to pathsd/bpf/BpfProg.c");
+DEFINE_string(
+    kbuild_modname,
+    "pathsd",
+    "Value to use for KBUILD_MODNAME during compilation");
+DEFINE_double(
+    bpf_connection_sampling_rate,
+    1.0,
+    "BPF connection sampling rate (will be rounded to multiples of 1/65535)");
+
+DEFINE_validator(path_bpf_include_headers, &ValidatePath);
+DEFINE_validator(path_bpf_source, &ValidateFilePath);
+DEFINE_validator(bpf_connection_sampling_rate, &ValidateSamplingRate);
+
+namespace {
+
+void
+handleRawPerfEvent(void* cb_cookie, void* data, int data_size) {
+  paths::pathsd::PathsCollector* collector =
+      static_cast<paths::pathsd::PathsCollector*>(cb_cookie);
+  collector->handlePerfEvent(data, data_size);
+}
+
+void
+handleRawLostPerfEvents(void* cb_cookie, uint64_t lost) {
+  paths::pathsd::PathsCollector* collector =
+      static_cast<paths::pathsd::PathsCollector*>(cb_cookie);
+  collector->handleLostPerfEvents(lost);
+}
+
+} // namespace
+
+namespace paths {
+namespace pathsd {
+
+PathsCollector::PathsCollector(
+    std::vector<std::unique_ptr<Module>> modules,
+    const std::shared_ptr<OutputPipeline>& output)
+    : output_(output), running_(false), bpf_(FLAGS_kbuild_modname),
+      events_(0), lost_events_(0) {
+  for (auto& module : modules) {
+    const auto recordType = module->getRecordType();
+    const auto streamId =
+        output_->addStream(module->getName(), module->getFieldNames());
+    CHECK(modules_.count(recordType) == 0)
+        << folly::format("Module {} enabled twice", module->getName());
+    modules_[recordType] = ModuleState{std::move(module), streamId, 0};
+  }
+}
+
+bool
+PathsCollector::run() {
+  running_ = true;
+  LOG(INFO) << "PathsCollector starting";
+
+  if (modules_.empty()) {
+    LOG(ERROR) << "No modules enabled";
+    running_.store(false);
+    return false;
+  }
+
+  fs::path pathToBpfHeaders(FLAGS_path_bpf_include_headers);
+  fs::path pathToBpfSource(FLAGS_path_bpf_source);
+  LOG(INFO) << folly::format(
+      "Path to BPF headers = {}", fs::absolute(pathToBpfHeaders).c_str());
+  LOG(INFO) << folly::format(
+      "Path to BPF source = {}", fs::absolute(pathToBpfSource).c_str());
+
+  std::vector<std::string> cflags = {};
+  cflags.emplace_back(
+      folly::sformat("-I{}", fs::absolute(pathToBpfHeaders).c_str()));
+  cflags.emplace_back(
+      folly::sformat("-DKBUILD_MODNAME=\"{}\"", FLAGS_kbuild_modname));
+  for (const auto& it : modules_) {
+    cflags.emplace_back(it.second.module->getCflag());
+  }
+
+  if (FLAGS_bpf_connection_sampling_rate < 1.0) {
+    unsigned random_max = static_cast<unsigned>(UINT16_MAX * FLAGS_bpf_connection_sampling_rate);
+    assert(random_max <= UINT16_MAX);
+    if (random_max == 0) {
+      LOG(WARNING) << folly::format("sampling_rate too low, setting to 1/{}", UINT16_MAX);
+      random_max = 1;
+    }
+    cflags.emplace_back(
+      folly::sformat("-DRANDOM_SAMPLE_MAX={}", random_max)
+    );
+  }
+
+  std::string fileContents;
+  if (not folly::readFile(
+          fs::absolute(pathToBpfSource).c_str(), fileContents)) {
+    LOG(ERROR) << folly::format(
+        "Could not read BPF source from {}",
+        pathToBpfSource.filename().c_str());
+    running_.store(false);
+    return false;
+  }
+
+  // the shared establish/close path, then every module's probes
+  std::vector<Module::Probe> probes = {
+      {Module::Probe::Type::TRACEPOINT,
+       "tcp:tcp_destroy_sock",
+       "on_tcp_destroy_sock",
+       true},
+      {Module::Probe::Type::TRACEPOINT,
+       "sock:inet_sock_set_state",
+       "on_inet_sock_set_state",
+       true},
+  };
+  for (const auto& it : modules_) {
+    const auto moduleProbes = it.second.module->getProbes();
+    probes.insert(probes.end(), moduleProbes.begin(), moduleProbes.end());
+  }
+  std::vector<common::BpfLoader::Program> programs;
+  for (const auto& probe : probes) {
+    const auto type = probe.type == Module::Probe::Type::TRACEPOINT
+        ? BPF_PROG_TYPE_TRACEPOINT
+        : BPF_PROG_TYPE_KPROBE;
+    const bool seen = std::any_of(
+        programs.begin(), programs.end(), [&probe](const auto& program) {
+          return program.fn == probe.fn;
+        });
+    if (not seen) {
+      programs.push_back({probe.fn, type});
+    }
+  }
+
+  // load the BPF program
+  {
+    const auto bpfSourceFilename = pathToBpfSource.filename().string();
+    LOG(INFO) << folly::format(
+        "Compiling and loading {} with flags {}",
+        bpfSourceFilename,
+        folly::join(" ", cflags));
+    auto r = bpf_.init(pathToBpfSource, fileContents, cflags, programs);
+    if (r.code() != 0) {
+      LOG(ERROR) << folly::format(
+          "Error loading BPF program {}: {}", bpfSourceFilename, r.msg());
+      running_.store(false);
+      return false;
+    }
+    LOG(INFO) << folly::format("Loaded BPF program {}", bpfSourceFilename);
+  }
+
+  for (const auto& probe : probes) {
+    if (not attachProbe(probe) && probe.required) {
+      running_.store(false);
+      return false;
+    }
+  }
+
+  const auto perfBuffName = "events";
+  {
+    auto r = bpf_.openPerfBuffer(
+        perfBuffName,
+        &handleRawPerfEvent,
+        &handleRawLostPerfEvents,
+        (void*)this,
+        64);
+    if (r.code() != 0) {
+      LOG(ERROR) << folly::format(
+          "Error opening perf buffer {}: {}", perfBuffName, r.msg());
+      running_.store(false);
+      return false;
+    }
+  }
+
+  // sweep entries leaked by missed on_tcp_destroy_sock calls;
+  // conn_tstamp_ns is the first member of struct conn_state
+  sweeper_ = common::BpfMapSweeper::createFromFlags(
+      bpf_.getMapFd("ht"),
+      folly::sformat("{}:ht", FLAGS_kbuild_modname),
+      0,
+      std::chrono::nanoseconds(1));
+  if (sweeper_) {
+    sweeper_->start();
+  }
+
+  queue_ = common::AsyncEventQueue<RawRecord>::createFromFlags(
+      FLAGS_kbuild_modname, [this](RawRecord& record) {
+        exportRecord(record.data, record.size);
+      });
+  if (queue_) {
+    queue_->start();
+  }
+
+  // poll events from the perf buffer
+  LOG(INFO) << folly::format(
+      "Waiting for records from perf buffer {}", perfBuffName);
+  while (running_.load()) {
+    bpf_.pollPerfBuffer(perfBuffName, 1000);
+  }
+  LOG(INFO) << "Exited perf buffer poll loop";
+  if (sweeper_) {
+    sweeper_->stop();
+  }
+  if (queue_) {
+    queue_->stop();
+  }
+  for (const auto& it : modules_) {
+    LOG(INFO) << folly::format(
+        "Module {}: {} records, {} rows written",
+        it.second.module->getName(),
+        it.second.records,
+        output_->getRowsWritten(it.second.streamId));
+  }
+  return true;
+}
+
+bool
+PathsCollector::attachProbe(const Module::Probe& probe) {
+  const bool isTracepoint = probe.type == Module::Probe::Type::TRACEPOINT;
+  const auto probeType = isTracepoint ? "tracepoint" : "kprobe";
+  auto r = isTracepoint ? bpf_.attachTracepoint(probe.target, probe.fn)
+                        : bpf_.attachKprobe(probe.target, probe.fn);
+  if (r.code() != 0) {
+    LOG(ERROR) << folly::format(
+        "Error attaching BPF function {} to {} {}: {}",
+        probe.fn,
+        probeType,
+        probe.target,
+        r.msg());
+    return false;
+  }
+  LOG(INFO) << folly::format(
+      "Attached BPF function {} to {} {}", probe.fn, probeType, probe.target);
+  return true;
+}
+
+void
+PathsCollector::stop() {
+  LOG(INFO) << folly::format(
+      "PathsCollector stopping: {} events ({} lost)",
+      events_.load(),
+      lost_events_.load());
+  running_.store(false);
+}
+
+bool
+PathsCollector::isRunning() const {
+  return running_.load();
+}
+
+void
+PathsCollector::handlePerfEvent(const void* data, const int data_size) {
+  events_++;
+  if ((unsigned)data_size < sizeof(bpf::record_hdr) ||
+      (unsigned)data_size > kMaxRecordSize) {
+    LOG(ERROR) << folly::format(
+        "Received record of {} bytes, expected between {} and {}",
+        data_size,
+        sizeof(bpf::record_hdr),
+        kMaxRecordSize);
+    return;
+  }
+  if (queue_) {
+    RawRecord record;
+    record.size = data_size;
+    std::memcpy(record.data, data, data_size);
+    queue_->push(record);
+    return;
+  }
+  exportRecord(data, data_size);
+}
+
+void
+PathsCollector::exportRecord(const void* data, size_t size) {
+  const auto hdr = static_cast<const bpf::record_hdr*>(data);
+  auto it = modules_.find(hdr->type);
+  if (it == modules_.end()) {
+    LOG(ERROR) << folly::format("Received record of unknown type {}", hdr->type);
+    return;
+  }
+  auto& state = it->second;
+  state.records++;
+  encoder_.clear();
+  if (state.module->encodeRow(
+          static_cast<const char*>(data) + sizeof(bpf::record_hdr),
+          size - sizeof(bpf::record_hdr),
+          encoder_)) {
+    output_->write(state.streamId, encoder_.str());
+  }
+}
+
+void
+PathsCollector::handleLostPerfEvents(const uint64_t lost) {
+  lost_events_.fetch_add(lost);
+  LOG(WARNING) << folly::format("Lost {} events", lost);
+}
+
+} // namespace pathsd
+} // namespace paths
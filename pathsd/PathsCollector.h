@@ -0,0 +1,79 @@
+#pragma once
+
+#include <src/ackevents/bpf/BpfStructs.h>
+#include <src/common/AsyncEventQueue.h>
+#include <src/common/BpfLoader.h>
+#include <src/common/BpfMapSweeper.h>
+#include <src/pathsd/Module.h>
+#include <src/pathsd/OutputPipeline.h>
+#include <src/pathsd/bpf/BpfStructs.h>
+#include <src/rtttrace/bpf/BpfStructs.h>
+#include <src/tcpevents/collector/bpf/BpfStructs.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace paths {
+namespace pathsd {
+
+/**
+ * Loads the combined BPF program with the enabled modules, attaches the
+ * shared establish/close path once plus each module's probes, and hands
+ * every record from the shared perf buffer to the module that emitted it.
+ */
+class PathsCollector {
+ public:
+  PathsCollector(
+      std::vector<std::unique_ptr<Module>> modules,
+      const std::shared_ptr<OutputPipeline>& output);
+
+  bool run();
+
+  void stop();
+
+  bool isRunning() const;
+
+  void handlePerfEvent(const void* data, const int data_size);
+
+  void handleLostPerfEvents(const uint64_t lost);
+
+ private:
+  // largest record the BPF program emits
+  static constexpr size_t kMaxRecordSize = sizeof(bpf::record_hdr) +
+      std::max({sizeof(ackevents::bpf::ack_event),
+                sizeof(rtttrace::bpf::rtt_event),
+                sizeof(tcpevents::bpf::tcp_event_t)});
+
+  // a perf buffer record, copied for the export thread
+  struct RawRecord {
+    uint32_t size;
+    alignas(8) char data[kMaxRecordSize];
+  };
+
+  void exportRecord(const void* data, size_t size);
+
+  struct ModuleState {
+    std::unique_ptr<Module> module;
+    size_t streamId;
+    uint64_t records;
+  };
+
+  bool attachProbe(const Module::Probe& probe);
+
+  // keyed by record type
+  std::map<uint32_t, ModuleState> modules_;
+  const std::shared_ptr<OutputPipeline> output_;
+  std::atomic<bool> running_;
+  common::BpfLoader bpf_;
+  std::unique_ptr<common::BpfMapSweeper> sweeper_;
+  std::atomic<uint64_t> events_;
+  std::atomic<uint64_t> lost_events_;
+  common::CsvRowEncoder encoder_;
+  // declared last so that it is drained before the members above go away
+  std::unique_ptr<common::AsyncEventQueue<RawRecord>> queue_;
+};
+
+} // namespace pathsd
+} // namespace paths
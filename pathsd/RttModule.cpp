@@ -0,0 +1,63 @@
+#include "RttModule.h"
+
+#include <folly/Format.h>
+#include <glog/logging.h>
+#include <src/pathsd/bpf/BpfStructs.h>
+#include <src/rtttrace/RttEventCsv.h>
+
+namespace paths {
+namespace pathsd {
+
+RttModule::RttModule(std::shared_ptr<const common::PrefixMatcher> clients)
+    : clients_(std::move(clients)) {}
+
+std::string
+RttModule::getName() const {
+  return "rtt";
+}
+
+std::string
+RttModule::getCflag() const {
+  return "-DMODULE_RTT";
+}
+
+std::vector<Module::Probe>
+RttModule::getProbes() const {
+  return {
+      {Probe::Type::TRACEPOINT, "tcp:tcp_skb_acked", "on_tcp_skb_acked", true},
+  };
+}
+
+uint32_t
+RttModule::getRecordType() const {
+  return RECORD_RTT_EVENT;
+}
+
+std::vector<std::string>
+RttModule::getFieldNames() const {
+  return rtttrace::getCsvFieldNames();
+}
+
+bool
+RttModule::encodeRow(
+    const void* data,
+    size_t size,
+    common::CsvRowEncoder& encoder) const {
+  if (size < sizeof(rtttrace::bpf::rtt_event)) {
+    LOG(ERROR) << folly::format(
+        "Received {} bytes for an rtt_event, expected {}",
+        size,
+        sizeof(rtttrace::bpf::rtt_event));
+    return false;
+  }
+  const auto& ev = *static_cast<const rtttrace::bpf::rtt_event*>(data);
+  if (!clients_->match(
+          reinterpret_cast<const struct sockaddr*>(&ev.header.dst))) {
+    return false;
+  }
+  rtttrace::encodeCsvRow(ev, encoder);
+  return true;
+}
+
+} // namespace pathsd
+} // namespace paths
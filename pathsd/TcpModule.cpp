@@ -0,0 +1,94 @@
+#include "TcpModule.h"
+
+#include <folly/Format.h>
+#include <glog/logging.h>
+#include <src/pathsd/bpf/BpfStructs.h>
+#include <src/tcpevents/collector/TcpEvent.h>
+#include <src/tcpevents/collector/TcpEventView.h>
+#include <src/tcpevents/handlers/TcpEventCsvExporter.h>
+
+namespace paths {
+namespace pathsd {
+
+using tcpevents::TcpEvent;
+using tcpevents::TcpEventCsvExporter;
+using tcpevents::TcpEventExporter;
+
+TcpModule::TcpModule(
+    std::shared_ptr<const common::PrefixMatcher> clients,
+    const folly::Optional<std::unordered_set<std::string>>&
+        statFieldsToExportOpt)
+    : clients_(std::move(clients)),
+      fieldsToExport_(TcpEventExporter::getFieldNamesToExport(
+          TcpEventExporter::getStatFieldsToExport(statFieldsToExportOpt))),
+      fieldSchemasToExport_(TcpEventExporter::getFieldsToExport(
+          TcpEventExporter::getFieldNamesToExport({}))),
+      // the stat columns follow the other fields
+      statsToExport_(std::vector<std::string>(
+          fieldsToExport_.begin() + fieldSchemasToExport_.size(),
+          fieldsToExport_.end())) {}
+
+std::string
+TcpModule::getName() const {
+  return "tcp";
+}
+
+std::string
+TcpModule::getCflag() const {
+  return "-DMODULE_TCP";
+}
+
+std::vector<Module::Probe>
+TcpModule::getProbes() const {
+  // tcp_set_ca_state is reached via the congestion control's set_state
+  // callback; only one of these exists per kernel configuration
+  return {
+      {Probe::Type::KPROBE, "bictcp_state", "on_tcp_set_ca_state", false},
+      {Probe::Type::KPROBE, "bbr_set_state", "on_tcp_set_ca_state", false},
+  };
+}
+
+uint32_t
+TcpModule::getRecordType() const {
+  return RECORD_TCP_EVENT;
+}
+
+std::vector<std::string>
+TcpModule::getFieldNames() const {
+  return TcpEventExporter::getColumnNames(fieldsToExport_);
+}
+
+bool
+TcpModule::encodeRow(
+    const void* data,
+    size_t size,
+    common::CsvRowEncoder& encoder) const {
+  if (size < sizeof(tcpevents::bpf::tcp_event_t)) {
+    LOG(ERROR) << folly::format(
+        "Received {} bytes for a tcp_event_t, expected {}",
+        size,
+        sizeof(tcpevents::bpf::tcp_event_t));
+    return false;
+  }
+  const tcpevents::TcpEventView view(
+      *static_cast<const tcpevents::bpf::tcp_event_t*>(data));
+
+  // same filter as tcpevents' BaseTcpEventHandler, on the raw event
+  const auto& stateChange = view.getDetails().state_change;
+  if ((int)stateChange.new_state.skt_state != TCP_CLOSE ||
+      (int)stateChange.old_state.skt_state == TCP_CLOSE ||
+      (int)stateChange.old_state.skt_state == TCP_LISTEN) {
+    return false;
+  }
+  if (!view.isDstIn(*clients_)) {
+    return false;
+  }
+
+  const TcpEvent event(view.getRawEvent());
+  TcpEventCsvExporter::encodeRow(
+      event, fieldSchemasToExport_, statsToExport_, encoder);
+  return true;
+}
+
+} // namespace pathsd
+} // namespace paths
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <folly/Optional.h>
+#include <src/common/PrefixMatcher.h>
+#include <src/pathsd/Module.h>
+#include <src/tcpevents/collector/TcpEvent.h>
+#include <src/tcpevents/collector/TcpEventStatProjection.h>
+#include <unordered_set>
+
+namespace paths {
+namespace pathsd {
+
+/**
+ * tcpevents: connection statistics and first-loss tracking from congestion
+ * avoidance state changes, exported when the connection closes.
+ */
+class TcpModule : public Module {
+ public:
+  TcpModule(
+      std::shared_ptr<const common::PrefixMatcher> clients,
+      const folly::Optional<std::unordered_set<std::string>>&
+          statFieldsToExportOpt = folly::none);
+
+  std::string getName() const override;
+  std::string getCflag() const override;
+  std::vector<Probe> getProbes() const override;
+  uint32_t getRecordType() const override;
+  std::vector<std::string> getFieldNames() const override;
+  bool encodeRow(
+      const void* data,
+      size_t size,
+      common::CsvRowEncoder& encoder) const override;
+
+ private:
+  const std::shared_ptr<const common::PrefixMatcher> clients_;
+  const std::vector<std::string> fieldsToExport_;
+  const std::vector<const tcpevents::TcpEvent::Field*> fieldSchemasToExport_;
+  const tcpevents::TcpEventStatProjection statsToExport_;
+};
+
+} // namespace pathsd
+} // namespace paths
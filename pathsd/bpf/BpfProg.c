@@ -0,0 +1,317 @@
+#include <bcc/proto.h>
+#include <linux/socket.h>
+#include <linux/tcp.h>
+#include <linux/win_minmax.h>
+#include <net/sock.h>
+#include <net/tcp.h>
+
+/* Combined program for pathsd. The connection table, the sampling check and
+ * the establish/close path are shared; each analysis is a module enabled
+ * with -DMODULE_ACK (ackevents), -DMODULE_RTT (rtttrace) and -DMODULE_TCP
+ * (tcpevents). Modules export the same event structs as the standalone
+ * tools, wrapped in a record_hdr, through a single perf buffer. The
+ * per-module logic is included from the headers each tool keeps next to its
+ * BpfStructs.h, so both programs run the same code.
+ *
+ * Differences from the standalone tools:
+ *   - EVDEBUG per-ACK events of ackevents are not supported;
+ *   - tcpevents snapshots (bpf_iter/tcp) are not supported. */
+
+/* ackevents and rtttrace define identical struct event_hdr */
+#include "ackevents/bpf/BpfStructs.h"
+#define event_hdr rtt_event_hdr
+#include "rtttrace/bpf/BpfStructs.h"
+#undef event_hdr
+#include "tcpevents/collector/bpf/BpfStructs.h"
+#include "tcpevents/collector/bpf/BpfPrivateStructs.h"
+#include "pathsd/bpf/BpfStructs.h"
+
+_Static_assert(sizeof(struct event_hdr) == sizeof(struct rtt_event_hdr),
+               "ackevents and rtttrace event headers must match");
+
+/* We generate a random byte on socket initialization to allow control
+ * of sampling rates (tcp_sock->cd_random_byte). In this code, we only
+ * track sockets whose random_byte is lower than RANDOM_BYTE_MAX.
+ * RANDOM_BYTE_MAX should be passed as a parameter to BCC. The default
+ * behavior is to track all sockets. */
+#ifndef RANDOM_SAMPLE_MAX
+#define RANDOM_SAMPLE_MAX UINT16_MAX
+#endif
+
+/* Because errors can acumulate over the lifetime of a connection, we
+ * keep track of events and stats only up to the point where
+ * MAX_TRACKED_PACKET packets have been transmitted in the connection. */
+#ifndef MAX_TRACKED_PACKET
+#define MAX_TRACKED_PACKET 64
+#endif
+
+#define _(var, src) bpf_probe_read(&var, sizeof(var), (void*)&src);
+
+#define _minmax_get(var, src)     \
+  {                        \
+    struct minmax mm;      \
+    _(mm, src);            \
+    var = minmax_get(&mm); \
+  }
+
+#define INCMAX(v, limit) if((v) < (u16)(limit)) { (v)++; }
+
+/* Per-connection state of rtttrace; the rest of struct rtt_event is read
+ * from the socket when a sample is exported. */
+struct rtt_state {
+  u32 establish_snd_una;
+  struct rtt_stats stats;
+};
+
+/* One entry per tracked connection, shared by all modules. */
+struct conn_state {
+  u64 conn_tstamp_ns;  // must remain the first member, it is read by the
+                       // userspace map sweeper
+#ifdef MODULE_ACK
+  struct ack_state ack;
+#endif
+#ifdef MODULE_RTT
+  struct rtt_state rtt;
+#endif
+#ifdef MODULE_TCP
+  struct connection_stats tcp;
+#endif
+};
+
+struct record {
+  struct record_hdr hdr;
+  union {
+#ifdef MODULE_ACK
+    struct ack_event ack;
+#endif
+#ifdef MODULE_RTT
+    struct rtt_event rtt;
+#endif
+#ifdef MODULE_TCP
+    struct tcp_event_t tcp;
+#endif
+  };
+};
+
+// Perf buffer shared by all modules
+BPF_PERF_OUTPUT(events);
+
+// with --bpf_pin_path, ht is pinned so that connection state survives a
+// daemon restart
+#ifdef BPF_PIN_PATH
+BPF_TABLE_PINNED("hash", struct sock*, struct conn_state, ht, UINT16_MAX,
+                 BPF_PIN_PATH "/ht");
+#else
+BPF_HASH(ht, struct sock*, struct conn_state, UINT16_MAX);
+#endif
+
+/* Records are too large for the BPF stack; they are assembled in this
+ * per-CPU slot before submission. */
+BPF_PERCPU_ARRAY(scratch, struct record, 1);
+
+/*****************************************************************************
+ * helper functions
+ *****************************************************************************/
+static bool tcp_sock_is_tracked(const struct sock *sk)
+{
+  struct tcp_sock *tp = tcp_sk(sk);
+  return tp->cd_random_u16 <= RANDOM_SAMPLE_MAX;
+}
+
+static struct record *record_get(u32 type)
+{
+  u32 zero = 0;
+  struct record *rec = scratch.lookup(&zero);
+  if (!rec) { return NULL; }
+  rec->hdr.type = type;
+  rec->hdr.reserved = 0;
+  return rec;
+}
+
+/* the ack and rtt modules both fill the event_hdr of ackevents */
+#include "ackevents/bpf/EventHeader.h"
+
+/*****************************************************************************
+ * ack module (ackevents)
+ *****************************************************************************/
+#ifdef MODULE_ACK
+#include "ackevents/bpf/AckTracking.h"
+
+static void ack_close(void *ctx, struct ack_state *st, const struct sock *sk)
+{
+  const struct tcp_sock* tp = tcp_sk(sk);
+  struct record *rec = record_get(RECORD_ACK_EVENT);
+  if (!rec) { return; }
+  struct ack_event *ev = &rec->ack;
+  if (ack_event_fill(ev, st, sk) < 0) { return; }
+
+  ev->non_spurious_retrans = tp->total_retrans -
+    st->dsack_or_timestamp_recovered;
+
+  events.perf_submit(ctx, rec, sizeof(rec->hdr) + sizeof(rec->ack));
+}
+
+int
+on_tcp_rate_skb_delivered(
+  struct pt_regs *ctx,
+  struct sock *sk,
+  struct sk_buff *skb,
+  struct rate_sample *rs)
+{
+  if (!tcp_sock_is_tracked(sk)) { return 0; }
+
+  struct conn_state *cs = ht.lookup(&sk);
+  if (!cs) { return 0; }
+  struct ack_state *st = &cs->ack;
+  if (ack_track_delivered(st, sk, skb) < 0) { return 0; }
+
+  struct tcp_sock *tp = tcp_sk(sk);
+  clean_trim_info(st);
+  _(st->prior_snd_una, tp->snd_una);
+  return 0;
+}
+
+int
+on_tcp_trim_head(
+  struct pt_regs *ctx,
+  struct sock *sk,
+  struct sk_buff *skb,
+  u32 len)
+{
+  if (!tcp_sock_is_tracked(sk)) { return 0; }
+
+  struct conn_state *cs = ht.lookup(&sk);
+  if (!cs) { return 0; }
+  ack_track_trim_head(&cs->ack, sk, skb, len);
+  return 0;
+}
+#endif /* MODULE_ACK */
+
+/*****************************************************************************
+ * rtt module (rtttrace)
+ *****************************************************************************/
+#ifdef MODULE_RTT
+#include "rtttrace/bpf/RttSample.h"
+
+static void rtt_establish(struct rtt_state *st, const struct sock *sk)
+{
+  struct tcp_sock *tp = tcp_sk(sk);
+  _(st->establish_snd_una, tp->snd_una);
+}
+
+int on_tcp_skb_acked(struct tracepoint__tcp__tcp_skb_acked* attrs)
+{
+  const struct sock* sk = (struct sock*)attrs->skaddr;
+  if (!tcp_sock_is_tracked(sk)) { return 0; }
+
+  struct conn_state *cs = ht.lookup((struct sock **)&sk);
+  if (!cs) { return 0; }
+  struct rtt_state *st = &cs->rtt;
+
+  struct record *rec = record_get(RECORD_RTT_EVENT);
+  if (!rec) { return 0; }
+  struct rtt_event *ev = &rec->rtt;
+  if (rtt_sample_fill(ev, &st->stats, st->establish_snd_una, attrs) < 0) {
+    return 0;
+  }
+  if (event_hdr_init((struct event_hdr*)&ev->header, sk) < 0) { return 0; }
+  ev->stats = st->stats;
+
+  events.perf_submit((void *)attrs, rec, sizeof(rec->hdr) + sizeof(rec->rtt));
+  return 0;
+}
+#endif /* MODULE_RTT */
+
+/*****************************************************************************
+ * tcp module (tcpevents)
+ *****************************************************************************/
+#ifdef MODULE_TCP
+#include "tcpevents/collector/bpf/TcpStats.h"
+
+static void tcpev_establish(struct connection_stats *cs, struct sock *sk)
+{
+  connection_stats_init(cs, sk);
+}
+
+static void tcpev_close(struct tracepoint__sock__inet_sock_set_state* attrs,
+    struct connection_stats *cs,
+    struct sock *sk)
+{
+  struct record *rec = record_get(RECORD_TCP_EVENT);
+  if (!rec) { return; }
+  struct tcp_event_t *event = &rec->tcp;
+  __builtin_memset(event, 0, sizeof(*event));
+
+  event->header.type = INET_SOCK_SET_STATE;
+  event->details.state_change.old_state.skt_state = attrs->oldstate;
+  event->details.state_change.new_state.skt_state = attrs->newstate;
+  if (fill_stats_event(sk, cs, event) < 0) { return; }
+
+  events.perf_submit((void *)attrs, rec, sizeof(rec->hdr) + sizeof(rec->tcp));
+}
+
+int
+on_tcp_set_ca_state(struct pt_regs* ctx, struct sock* sk, u8 new_state) {
+  if (!tcp_sock_is_tracked(sk)) { return 0; }
+  struct inet_connection_sock* icsk = inet_csk(sk);
+  u8 old_state = get_ca_state(icsk);
+  struct conn_state *cs = ht.lookup(&sk);
+  if (!cs) { return 0; }
+
+  count_ca_state_changes(&cs->tcp, sk, old_state, new_state);
+  track_losses(&cs->tcp, &(cs->tcp.loss_track_state), sk, old_state,
+      new_state);
+
+  return 0;
+}
+#endif /* MODULE_TCP */
+
+/*****************************************************************************
+ * shared establish/close path
+ *****************************************************************************/
+int
+on_tcp_destroy_sock(struct tracepoint__tcp__tcp_destroy_sock* attrs) {
+  struct sock* sk = (struct sock*)attrs->skaddr;
+  if (!tcp_sock_is_tracked(sk)) { return 0; }
+  ht.delete(&sk);
+  return 0;
+}
+
+int
+on_inet_sock_set_state(struct tracepoint__sock__inet_sock_set_state* attrs) {
+  if (attrs->protocol != IPPROTO_TCP) {
+    return 0;
+  }
+
+  struct sock* sk = (struct sock*)attrs->skaddr;
+  struct tcp_sock* tp = tcp_sk(sk);
+
+  if (!tcp_sock_is_tracked(sk)) { return 0; }
+
+  if (attrs->newstate == TCP_ESTABLISHED) {
+    struct conn_state cs = {};
+    if (sk->sk_family != AF_INET && sk->sk_family != AF_INET6) { return 0; }
+    _(cs.conn_tstamp_ns, tp->cd_init_clock_ns);
+#ifdef MODULE_ACK
+    ack_state_init(&cs.ack, sk);
+#endif
+#ifdef MODULE_RTT
+    rtt_establish(&cs.rtt, sk);
+#endif
+#ifdef MODULE_TCP
+    tcpev_establish(&cs.tcp, sk);
+#endif
+    ht.update(&sk, &cs);
+  } else if (attrs->newstate == TCP_CLOSE) {
+    struct conn_state *cs = ht.lookup(&sk);
+    if (!cs) { return 0; }
+#ifdef MODULE_ACK
+    ack_close((void *)attrs, &cs->ack, sk);
+#endif
+#ifdef MODULE_TCP
+    tcpev_close(attrs, &cs->tcp, sk);
+#endif
+  }
+
+  return 0;
+}
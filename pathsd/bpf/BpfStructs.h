@@ -0,0 +1,25 @@
+#pragma once
+
+#ifdef __cplusplus
+namespace paths {
+namespace pathsd {
+namespace bpf {
+#endif
+
+/* Every record in the shared perf buffer starts with a record_hdr; the
+ * payload that follows is the event struct of the tool the module was
+ * derived from (see type). */
+#define RECORD_ACK_EVENT 1 /* struct paths::ackevents::bpf::ack_event */
+#define RECORD_RTT_EVENT 2 /* struct paths::rtttrace::bpf::rtt_event */
+#define RECORD_TCP_EVENT 3 /* struct paths::tcpevents::bpf::tcp_event_t */
+
+struct record_hdr {
+  uint32_t type;
+  uint32_t reserved; /* keeps the payload 8-byte aligned */
+};
+
+#ifdef __cplusplus
+} // namespace bpf
+} // namespace pathsd
+} // namespace paths
+#endif
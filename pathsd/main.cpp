@@ -0,0 +1,111 @@
+#include <src/common/Init.h>
+#include <src/common/PrefixMatcher.h>
+#include <src/common/SignalHandler.h>
+#include <src/pathsd/AckModule.h>
+#include <src/pathsd/OutputPipeline.h>
+#include <src/pathsd/PathsCollector.h>
+#include <src/pathsd/RttModule.h>
+#include <src/pathsd/TcpModule.h>
+
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <folly/Format.h>
+#include <folly/gen/Base.h>
+#include <folly/gen/String.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+DEFINE_string(
+    modules,
+    "ack,rtt,tcp",
+    "Comma separated list of modules to run (options: ack, rtt, tcp)");
+DEFINE_string(
+    export_dir,
+    "",
+    "Directory to export events to, one <module>.csv per module. "
+    "If not set, events are exported to stdout prefixed by the module name");
+DEFINE_string(
+    stats_to_print,
+    "all",
+    "List of stats exported by the tcp module, defined as a comma separated "
+    "list. Set to 'all' (default) to export all stats");
+DEFINE_string(client_prefix, "10.0.0.0/9", "Prefix of monitored clients");
+DEFINE_validator(client_prefix, &paths::common::validateClientPrefix);
+
+using namespace paths::pathsd;
+using paths::common::PrefixMatcher;
+
+using folly::gen::as;
+using folly::gen::eachTo;
+using folly::gen::filter;
+using folly::gen::fromConst;
+using folly::gen::map;
+using folly::gen::order;
+using folly::gen::split;
+using folly::gen::unsplit;
+
+int
+main(int argc, char* argv[]) {
+  paths::init(argc, argv);
+
+  folly::Optional<std::unordered_set<std::string>> statsToPrintOpt;
+  if (FLAGS_stats_to_print != "all") {
+    statsToPrintOpt = split(FLAGS_stats_to_print, ',') |
+        map([](const auto& str) { return trimWhitespace(str); }) |
+        eachTo<std::string>() |
+        filter([](const auto& str) { return str.size(); }) | order |
+        as<std::unordered_set<std::string>>();
+  }
+
+  const auto moduleNames = split(FLAGS_modules, ',') |
+      map([](const auto& str) { return trimWhitespace(str); }) |
+      eachTo<std::string>() |
+      filter([](const auto& str) { return str.size(); }) |
+      as<std::vector<std::string>>();
+  std::shared_ptr<const PrefixMatcher> clients =
+      PrefixMatcher::createFromFlags(FLAGS_client_prefix);
+  if (!clients) {
+    LOG(FATAL) << "Unable to load the monitored client prefixes";
+  }
+  std::vector<std::unique_ptr<Module>> modules;
+  for (const auto& name : moduleNames) {
+    if (name == "ack") {
+      modules.push_back(std::make_unique<AckModule>(clients));
+    } else if (name == "rtt") {
+      modules.push_back(std::make_unique<RttModule>(clients));
+    } else if (name == "tcp") {
+      modules.push_back(
+          std::make_unique<TcpModule>(clients, statsToPrintOpt));
+    } else {
+      LOG(FATAL) << folly::sformat("Module {} not known", name);
+    }
+  }
+  LOG(INFO) << folly::sformat(
+      "Running modules ({}) for clients in {}",
+      fromConst(moduleNames) | unsplit(','),
+      clients->describe());
+
+  const auto output = std::make_shared<OutputPipeline>(FLAGS_export_dir);
+  PathsCollector collector(std::move(modules), output);
+
+  // setup shutdown handler
+  const auto stopServices = [&]() { collector.stop(); };
+  folly::EventBase eventBase;
+  paths::common::ShutdownSignalHandler signalHandler(&eventBase, stopServices);
+
+  // run the collector, wait for termination signal
+  std::thread threadObj([&] {
+    eventBase.waitUntilRunning();
+    collector.run();
+    LOG(INFO) << "PathsCollector::run() returned, shutting down";
+    eventBase.terminateLoopSoon();
+  });
+  eventBase.loopForever();
+  threadObj.join();
+
+  LOG(INFO) << "Done";
+  return 0;
+}
@@ -106,7 +106,8 @@ namespace paths {
 namespace rttevents {
 
 RttEventCollector::RttEventCollector(const std::shared_ptr<CallbackHandler>& cbHandler)
-    : cbHandler_(cbHandler), running_(false), events_(0), lost_events_(0) {}
+    : cbHandler_(cbHandler), running_(false), bpf_(FLAGS_kbuild_modname),
+      events_(0), lost_events_(0) {}
 
 bool
 RttEventCollector::run() {
@@ -152,6 +153,11 @@ RttEventCollector::run() {
   LOG(INFO) << folly::format(
       "Read BPF source from {}", pathToBpfSource.filename().c_str());
 
+  // every BPF function that is attached below
+  std::vector<common::BpfLoader::Program> programs = {
+      {"on_tcp_cong_control", BPF_PROG_TYPE_TRACEPOINT},
+  };
+
   // load the BPF program
   {
     const auto bpfSourceFilename = pathToBpfSource.filename().c_str();
@@ -159,7 +165,7 @@ RttEventCollector::run() {
         "Compiling and loading {} with flags {}",
         bpfSourceFilename,
         folly::join(" ", cflags));
-    auto r = ebpf_.init(fileContents, cflags);
+    auto r = bpf_.init(pathToBpfSource, fileContents, cflags, programs);
     if (r.code() != 0) {
       LOG(ERROR) << folly::format(
           "Error loading BPF program {}: {}", bpfSourceFilename, r.msg());
@@ -172,7 +178,7 @@ RttEventCollector::run() {
   {
     const std::string tracepoint = "tcp:tcp_cong_control";
     const std::string fn = "on_tcp_cong_control";
-    auto r = ebpf_.attach_tracepoint(tracepoint, fn);
+    auto r = bpf_.attachTracepoint(tracepoint, fn);
     if (r.code() != 0) {
       LOG(ERROR) << folly::format(
           "Error attaching BPF function {} to tracepoint {}: {}",
@@ -188,7 +194,7 @@ RttEventCollector::run() {
 
   const auto perfBuffName = "events";
   {
-    auto r = ebpf_.open_perf_buffer(
+    auto r = bpf_.openPerfBuffer(
         perfBuffName,
         &handleRawPerfEvent,
         &handleRawLostPerfEvents,
@@ -206,7 +212,7 @@ RttEventCollector::run() {
   LOG(INFO) << folly::format(
       "Waiting for TcpEvents from perf buffer {}", perfBuffName);
   while (running_.load()) {
-    ebpf_.poll_perf_buffer(perfBuffName, 1000);
+    bpf_.pollPerfBuffer(perfBuffName, 1000);
   }
   LOG(INFO) << "Exited perf buffer poll loop";
   return true;
@@ -1,6 +1,6 @@
 #pragma once
 
-#include <bcc/BPF.h>
+#include <src/common/BpfLoader.h>
 #include <atomic>
 #include <memory>
 
@@ -31,7 +31,7 @@ class RttEventCollector {
  private:
   const std::shared_ptr<CallbackHandler> cbHandler_;
   std::atomic<bool> running_;
-  ebpf::BPF ebpf_;
+  common::BpfLoader bpf_;
   std::atomic<uint64_t> events_;
   std::atomic<uint64_t> lost_events_;
 };
@@ -0,0 +1,60 @@
+#include "RttEventCsv.h"
+
+#include <src/common/ColumnProjection.h>
+#include <src/common/ColumnarFile.h>
+#include <src/common/SqliteWriter.h>
+
+namespace paths {
+namespace rttevents {
+
+std::vector<std::string>
+getCsvFieldNames() {
+  std::vector<std::string> row;
+  row.push_back("ev_tstamp_ns");
+  row.push_back("conn_tstamp_ns");
+  common::appendAddressColumnNames("src", row);
+  common::appendAddressColumnNames("dst", row);
+  row.push_back("rtt_us");
+  row.push_back("bytes_acked");
+  row.push_back("packets_out");
+  row.push_back("snd_nxt");
+  return row;
+}
+
+template <typename Encoder>
+void
+encodeCsvRow(const struct bpf::rtt_event& ev, Encoder& encoder) {
+  encoder.add(ev.header.ev_tstamp_ns);
+  encoder.add(ev.header.conn_tstamp_ns);
+  common::addAddressColumns(encoder, &ev.header.src);
+  common::addAddressColumns(encoder, &ev.header.dst);
+  encoder.add(ev.rtt_us);
+  encoder.add(ev.bytes_acked);
+  encoder.add(ev.packets_out);
+  encoder.add(ev.snd_nxt);
+}
+
+template void encodeCsvRow(
+    const struct bpf::rtt_event& ev,
+    common::CsvRowEncoder& encoder);
+template void encodeCsvRow(
+    const struct bpf::rtt_event& ev,
+    common::ColumnarWriter& encoder);
+template void encodeCsvRow(
+    const struct bpf::rtt_event& ev,
+    common::ColumnTypeRecorder& encoder);
+template void encodeCsvRow(
+    const struct bpf::rtt_event& ev,
+    common::SqliteWriter& encoder);
+template void encodeCsvRow(
+    const struct bpf::rtt_event& ev,
+    common::ProjectedRow<common::CsvRowEncoder>& encoder);
+template void encodeCsvRow(
+    const struct bpf::rtt_event& ev,
+    common::ProjectedRow<common::ColumnarWriter>& encoder);
+template void encodeCsvRow(
+    const struct bpf::rtt_event& ev,
+    common::ProjectedRow<common::SqliteWriter>& encoder);
+
+} // namespace rttevents
+} // namespace paths
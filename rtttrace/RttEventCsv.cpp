@@ -0,0 +1,136 @@
+#include "RttEventCsv.h"
+
+#include <src/common/ColumnProjection.h>
+#include <src/common/ColumnarFile.h>
+#include <src/common/EventStream.h>
+#include <src/common/SqliteWriter.h>
+
+namespace paths {
+namespace rtttrace {
+
+folly::SocketAddress
+toSocketAddress(const struct sockaddr_storage* sas) {
+  folly::SocketAddress socketAddress;
+  socketAddress.setFromSockaddr((struct sockaddr*)sas);
+  socketAddress.tryConvertToIPv4();
+  return socketAddress;
+}
+
+std::vector<std::string>
+getCsvFieldNames() {
+  std::vector<std::string> row;
+  row.push_back("ev_tstamp_ns");
+  row.push_back("conn_tstamp_ns");
+  common::appendAddressColumnNames("src", row);
+  common::appendAddressColumnNames("dst", row);
+
+  row.push_back("scb_seq");
+  row.push_back("scb_end_seq");
+  row.push_back("scb_packet_num");
+  row.push_back("scb_xmit_timestamp_us");
+  row.push_back("scb_now_timestamp_us");
+  row.push_back("scb_rtt_us");
+  row.push_back("scb_tcp_packets_in_flight");
+  row.push_back("scb_tx_bytes_in_flight");
+  row.push_back("scb_tx_packets_in_flight");
+  row.push_back("scb_pcount");
+  row.push_back("scb_tx_delivered");
+  row.push_back("scb_tx_delivered_mstamp");
+  row.push_back("scb_tx_first_tx_mstamp");
+  row.push_back("scb_flags");
+  row.push_back("scb_fully_acked");
+  row.push_back("scb_sacked");
+
+  row.push_back("tcp_delivered");
+  row.push_back("tcp_establish_snd_una");
+  row.push_back("tcp_mdev_us");
+  row.push_back("tcp_mss_cache");
+  row.push_back("tcp_mstamp");
+  row.push_back("tcp_rto");
+  row.push_back("tcp_min_rtt_us");
+  row.push_back("tcp_rttvar_us");
+  row.push_back("tcp_sacked_out");
+  row.push_back("tcp_snd_una");
+  row.push_back("tcp_srtt_us");
+
+  row.push_back("stats_calls");
+  row.push_back("stats_skbs_with_acked_pcount_zero");
+  row.push_back("stats_skbs_not_first_ack");
+  row.push_back("stats_skbs_retransmitted");
+  row.push_back("stats_unexported_packets");
+
+  return row;
+}
+
+template <typename Encoder>
+void
+encodeCsvRow(const struct bpf::rtt_event& ev, Encoder& encoder) {
+  encoder.add(ev.header.ev_tstamp_ns);
+  encoder.add(ev.header.conn_tstamp_ns);
+  common::addAddressColumns(encoder, &ev.header.src);
+  common::addAddressColumns(encoder, &ev.header.dst);
+
+  encoder.add(ev.scb.seq);
+  encoder.add(ev.scb.end_seq);
+  encoder.add(ev.scb.packet_num);
+  encoder.add(ev.scb.xmit_timestamp_us);
+  encoder.add(ev.scb.now_timestamp_us);
+  encoder.add(ev.scb.rtt_us);
+  encoder.add(ev.scb.tcp_packets_in_flight);
+  encoder.add(ev.scb.tx_bytes_in_flight);
+  encoder.add(ev.scb.tx_packets_in_flight);
+  encoder.add(ev.scb.pcount);
+  encoder.add(ev.scb.tx_delivered);
+  encoder.add(ev.scb.tx_delivered_mstamp);
+  encoder.add(ev.scb.tx_first_tx_mstamp);
+  encoder.add(ev.scb.flags);
+  encoder.add(ev.scb.fully_acked);
+  encoder.add(ev.scb.sacked);
+
+  encoder.add(ev.tcp.delivered);
+  encoder.add(ev.tcp.establish_snd_una);
+  encoder.add(ev.tcp.mdev_us);
+  encoder.add(ev.tcp.mss_cache);
+  encoder.add(ev.tcp.mstamp);
+  encoder.add(ev.tcp.rto);
+  encoder.add(ev.tcp.min_rtt_us);
+  encoder.add(ev.tcp.rttvar_us);
+  encoder.add(ev.tcp.sacked_out);
+  encoder.add(ev.tcp.snd_una);
+  encoder.add(ev.tcp.srtt_us);
+
+  encoder.add(ev.stats.calls);
+  encoder.add(ev.stats.skbs_with_acked_pcount_zero);
+  encoder.add(ev.stats.skbs_not_first_ack);
+  encoder.add(ev.stats.skbs_retransmitted);
+  encoder.add(ev.stats.unexported_packets);
+
+}
+
+template void encodeCsvRow(
+    const struct bpf::rtt_event& ev,
+    common::CsvRowEncoder& encoder);
+template void encodeCsvRow(
+    const struct bpf::rtt_event& ev,
+    common::ColumnarWriter& encoder);
+template void encodeCsvRow(
+    const struct bpf::rtt_event& ev,
+    common::ColumnTypeRecorder& encoder);
+template void encodeCsvRow(
+    const struct bpf::rtt_event& ev,
+    common::EventStreamRow& encoder);
+template void encodeCsvRow(
+    const struct bpf::rtt_event& ev,
+    common::SqliteWriter& encoder);
+template void encodeCsvRow(
+    const struct bpf::rtt_event& ev,
+    common::ProjectedRow<common::CsvRowEncoder>& encoder);
+template void encodeCsvRow(
+    const struct bpf::rtt_event& ev,
+    common::ProjectedRow<common::ColumnarWriter>& encoder);
+template void encodeCsvRow(
+    const struct bpf::rtt_event& ev,
+    common::ProjectedRow<common::SqliteWriter>& encoder);
+
+} // namespace rtttrace
+} // namespace paths
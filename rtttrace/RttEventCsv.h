@@ -0,0 +1,30 @@
+#pragma once
+
+#include <folly/SocketAddress.h>
+#include <src/common/CsvRowEncoder.h>
+#include <src/rtttrace/bpf/BpfStructs.h>
+#include <string>
+#include <vector>
+
+namespace paths {
+namespace rtttrace {
+
+folly::SocketAddress toSocketAddress(const struct sockaddr_storage* sas);
+
+/**
+ * Returns the CSV column names, in the order used by toCsvRow.
+ */
+std::vector<std::string> getCsvFieldNames();
+
+/**
+ * Appends the CSV columns of an event to the encoder. Instantiated for
+ * CsvRowEncoder, for ColumnarWriter and ColumnTypeRecorder, which fill the
+ * same columns for --export_mode=columnar, for SqliteWriter, for a
+ * ProjectedRow of CsvRowEncoder, ColumnarWriter or SqliteWriter (--exporters
+ * fields), and for EventStreamRow.
+ */
+template <typename Encoder>
+void encodeCsvRow(const struct bpf::rtt_event& ev, Encoder& encoder);
+
+} // namespace rtttrace
+} // namespace paths
@@ -1,6 +1,7 @@
 #pragma once
 
-#include <bcc/BPF.h>
+#include <src/common/BpfLoader.h>
+#include <src/common/BpfMapSweeper.h>
 #include <atomic>
 #include <memory>
 
@@ -31,7 +32,8 @@ class RttTraceCollector {
  private:
   const std::shared_ptr<CallbackHandler> cbHandler_;
   std::atomic<bool> running_;
-  ebpf::BPF ebpf_;
+  common::BpfLoader bpf_;
+  std::unique_ptr<common::BpfMapSweeper> sweeper_;
   std::atomic<uint64_t> events_;
   std::atomic<uint64_t> lost_events_;
 };
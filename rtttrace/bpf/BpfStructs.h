@@ -55,7 +55,8 @@ struct rtt_event {
     uint32_t srtt_us;
   } tcp;
 
-  struct {
+  /* also kept per connection by the rtt module of pathsd */
+  struct rtt_stats {
     uint16_t calls;
     uint16_t skbs_with_acked_pcount_zero;
     uint16_t skbs_not_first_ack;
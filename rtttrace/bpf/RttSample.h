@@ -0,0 +1,137 @@
+#pragma once
+
+/* RTT samples of rtttrace, taken from tcp_skb_acked. Shared by the rtttrace
+ * program and the rtt module of pathsd.
+ *
+ * Needs BpfStructs.h, UINT*_MAX and the _, _minmax_get and INCMAX macros of
+ * the including program. */
+
+static u64 local_tcp_skb_timestamp_us(const struct sk_buff *skb)
+{
+  return div_u64(skb->skb_mstamp_ns, NSEC_PER_USEC);
+}
+
+static u32 local_tcp_stamp_us_delta(u64 t1, u64 t0)
+{
+  s64 diff = (s64)t1 - (s64)t0;
+  return diff < 0 ? 0 : diff;
+}
+
+/* Fills the scb and tcp fields of ev with the sample of the skb acked in
+ * attrs, counting in stats the calls and the skbs that give no sample.
+ * establish_snd_una is the snd_una of the connection when it was
+ * established. Returns -1 if the skb is not exported. */
+static int
+rtt_sample_fill(struct rtt_event *ev,
+    struct rtt_stats *stats,
+    u32 establish_snd_una,
+    struct tracepoint__tcp__tcp_skb_acked* attrs)
+{
+  const struct sock* sk = (struct sock*)attrs->skaddr;
+  const struct inet_connection_sock* icsk = inet_csk(sk);
+  const struct tcp_sock *tp = tcp_sk(sk);
+  const struct sk_buff *skb = (struct sk_buff *)attrs->skbaddr;
+  const struct tcp_skb_cb *scb = TCP_SKB_CB(skb);
+
+  INCMAX(stats->calls, UINT16_MAX);
+
+  bool fully_acked = attrs->fully_acked;
+
+  u32 acked_pcount = attrs->acked_pcount;
+  if (acked_pcount == 0) {
+    // The kernel only updates RTT when acked_pcount > 1, we do the same.
+    INCMAX(stats->skbs_with_acked_pcount_zero, UINT16_MAX);
+    return -1;
+  }
+
+  bool is_first_ack = attrs->first_acked;
+  if (!is_first_ack) {
+    // Only compute RTT for the first packet in a batch. This prevents
+    // computing RTT for packets acknowledged out of order.
+    INCMAX(stats->skbs_not_first_ack, UINT16_MAX);
+    return -1;
+  }
+
+  if(scb->sacked & TCPCB_RETRANS) {
+    // Never look at RTT measurements from retransmitted packets.
+    INCMAX(stats->skbs_retransmitted, UINT16_MAX);
+    return -1;
+  }
+
+  u32 seq, end_seq;
+  if (fully_acked) {
+    _(seq, scb->seq);
+    _(end_seq, scb->end_seq);
+  } else {
+    _(seq, attrs->orig_seq);
+    _(end_seq, tp->snd_una);
+  }
+
+  u64 bytes = ((s64)UINT32_MAX - establish_snd_una + 1 + seq)
+      % (s64)UINT32_MAX;
+  u32 packet_num = bytes / tp->mss_cache;
+
+  u32 scb_tx_bytes_in_flight =
+#ifndef BCC_SEC
+      BPF_CORE_READ_BITFIELD_PROBED(scb, tx.in_flight);
+#else
+      (*(u32*)(&scb->tx)) & 0xffffff;
+#endif
+
+  // tx_bytes_in_flight is computed based on tx.in_flight, which the
+  // kernel keeps for rate delivery computation. We also export
+  // tcp_packets_in_flight, which is the kernels computation used in the
+  // congestion control algorithm. These could be different if packets
+  // are delivered out-of-order because of how they are computed
+  // (tx.in_flight does not consider SACK'd packets).
+  u32 tx_bytes_in_flight = scb_tx_bytes_in_flight - (scb->end_seq - scb->seq);
+  u32 tx_packets_in_flight = tx_bytes_in_flight / tp->mss_cache;
+  u32 tcp_packets_in_flight = scb->packets_in_flight;
+
+  // We do export an event if any estimation of the number of packets in
+  // flight is less than 2. We do not check for zero to avoid small
+  // errors (e.g., due to the kernel sending an SKB with pcount == 2).
+  if (tx_packets_in_flight >= 2 && tcp_packets_in_flight >= 2
+      && packet_num > RTTTRACE_MAX_PACKET_EXPORT) {
+    INCMAX(stats->unexported_packets, UINT16_MAX);
+    return -1;
+  }
+
+  u64 xmit_timestamp_us = local_tcp_skb_timestamp_us(skb);
+  u32 rtt_us = local_tcp_stamp_us_delta(tp->tcp_mstamp, xmit_timestamp_us);
+
+  ev->scb.seq = seq;
+  ev->scb.end_seq = end_seq;
+  ev->scb.packet_num = packet_num;
+  ev->scb.xmit_timestamp_us = xmit_timestamp_us;
+  ev->scb.now_timestamp_us = tp->tcp_mstamp;
+  ev->scb.rtt_us = rtt_us;
+  ev->scb.tcp_packets_in_flight = tcp_packets_in_flight;
+  ev->scb.tx_bytes_in_flight = tx_bytes_in_flight;
+  ev->scb.tx_packets_in_flight = tx_packets_in_flight;
+
+  ev->scb.pcount = acked_pcount;
+  _(ev->scb.tx_delivered, scb->tx.delivered);
+  _(ev->scb.tx_delivered_mstamp, scb->tx.delivered_mstamp);
+  _(ev->scb.tx_first_tx_mstamp, scb->tx.first_tx_mstamp);
+  _(ev->scb.flags, scb->tcp_flags);
+  ev->scb.fully_acked = (u8)fully_acked;
+  _(ev->scb.sacked, scb->sacked);
+
+  _(ev->tcp.delivered, tp->delivered);
+  ev->tcp.establish_snd_una = establish_snd_una;
+  _(ev->tcp.mdev_us, tp->mdev_us);
+  ev->tcp.mdev_us >>= 2;
+  _(ev->tcp.mss_cache, tp->mss_cache);
+  _(ev->tcp.mstamp, tp->tcp_mstamp);
+  _(ev->tcp.rto, icsk->icsk_rto);
+  _minmax_get(ev->tcp.min_rtt_us, tp->rtt_min);
+  _(ev->tcp.rttvar_us, tp->rttvar_us);
+  ev->tcp.rttvar_us >>= 2;
+  _(ev->tcp.sacked_out, tp->sacked_out);
+  _(ev->tcp.snd_una, tp->snd_una);
+  _(ev->tcp.srtt_us, tp->srtt_us);
+  ev->tcp.srtt_us >>= 3;
+
+  return 0;
+}
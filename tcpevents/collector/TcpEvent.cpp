@@ -1,8 +1,8 @@
 #include "TcpEvent.h"
 
-#include <boost/variant.hpp>
+#include <cstddef>
+
 #include <folly/Format.h>
-#include <folly/Overload.h>
 #include <folly/gen/Base.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -24,6 +24,19 @@ toSocketAddress(const paths::tcpevents::bpf::endpoint_t& endpoint) {
   return socketAddress;
 }
 
+// same as address.describe(), through the cache of common::formatAddress()
+std::string
+describe(const folly::SocketAddress& address) {
+  struct sockaddr_storage sas;
+  address.getAddress(&sas);
+  char tmp[paths::common::kMaxFormattedAddressLength];
+  const auto len = paths::common::formatAddress(&sas, tmp);
+  if (len == 0) {
+    return "<uninitialized address>";
+  }
+  return std::string(tmp, len);
+}
+
 template <typename T>
 folly::Optional<const char*>
 fatalEnumToOptStr(T e) {
@@ -40,177 +53,233 @@ fatalEnumToStr(T e) {
   return fatal::enum_to_string(e, kUnknownEnumType);
 }
 
-struct RegisteredStat {
-  RegisteredStat(
-      const char* name,
-      const int paths::tcpevents::bpf::tcp_event_stats_t::*mPtr)
-      : name(name), mPtr(mPtr) {}
-  RegisteredStat(
-      const char* name,
-      const uint8_t paths::tcpevents::bpf::tcp_event_stats_t::*mPtr)
-      : name(name), mPtr(mPtr) {}
-  RegisteredStat(
-      const char* name,
-      const uint16_t paths::tcpevents::bpf::tcp_event_stats_t::*mPtr)
-      : name(name), mPtr(mPtr) {}
-  RegisteredStat(
-      const char* name,
-      const uint32_t paths::tcpevents::bpf::tcp_event_stats_t::*mPtr)
-      : name(name), mPtr(mPtr) {}
-  RegisteredStat(
-      const char* name,
-      const uint64_t paths::tcpevents::bpf::tcp_event_stats_t::*mPtr)
-      : name(name), mPtr(mPtr) {}
-  RegisteredStat(
-      const char* name,
-      const bool paths::tcpevents::bpf::tcp_event_stats_t::*mPtr)
-      : name(name), mPtr(mPtr) {}
-
-  std::string
-  statToStr(const paths::tcpevents::bpf::tcp_event_stats_t& stats) const {
-    return folly::variant_match(
-        mPtr,
-        [&stats](const int paths::tcpevents::bpf::tcp_event_stats_t::*s) {
-          return folly::sformat("{}", stats.*s);
-        },
-        [&stats](const uint8_t paths::tcpevents::bpf::tcp_event_stats_t::*s) {
-          return folly::sformat("{}", stats.*s);
-        },
-        [&stats](const uint16_t paths::tcpevents::bpf::tcp_event_stats_t::*s) {
-          return folly::sformat("{}", stats.*s);
-        },
-        [&stats](const uint32_t paths::tcpevents::bpf::tcp_event_stats_t::*s) {
-          return folly::sformat("{}", stats.*s);
-        },
-        [&stats](const uint64_t paths::tcpevents::bpf::tcp_event_stats_t::*s) {
-          return folly::sformat("{}", stats.*s);
-        },
-        [&stats](const bool paths::tcpevents::bpf::tcp_event_stats_t::*s) {
-          return folly::sformat("{}", stats.*s);
-        });
+using paths::tcpevents::TcpEvent;
+using Field = TcpEvent::Field;
+using FieldValue = TcpEvent::FieldValue;
+
+template <typename T>
+FieldValue
+enumValue(T e) {
+  return FieldValue::of(static_cast<int>(e));
+}
+
+template <typename T>
+FieldValue
+enumName(T e) {
+  return FieldValue::ofString(fatalEnumToStr(e));
+}
+
+FieldValue
+nsValue(std::chrono::nanoseconds ts) {
+  return FieldValue::of(static_cast<int64_t>(ts.count()));
+}
+
+// an enum of the event and its name
+#define _state(name, member)                                      \
+  Field{name,                                                     \
+        Field::Group::STATE,                                      \
+        FieldValue::Type::INT,                                    \
+        [](const TcpEvent& e) { return enumValue(e.member); }},   \
+      Field{name "_name",                                         \
+            Field::Group::STATE,                                  \
+            FieldValue::Type::STRING,                             \
+            [](const TcpEvent& e) { return enumName(e.member); }}
+
+// an enum of the details union and its name, only set for events of evType
+#define _detail(name, evType, member)                 \
+  Field{name,                                         \
+        Field::Group::DETAIL,                         \
+        FieldValue::Type::INT,                        \
+        [](const TcpEvent& e) {                       \
+          return e.type == TcpEvent::Type::evType     \
+              ? enumValue(e.details.member)           \
+              : FieldValue();                         \
+        }},                                           \
+      Field{name "_name",                             \
+            Field::Group::DETAIL,                     \
+            FieldValue::Type::STRING,                 \
+            [](const TcpEvent& e) {                   \
+              return e.type == TcpEvent::Type::evType \
+                  ? enumName(e.details.member)        \
+                  : FieldValue();                     \
+            }}
+
+#define _stat(stat)                                                           \
+  Field{#stat,                                                                \
+        Field::Group::STAT,                                                   \
+        FieldValue::of(paths::tcpevents::bpf::tcp_event_stats_t().stat).type, \
+        [](const TcpEvent& e) { return FieldValue::of(e.rawStats.stat); },    \
+        offsetof(paths::tcpevents::bpf::tcp_event_stats_t, stat),             \
+        sizeof(paths::tcpevents::bpf::tcp_event_stats_t::stat)}
+
+std::vector<Field>
+makeFields() {
+  return {
+      // header
+      Field{"event_ns",
+            Field::Group::HEADER,
+            FieldValue::Type::INT,
+            [](const TcpEvent& e) { return nsValue(e.event_ts); }},
+      Field{"conn_ns",
+            Field::Group::HEADER,
+            FieldValue::Type::INT,
+            [](const TcpEvent& e) { return nsValue(e.conn_ts); }},
+      Field{"src",
+            Field::Group::HEADER,
+            FieldValue::Type::ADDRESS,
+            [](const TcpEvent& e) { return FieldValue::ofAddress(e.src); }},
+      Field{"dst",
+            Field::Group::HEADER,
+            FieldValue::Type::ADDRESS,
+            [](const TcpEvent& e) { return FieldValue::ofAddress(e.dst); }},
+      Field{"event_type",
+            Field::Group::HEADER,
+            FieldValue::Type::INT,
+            [](const TcpEvent& e) { return enumValue(e.type); }},
+      Field{"event_type_name",
+            Field::Group::HEADER,
+            FieldValue::Type::STRING,
+            [](const TcpEvent& e) { return enumName(e.type); }},
+
+      // state
+      _state("skt_state", sockState),
+      _state("ca_state", tcpCaState),
+
+      // detail
+      _detail(
+          "old_skt_state",
+          INET_SOCK_SET_STATE,
+          state_change.old_state.skt_state),
+      _detail(
+          "new_skt_state",
+          INET_SOCK_SET_STATE,
+          state_change.new_state.skt_state),
+      _detail("old_ca_state", TCP_SET_CA_STATE, state_change.old_state.ca_state),
+      _detail("new_ca_state", TCP_SET_CA_STATE, state_change.new_state.ca_state),
+      _detail("ca_event", TCP_CA_EVENT, ca_event),
+
+      // stats
+      _stat(srtt_us),
+      _stat(mdev_us),
+      _stat(rttvar_us),
+      _stat(min_rtt_us),
+      _stat(min_rtt_us_on_establish),
+      _stat(snd_cwnd),
+      _stat(snd_ssthresh),
+      // _stat(snd_cwnd_cnt),
+      // _stat(snd_cwnd_clamp),
+      // _stat(snd_cwnd_used),
+      // _stat(snd_cwnd_stamp),
+      // _stat(is_cwnd_limited),
+      // _stat(prior_cwnd),
+      // _stat(prior_ssthresh),
+      // _stat(high_seq),
+      // _stat(prr_delivered),
+      // _stat(prr_out),
+      _stat(segs_in),
+      _stat(segs_out),
+      _stat(data_segs_in),
+      _stat(data_segs_out),
+      _stat(total_retrans),
+      _stat(bytes_received),
+      _stat(bytes_acked),
+      _stat(bytes_retrans),
+      _stat(delivered),
+      _stat(delivered_ce),
+      _stat(first_tx_mstamp),
+      _stat(delivered_mstamp),
+      _stat(mss_cache),
+      // _stat(rate_delivered),
+      // _stat(rate_interval_us),
+      // _stat(rate_app_limited),
+      // _stat(app_limited_until),
+      // _stat(write_seq),
+      // _stat(snd_nxt),
+      // _stat(snd_una),
+      // _stat(snd_sml),
+      // _stat(packets_out),
+      // _stat(retrans_out),
+      // _stat(sacked_out),
+      // _stat(lost_out),
+      _stat(lost),
+      // _stat(reordering),
+      // _stat(reord_seen),
+      // _stat(max_packets_out),
+      // _stat(max_packets_seq),
+      // _stat(rcv_wnd),
+      _stat(chrono_busy),
+      _stat(chrono_rwnd_limited),
+      _stat(chrono_sndbuf_limited),
+      // _stat(rack_mstamp),
+      // _stat(rack_rtt_us),
+      // _stat(rack_end_seq),
+      // _stat(rack_last_delivered),
+      _stat(pacing_status),
+      _stat(pacing_rate),
+      _stat(max_pacing_rate),
+      _stat(sndbuf),
+      _stat(rcvbuf),
+      _stat(sk_shutdown),
+      _stat(sk_err),
+      _stat(sk_err_soft),
+      _stat(rto),
+      _stat(start_us),
+      _stat(bytes_per_ns),
+
+      _stat(cc_algo),
+      _stat(fstloss_tracked),
+      _stat(fstloss_packet),
+      _stat(fstloss_reason),
+      _stat(fstloss_done),
+      _stat(fstloss_stats_set_loss_count),
+      _stat(fstloss_stats_undo_count),
+      _stat(fstloss_stats_undone_undo_marker),
+      _stat(fstloss_stats_undone_mtu_probing),
+      _stat(fstloss_stats_undone_ssthresh_infinite),
+      _stat(fstloss_stats_transitions_loss_to_loss),
+      _stat(fstloss_stats_transitions_open_to_open),
+      _stat(fstloss_stats_transitions_recovery_to_loss),
+      _stat(fstloss_stats_transitions_after_done),
+      _stat(fstloss_stats_recovery_to_loss_with_partial_acks),
+
+      _stat(ca_state_changes_count),
+      _stat(ca_state_changes_open_disorder),
+      _stat(ca_state_changes_cwr),
+      _stat(ca_state_changes_recovery),
+      _stat(ca_state_changes_loss),
+  };
+}
+
+#undef _state
+#undef _detail
+#undef _stat
+
+std::vector<std::string>
+getFieldNames(Field::Group group) {
+  std::vector<std::string> result;
+  for (const auto& field : TcpEvent::getFields()) {
+    if (field.group == group) {
+      result.push_back(field.name);
+    }
   }
+  return result;
+}
 
-  const char* name;
-  const boost::variant<
-      const int paths::tcpevents::bpf::tcp_event_stats_t::*,
-      const uint8_t paths::tcpevents::bpf::tcp_event_stats_t::*,
-      const uint16_t paths::tcpevents::bpf::tcp_event_stats_t::*,
-      const uint32_t paths::tcpevents::bpf::tcp_event_stats_t::*,
-      const uint64_t paths::tcpevents::bpf::tcp_event_stats_t::*,
-      const bool paths::tcpevents::bpf::tcp_event_stats_t::*>
-      mPtr;
-};
-
-#define _stat(stat) \
-  RegisteredStat(#stat, &paths::tcpevents::bpf::tcp_event_stats_t::stat)
-
-static std::vector<RegisteredStat> registeredStats = {
-    _stat(srtt_us),
-    _stat(mdev_us),
-    _stat(rttvar_us),
-    _stat(min_rtt_us),
-    _stat(min_rtt_us_on_establish),
-    _stat(snd_cwnd),
-    _stat(snd_ssthresh),
-    // _stat(snd_cwnd_cnt),
-    // _stat(snd_cwnd_clamp),
-    // _stat(snd_cwnd_used),
-    // _stat(snd_cwnd_stamp),
-    // _stat(is_cwnd_limited),
-    // _stat(prior_cwnd),
-    // _stat(prior_ssthresh),
-    // _stat(high_seq),
-    // _stat(prr_delivered),
-    // _stat(prr_out),
-    _stat(segs_in),
-    _stat(segs_out),
-    _stat(data_segs_in),
-    _stat(data_segs_out),
-    _stat(total_retrans),
-    _stat(bytes_received),
-    _stat(bytes_acked),
-    _stat(bytes_retrans),
-    _stat(delivered),
-    _stat(delivered_ce),
-    _stat(first_tx_mstamp),
-    _stat(delivered_mstamp),
-    _stat(mss_cache),
-    // _stat(rate_delivered),
-    // _stat(rate_interval_us),
-    // _stat(rate_app_limited),
-    // _stat(app_limited_until),
-    // _stat(write_seq),
-    // _stat(snd_nxt),
-    // _stat(snd_una),
-    // _stat(snd_sml),
-    // _stat(packets_out),
-    // _stat(retrans_out),
-    // _stat(sacked_out),
-    // _stat(lost_out),
-    _stat(lost),
-    // _stat(reordering),
-    // _stat(reord_seen),
-    // _stat(max_packets_out),
-    // _stat(max_packets_seq),
-    // _stat(rcv_wnd),
-    _stat(chrono_busy),
-    _stat(chrono_rwnd_limited),
-    _stat(chrono_sndbuf_limited),
-    // _stat(rack_mstamp),
-    // _stat(rack_rtt_us),
-    // _stat(rack_end_seq),
-    // _stat(rack_last_delivered),
-    _stat(pacing_status),
-    _stat(pacing_rate),
-    _stat(max_pacing_rate),
-    _stat(sndbuf),
-    _stat(rcvbuf),
-    _stat(sk_shutdown),
-    _stat(sk_err),
-    _stat(sk_err_soft),
-    _stat(rto),
-    _stat(start_us),
-    _stat(bytes_per_ns),
-
-    _stat(cc_algo),
-    _stat(fstloss_tracked),
-    _stat(fstloss_packet),
-    _stat(fstloss_reason),
-    _stat(fstloss_done),
-    _stat(fstloss_stats_set_loss_count),
-    _stat(fstloss_stats_undo_count),
-    _stat(fstloss_stats_undone_undo_marker),
-    _stat(fstloss_stats_undone_mtu_probing),
-    _stat(fstloss_stats_undone_ssthresh_infinite),
-    _stat(fstloss_stats_transitions_loss_to_loss),
-    _stat(fstloss_stats_transitions_open_to_open),
-    _stat(fstloss_stats_transitions_recovery_to_loss),
-    _stat(fstloss_stats_transitions_after_done),
-    _stat(fstloss_stats_recovery_to_loss_with_partial_acks),
-
-    _stat(ca_state_changes_count),
-    _stat(ca_state_changes_open_disorder),
-    _stat(ca_state_changes_cwr),
-    _stat(ca_state_changes_recovery),
-    _stat(ca_state_changes_loss),
-
-};
-
-// TODO(bschlinker): Register these fields
-const std::vector<std::string> kHeaderFields(
-    {"event_ns", "conn_ns", "src", "dst", "event_type", "event_type_name"});
-const std::vector<std::string> kStateFields(
-    {"skt_state", "skt_state_name", "ca_state", "ca_state_name"});
-const std::vector<std::string> kDetailFields({"old_skt_state",
-                                              "old_skt_state_name",
-                                              "new_skt_state",
-                                              "new_skt_state_name",
-                                              "old_ca_state",
-                                              "old_ca_state_name",
-                                              "new_ca_state",
-                                              "new_ca_state_name",
-                                              "ca_event",
-                                              "ca_event_name"});
+// fields of group that are set for event, formatted
+std::map<std::string, std::string>
+getGroupMap(const TcpEvent& event, Field::Group group) {
+  std::map<std::string, std::string> result;
+  for (const auto& field : TcpEvent::getFields()) {
+    if (field.group != group) {
+      continue;
+    }
+    const auto value = field.get(event);
+    if (value.type != FieldValue::Type::NONE) {
+      result.emplace(field.name, value.toString());
+    }
+  }
+  return result;
+}
 
 } // namespace
 
@@ -235,7 +304,7 @@ TcpEvent::toString(
 
   // add the header
   strsToPrint.push_back(folly::sformat(
-      "TcpEvent for flow {} -> {}:", src.describe(), dst.describe()));
+      "TcpEvent for flow {} -> {}:", describe(src), describe(dst)));
 
   // add header fields
   const auto headerFields = getHeaderMap();
@@ -309,99 +378,77 @@ TcpEvent::getFieldMap() const {
 
 std::map<std::string, std::string>
 TcpEvent::getHeaderMap() const {
-  std::map<std::string, std::string> result;
-  result.emplace(
-      "event_ns",
-      std::to_string(
-          std::chrono::duration_cast<std::chrono::nanoseconds>(event_ts).count()));
-  result.emplace(
-      "conn_ns",
-      std::to_string(
-          std::chrono::duration_cast<std::chrono::nanoseconds>(conn_ts).count()));
-  result.emplace("src", src.describe());
-  result.emplace("dst", dst.describe());
-  result.emplace("event_type", std::to_string(int(type)));
-  result.emplace("event_type_name", fatalEnumToStr(type));
-  return result;
+  return getGroupMap(*this, Field::Group::HEADER);
 }
 
 std::map<std::string, std::string>
 TcpEvent::getStateMap() const {
-  std::map<std::string, std::string> result;
-  result.emplace("skt_state", std::to_string((int)sockState));
-  result.emplace("skt_state_name", fatalEnumToStr(sockState));
-  result.emplace("ca_state", std::to_string((int)tcpCaState));
-  result.emplace("ca_state_name", fatalEnumToStr(tcpCaState));
-  return result;
+  return getGroupMap(*this, Field::Group::STATE);
 }
 
 std::map<std::string, std::string>
 TcpEvent::getDetailMap() const {
-  std::map<std::string, std::string> result;
+  return getGroupMap(*this, Field::Group::DETAIL);
+}
 
+std::map<std::string, std::string>
+TcpEvent::getStatMap() const {
+  return getGroupMap(*this, Field::Group::STAT);
+}
+
+std::string
+TcpEvent::FieldValue::toString() const {
   switch (type) {
-  case bpf::tcp_event_type_e::INET_SOCK_SET_STATE: {
-    const auto oldState = details.state_change.old_state.skt_state;
-    const auto newState = details.state_change.new_state.skt_state;
-    result.emplace("old_skt_state", std::to_string((int)oldState));
-    result.emplace("old_skt_state_name", fatalEnumToStr(oldState));
-    result.emplace("new_skt_state", std::to_string((int)newState));
-    result.emplace("new_skt_state_name", fatalEnumToStr(newState));
-    break;
+  case Type::NONE:
+    return "";
+  case Type::INT:
+    return std::to_string(i);
+  case Type::UINT:
+    return std::to_string(u);
+  case Type::BOOL:
+    return folly::sformat("{}", b);
+  case Type::STRING:
+    return s;
+  case Type::ADDRESS:
+    return describe(*addr);
   }
-  case bpf::tcp_event_type_e::TCP_SET_CA_STATE: {
-    const auto oldState = details.state_change.old_state.ca_state;
-    const auto newState = details.state_change.new_state.ca_state;
-    result.emplace("old_ca_state", std::to_string((int)oldState));
-    result.emplace("old_ca_state_name", fatalEnumToStr(oldState));
-    result.emplace("new_ca_state", std::to_string((int)newState));
-    result.emplace("new_ca_state_name", fatalEnumToStr(newState));
-    break;
-  }
-  case bpf::tcp_event_type_e::TCP_CA_EVENT: {
-    const auto caEvent = details.ca_event;
-    result.emplace("ca_event", std::to_string((int)caEvent));
-    result.emplace("ca_event_name", fatalEnumToStr(caEvent));
-    break;
-  }
-  default:
-    break;
-  };
+  return "";
+}
 
-  return result;
+const std::vector<TcpEvent::Field>&
+TcpEvent::getFields() {
+  static const std::vector<Field> fields = makeFields();
+  return fields;
 }
 
-std::map<std::string, std::string>
-TcpEvent::getStatMap() const {
-  std::map<std::string, std::string> result;
-  for (const auto& rStat : registeredStats) {
-    result.emplace(rStat.name, folly::sformat("{}", rStat.statToStr(rawStats)));
+const TcpEvent::Field*
+TcpEvent::getField(folly::StringPiece name) {
+  for (const auto& field : getFields()) {
+    if (name == field.name) {
+      return &field;
+    }
   }
-  return result;
+  return nullptr;
 }
 
 std::vector<std::string>
 TcpEvent::getHeaderFieldNames() {
-  return kHeaderFields;
+  return getFieldNames(Field::Group::HEADER);
 }
 
 std::vector<std::string>
 TcpEvent::getDetailFieldNames() {
-  return kDetailFields;
+  return getFieldNames(Field::Group::DETAIL);
 }
 
 std::vector<std::string>
 TcpEvent::getStateFieldNames() {
-  return kStateFields;
+  return getFieldNames(Field::Group::STATE);
 }
 
 std::vector<std::string>
 TcpEvent::getStatFieldNames() {
-  std::vector<std::string> result;
-  for (const auto& rStat : registeredStats) {
-    result.push_back(rStat.name);
-  }
-  return result;
+  return getFieldNames(Field::Group::STAT);
 }
 
 } // namespace tcpevents
@@ -1,11 +1,15 @@
 #pragma once
 
 #include <fatal/type/enum.h>
+#include <folly/Range.h>
 #include <folly/SocketAddress.h>
+#include <src/common/CsvRowEncoder.h>
 #include <src/tcpevents/collector/bpf/BpfStructs.h>
+#include <sys/socket.h>
 #include <chrono>
 #include <map>
 #include <set>
+#include <type_traits>
 #include <unordered_set>
 
 namespace paths {
@@ -17,6 +21,126 @@ namespace tcpevents {
 struct TcpEvent {
   using Type = bpf::tcp_event_type_e;
 
+  /**
+   * Typed value of a field of an event. Strings are static (enum names) and
+   * addresses point into the event.
+   */
+  struct FieldValue {
+    enum class Type : uint8_t { NONE, INT, UINT, BOOL, STRING, ADDRESS };
+
+    template <typename T>
+    static FieldValue of(T value) {
+      static_assert(std::is_integral<T>::value, "integral value expected");
+      FieldValue v;
+      if constexpr (std::is_same<T, bool>::value) {
+        v.type = Type::BOOL;
+        v.b = value;
+      } else if constexpr (std::is_signed<T>::value) {
+        v.type = Type::INT;
+        v.i = value;
+      } else {
+        v.type = Type::UINT;
+        v.u = value;
+      }
+      return v;
+    }
+
+    static FieldValue ofString(const char* value) {
+      FieldValue v;
+      v.type = Type::STRING;
+      v.s = value;
+      return v;
+    }
+
+    static FieldValue ofAddress(const folly::SocketAddress& value) {
+      FieldValue v;
+      v.type = Type::ADDRESS;
+      v.addr = &value;
+      return v;
+    }
+
+    /**
+     * Same format as the field maps; empty for NONE.
+     */
+    std::string toString() const;
+
+    /**
+     * Adds the value to an encoder with the interface of
+     * common::ColumnarWriter, NONE as a null and addresses as
+     * common::addAddressColumns() does.
+     */
+    template <typename Encoder>
+    void encode(Encoder& encoder) const {
+      switch (type) {
+      case Type::NONE:
+        encoder.addNull();
+        break;
+      case Type::INT:
+        encoder.add(i);
+        break;
+      case Type::UINT:
+        encoder.add(u);
+        break;
+      case Type::BOOL:
+        encoder.add(b);
+        break;
+      case Type::STRING:
+        encoder.addString(s);
+        break;
+      case Type::ADDRESS: {
+        struct sockaddr_storage sas;
+        addr->getAddress(&sas);
+        common::addAddressColumns(encoder, &sas);
+        break;
+      }
+      }
+    }
+
+    // NONE if the field does not apply to the event (e.g., details of other
+    // event types)
+    Type type{Type::NONE};
+    union {
+      int64_t i;
+      uint64_t u;
+      bool b;
+      const char* s;
+      const folly::SocketAddress* addr;
+    };
+  };
+
+  /**
+   * Static description of a field: the schema shared by all exporters.
+   *
+   * Exporters resolve the fields they export once (getField) and then call
+   * get for each event, without building strings or maps.
+   */
+  struct Field {
+    enum class Group : uint8_t { HEADER, STATE, DETAIL, STAT };
+
+    const char* name;
+    Group group;
+
+    // type of the values returned by get (or NONE)
+    FieldValue::Type type;
+    FieldValue (*get)(const TcpEvent& event);
+
+    // STAT fields only: location of the stat in tcp_event_stats_t
+    // (see TcpEventStatProjection)
+    uint16_t statOffset{0};
+    uint8_t statWidth{0};
+  };
+
+  /**
+   * All fields: header, state, detail, then stat fields (in registration
+   * order within each group).
+   */
+  static const std::vector<Field>& getFields();
+
+  /**
+   * Returns the field with the given name, or nullptr if there is none.
+   */
+  static const Field* getField(folly::StringPiece name);
+
   // TODO(bschlinker): Change constructor to be tryToTcpEvent, since some of the
   // construction process can throw (although unlikely...)
   TcpEvent(const bpf::tcp_event_t& rawEvent);
@@ -34,7 +158,8 @@ struct TcpEvent {
   /**
    * Get all fields in a map (field name -> field value).
    *
-   * Used std::map to provide ordering.
+   * Used std::map to provide ordering. Exporters should use getFields()
+   * instead, which does not format every field.
    */
   std::map<std::string, std::string> getFieldMap() const;
 
@@ -1,10 +1,16 @@
 #include "TcpEventCollector.h"
 
+#include <bcc/libbpf.h>
 #include <folly/FileUtil.h>
 #include <folly/Format.h>
+#include <folly/String.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <unistd.h>
 #include <experimental/filesystem>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
 #include <vector>
 
@@ -77,12 +83,20 @@ DEFINE_double(
     bpf_connection_sampling_rate,
     1.0,
     "BPF connection sampling rate (will be rounded to multiples of 1/65535)");
+DEFINE_uint32(
+    snapshot_interval_s,
+    0,
+    "Interval between snapshots of all tracked connections, taken with a "
+    "bpf_iter/tcp program (requires kernel >= 5.9; 0 disables snapshots)");
 DEFINE_validator(path_bpf_include_headers, &ValidatePath);
 DEFINE_validator(path_bpf_source, &ValidateFilePath);
 DEFINE_validator(bpf_connection_sampling_rate, &ValidateSamplingRate);
 
 namespace {
 
+// snapshot events handled between two polls of the perf buffer
+constexpr size_t kSnapshotStepEvents = 1024;
+
 void
 handleRawPerfEvent(void* cb_cookie, void* data, int data_size) {
   paths::tcpevents::TcpEventCollector* collector =
@@ -106,7 +120,9 @@ TcpEventCollector::TcpEventCollector(
     const std::unordered_set<TcpEvent::Type>& enabledEvents,
     const std::shared_ptr<CallbackHandler>& cbHandler)
     : enabledEvents_(enabledEvents), cbHandler_(cbHandler), running_(false),
-      events_cnt_(0), lost_events_cnt_(0) {}
+      bpf_(FLAGS_kbuild_modname), iterLinkFd_(-1), iterFd_(-1),
+      snapshotUsed_(0), snapshotConnections_(0), events_cnt_(0),
+      lost_events_cnt_(0), snapshot_events_cnt_(0) {}
 
 bool
 TcpEventCollector::run() {
@@ -140,6 +156,10 @@ TcpEventCollector::run() {
     );
   }
 
+  if (FLAGS_snapshot_interval_s) {
+    cflags.emplace_back("-DTCP_SNAPSHOT");
+  }
+
   std::string fileContents;
   if (not folly::readFile(
           fs::absolute(pathToBpfSource).c_str(), fileContents)) {
@@ -152,6 +172,16 @@ TcpEventCollector::run() {
   LOG(INFO) << folly::format(
       "Read BPF source from {}", pathToBpfSource.filename().c_str());
 
+  // every BPF function that is attached below
+  std::vector<common::BpfLoader::Program> programs = {
+      {"on_tcp_destroy_sock", BPF_PROG_TYPE_TRACEPOINT},
+      {"on_inet_sock_set_state", BPF_PROG_TYPE_TRACEPOINT},
+      {"on_tcp_set_ca_state", BPF_PROG_TYPE_KPROBE},
+  };
+  if (FLAGS_snapshot_interval_s) {
+    programs.push_back({"bpf_iter__tcp", BPF_PROG_TYPE_TRACING});
+  }
+
   // load the BPF program
   {
     LOG(INFO) << folly::format(
@@ -159,7 +189,7 @@ TcpEventCollector::run() {
         pathToBpfSource.filename().c_str(),
         folly::join(", ", cflags));
     const auto bpfSourceFilename = pathToBpfSource.filename().c_str();
-    auto r = ebpf_.init(fileContents, cflags);
+    auto r = bpf_.init(pathToBpfSource, fileContents, cflags, programs);
     if (r.code() != 0) {
       LOG(ERROR) << folly::format(
           "Error loading BPF program {}: {}", bpfSourceFilename, r.msg());
@@ -174,7 +204,7 @@ TcpEventCollector::run() {
   {
     const std::string tracepoint = "tcp:tcp_destroy_sock";
     const std::string fn = "on_tcp_destroy_sock";
-    auto r = ebpf_.attach_tracepoint(tracepoint, fn);
+    auto r = bpf_.attachTracepoint(tracepoint, fn);
     if (r.code() != 0) {
       LOG(ERROR) << folly::format(
           "Error attaching BPF function {} to tracepoint {}: {}",
@@ -196,7 +226,7 @@ TcpEventCollector::run() {
   {
     const std::string tracepoint = "sock:inet_sock_set_state";
     const std::string fn = "on_inet_sock_set_state";
-    auto r = ebpf_.attach_tracepoint(tracepoint, fn);
+    auto r = bpf_.attachTracepoint(tracepoint, fn);
     if (r.code() != 0) {
       LOG(ERROR) << folly::format(
           "Error attaching BPF function {} to tracepoint {}: {}",
@@ -214,7 +244,7 @@ TcpEventCollector::run() {
   if (enabledEvents_.count(TcpEvent::Type::TCP_SET_CA_STATE)) {
     for (const auto& kprobe : {"bictcp_state", "bbr_set_state"}) {
       const std::string fn = "on_tcp_set_ca_state";
-      auto r = ebpf_.attach_kprobe(kprobe, fn, 0, BPF_PROBE_ENTRY);
+      auto r = bpf_.attachKprobe(kprobe, fn);
       if (r.code() != 0) {
         LOG(ERROR) << folly::format(
             "Error attaching BPF function {} to kprobe {}: {}",
@@ -232,7 +262,7 @@ TcpEventCollector::run() {
   // open the perf buffer
   const auto perfBuffName = "events";
   {
-    auto r = ebpf_.open_perf_buffer(
+    auto r = bpf_.openPerfBuffer(
         perfBuffName,
         &handleRawPerfEvent,
         &handleRawLostPerfEvents,
@@ -246,14 +276,88 @@ TcpEventCollector::run() {
     }
   }
 
+  // setup bpf_iter/tcp for periodic snapshots of live connections
+  if (FLAGS_snapshot_interval_s) {
+    const std::string fn = "bpf_iter__tcp";
+    const int progFd = bpf_.getProgFd(fn);
+    if (progFd < 0) {
+      LOG(ERROR) << folly::format("Error loading BPF iterator {}", fn);
+      running_.store(false);
+      return false;
+    }
+    iterLinkFd_ = bcc_iter_attach(progFd, nullptr, 0);
+    if (iterLinkFd_ < 0) {
+      LOG(ERROR) << folly::format(
+          "Error attaching BPF iterator {}: {}", fn, folly::errnoStr(errno));
+      running_.store(false);
+      return false;
+    }
+    LOG(INFO) << folly::format(
+        "Attached BPF iterator {}, taking snapshots every {}s",
+        fn,
+        FLAGS_snapshot_interval_s);
+  }
+
+  // sweep entries leaked by missed on_tcp_destroy_sock calls. With
+  // snapshots, the iterator stamps every live connection in seen_us, so
+  // entries age from the last time their socket was seen; otherwise from
+  // start_us. Both lead struct connection_stats (bpf/BpfPrivateStructs.h)
+  if (FLAGS_bpf_map_gc_interval_s && FLAGS_snapshot_interval_s &&
+      FLAGS_bpf_map_gc_max_age_s <= 2 * FLAGS_snapshot_interval_s) {
+    LOG(WARNING) << folly::format(
+        "--bpf_map_gc_max_age_s={} is not well above "
+        "--snapshot_interval_s={}; live connections may be swept",
+        FLAGS_bpf_map_gc_max_age_s,
+        FLAGS_snapshot_interval_s);
+  }
+  sweeper_ = common::BpfMapSweeper::createFromFlags(
+      bpf_.getMapFd("ht"),
+      folly::sformat("{}:ht", FLAGS_kbuild_modname),
+      FLAGS_snapshot_interval_s ? sizeof(uint64_t) : 0,
+      std::chrono::microseconds(1));
+  if (sweeper_) {
+    sweeper_->start();
+  }
+
   // poll events from the perf buffer
   LOG(INFO) << folly::format(
       "Waiting for TcpEvents from perf buffer {}", perfBuffName);
+  const auto snapshotInterval =
+      std::chrono::seconds(FLAGS_snapshot_interval_s);
+  auto nextSnapshot = std::chrono::steady_clock::now() + snapshotInterval;
   while (running_.load()) {
-    ebpf_.poll_perf_buffer(perfBuffName, 1000);
+    // while a snapshot is in progress, it is read a step at a time between
+    // non-blocking polls, so that the perf buffer keeps being drained
+    bpf_.pollPerfBuffer(perfBuffName, iterFd_ >= 0 ? 0 : 1000);
+    if (iterFd_ >= 0) {
+      if (not continueSnapshot(kSnapshotStepEvents)) {
+        nextSnapshot = std::chrono::steady_clock::now() + snapshotInterval;
+      }
+    } else if (
+        iterLinkFd_ >= 0 &&
+        std::chrono::steady_clock::now() >= nextSnapshot) {
+      if (not startSnapshot()) {
+        nextSnapshot = std::chrono::steady_clock::now() + snapshotInterval;
+      }
+    }
   }
   LOG(INFO) << "Exited perf buffer poll loop";
-  LOG(INFO) << folly::format("TcpEvents {} total ({} lost)", events_cnt_, lost_events_cnt_);
+  if (iterFd_ >= 0) {
+    close(iterFd_);
+    iterFd_ = -1;
+  }
+  if (iterLinkFd_ >= 0) {
+    close(iterLinkFd_);
+    iterLinkFd_ = -1;
+  }
+  if (sweeper_) {
+    sweeper_->stop();
+  }
+  LOG(INFO) << folly::format(
+      "TcpEvents {} total ({} lost), {} snapshot events",
+      events_cnt_,
+      lost_events_cnt_,
+      snapshot_events_cnt_);
   return true;
 }
 
@@ -273,8 +377,80 @@ TcpEventCollector::handlePerfEvent(const void* data, const int data_size) {
   // TODO(bschlinker): Sanity check that data_size == sizeof(tcp_event_t)
   events_cnt_++;
   const bpf::tcp_event_t* rawEvent = static_cast<const bpf::tcp_event_t*>(data);
-  auto e = std::make_unique<TcpEvent>(*rawEvent);
-  cbHandler_->handleTcpEvent(std::move(e));
+  if (cbHandler_->handleRawTcpEvent(*rawEvent)) {
+    return;
+  }
+  cbHandler_->handleTcpEventView(TcpEventView(*rawEvent));
+}
+
+bool
+TcpEventCollector::startSnapshot() {
+  iterFd_ = bcc_iter_create(iterLinkFd_);
+  if (iterFd_ < 0) {
+    LOG(ERROR) << folly::format(
+        "Error creating BPF iterator: {}", folly::errnoStr(errno));
+    return false;
+  }
+  snapshotBuf_.resize(sizeof(bpf::tcp_event_t) * 64);
+  snapshotUsed_ = 0;
+  snapshotConnections_ = 0;
+  snapshotStart_ = std::chrono::steady_clock::now();
+  return true;
+}
+
+bool
+TcpEventCollector::continueSnapshot(size_t maxEvents) {
+  // records may be split across reads, keep the remainder around
+  constexpr size_t kRecordSize = sizeof(bpf::tcp_event_t);
+  size_t events = 0;
+  bool done = false;
+  while (events < maxEvents) {
+    const ssize_t n = folly::readNoInt(
+        iterFd_,
+        snapshotBuf_.data() + snapshotUsed_,
+        snapshotBuf_.size() - snapshotUsed_);
+    if (n < 0) {
+      LOG(ERROR) << folly::format(
+          "Error reading BPF iterator: {}", folly::errnoStr(errno));
+      done = true;
+      break;
+    }
+    if (n == 0) {
+      done = true;
+      break;
+    }
+    snapshotUsed_ += n;
+    size_t offset = 0;
+    for (; offset + kRecordSize <= snapshotUsed_; offset += kRecordSize) {
+      const bpf::tcp_event_t* rawEvent =
+          reinterpret_cast<const bpf::tcp_event_t*>(
+              snapshotBuf_.data() + offset);
+      events++;
+      if (not cbHandler_->handleRawTcpEvent(*rawEvent)) {
+        cbHandler_->handleTcpEventView(TcpEventView(*rawEvent));
+      }
+    }
+    std::memmove(
+        snapshotBuf_.data(),
+        snapshotBuf_.data() + offset,
+        snapshotUsed_ - offset);
+    snapshotUsed_ -= offset;
+  }
+  snapshotConnections_ += events;
+  snapshot_events_cnt_ += events;
+  if (not done) {
+    return true;
+  }
+
+  close(iterFd_);
+  iterFd_ = -1;
+  LOG(INFO) << folly::format(
+      "Snapshot of {} tracked connections took {} ms",
+      snapshotConnections_,
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - snapshotStart_)
+          .count());
+  return false;
 }
 
 void
@@ -1,9 +1,13 @@
 #pragma once
 
-#include <bcc/BPF.h>
+#include <src/common/BpfLoader.h>
+#include <src/common/BpfMapSweeper.h>
 #include <src/tcpevents/collector/TcpEvent.h>
+#include <src/tcpevents/collector/TcpEventView.h>
 #include <atomic>
+#include <chrono>
 #include <memory>
+#include <vector>
 
 namespace paths {
 namespace tcpevents {
@@ -12,7 +16,30 @@ class TcpEventCollector {
  public:
   class CallbackHandler {
    public:
-    virtual void handleTcpEvent(std::unique_ptr<TcpEvent> event) = 0;
+    /**
+     * The event goes back to its TcpEventPool once its last handle is
+     * released; keep a copy of the handle to use it past the call.
+     */
+    virtual void handleTcpEvent(TcpEventHandle event) = 0;
+
+    /**
+     * Called with each event as read from the perf buffer (or snapshot
+     * iterator), before it is converted. Return true to consume the event,
+     * in which case no TcpEvent is built and handleTcpEvent is not called.
+     */
+    virtual bool handleRawTcpEvent(const bpf::tcp_event_t& /* event */) {
+      return false;
+    }
+
+    /**
+     * Called with each event not consumed by handleRawTcpEvent. Handlers
+     * that drop events can filter them on the view, and only build the
+     * TcpEvents they keep; by default, every event is built and passed to
+     * handleTcpEvent.
+     */
+    virtual void handleTcpEventView(const TcpEventView& view) {
+      handleTcpEvent(view.toTcpEvent());
+    }
   };
 
   TcpEventCollector(
@@ -30,12 +57,34 @@ class TcpEventCollector {
   void handleLostPerfEvents(const uint64_t lost);
 
  private:
+  /**
+   * Starts a run of the bpf_iter/tcp program, which yields a TCP_SNAPSHOT
+   * event for every tracked connection. Returns false if it cannot.
+   */
+  bool startSnapshot();
+
+  /**
+   * Passes the next snapshot events, at least maxEvents of them unless the
+   * snapshot ends, to the callback handler. Returns false once the snapshot
+   * is complete (or failed).
+   */
+  bool continueSnapshot(size_t maxEvents);
+
   const std::unordered_set<TcpEvent::Type> enabledEvents_;
   const std::shared_ptr<CallbackHandler> cbHandler_;
   std::atomic<bool> running_;
-  ebpf::BPF ebpf_;
+  common::BpfLoader bpf_;
+  std::unique_ptr<common::BpfMapSweeper> sweeper_;
+  int iterLinkFd_;
+  // snapshot in progress: iterator, and records split across reads
+  int iterFd_;
+  std::vector<char> snapshotBuf_;
+  size_t snapshotUsed_;
+  uint64_t snapshotConnections_;
+  std::chrono::steady_clock::time_point snapshotStart_;
   uint64_t events_cnt_;
   uint64_t lost_events_cnt_;
+  uint64_t snapshot_events_cnt_;
 };
 
 } // namespace tcpevents
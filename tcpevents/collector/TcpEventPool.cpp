@@ -0,0 +1,70 @@
+#include "TcpEventPool.h"
+
+namespace paths {
+namespace tcpevents {
+
+TcpEventPool::~TcpEventPool() {
+  deleteSlots(free_);
+  deleteSlots(released_.exchange(nullptr));
+}
+
+TcpEventPool&
+TcpEventPool::getDefault() {
+  // leaked on purpose, see header
+  static auto pool = new TcpEventPool();
+  return *pool;
+}
+
+TcpEventPool::Handle
+TcpEventPool::acquire(const bpf::tcp_event_t& rawEvent) {
+  Slot* slot = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(acquireMutex_);
+    if (free_ == nullptr) {
+      // taking the whole list is safe from ABA, unlike popping one slot
+      free_ = released_.exchange(nullptr, std::memory_order_acquire);
+    }
+    if (free_) {
+      slot = free_;
+      free_ = slot->next;
+    }
+  }
+  if (slot == nullptr) {
+    slot = new Slot();
+    slot->pool = this;
+    allocatedSlots_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  try {
+    new (&slot->storage) TcpEvent(rawEvent);
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(acquireMutex_);
+    slot->next = free_;
+    free_ = slot;
+    throw;
+  }
+  slot->refs.store(1, std::memory_order_relaxed);
+  return Handle(slot);
+}
+
+void
+TcpEventPool::release(Slot* slot) {
+  slot->event()->~TcpEvent();
+  auto head = released_.load(std::memory_order_relaxed);
+  do {
+    slot->next = head;
+  } while (not released_.compare_exchange_weak(
+      head, slot, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void
+TcpEventPool::deleteSlots(Slot* slot) {
+  while (slot) {
+    const auto next = slot->next;
+    delete slot;
+    slot = next;
+  }
+}
+
+} // namespace tcpevents
+} // namespace paths
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <src/tcpevents/collector/TcpEvent.h>
+#include <src/tcpevents/collector/bpf/BpfStructs.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+
+namespace paths {
+namespace tcpevents {
+
+/**
+ * Recycles the storage of TcpEvents, so that building the TcpEvent of every
+ * exported event does not cost a malloc/free pair on the polling thread.
+ *
+ * acquire() builds a TcpEvent in a free slot and returns a Handle to it.
+ * Handles are reference counted and can be copied and released from any
+ * thread (e.g. the export queue threads); the slot goes back to the pool
+ * when the last handle to it is released. The pool only allocates when no
+ * slot is free, so it stops allocating once it holds as many slots as there
+ * are events in flight (bounded by the export queue sizes).
+ *
+ * Released slots are pushed on a lock-free list, which acquire() takes as a
+ * whole when it runs out of free slots.
+ */
+class TcpEventPool {
+ private:
+  struct Slot {
+    std::aligned_storage_t<sizeof(TcpEvent), alignof(TcpEvent)> storage;
+    std::atomic<uint32_t> refs{0};
+    TcpEventPool* pool{nullptr};
+    Slot* next{nullptr};
+
+    TcpEvent* event() {
+      return std::launder(reinterpret_cast<TcpEvent*>(&storage));
+    }
+  };
+
+ public:
+  /**
+   * Shared handle to a TcpEvent of the pool, like a std::shared_ptr but
+   * without a control block to allocate.
+   */
+  class Handle {
+   public:
+    Handle() = default;
+
+    Handle(const Handle& other) : slot_(other.slot_) {
+      if (slot_) {
+        slot_->refs.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+
+    Handle(Handle&& other) noexcept : slot_(other.slot_) {
+      other.slot_ = nullptr;
+    }
+
+    Handle& operator=(const Handle& other) {
+      Handle copy(other);
+      std::swap(slot_, copy.slot_);
+      return *this;
+    }
+
+    Handle& operator=(Handle&& other) noexcept {
+      if (this != &other) {
+        reset();
+        slot_ = other.slot_;
+        other.slot_ = nullptr;
+      }
+      return *this;
+    }
+
+    ~Handle() {
+      reset();
+    }
+
+    /**
+     * Releases the event, returning it to the pool if this was its last
+     * handle.
+     */
+    void reset() {
+      if (slot_ &&
+          slot_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        slot_->pool->release(slot_);
+      }
+      slot_ = nullptr;
+    }
+
+    const TcpEvent* get() const {
+      return slot_ ? slot_->event() : nullptr;
+    }
+
+    const TcpEvent& operator*() const {
+      return *get();
+    }
+
+    const TcpEvent* operator->() const {
+      return get();
+    }
+
+    explicit operator bool() const {
+      return slot_ != nullptr;
+    }
+
+   private:
+    friend class TcpEventPool;
+
+    explicit Handle(Slot* slot) : slot_(slot) {}
+
+    Slot* slot_{nullptr};
+  };
+
+  TcpEventPool() = default;
+
+  /**
+   * Frees the slots of the pool; every handle must have been released.
+   */
+  ~TcpEventPool();
+
+  TcpEventPool(const TcpEventPool&) = delete;
+  TcpEventPool& operator=(const TcpEventPool&) = delete;
+
+  /**
+   * Pool used by TcpEventView::toTcpEvent(). It is never destroyed, so
+   * handles still queued for export may outlive the collector.
+   */
+  static TcpEventPool& getDefault();
+
+  /**
+   * Builds a TcpEvent from rawEvent in a free slot, allocating a slot only
+   * if none is free.
+   */
+  Handle acquire(const bpf::tcp_event_t& rawEvent);
+
+  /**
+   * Number of slots allocated by the pool so far.
+   */
+  size_t getAllocatedSlots() const {
+    return allocatedSlots_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // destroys the event of slot and pushes slot on released_
+  void release(Slot* slot);
+
+  static void deleteSlots(Slot* slot);
+
+  // slots free for acquire()
+  std::mutex acquireMutex_;
+  Slot* free_{nullptr};
+
+  // slots released since acquire() last took them, pushed from any thread
+  std::atomic<Slot*> released_{nullptr};
+
+  std::atomic<size_t> allocatedSlots_{0};
+};
+
+using TcpEventHandle = TcpEventPool::Handle;
+
+} // namespace tcpevents
+} // namespace paths
@@ -0,0 +1,227 @@
+/**
+ * Cost of building the TcpEvent of an exported event and handing it to an
+ * export queue, whose thread releases it.
+ *
+ * makeUniqueEvent reproduces the handlers before TcpEventPool (a
+ * std::make_unique per event, then a std::shared_ptr for the export
+ * queues); pooledEvent builds the events in a TcpEventPool. After the
+ * benchmarks, the heap allocations per event of both paths are printed for
+ * --alloc_events events, once the pool has warmed up.
+ *
+ * legacyJsonFormat reproduces TcpEventJsonExporter before JsonRowEncoder
+ * (an nlohmann::json object built from getFieldMap() and dumped);
+ * encoderJsonFormat is TcpEventJsonExporter::format. Run with e.g.:
+ *   buck run //src/tcpevents/collector:TcpEventPoolBenchmark -- \
+ *       --bm_min_usec=1000000
+ */
+#include <src/common/AsyncEventQueue.h>
+#include <src/tcpevents/collector/TcpEventPool.h>
+#include <src/tcpevents/handlers/TcpEventJsonExporter.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+
+#include <folly/Benchmark.h>
+#include <folly/Format.h>
+#include <folly/init/Init.h>
+#include <gflags/gflags.h>
+#include <nlohmann/json.hpp>
+
+DEFINE_uint64(
+    alloc_events,
+    1000000,
+    "Events pushed through each path when counting heap allocations");
+
+namespace {
+
+// heap allocations made by any thread
+std::atomic<uint64_t> allocations{0};
+
+} // namespace
+
+void*
+operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void*
+operator new[](size_t size) {
+  return operator new(size);
+}
+
+void
+operator delete(void* p) noexcept {
+  free(p);
+}
+
+void
+operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void
+operator delete(void* p, size_t /* size */) noexcept {
+  free(p);
+}
+
+void
+operator delete[](void* p, size_t /* size */) noexcept {
+  free(p);
+}
+
+using namespace paths;
+using namespace paths::tcpevents;
+
+namespace {
+
+constexpr size_t kQueueCapacity = 4096;
+
+bpf::tcp_event_t
+makeEvent() {
+  bpf::tcp_event_t ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.header.type = TcpEvent::Type::TCP_SNAPSHOT;
+  ev.header.ev_tstamp_ns = 1571234567890123456ULL;
+  ev.header.conn_tstamp_ns = 1571234560000000000ULL;
+  ev.header.src.sin6.sin6_family = AF_INET6;
+  ev.header.src.sin6.sin6_port = htons(443);
+  inet_pton(AF_INET6, "2001:db8::10", &ev.header.src.sin6.sin6_addr);
+  ev.header.dst.sin6.sin6_family = AF_INET6;
+  ev.header.dst.sin6.sin6_port = htons(51234);
+  inet_pton(AF_INET6, "::ffff:10.1.2.3", &ev.header.dst.sin6.sin6_addr);
+  ev.stats.srtt_us = 35211;
+  ev.stats.mdev_us = 1203;
+  ev.stats.min_rtt_us = 30111;
+  ev.stats.snd_cwnd = 212;
+  ev.stats.segs_in = 5123;
+  ev.stats.segs_out = 87312;
+  return ev;
+}
+
+const bpf::tcp_event_t kRawEvent = makeEvent();
+
+template <typename Event>
+std::unique_ptr<common::AsyncEventQueue<Event>>
+makeQueue() {
+  typename common::AsyncEventQueue<Event>::Options options;
+  options.name = "bm_export";
+  options.capacity = kQueueCapacity;
+  options.statsInterval = std::chrono::seconds(0);
+  // stands in for an exporter, reading the event before releasing it
+  auto queue = std::make_unique<common::AsyncEventQueue<Event>>(
+      options, [](Event& event) {
+        folly::doNotOptimizeAway(event->rawStats);
+        event = Event();
+      });
+  queue->start();
+  return queue;
+}
+
+std::shared_ptr<const TcpEvent>
+buildUniqueEvent() {
+  return std::shared_ptr<const TcpEvent>(
+      std::make_unique<TcpEvent>(kRawEvent));
+}
+
+TcpEventHandle
+buildPooledEvent(TcpEventPool& pool) {
+  return pool.acquire(kRawEvent);
+}
+
+template <typename Event, typename MakeEvent>
+void
+runPath(size_t iters, MakeEvent makeEvent) {
+  std::unique_ptr<common::AsyncEventQueue<Event>> queue;
+  BENCHMARK_SUSPEND {
+    queue = makeQueue<Event>();
+  }
+  for (size_t i = 0; i < iters; i++) {
+    queue->push(makeEvent());
+  }
+  // includes the release of the events still queued
+  queue.reset();
+}
+
+// heap allocations per event over --alloc_events events, after as many
+// events to warm up
+template <typename Event, typename MakeEvent>
+double
+allocationsPerEvent(MakeEvent makeEvent) {
+  auto queue = makeQueue<Event>();
+  for (uint64_t i = 0; i < FLAGS_alloc_events; i++) {
+    queue->push(makeEvent());
+  }
+  const auto before = allocations.load();
+  for (uint64_t i = 0; i < FLAGS_alloc_events; i++) {
+    queue->push(makeEvent());
+  }
+  const auto after = allocations.load();
+  queue.reset();
+  return double(after - before) / FLAGS_alloc_events;
+}
+
+} // namespace
+
+BENCHMARK(makeUniqueEvent, iters) {
+  runPath<std::shared_ptr<const TcpEvent>>(iters, buildUniqueEvent);
+}
+
+BENCHMARK_RELATIVE(pooledEvent, iters) {
+  TcpEventPool pool;
+  runPath<TcpEventHandle>(iters, [&pool] { return buildPooledEvent(pool); });
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(legacyJsonFormat, iters) {
+  std::unique_ptr<TcpEvent> event;
+  BENCHMARK_SUSPEND {
+    event = std::make_unique<TcpEvent>(kRawEvent);
+  }
+  for (size_t i = 0; i < iters; i++) {
+    folly::doNotOptimizeAway(nlohmann::json(event->getFieldMap()).dump());
+  }
+}
+
+BENCHMARK_RELATIVE(encoderJsonFormat, iters) {
+  std::unique_ptr<TcpEvent> event;
+  std::unique_ptr<TcpEventJsonExporter> exporter;
+  BENCHMARK_SUSPEND {
+    event = std::make_unique<TcpEvent>(kRawEvent);
+    exporter = std::make_unique<TcpEventJsonExporter>();
+  }
+  for (size_t i = 0; i < iters; i++) {
+    folly::doNotOptimizeAway(exporter->format(*event));
+  }
+}
+
+int
+main(int argc, char* argv[]) {
+  folly::init(&argc, &argv);
+  folly::runBenchmarks();
+
+  const auto uniqueAllocations =
+      allocationsPerEvent<std::shared_ptr<const TcpEvent>>(buildUniqueEvent);
+  TcpEventPool pool;
+  const auto pooledAllocations = allocationsPerEvent<TcpEventHandle>(
+      [&pool] { return buildPooledEvent(pool); });
+  std::cout << folly::format(
+                   "makeUniqueEvent: {:.4f} allocations/event\n"
+                   "pooledEvent: {:.4f} allocations/event "
+                   "({} slots allocated by the pool)",
+                   uniqueAllocations,
+                   pooledAllocations,
+                   pool.getAllocatedSlots())
+            << std::endl;
+  return 0;
+}
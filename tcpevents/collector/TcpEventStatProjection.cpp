@@ -0,0 +1,22 @@
+#include "TcpEventStatProjection.h"
+
+#include <folly/Format.h>
+#include <glog/logging.h>
+
+namespace paths {
+namespace tcpevents {
+
+TcpEventStatProjection::TcpEventStatProjection(
+    const std::vector<std::string>& statNames) {
+  entries_.reserve(statNames.size());
+  for (const auto& statName : statNames) {
+    const auto field = TcpEvent::getField(statName);
+    CHECK(field && field->group == TcpEvent::Field::Group::STAT)
+        << folly::sformat("Unknown TcpEvent stat {}", statName);
+    entries_.push_back(
+        Entry{field->name, field->statOffset, field->statWidth, field->type});
+  }
+}
+
+} // namespace tcpevents
+} // namespace paths
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <src/tcpevents/collector/TcpEvent.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace paths {
+namespace tcpevents {
+
+/**
+ * The stats selected for export (e.g., by --stats_to_print), resolved once
+ * to their location in tcp_event_stats_t.
+ *
+ * Reading the selected stats of an event is then a loop over a flat table of
+ * (offset, width, type) entries: no name lookups, no per-stat calls and no
+ * work for the stats that are not selected.
+ */
+class TcpEventStatProjection {
+ public:
+  struct Entry {
+    const char* name;
+    uint16_t offset;
+    uint8_t width;
+    TcpEvent::FieldValue::Type type;
+  };
+
+  /**
+   * Resolves stat names, in the given order. Fails hard on unknown names;
+   * validate them first (TcpEventExporter::getStatFieldsToExport).
+   */
+  explicit TcpEventStatProjection(const std::vector<std::string>& statNames);
+
+  const std::vector<Entry>& getEntries() const {
+    return entries_;
+  }
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+  /**
+   * Reads the stat of entry from stats.
+   */
+  static TcpEvent::FieldValue read(
+      const Entry& entry,
+      const bpf::tcp_event_stats_t& stats) {
+    const auto ptr = reinterpret_cast<const char*>(&stats) + entry.offset;
+    switch (entry.width) {
+    case 1:
+      return load<uint8_t, int8_t>(ptr, entry.type);
+    case 2:
+      return load<uint16_t, int16_t>(ptr, entry.type);
+    case 4:
+      return load<uint32_t, int32_t>(ptr, entry.type);
+    default:
+      return load<uint64_t, int64_t>(ptr, entry.type);
+    }
+  }
+
+  /**
+   * Calls f(entry, value) for each selected stat of the event, in order.
+   */
+  template <typename F>
+  void forEach(const TcpEvent& event, F&& f) const {
+    for (const auto& entry : entries_) {
+      f(entry, read(entry, event.rawStats));
+    }
+  }
+
+ private:
+  template <typename U, typename S>
+  static TcpEvent::FieldValue load(
+      const char* ptr,
+      TcpEvent::FieldValue::Type type) {
+    U value;
+    memcpy(&value, ptr, sizeof(value));
+    switch (type) {
+    case TcpEvent::FieldValue::Type::INT:
+      return TcpEvent::FieldValue::of(static_cast<S>(value));
+    case TcpEvent::FieldValue::Type::BOOL:
+      return TcpEvent::FieldValue::of(static_cast<bool>(value));
+    default:
+      return TcpEvent::FieldValue::of(value);
+    }
+  }
+
+  std::vector<Entry> entries_;
+};
+
+} // namespace tcpevents
+} // namespace paths
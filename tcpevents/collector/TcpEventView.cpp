@@ -0,0 +1,31 @@
+#include "TcpEventView.h"
+
+#include <sys/socket.h>
+
+namespace paths {
+namespace tcpevents {
+
+namespace {
+
+folly::SocketAddress
+toSocketAddress(const bpf::endpoint_t& endpoint) {
+  folly::SocketAddress socketAddress;
+  socketAddress.setFromSockaddr((struct sockaddr*)&endpoint);
+  socketAddress.tryConvertToIPv4();
+  return socketAddress;
+}
+
+} // namespace
+
+folly::SocketAddress
+TcpEventView::getSrc() const {
+  return toSocketAddress(raw_.header.src);
+}
+
+folly::SocketAddress
+TcpEventView::getDst() const {
+  return toSocketAddress(raw_.header.dst);
+}
+
+} // namespace tcpevents
+} // namespace paths
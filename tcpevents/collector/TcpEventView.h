@@ -0,0 +1,89 @@
+#pragma once
+
+#include <folly/IPAddress.h>
+#include <folly/SocketAddress.h>
+#include <src/common/PrefixMatcher.h>
+#include <src/tcpevents/collector/TcpEvent.h>
+#include <src/tcpevents/collector/TcpEventPool.h>
+#include <src/tcpevents/collector/bpf/BpfStructs.h>
+#include <chrono>
+
+namespace paths {
+namespace tcpevents {
+
+/**
+ * Read-only view of a raw tcp_event_t, valid as long as the record it wraps
+ * (the perf buffer or snapshot record the event is handled from).
+ *
+ * Building a TcpEvent copies the whole tcp_event_stats_t and converts both
+ * endpoints to folly::SocketAddress. The view decodes fields only when they
+ * are accessed, so handlers can drop events on their type, state change or
+ * destination and build a TcpEvent (toTcpEvent()) only for the events they
+ * export.
+ */
+class TcpEventView {
+ public:
+  explicit TcpEventView(const bpf::tcp_event_t& rawEvent) : raw_(rawEvent) {}
+
+  const bpf::tcp_event_t& getRawEvent() const {
+    return raw_;
+  }
+
+  TcpEvent::Type getType() const {
+    return raw_.header.type;
+  }
+
+  std::chrono::nanoseconds getEventTs() const {
+    return std::chrono::nanoseconds(raw_.header.ev_tstamp_ns);
+  }
+
+  std::chrono::nanoseconds getConnTs() const {
+    return std::chrono::nanoseconds(raw_.header.conn_tstamp_ns);
+  }
+
+  const bpf::tcp_event_details_t& getDetails() const {
+    return raw_.details;
+  }
+
+  const bpf::tcp_event_stats_t& getRawStats() const {
+    return raw_.stats;
+  }
+
+  InetSockState getSockState() const {
+    return raw_.states.skt_state;
+  }
+
+  TcpCaState getTcpCaState() const {
+    return raw_.states.ca_state;
+  }
+
+  /**
+   * Decodes an endpoint as TcpEvent does (IPv4-mapped addresses as IPv4).
+   */
+  folly::SocketAddress getSrc() const;
+
+  folly::SocketAddress getDst() const;
+
+  /**
+   * Whether the destination address is one of clients, matched on the raw
+   * endpoint without decoding it.
+   */
+  bool isDstIn(const common::PrefixMatcher& clients) const {
+    return clients.match(
+        reinterpret_cast<const struct sockaddr*>(&raw_.header.dst));
+  }
+
+  /**
+   * Decodes the whole event, in a TcpEvent recycled by pool.
+   */
+  TcpEventHandle toTcpEvent(
+      TcpEventPool& pool = TcpEventPool::getDefault()) const {
+    return pool.acquire(raw_);
+  }
+
+ private:
+  const bpf::tcp_event_t& raw_;
+};
+
+} // namespace tcpevents
+} // namespace paths
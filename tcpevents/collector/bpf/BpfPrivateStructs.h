@@ -38,6 +38,10 @@ struct loss_track_state {
 
 struct connection_stats {
   u64 start_us;             // connection start time
+  u64 seen_us;              // last time the tcp iterator saw the socket, 0
+                            // if never; start_us and seen_us must remain the
+                            // first members, they are read by the userspace
+                            // map sweeper
   u32 minrtt_on_establish;  // minrtt observed on connection establishment
   u8 cc_algo;               // caching information from the tsk
   struct {
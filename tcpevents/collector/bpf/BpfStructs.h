@@ -22,6 +22,7 @@ FATAL_RICH_ENUM_CLASS(
   TCP_CA_EVENT,
   TCP_RATE_CHECK_APP_LIMITED,
   TCP_RATE_CHECK_APP_LIMITED_RET,
+  TCP_SNAPSHOT,
 #ifndef __cplusplus
 };
 #else
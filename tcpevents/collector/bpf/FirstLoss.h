@@ -0,0 +1,271 @@
+#pragma once
+
+/* Congestion-avoidance state and first-loss tracking of a connection,
+ * shared by the tcpevents program and the tcp module of pathsd. Driven by
+ * on_tcp_set_ca_state: count_ca_state_changes() and track_losses() are
+ * called on every CA state transition, before the kernel applies it.
+ *
+ * Needs BpfPrivateStructs.h, MAX_TRACKED_PACKET and the INCMAX macro of the
+ * including program. */
+
+static u8 get_ca_state(struct inet_connection_sock* icsk) {
+  u8* bitset_ptr = ((u8*)(&icsk->icsk_retransmits)) - 1;
+  u8 bitset;
+  bpf_probe_read(&bitset, sizeof(bitset), (void*)bitset_ptr);
+  return bitset & 0x3F;
+}
+
+static uint8_t
+get_cc_algo(struct connection_stats *cs, struct sock *sk) {
+  if(cs->cc_algo == TCP_CA_NAME_UNSET) {
+    char cmp[TCP_CA_NAME_MAX+1];
+    struct inet_connection_sock* icsk = inet_csk(sk);
+    bpf_probe_read_str(cmp, sizeof(cmp), &icsk->icsk_ca_ops->name);
+    char cubic[] = "cubic";
+    char bbr[] = "bbr";
+    int i = 0;
+    for(; i < 5 && cubic[i] == cmp[i]; i++);
+    if(i == 5) {
+      cs->cc_algo = TCP_CA_NAME_CUBIC;
+    } else {
+      for(i = 0; i < 3 && bbr[i] == cmp[i]; i++);
+      if(i == 3) {
+        cs->cc_algo = TCP_CA_NAME_BBR;
+      } else {
+        cs->cc_algo = TCP_CA_NAME_UNKNOWN;
+      }
+    }
+  }
+  return cs->cc_algo;
+}
+
+static void
+count_ca_state_changes(struct connection_stats *cs,
+    struct sock *sk,
+    u8 old_state,
+    u8 new_state) {
+  INCMAX(cs->ca_state_changes.count, UINT16_MAX);
+  switch (new_state) {
+    case TCP_CA_Open:
+    case TCP_CA_Disorder:
+      INCMAX(cs->ca_state_changes.tcp_ca_open_disorder, UINT16_MAX);
+    break;
+    case TCP_CA_CWR:
+      INCMAX(cs->ca_state_changes.tcp_ca_cwr, UINT16_MAX);
+    break;
+    case TCP_CA_Recovery:
+      INCMAX(cs->ca_state_changes.tcp_ca_recovery, UINT16_MAX);
+    break;
+    case TCP_CA_Loss:
+      INCMAX(cs->ca_state_changes.tcp_ca_loss, UINT16_MAX);
+    break;
+  }
+}
+
+static void
+lts_set_loss(struct loss_track_state *lts, u8 reason) {
+  if(!lts->first_loss_reason) {
+    INCMAX(lts->stats.set_loss_count, UINT8_MAX);
+    lts->first_lost_packet = lts->enter.first_lost_packet;
+    lts->first_loss_reason = reason;
+  }
+}
+
+static void
+lts_reset(struct loss_track_state *lts) {
+  lts->enter.snd_nxt = 0;
+  lts->enter.snd_una = 0;
+  lts->enter.prior_ssthresh = 0;
+  lts->enter.first_lost_packet = 0;
+}
+
+static void
+lts_undo(struct loss_track_state *lts) {
+  INCMAX(lts->stats.undo_count, UINT8_MAX);
+  lts_reset(lts);
+  lts->first_lost_packet = 0;
+  lts->first_loss_reason = 0;
+}
+
+static void
+lts_save(struct loss_track_state *lts, struct sock *sk) {
+  struct tcp_sock* tsk = tcp_sk(sk);
+  u32 fstloss = tsk->delivered - tsk->sacked_out;
+  if(fstloss > UINT16_MAX) { fstloss = UINT16_MAX; }
+  lts->enter.snd_nxt = tsk->snd_nxt;
+  lts->enter.snd_una = tsk->snd_una;
+  lts->enter.prior_ssthresh = tsk->prior_ssthresh;
+  lts->enter.first_lost_packet = fstloss;
+}
+
+static void
+lts_set_error(struct loss_track_state *lts, u8 reason) {
+  lts_reset(lts);
+  lts->error = reason;
+}
+
+static void
+lts_handle_open(struct connection_stats *cs,
+    struct loss_track_state *lts,
+    struct sock *sk,
+    u8 old_state,
+    u8 new_state) {
+  if(old_state <= TCP_CA_Disorder) {
+    /* Nothing to do unless recovering from loss. */
+    INCMAX(lts->stats.transitions_open_to_open, UINT8_MAX);
+    lts_reset(lts);
+    return;
+  }
+
+  if(lts->enter.prior_ssthresh == 0) {
+    // This "loss" event was due to MTU probing, ignoring.
+    INCMAX(lts->stats.undone_mtu_probing, UINT8_MAX);
+    lts_reset(lts);
+    return;
+  }
+
+  struct tcp_sock* tsk = tcp_sk(sk);
+  if(lts->enter.snd_nxt != tsk->high_seq) {
+    /* This check prevents us from confusing multiple CA_Loss events
+     * (e.g., when we get Open->Loss, miss Loss->Open, miss Open->Loss,
+     * and get Loss->Open). In this case we missed track of the first
+     * loss and ignore the connection. However, this is a conservative:
+     * The kernel updates tsk->high_seq every time it enters CA_Loss and
+     * whenever F-RTO/SACKs identify spurious retransmissions:
+     * enter_snd_next may be different from tsk->high_seq even if we are
+     * still in the same loss event.
+     * https://github.com/torvalds/linux/blob/v5.4/net/ipv4/tcp_input.c#L2687
+     */
+    lts_set_error(lts, LTS_ERR_WRONG_HIGH_SEQ);
+    return;
+  }
+
+  if((old_state == TCP_CA_Recovery || old_state == TCP_CA_Loss)
+      && tsk->undo_marker == 0) {
+    /* We're coming in from a loss state without error and all
+     * retransmissions were undone. Condition ensures we do not enter
+     * here if coming from CWR. */
+    INCMAX(lts->stats.undone_undo_marker, UINT8_MAX);
+    lts_reset(lts);
+    return;
+  }
+
+  if(get_cc_algo(cs, sk) == TCP_CA_NAME_CUBIC
+      && tsk->snd_ssthresh == TCP_INFINITE_SSTHRESH) {
+    /* Return early, as there is no loss; lts->first_loss_reason must have
+     * been reset in track_losses() already. */
+    if(lts->first_loss_reason) {
+      lts_set_error(lts, LTS_ERR_LOSS_WITH_INFINTE_SSTHRESH);
+      return;
+    }
+    lts_reset(lts);
+    return;
+  }
+
+  lts_set_loss(lts, LTS_REASON_NORMAL_RECOVERY);
+  lts_reset(lts);
+}
+
+static void
+track_losses(struct connection_stats *cs,
+    struct loss_track_state *lts,
+    struct sock *sk,
+    u8 old_state,
+    u8 new_state) {
+  if(lts->error) {
+    return;
+  }
+  struct tcp_sock* tsk = tcp_sk(sk);
+  struct inet_connection_sock* icsk = inet_csk(sk);
+  if(tsk->delivered - tsk->sacked_out > MAX_TRACKED_PACKET &&
+      lts->enter.first_lost_packet == 0) {
+    /* Stop tracking if we're past MAX_TRACKED_PACKET and not already
+     * tracking any loss. This requires we call lts_reset() whenever we
+     * stop tracking a loss episode. */
+    lts->done = 1;
+  }
+  if(lts->done) {
+    /* Nothing to do after we're done with tracking the first loss. */
+    INCMAX(lts->stats.transitions_after_done, UINT8_MAX);
+    return;
+  }
+  if(old_state != lts->old_state) {
+    lts_set_error(lts, LTS_ERR_MISSED_TRANSITION);
+    return;
+  }
+  lts->old_state = new_state;
+
+  if(get_cc_algo(cs, sk) == TCP_CA_NAME_CUBIC
+      && tsk->snd_ssthresh == TCP_INFINITE_SSTHRESH
+      && lts->first_loss_reason) {
+    /* We had confirmed loss, but it has been undone. As this check is
+     * after the lts->done check, we may fail to check for undos that
+     * happen after we transition to open (undos that happen before or
+     * on the transition to CA_Open never call lts_set_loss() and are
+     * not a problem). We can quantify the frequency of these "undos
+     * after CA_Open" events by checking the value of this counter. */
+    INCMAX(lts->stats.undone_ssthresh_infinite, UINT8_MAX);
+    lts_undo(lts);
+  }
+
+  switch(new_state) {
+  case TCP_CA_Open:
+  case TCP_CA_Disorder:
+    lts_handle_open(cs, lts, sk, old_state, new_state);
+    break;
+  case TCP_CA_CWR:
+    // This is a TLP-confirmed loss.  The kernel switches right
+    // back to Open and never undoes TLP-confirmed losses.
+    lts_save(lts, sk);
+    lts_set_loss(lts, LTS_REASON_TLP_CONFIRMED);
+    break;
+  case TCP_CA_Recovery:
+    if(old_state == TCP_CA_Recovery) {
+      // We think transitions from recovery to recovery should not happen.
+      lts_set_error(lts, LTS_ERR_RECOVERY_TO_RECOVERY);
+      return;
+    }
+    if(tsk->prior_ssthresh == 0) {
+      // we use prior_sshthresh == 0 to identify losses due to MTU
+      // probing. however, tcp_enter_recovery() also sets
+      // prior_sshthresh = 0, and then proceeds to set it back to
+      // current_sshthresh() whenever we're not already in CWR. It seems
+      // we should rarely be in CWR when calling tcp_enter_recovery(),
+      // as there are no recovery-to-recovery transitions.
+      // https://github.com/torvalds/linux/blob/v5.4/net/ipv4/tcp_input.c#L2651
+      lts_set_error(lts, LTS_ERR_PRIOR_SSHTHRESH_ZERO_IN_RECOVERY);
+      return;
+    }
+    // FALLTHROUGH
+  case TCP_CA_Loss:
+    /* If old_state == TCP_CA_Recovery || TCP_CA_Loss, we are reentering
+     * the loss event (e.g., RTO of a retransmitted packet). Cannot
+     * overwrite state, need to keep track of the first packet that put
+     * it in Recovery or Loss. */
+    if(old_state == TCP_CA_Recovery) {
+      /* old_state == TCP_CA_Recovery does NOT fall through from above */
+      INCMAX(lts->stats.transitions_recovery_to_loss, UINT8_MAX);
+      if(tsk->snd_una != lts->enter.snd_una ||
+        tsk->snd_nxt != lts->enter.snd_nxt) {
+        INCMAX(lts->stats.recovery_to_loss_with_partial_acks, UINT8_MAX);
+      }
+    } else if(old_state == TCP_CA_Loss) {
+      INCMAX(lts->stats.transitions_loss_to_loss, UINT8_MAX);
+      if(tsk->snd_una != lts->enter.snd_una ||
+          tsk->snd_nxt != lts->enter.snd_nxt) {
+        /* We are re-entering loss, but the window has moved since we
+         * saved the loss state. Some of the packets assumed lost were
+         * received, but the connection cannot yet move into CA_Open
+         * because some packets are still lost. Here we conservatively
+         * charge loss to the first packet we observed when we first
+         * transition into loss. */
+        lts_set_loss(lts, LTS_REASON_LOSS_WITH_PARTIAL_ACKS);
+        lts_reset(lts);
+      }
+    } else {
+      /* New loss event, save state for tracking. */
+      lts_save(lts, sk);
+    }
+    break;
+  }
+}
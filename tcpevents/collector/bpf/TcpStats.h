@@ -0,0 +1,188 @@
+#pragma once
+
+/* Per-connection stats of tcpevents: initialized when a connection is
+ * established, and exported as a tcp_event_t when it closes (and in
+ * snapshots). Shared by the tcpevents program and the tcp module of pathsd.
+ *
+ * Needs BpfStructs.h, BpfPrivateStructs.h and the _ and _minmax_get macros
+ * of the including program. */
+
+#include "FirstLoss.h"
+
+static void
+connection_stats_init(struct connection_stats *cs, struct sock* sk) {
+  struct tcp_sock* tsk = tcp_sk(sk);
+  cs->start_us = bpf_ktime_get_ns() / 1000;
+  _minmax_get(cs->minrtt_on_establish, tsk->rtt_min);
+  cs->cc_algo = TCP_CA_NAME_UNSET;  /* unnecessary, but being explicit */
+}
+
+/* Fills the header, states and stats of event from the socket and its
+ * tracked connection_stats. Returns -1 if the socket family is not
+ * supported. */
+static int
+fill_stats_event(struct sock* sk,
+    struct connection_stats *cs,
+    struct tcp_event_t* event) {
+  struct tcp_sock* tsk = tcp_sk(sk);
+  struct inet_sock* inet = inet_sk(sk);
+  struct inet_connection_sock* icsk = inet_csk(sk);
+
+  // header
+  event->header.ev_tstamp_ns = bpf_ktime_get_ns();
+  event->header.conn_tstamp_ns = tsk->cd_init_clock_ns;
+
+  {
+    struct sockaddr* src = (struct sockaddr*)&event->header.src;
+    struct sockaddr* dst = (struct sockaddr*)&event->header.dst;
+    _(src->sa_family, sk->sk_family);
+    _(dst->sa_family, sk->sk_family);
+  }
+
+  if (sk->sk_family == AF_INET) {
+    struct sockaddr_in* src = (struct sockaddr_in*)&event->header.src;
+    struct sockaddr_in* dst = (struct sockaddr_in*)&event->header.dst;
+    _(src->sin_port, inet->inet_sport);
+    _(dst->sin_port, inet->inet_dport);
+    _(src->sin_addr, inet->inet_saddr);
+    _(dst->sin_addr, inet->inet_daddr);
+  } else if (sk->sk_family == AF_INET6) {
+    struct sockaddr_in6* src = (struct sockaddr_in6*)&event->header.src;
+    struct sockaddr_in6* dst = (struct sockaddr_in6*)&event->header.dst;
+    _(src->sin6_port, inet->inet_sport);
+    _(dst->sin6_port, inet->inet_dport);
+    _(src->sin6_addr, sk->sk_v6_rcv_saddr);
+    _(dst->sin6_addr, sk->sk_v6_daddr);
+  } else {
+    return -1;
+  }
+
+  // state info
+  _(event->states.skt_state, sk->sk_state);
+  event->states.ca_state = get_ca_state(icsk);
+
+  // stats
+
+  //////////////////////////////////////////////////
+  // from struct tcp_sock
+  // see include/linux/tcp.h
+  //////////////////////////////////////////////////
+  _(event->stats.srtt_us, tsk->srtt_us);
+  event->stats.srtt_us = event->stats.srtt_us >> 3;
+  _(event->stats.mdev_us, tsk->mdev_us);
+  event->stats.mdev_us >>= 2;
+  _(event->stats.rttvar_us, tsk->rttvar_us);
+  event->stats.rttvar_us >>= 2;
+
+  _minmax_get(event->stats.min_rtt_us, tsk->rtt_min);
+  event->stats.min_rtt_us_on_establish = cs->minrtt_on_establish;
+
+  _(event->stats.snd_ssthresh, tsk->snd_ssthresh);
+  _(event->stats.snd_cwnd, tsk->snd_cwnd);
+
+  _(event->stats.segs_in, tsk->segs_in);
+  _(event->stats.segs_out, tsk->segs_out);
+  _(event->stats.data_segs_in, tsk->data_segs_in);
+  _(event->stats.data_segs_out, tsk->data_segs_out);
+  _(event->stats.total_retrans, tsk->total_retrans);
+
+  _(event->stats.bytes_received, tsk->bytes_received);
+  _(event->stats.bytes_acked, tsk->bytes_acked);
+  _(event->stats.bytes_retrans, tsk->bytes_retrans);
+
+  _(event->stats.delivered, tsk->delivered);
+  _(event->stats.delivered_ce, tsk->delivered_ce);
+  _(event->stats.first_tx_mstamp, tsk->first_tx_mstamp);
+  _(event->stats.delivered_mstamp, tsk->delivered_mstamp);
+
+  _(event->stats.mss_cache, tsk->mss_cache);
+
+  _(event->stats.lost, tsk->lost);
+
+  {
+    // TODO: Improve to handle all chrono types and account for chrono_start
+    uint32_t chrono_stats[__TCP_CHRONO_MAX];
+    _(chrono_stats, tsk->chrono_stat);
+
+    event->stats.chrono_busy = chrono_stats[TCP_CHRONO_BUSY - 1];
+    event->stats.chrono_rwnd_limited =
+        chrono_stats[TCP_CHRONO_RWND_LIMITED - 1];
+    event->stats.chrono_sndbuf_limited =
+        chrono_stats[TCP_CHRONO_SNDBUF_LIMITED - 1];
+
+    event->stats.chrono_busy *= USEC_PER_SEC / HZ;
+    event->stats.chrono_rwnd_limited *= USEC_PER_SEC / HZ;
+    event->stats.chrono_sndbuf_limited *= USEC_PER_SEC / HZ;
+  }
+
+  //////////////////////////////////////////////////
+  // from struct sock
+  // see include/net/sock.h
+  //////////////////////////////////////////////////
+  _(event->stats.pacing_status, sk->sk_pacing_status);
+  _(event->stats.pacing_rate, sk->sk_pacing_rate);
+  _(event->stats.max_pacing_rate, sk->sk_max_pacing_rate);
+
+  _(event->stats.sndbuf, sk->sk_sndbuf);
+  _(event->stats.rcvbuf, sk->sk_rcvbuf);
+
+  _(event->stats.sk_shutdown, sk->sk_shutdown);
+  _(event->stats.sk_err, sk->sk_err);
+  _(event->stats.sk_err_soft, sk->sk_err_soft);
+
+  //////////////////////////////////////////////////
+  // from inet_connection_sock
+  // see include/net/inet_connection_sock.h
+  //////////////////////////////////////////////////
+  _(event->stats.rto, icsk->icsk_rto);
+
+  // custom tracking of socket start time and throughput
+  {
+    u64 tstamp_us = bpf_ktime_get_ns() / 1000;
+    u64 duration = (tstamp_us > cs->start_us) ? (tstamp_us - cs->start_us) : 1;
+    event->stats.start_us = cs->start_us;
+    event->stats.bytes_per_ns = 1000 * event->stats.bytes_acked / duration;
+  }
+
+  // loss_track_state
+  {
+    struct loss_track_state *lts = &(cs->loss_track_state);
+    event->stats.cc_algo = cs->cc_algo;
+    event->stats.fstloss_tracked = 1;
+    event->stats.fstloss_packet = lts->first_lost_packet;
+    event->stats.fstloss_reason = lts->first_loss_reason;
+    event->stats.fstloss_error = lts->error;
+    event->stats.fstloss_done = lts->done;
+    event->stats.fstloss_stats_set_loss_count = lts->stats.set_loss_count;
+    event->stats.fstloss_stats_undo_count = lts->stats.undo_count;
+    event->stats.fstloss_stats_undone_undo_marker =
+        lts->stats.undone_undo_marker;
+    event->stats.fstloss_stats_undone_mtu_probing =
+        lts->stats.undone_mtu_probing;
+    event->stats.fstloss_stats_undone_ssthresh_infinite =
+        lts->stats.undone_ssthresh_infinite;
+    event->stats.fstloss_stats_transitions_loss_to_loss =
+        lts->stats.transitions_loss_to_loss;
+    event->stats.fstloss_stats_transitions_open_to_open =
+        lts->stats.transitions_open_to_open;
+    event->stats.fstloss_stats_transitions_recovery_to_loss =
+        lts->stats.transitions_recovery_to_loss;
+    event->stats.fstloss_stats_transitions_after_done =
+        lts->stats.transitions_after_done;
+    event->stats.fstloss_stats_recovery_to_loss_with_partial_acks =
+        lts->stats.recovery_to_loss_with_partial_acks;
+  }
+
+  // ca_state_changes
+  {
+    event->stats.ca_state_changes_count = cs->ca_state_changes.count;
+    event->stats.ca_state_changes_open_disorder =
+        cs->ca_state_changes.tcp_ca_open_disorder;
+    event->stats.ca_state_changes_cwr = cs->ca_state_changes.tcp_ca_cwr;
+    event->stats.ca_state_changes_recovery =
+        cs->ca_state_changes.tcp_ca_recovery;
+    event->stats.ca_state_changes_loss = cs->ca_state_changes.tcp_ca_loss;
+  }
+
+  return 0;
+}
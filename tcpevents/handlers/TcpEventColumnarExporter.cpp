@@ -0,0 +1,57 @@
+#include "TcpEventColumnarExporter.h"
+
+#include <glog/logging.h>
+
+namespace paths {
+namespace tcpevents {
+
+TcpEventColumnarExporter::TcpEventColumnarExporter(
+    std::unique_ptr<common::BufferedWriter> writer,
+    const folly::Optional<std::unordered_set<std::string>>&
+        statFieldsToExportOpt)
+    : TcpEventExporter(std::move(writer), statFieldsToExportOpt),
+      columnar_(common::ColumnarWriter::createFromFlags(
+          *writer_,
+          "tcpevents",
+          getColumnsToExport())) {}
+
+TcpEventColumnarExporter::TcpEventColumnarExporter(
+    const folly::Optional<std::unordered_set<std::string>>&
+        statFieldsToExportOpt)
+    : TcpEventColumnarExporter(
+          common::BufferedWriter::createFromFlags(folly::none),
+          statFieldsToExportOpt) {}
+
+std::string
+TcpEventColumnarExporter::format(const TcpEvent& /* event */) const {
+  LOG(FATAL) << "Columnar output cannot be formatted line by line";
+  return "";
+}
+
+void
+TcpEventColumnarExporter::write(const TcpEvent& event) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  columnar_->beginRow();
+  for (const auto field : fieldSchemasToExport_) {
+    field->get(event).encode(*columnar_);
+  }
+  statsToExport_.forEach(event, [this](const auto& /* entry */, const auto& v) {
+    v.encode(*columnar_);
+  });
+  columnar_->endRow();
+}
+
+void
+TcpEventColumnarExporter::flush() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  columnar_->flush();
+}
+
+uint64_t
+TcpEventColumnarExporter::getBytesWritten() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return columnar_->getBytesWritten();
+}
+
+} // namespace tcpevents
+} // namespace paths
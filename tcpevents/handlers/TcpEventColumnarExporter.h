@@ -0,0 +1,55 @@
+#pragma once
+
+#include <src/common/ColumnarFile.h>
+#include <src/tcpevents/handlers/TcpEventExporter.h>
+#include <mutex>
+
+namespace paths {
+namespace tcpevents {
+
+/**
+ * Exporter for dumping TcpEvents to a columnar file (see
+ * common::ColumnarWriter), with one column per exported field.
+ *
+ * The schema comes from the field schema of TcpEvent: integer fields are
+ * stored as 64-bit integers, enum names and addresses as strings, and
+ * fields that do not apply to an event are null.
+ */
+class TcpEventColumnarExporter : public TcpEventExporter {
+ public:
+  TcpEventColumnarExporter(
+      std::unique_ptr<common::BufferedWriter> writer,
+      const folly::Optional<std::unordered_set<std::string>>&
+          statFieldsToExportOpt = folly::none);
+
+  TcpEventColumnarExporter(
+      const folly::Optional<std::unordered_set<std::string>>&
+          statFieldsToExportOpt = folly::none);
+
+  /**
+   * Columnar output is not line oriented; fails hard.
+   */
+  std::string format(const TcpEvent& event) const override;
+
+  /**
+   * Adds the event to the open record batch.
+   */
+  void write(const TcpEvent& event) const override;
+
+  /**
+   * Writes the open record batch.
+   */
+  void flush() const;
+
+  /**
+   * Bytes of record batches written so far.
+   */
+  uint64_t getBytesWritten() const;
+
+ private:
+  mutable std::mutex mutex_;
+  const std::unique_ptr<common::ColumnarWriter> columnar_;
+};
+
+} // namespace tcpevents
+} // namespace paths
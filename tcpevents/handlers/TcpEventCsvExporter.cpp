@@ -1,40 +1,78 @@
 #include "TcpEventCsvExporter.h"
 
-#include <folly/MapUtil.h>
 #include <folly/String.h>
 
 namespace paths {
 namespace tcpevents {
 
 TcpEventCsvExporter::TcpEventCsvExporter(
-    folly::Optional<folly::File>&& outputFileOpt,
+    std::unique_ptr<common::BufferedWriter> writer,
     const folly::Optional<std::unordered_set<std::string>>&
         statFieldsToExportOpt)
-    : TcpEventExporter(std::move(outputFileOpt), statFieldsToExportOpt) {
-  // write our column names
-  writeToOutput(folly::join(",", fieldsToExport_));
+    : TcpEventExporter(std::move(writer), statFieldsToExportOpt) {
+  // write our column names, at the start of every segment
+  writer_->setHeader(folly::join(",", getColumnNames(fieldsToExport_)) + "\n");
 }
 
 TcpEventCsvExporter::TcpEventCsvExporter(
     const folly::Optional<std::unordered_set<std::string>>&
         statFieldsToExportOpt)
-    : TcpEventCsvExporter(folly::none, statFieldsToExportOpt) {}
+    : TcpEventCsvExporter(
+          common::BufferedWriter::createFromFlags(folly::none),
+          statFieldsToExportOpt) {}
+
+std::string
+TcpEventCsvExporter::format(const TcpEvent& event) const {
+  // format() may be called from several threads (e.g. by the decoder)
+  thread_local common::CsvRowEncoder encoder;
+  encoder.clear();
+  encodeRow(event, fieldSchemasToExport_, statsToExport_, encoder);
+  return encoder.str();
+}
 
 void
-TcpEventCsvExporter::write(const TcpEvent& event) const {
-  std::vector<std::string> row;
-  const auto fieldNamesToValues = event.getFieldMap();
-  for (const auto& fieldName : fieldsToExport_) {
-    const auto fieldPtr = folly::get_ptr(fieldNamesToValues, fieldName);
-    if (fieldPtr) {
-      row.push_back(*fieldPtr);
-    } else {
-      row.push_back("");
-    }
+TcpEventCsvExporter::encodeRow(
+    const TcpEvent& event,
+    const std::vector<const TcpEvent::Field*>& fields,
+    const TcpEventStatProjection& stats,
+    common::CsvRowEncoder& encoder) {
+  for (const auto field : fields) {
+    encodeValue(field->get(event), encoder);
   }
+  stats.forEach(event, [&encoder](const auto& /* entry */, const auto& value) {
+    encodeValue(value, encoder);
+  });
+}
 
-  // dump the row
-  writeToOutput(folly::join(",", row));
+void
+TcpEventCsvExporter::encodeValue(
+    const TcpEvent::FieldValue& value,
+    common::CsvRowEncoder& encoder) {
+  using Type = TcpEvent::FieldValue::Type;
+  switch (value.type) {
+  case Type::NONE:
+    encoder.addRaw("");
+    break;
+  case Type::INT:
+    encoder.add(value.i);
+    break;
+  case Type::UINT:
+    encoder.add(value.u);
+    break;
+  case Type::BOOL:
+    // same as FieldValue::toString()
+    encoder.addRaw(value.b ? "true" : "false");
+    break;
+  case Type::STRING:
+    encoder.addString(value.s);
+    break;
+  case Type::ADDRESS: {
+    struct sockaddr_storage sas;
+    value.addr->getAddress(&sas);
+    common::addAddressColumns(encoder, &sas);
+    break;
+  }
+  }
 }
 
 } // namespace tcpevents
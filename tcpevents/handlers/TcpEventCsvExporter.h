@@ -1,5 +1,6 @@
 #pragma once
 
+#include <src/common/CsvRowEncoder.h>
 #include <src/tcpevents/handlers/TcpEventExporter.h>
 
 namespace paths {
@@ -11,7 +12,7 @@ namespace tcpevents {
 class TcpEventCsvExporter : public TcpEventExporter {
  public:
   TcpEventCsvExporter(
-      folly::Optional<folly::File>&& outputFileOpt = folly::none,
+      std::unique_ptr<common::BufferedWriter> writer,
       const folly::Optional<std::unordered_set<std::string>>&
           statFieldsToExportOpt = folly::none);
 
@@ -20,9 +21,24 @@ class TcpEventCsvExporter : public TcpEventExporter {
           statFieldsToExportOpt = folly::none);
 
   /**
-   * Converts the event to CSV and then writes to the configured output.
+   * Converts the event to a CSV row.
    */
-  void write(const TcpEvent& event) const override;
+  std::string format(const TcpEvent& event) const override;
+
+  /**
+   * Appends the given fields and then the given stats of the event to a CSV
+   * row, in order. Fields that do not apply to the event are left empty.
+   */
+  static void encodeRow(
+      const TcpEvent& event,
+      const std::vector<const TcpEvent::Field*>& fields,
+      const TcpEventStatProjection& stats,
+      common::CsvRowEncoder& encoder);
+
+ private:
+  static void encodeValue(
+      const TcpEvent::FieldValue& value,
+      common::CsvRowEncoder& encoder);
 };
 
 } // namespace tcpevents
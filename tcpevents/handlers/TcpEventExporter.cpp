@@ -1,12 +1,11 @@
 #include "TcpEventExporter.h"
 
-#include <folly/FileUtil.h>
 #include <folly/Format.h>
 #include <folly/gen/Base.h>
+#include <src/tcpevents/handlers/TcpEventColumnarExporter.h>
 #include <src/tcpevents/handlers/TcpEventCsvExporter.h>
 #include <src/tcpevents/handlers/TcpEventJsonExporter.h>
 #include <src/tcpevents/handlers/TcpEventTxtExporter.h>
-#include <iostream>
 
 namespace paths {
 namespace tcpevents {
@@ -14,37 +13,62 @@ namespace tcpevents {
 using folly::gen::as;
 using folly::gen::fromConst;
 
+namespace {
+
+common::ColumnType
+toColumnType(TcpEvent::FieldValue::Type type) {
+  switch (type) {
+  case TcpEvent::FieldValue::Type::INT:
+    return common::ColumnType::INT64;
+  case TcpEvent::FieldValue::Type::UINT:
+  case TcpEvent::FieldValue::Type::BOOL:
+    return common::ColumnType::UINT64;
+  default:
+    return common::ColumnType::STRING;
+  }
+}
+
+} // namespace
+
 TcpEventExporter::TcpEventExporter(
-    folly::Optional<folly::File>&& outputFileOpt,
+    std::unique_ptr<common::BufferedWriter> writer,
     const folly::Optional<std::unordered_set<std::string>>&
         statFieldsToExportOpt)
     : statFieldsToExport_(getStatFieldsToExport(statFieldsToExportOpt)),
       fieldsToExport_(getFieldNamesToExport(statFieldsToExport_)),
-      outputFileOpt_(std::move(outputFileOpt)) {}
+      fieldSchemasToExport_(getFieldsToExport(getFieldNamesToExport({}))),
+      statsToExport_(statFieldsToExport_),
+      writer_(std::move(writer)) {}
 
 TcpEventExporter::TcpEventExporter(
     const folly::Optional<std::unordered_set<std::string>>&
         statFieldsToExportOpt)
-    : TcpEventExporter(folly::none, statFieldsToExportOpt) {}
+    : TcpEventExporter(
+          common::BufferedWriter::createFromFlags(folly::none),
+          statFieldsToExportOpt) {}
 
 std::shared_ptr<TcpEventExporter>
 TcpEventExporter::createExporter(
     const TcpEventExporterType& type,
-    folly::Optional<folly::File>&& outputFileOpt,
+    std::unique_ptr<common::BufferedWriter> writer,
     const folly::Optional<std::unordered_set<std::string>>&
         statFieldsToExportOpt) {
   switch (type) {
   case TcpEventExporterType::CSV: {
     return std::make_shared<TcpEventCsvExporter>(
-        std::move(outputFileOpt), statFieldsToExportOpt);
+        std::move(writer), statFieldsToExportOpt);
   }
   case TcpEventExporterType::JSON: {
     return std::make_shared<TcpEventJsonExporter>(
-        std::move(outputFileOpt), statFieldsToExportOpt);
+        std::move(writer), statFieldsToExportOpt);
   }
   case TcpEventExporterType::TXT: {
     return std::make_shared<TcpEventTxtExporter>(
-        std::move(outputFileOpt), statFieldsToExportOpt);
+        std::move(writer), statFieldsToExportOpt);
+  }
+  case TcpEventExporterType::COLUMNAR: {
+    return std::make_shared<TcpEventColumnarExporter>(
+        std::move(writer), statFieldsToExportOpt);
   }
   default:
     LOG(FATAL) << folly::sformat(
@@ -59,7 +83,20 @@ TcpEventExporter::createExporter(
     const TcpEventExporterType& type,
     const folly::Optional<std::unordered_set<std::string>>&
         statFieldsToExportOpt) {
-  return createExporter(type, folly::none, statFieldsToExportOpt);
+  return createExporter(
+      type,
+      common::BufferedWriter::createFromFlags(folly::none),
+      statFieldsToExportOpt);
+}
+
+void
+TcpEventExporter::write(const TcpEvent& event) const {
+  writeToOutput(format(event));
+}
+
+void
+TcpEventExporter::writeFormatted(folly::StringPiece lines) const {
+  writer_->write(lines);
 }
 
 std::vector<std::string>
@@ -114,17 +151,59 @@ TcpEventExporter::getFieldNamesToExport(
   return fieldNames;
 }
 
+std::vector<const TcpEvent::Field*>
+TcpEventExporter::getFieldsToExport(
+    const std::vector<std::string>& fieldNames) {
+  std::vector<const TcpEvent::Field*> fields;
+  fields.reserve(fieldNames.size());
+  for (const auto& fieldName : fieldNames) {
+    const auto field = TcpEvent::getField(fieldName);
+    CHECK(field) << folly::sformat("Unknown TcpEvent field {}", fieldName);
+    fields.push_back(field);
+  }
+  return fields;
+}
+
+std::vector<std::string>
+TcpEventExporter::getColumnNames(const std::vector<std::string>& fieldNames) {
+  std::vector<std::string> names;
+  names.reserve(fieldNames.size());
+  for (const auto& fieldName : fieldNames) {
+    const auto field = TcpEvent::getField(fieldName);
+    if (field && field->type == TcpEvent::FieldValue::Type::ADDRESS) {
+      common::appendAddressColumnNames(fieldName, names);
+    } else {
+      names.push_back(fieldName);
+    }
+  }
+  return names;
+}
+
 void
 TcpEventExporter::writeToOutput(const std::string& line) const {
-  if (outputFileOpt_.hasValue()) {
-    const auto& outputFile = outputFileOpt_.value();
-    CHECK_EQ(
-        line.size(),
-        folly::writeFull(outputFile.fd(), line.data(), line.size()));
-    CHECK_EQ(1, folly::writeFull(outputFile.fd(), "\n", 1));
-  } else {
-    std::cout << line << std::endl;
+  writer_->writeLine(line);
+}
+
+std::vector<common::ColumnSpec>
+TcpEventExporter::getColumnsToExport() const {
+  std::vector<common::ColumnSpec> columns;
+  for (const auto field : fieldSchemasToExport_) {
+    if (field->type == TcpEvent::FieldValue::Type::ADDRESS &&
+        FLAGS_export_raw_addresses) {
+      std::vector<std::string> names;
+      common::appendAddressColumnNames(field->name, names);
+      for (auto& name : names) {
+        columns.push_back(
+            common::ColumnSpec{std::move(name), common::ColumnType::UINT64});
+      }
+      continue;
+    }
+    columns.push_back(common::ColumnSpec{field->name, toColumnType(field->type)});
+  }
+  for (const auto& entry : statsToExport_.getEntries()) {
+    columns.push_back(common::ColumnSpec{entry.name, toColumnType(entry.type)});
   }
+  return columns;
 }
 
 } // namespace tcpevents
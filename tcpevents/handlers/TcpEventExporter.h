@@ -5,12 +5,16 @@
 
 #include <fatal/type/enum.h>
 #include <folly/File.h>
+#include <folly/Range.h>
+#include <src/common/BufferedWriter.h>
+#include <src/common/ColumnarFile.h>
 #include <src/tcpevents/collector/TcpEvent.h>
+#include <src/tcpevents/collector/TcpEventStatProjection.h>
 
 namespace paths {
 namespace tcpevents {
 
-FATAL_RICH_ENUM_CLASS(TcpEventExporterType, CSV, JSON, TXT);
+FATAL_RICH_ENUM_CLASS(TcpEventExporterType, CSV, JSON, TXT, COLUMNAR);
 
 /**
  * Base class for all TcpEvent exporters.
@@ -18,20 +22,23 @@ FATAL_RICH_ENUM_CLASS(TcpEventExporterType, CSV, JSON, TXT);
 class TcpEventExporter {
  public:
   TcpEventExporter(
-      folly::Optional<folly::File>&& outputFileOpt = folly::none,
+      std::unique_ptr<common::BufferedWriter> writer,
       const folly::Optional<std::unordered_set<std::string>>&
           statFieldsToExportOpt = folly::none);
 
+  virtual ~TcpEventExporter() = default;
+
   TcpEventExporter(
       const folly::Optional<std::unordered_set<std::string>>&
           statFieldsToExportOpt = folly::none);
 
   /**
-   * Creates an TcpEvent exporter of the specified type that exports to a file.
+   * Creates an TcpEvent exporter of the specified type that exports to a
+   * writer.
    */
   static std::shared_ptr<TcpEventExporter> createExporter(
       const TcpEventExporterType& type,
-      folly::Optional<folly::File>&& outputFileOpt = folly::none,
+      std::unique_ptr<common::BufferedWriter> writer,
       const folly::Optional<std::unordered_set<std::string>>&
           statFieldsToExportOpt = folly::none);
 
@@ -44,9 +51,22 @@ class TcpEventExporter {
           statFieldsToExportOpt = folly::none);
 
   /**
-   * Converts the event to CSV and then writes to the configured output.
+   * Converts the event to the exporter's format, without a trailing newline.
+   *
+   * Does not touch the output, so it may be called from several threads.
+   */
+  virtual std::string format(const TcpEvent& event) const = 0;
+
+  /**
+   * Converts the event and then writes it to the configured output.
    */
-  virtual void write(const TcpEvent& event) const = 0;
+  virtual void write(const TcpEvent& event) const;
+
+  /**
+   * Writes events already converted with format(), each followed by a
+   * newline, to the configured output. Used to write batches of events.
+   */
+  void writeFormatted(folly::StringPiece lines) const;
 
   /**
    * Returns a list of stat fields to export.
@@ -64,20 +84,49 @@ class TcpEventExporter {
   static std::vector<std::string> getFieldNamesToExport(
       const std::vector<std::string>& statFieldsToExport);
 
+  /**
+   * Resolves field names (from getFieldNamesToExport) to their schema, so
+   * that events can be exported without looking fields up by name.
+   */
+  static std::vector<const TcpEvent::Field*> getFieldsToExport(
+      const std::vector<std::string>& fieldNames);
+
+  /**
+   * Expands field names (from getFieldNamesToExport) to column names: the
+   * same names, except for address fields with --export_raw_addresses (see
+   * common::appendAddressColumnNames).
+   */
+  static std::vector<std::string> getColumnNames(
+      const std::vector<std::string>& fieldNames);
+
  protected:
   /**
    * Writes a line to the configured output.
    */
   void writeToOutput(const std::string& line) const;
 
+  /**
+   * Typed columns of the exported fields, for the exporters that are not
+   * line oriented: integer fields are 64-bit integers, enum names and
+   * addresses strings.
+   */
+  std::vector<common::ColumnSpec> getColumnsToExport() const;
+
   // Statistics fields to export (post-filtering)
   const std::vector<std::string> statFieldsToExport_;
 
   // Ordered list of fields to export
   const std::vector<std::string> fieldsToExport_;
 
-  // File to export to (if not set, export to stdout)
-  const folly::Optional<folly::File> outputFileOpt_;
+  // Schema of the header, state and detail fields of fieldsToExport_, in the
+  // same order; the stat columns follow them
+  const std::vector<const TcpEvent::Field*> fieldSchemasToExport_;
+
+  // statFieldsToExport_, resolved to their location in the event
+  const TcpEventStatProjection statsToExport_;
+
+  // Buffered writer for the export file (or stdout, if no file is set)
+  const std::unique_ptr<common::BufferedWriter> writer_;
 };
 
 } // namespace tcpevents
@@ -1,13 +1,96 @@
 #include "TcpEventJsonExporter.h"
 
-#include <nlohmann/json.hpp>
-
 namespace paths {
 namespace tcpevents {
 
+namespace {
+
+std::vector<std::string>
+makeKeys(const std::vector<std::string>& fieldNames) {
+  std::vector<std::string> keys;
+  keys.reserve(fieldNames.size());
+  for (const auto& fieldName : fieldNames) {
+    keys.push_back(common::JsonRowEncoder::makeKey(fieldName));
+  }
+  return keys;
+}
+
+} // namespace
+
+TcpEventJsonExporter::TcpEventJsonExporter(
+    std::unique_ptr<common::BufferedWriter> writer,
+    const folly::Optional<std::unordered_set<std::string>>&
+        statFieldsToExportOpt)
+    : TcpEventExporter(std::move(writer), statFieldsToExportOpt),
+      keys_(makeKeys(getColumnNames(fieldsToExport_))) {}
+
+TcpEventJsonExporter::TcpEventJsonExporter(
+    const folly::Optional<std::unordered_set<std::string>>&
+        statFieldsToExportOpt)
+    : TcpEventJsonExporter(
+          common::BufferedWriter::createFromFlags(folly::none),
+          statFieldsToExportOpt) {}
+
+std::string
+TcpEventJsonExporter::format(const TcpEvent& event) const {
+  // format() may be called from several threads (e.g. by the decoder)
+  thread_local common::JsonRowEncoder encoder;
+  encoder.clear();
+  const std::string* key = keys_.data();
+  for (const auto field : fieldSchemasToExport_) {
+    encodeMember(key, field->get(event), encoder);
+  }
+  statsToExport_.forEach(event, [&](const auto& /* entry */, const auto& v) {
+    encodeMember(key, v, encoder);
+  });
+  return encoder.finish();
+}
+
 void
-TcpEventJsonExporter::write(const TcpEvent& event) const {
-  writeToOutput(nlohmann::json(event.getFieldMap()).dump());
+TcpEventJsonExporter::encodeMember(
+    const std::string*& key,
+    const TcpEvent::FieldValue& value,
+    common::JsonRowEncoder& encoder) {
+  using Type = TcpEvent::FieldValue::Type;
+  if (value.type == Type::ADDRESS && FLAGS_export_raw_addresses) {
+    struct sockaddr_storage sas;
+    value.addr->getAddress(&sas);
+    const auto raw = common::toRawAddress(&sas);
+    encoder.addKey(*key++);
+    encoder.add(raw.hi);
+    encoder.addKey(*key++);
+    encoder.add(raw.lo);
+    encoder.addKey(*key++);
+    encoder.add(raw.port);
+    return;
+  }
+  const auto& name = *key++;
+  if (value.type == Type::NONE) {
+    return;
+  }
+  encoder.addKey(name);
+  switch (value.type) {
+  case Type::NONE:
+    break;
+  case Type::INT:
+    encoder.add(value.i);
+    break;
+  case Type::UINT:
+    encoder.add(value.u);
+    break;
+  case Type::BOOL:
+    encoder.add(value.b);
+    break;
+  case Type::STRING:
+    encoder.addString(value.s);
+    break;
+  case Type::ADDRESS: {
+    struct sockaddr_storage sas;
+    value.addr->getAddress(&sas);
+    encoder.addAddress(&sas);
+    break;
+  }
+  }
 }
 
 } // namespace tcpevents
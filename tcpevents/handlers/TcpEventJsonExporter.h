@@ -1,5 +1,6 @@
 #pragma once
 
+#include <src/common/JsonRowEncoder.h>
 #include <src/tcpevents/handlers/TcpEventExporter.h>
 
 namespace paths {
@@ -7,15 +8,37 @@ namespace tcpevents {
 
 /**
  * Exporter for dumping TcpEvents to a JSON file (one line per JSON object).
+ *
+ * Numeric fields are exported as JSON numbers. Fields that do not apply to
+ * the event (e.g., details of other event types) are omitted.
  */
 class TcpEventJsonExporter : public TcpEventExporter {
  public:
-  using TcpEventExporter::TcpEventExporter;
+  TcpEventJsonExporter(
+      std::unique_ptr<common::BufferedWriter> writer,
+      const folly::Optional<std::unordered_set<std::string>>&
+          statFieldsToExportOpt = folly::none);
+
+  TcpEventJsonExporter(
+      const folly::Optional<std::unordered_set<std::string>>&
+          statFieldsToExportOpt = folly::none);
 
   /**
-   * Converts the event to a string and then writes to the configured output.
+   * Converts the event to a JSON object.
    */
-  void write(const TcpEvent& event) const override;
+  std::string format(const TcpEvent& event) const override;
+
+ private:
+  // adds the member(s) of a field, unless it does not apply to the event,
+  // and moves key past its keys (three for an address exported as integers;
+  // address fields are header fields, which apply to every event)
+  static void encodeMember(
+      const std::string*& key,
+      const TcpEvent::FieldValue& value,
+      common::JsonRowEncoder& encoder);
+
+  // escaped keys of the columns of fieldsToExport_, in the same order
+  const std::vector<std::string> keys_;
 };
 
 } // namespace tcpevents
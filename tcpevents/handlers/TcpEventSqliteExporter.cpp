@@ -0,0 +1,44 @@
+#include "TcpEventSqliteExporter.h"
+
+#include <glog/logging.h>
+
+namespace paths {
+namespace tcpevents {
+
+TcpEventSqliteExporter::TcpEventSqliteExporter(
+    const std::string& path,
+    const folly::Optional<std::unordered_set<std::string>>&
+        statFieldsToExportOpt)
+    : TcpEventExporter(nullptr, statFieldsToExportOpt),
+      sqlite_(common::SqliteWriter::createFromFlags(
+          path,
+          "tcpevents",
+          getColumnsToExport(),
+          {"event_ns", "dst"})) {}
+
+std::string
+TcpEventSqliteExporter::format(const TcpEvent& /* event */) const {
+  LOG(FATAL) << "SQLite output cannot be formatted line by line";
+  return "";
+}
+
+void
+TcpEventSqliteExporter::write(const TcpEvent& event) const {
+  // beginRow() locks the writer until endRow()
+  sqlite_->beginRow();
+  for (const auto field : fieldSchemasToExport_) {
+    field->get(event).encode(*sqlite_);
+  }
+  statsToExport_.forEach(event, [this](const auto& /* entry */, const auto& v) {
+    v.encode(*sqlite_);
+  });
+  sqlite_->endRow();
+}
+
+void
+TcpEventSqliteExporter::commit() const {
+  sqlite_->commit();
+}
+
+} // namespace tcpevents
+} // namespace paths
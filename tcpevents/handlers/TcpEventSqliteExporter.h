@@ -0,0 +1,47 @@
+#pragma once
+
+#include <src/common/SqliteWriter.h>
+#include <src/tcpevents/handlers/TcpEventExporter.h>
+
+namespace paths {
+namespace tcpevents {
+
+/**
+ * Exporter for inserting TcpEvents into a SQLite database (see
+ * common::SqliteWriter), with one column per exported field.
+ *
+ * Column types are those of TcpEventColumnarExporter; fields that do not
+ * apply to an event are NULL. The database is indexed on event_ns and dst
+ * when it is closed.
+ */
+class TcpEventSqliteExporter : public TcpEventExporter {
+ public:
+  /**
+   * Writes to the database at path (rotated if --export_rotate_* are set).
+   */
+  TcpEventSqliteExporter(
+      const std::string& path,
+      const folly::Optional<std::unordered_set<std::string>>&
+          statFieldsToExportOpt = folly::none);
+
+  /**
+   * SQLite output is not line oriented; fails hard.
+   */
+  std::string format(const TcpEvent& event) const override;
+
+  /**
+   * Inserts the event in the open transaction.
+   */
+  void write(const TcpEvent& event) const override;
+
+  /**
+   * Commits the open transaction.
+   */
+  void commit() const;
+
+ private:
+  const std::unique_ptr<common::SqliteWriter> sqlite_;
+};
+
+} // namespace tcpevents
+} // namespace paths
@@ -0,0 +1,30 @@
+#include "TcpEventStreamSchema.h"
+
+#include <src/tcpevents/handlers/TcpEventExporter.h>
+
+namespace paths {
+namespace tcpevents {
+
+std::vector<std::string>
+TcpEventStreamSchema::getFieldNames() const {
+  std::vector<std::string> names;
+  for (const auto& field : TcpEvent::getFields()) {
+    names.push_back(field.name);
+  }
+  return TcpEventExporter::getColumnNames(names);
+}
+
+void
+TcpEventStreamSchema::decode(
+    const void* record,
+    common::EventStreamRow& row) const {
+  const TcpEvent event(*static_cast<const bpf::tcp_event_t*>(record));
+  row.setType(fatal::enum_to_string(event.type, "UNKNOWN"));
+  row.setDst(event.dst.getIPAddress());
+  for (const auto& field : TcpEvent::getFields()) {
+    field.get(event).encode(row);
+  }
+}
+
+} // namespace tcpevents
+} // namespace paths
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <src/common/EventStream.h>
+#include <src/tcpevents/collector/TcpEvent.h>
+
+namespace paths {
+namespace tcpevents {
+
+/**
+ * Stream schema (see common::EventStreamServer) of raw tcp_event_t records:
+ * every field of TcpEvent::getFields(), the event type name (e.g.
+ * TCP_SET_CA_STATE) as the type subscribers filter on.
+ */
+class TcpEventStreamSchema : public common::EventStreamSchema {
+ public:
+  std::vector<std::string> getFieldNames() const override;
+
+  void decode(const void* record, common::EventStreamRow& row) const override;
+};
+
+} // namespace tcpevents
+} // namespace paths
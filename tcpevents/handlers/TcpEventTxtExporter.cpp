@@ -1,13 +1,88 @@
 #include "TcpEventTxtExporter.h"
 
+#include <algorithm>
+
+#include <folly/Format.h>
+
 namespace paths {
 namespace tcpevents {
 
+namespace {
+
+std::vector<std::string>
+sorted(std::vector<std::string> names) {
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+void
+appendSeparator(std::string& out, const char* name) {
+  out.append("\n\t--- ").append(name).append(" ---");
+}
+
 void
-TcpEventTxtExporter::write(const TcpEvent& event) const {
-  // dump the event via toString()
-  writeToOutput(event.toString(std::unordered_set<std::string>(
-      statFieldsToExport_.begin(), statFieldsToExport_.end())));
+appendField(
+    std::string& out,
+    const char* name,
+    const TcpEvent::FieldValue& value) {
+  out.append("\n\t").append(name).append(" = ").append(value.toString());
+}
+
+} // namespace
+
+TcpEventTxtExporter::TcpEventTxtExporter(
+    std::unique_ptr<common::BufferedWriter> writer,
+    const folly::Optional<std::unordered_set<std::string>>&
+        statFieldsToExportOpt)
+    : TcpEventExporter(std::move(writer), statFieldsToExportOpt),
+      headerFields_(getFieldsToExport(sorted(TcpEvent::getHeaderFieldNames()))),
+      stateFields_(getFieldsToExport(sorted(TcpEvent::getStateFieldNames()))),
+      detailFields_(getFieldsToExport(sorted(TcpEvent::getDetailFieldNames()))),
+      sortedStats_(sorted(statFieldsToExport_)) {}
+
+TcpEventTxtExporter::TcpEventTxtExporter(
+    const folly::Optional<std::unordered_set<std::string>>&
+        statFieldsToExportOpt)
+    : TcpEventTxtExporter(
+          common::BufferedWriter::createFromFlags(folly::none),
+          statFieldsToExportOpt) {}
+
+std::string
+TcpEventTxtExporter::format(const TcpEvent& event) const {
+  auto out = folly::sformat(
+      "TcpEvent for flow {} -> {}:",
+      TcpEvent::FieldValue::ofAddress(event.src).toString(),
+      TcpEvent::FieldValue::ofAddress(event.dst).toString());
+  for (const auto field : headerFields_) {
+    appendField(out, field->name, field->get(event));
+  }
+
+  appendSeparator(out, "state");
+  for (const auto field : stateFields_) {
+    appendField(out, field->name, field->get(event));
+  }
+
+  // only the details of the event's type are set
+  bool hasDetails = false;
+  for (const auto field : detailFields_) {
+    const auto value = field->get(event);
+    if (value.type == TcpEvent::FieldValue::Type::NONE) {
+      continue;
+    }
+    if (!hasDetails) {
+      appendSeparator(out, "detail");
+      hasDetails = true;
+    }
+    appendField(out, field->name, value);
+  }
+
+  if (sortedStats_.size()) {
+    appendSeparator(out, "stat");
+    sortedStats_.forEach(event, [&out](const auto& entry, const auto& value) {
+      appendField(out, entry.name, value);
+    });
+  }
+  return out;
 }
 
 } // namespace tcpevents
@@ -10,12 +10,26 @@ namespace tcpevents {
  */
 class TcpEventTxtExporter : public TcpEventExporter {
  public:
-  using TcpEventExporter::TcpEventExporter;
+  TcpEventTxtExporter(
+      std::unique_ptr<common::BufferedWriter> writer,
+      const folly::Optional<std::unordered_set<std::string>>&
+          statFieldsToExportOpt = folly::none);
+
+  TcpEventTxtExporter(
+      const folly::Optional<std::unordered_set<std::string>>&
+          statFieldsToExportOpt = folly::none);
 
   /**
-   * Converts the event to a string and then writes to the configured output.
+   * Converts the event to a string, in the format of TcpEvent::toString().
    */
-  void write(const TcpEvent& event) const override;
+  std::string format(const TcpEvent& event) const override;
+
+ private:
+  // fields of each section, sorted by name (as TcpEvent::toString() does)
+  const std::vector<const TcpEvent::Field*> headerFields_;
+  const std::vector<const TcpEvent::Field*> stateFields_;
+  const std::vector<const TcpEvent::Field*> detailFields_;
+  const TcpEventStatProjection sortedStats_;
 };
 
 } // namespace tcpevents
@@ -3,30 +3,119 @@
 #include <iostream>
 
 #include <folly/Format.h>
+#include <src/common/ExporterSpec.h>
 
 namespace paths {
 namespace tcpevents {
 
+namespace {
+
+// snapshots of live connections are exported as they come, other events
+// when a connection closes
+bool
+isExported(TcpEvent::Type type, const bpf::tcp_event_details_t& details) {
+  if (type == TcpEvent::Type::TCP_SNAPSHOT) {
+    return true;
+  }
+  if ((int)details.state_change.new_state.skt_state != TCP_CLOSE) {
+    return false;
+  }
+  if ((int)details.state_change.old_state.skt_state == TCP_CLOSE ||
+      (int)details.state_change.old_state.skt_state == TCP_LISTEN) {
+    return false;
+  }
+  return true;
+}
+
+std::vector<BaseTcpEventHandler::Output>
+makeOutputs(
+    const std::shared_ptr<TcpEventExporter>& exporter,
+    std::shared_ptr<const common::PrefixMatcher> clients) {
+  BaseTcpEventHandler::Output output;
+  output.exporter = exporter;
+  output.clients = std::move(clients);
+  CHECK(common::parseQueueFullPolicy(
+      FLAGS_export_queue_full_policy, output.queueFull));
+  return {output};
+}
+
+} // namespace
+
 BaseTcpEventHandler::BaseTcpEventHandler(
     const std::shared_ptr<TcpEventExporter>& exporter,
-    std::string monitored_prefix)
-    : exporter_(exporter), monitored_prefix_(monitored_prefix) {
-  LOG(INFO) << folly::format("Monitoring events to clients in prefix {}", monitored_prefix_);
+    std::shared_ptr<const common::PrefixMatcher> clients)
+    : BaseTcpEventHandler(makeOutputs(exporter, std::move(clients))) {}
+
+BaseTcpEventHandler::BaseTcpEventHandler(std::vector<Output> outputs) {
+  for (size_t i = 0; i < outputs.size(); i++) {
+    auto sink = std::make_unique<Sink>();
+    sink->output = std::move(outputs[i]);
+    LOG(INFO) << folly::format(
+        "Monitoring events to clients in {}",
+        sink->output.clients->describe());
+    const auto exporter = sink->output.exporter.get();
+    sink->queue = common::AsyncEventQueue<TcpEventHandle>::createFromFlags(
+        common::getExporterQueueName("tcpevents", i, outputs.size()),
+        sink->output.queueFull,
+        [exporter](TcpEventHandle& event) {
+          exporter->write(*event);
+          // back to the pool now rather than when the next event is popped
+          event.reset();
+        });
+    if (sink->queue) {
+      sink->queue->start();
+    }
+    sinks_.push_back(std::move(sink));
+  }
 }
 
 void
-BaseTcpEventHandler::handleTcpEvent(std::unique_ptr<TcpEvent> event) {
-  if ((int)event->details.state_change.new_state.skt_state != TCP_CLOSE) {
+BaseTcpEventHandler::handleTcpEventView(const TcpEventView& view) {
+  if (!isExported(view.getType(), view.getDetails())) {
     return;
   }
-  if ((int)event->details.state_change.old_state.skt_state == TCP_CLOSE ||
-      (int)event->details.state_change.old_state.skt_state == TCP_LISTEN) {
-    return;
+  matched_.clear();
+  for (const auto& sink : sinks_) {
+    const auto& output = sink->output;
+    if ((output.types.empty() || output.types.count(view.getType())) &&
+        view.isDstIn(*output.clients)) {
+      matched_.push_back(sink.get());
+    }
+  }
+  if (!matched_.empty()) {
+    dispatch(view.toTcpEvent());
   }
-  if(!event->dst.getIPAddress().inSubnet(monitored_prefix_)) {
+}
+
+void
+BaseTcpEventHandler::handleTcpEvent(TcpEventHandle event) {
+  if (!isExported(event->type, event->details)) {
     return;
   }
-  exporter_->write(*event);
+  const auto dst = event->dst.getIPAddress();
+  matched_.clear();
+  for (const auto& sink : sinks_) {
+    const auto& output = sink->output;
+    if ((output.types.empty() || output.types.count(event->type)) &&
+        output.clients->match(dst)) {
+      matched_.push_back(sink.get());
+    }
+  }
+  if (!matched_.empty()) {
+    dispatch(event);
+  }
+}
+
+void
+BaseTcpEventHandler::dispatch(const TcpEventHandle& event) {
+  // each queue holds a handle to the same pooled event
+  for (const auto sink : matched_) {
+    if (sink->queue) {
+      sink->queue->push(event);
+      continue;
+    }
+    sink->output.exporter->write(*event);
+  }
 }
 
 } // namespace tcpevents
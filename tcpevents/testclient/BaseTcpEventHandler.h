@@ -2,23 +2,66 @@
 
 #include <folly/File.h>
 #include <folly/Optional.h>
+#include <src/common/AsyncEventQueue.h>
+#include <src/common/PrefixMatcher.h>
 #include <src/tcpevents/collector/TcpEventCollector.h>
 #include <src/tcpevents/handlers/TcpEventCsvExporter.h>
+#include <unordered_set>
+#include <vector>
 
 namespace paths {
 namespace tcpevents {
 
 class BaseTcpEventHandler : public TcpEventCollector::CallbackHandler {
  public:
+  /**
+   * An exporter, and the events it is given.
+   */
+  struct Output {
+    std::shared_ptr<TcpEventExporter> exporter;
+
+    // events to these clients
+    std::shared_ptr<const common::PrefixMatcher> clients;
+
+    // events of these types, all if empty
+    std::unordered_set<TcpEvent::Type> types;
+
+    common::QueueFullPolicy queueFull{common::QueueFullPolicy::BLOCK};
+  };
+
   BaseTcpEventHandler(
     const std::shared_ptr<TcpEventExporter>& exporter,
-    std::string monitored_prefix);
+    std::shared_ptr<const common::PrefixMatcher> clients);
+
+  /**
+   * Exports the events to several exporters (--exporters). Each event is
+   * converted once and shared (by handle) by the exporters it matches, each
+   * of them exporting from a queue and thread of its own.
+   */
+  explicit BaseTcpEventHandler(std::vector<Output> outputs);
 
-  void handleTcpEvent(std::unique_ptr<TcpEvent> event) override;
+  /**
+   * Filters the event on its view, so that TcpEvents are only built for the
+   * events that are exported.
+   */
+  void handleTcpEventView(const TcpEventView& view) override;
+
+  void handleTcpEvent(TcpEventHandle event) override;
 
  private:
-  const std::shared_ptr<TcpEventExporter> exporter_;
-  const std::string monitored_prefix_;
+  struct Sink {
+    Output output;
+    // declared last so that it is drained before the exporter goes away
+    std::unique_ptr<common::AsyncEventQueue<TcpEventHandle>> queue;
+  };
+
+  // exports the event to the sinks in matched_
+  void dispatch(const TcpEventHandle& event);
+
+  std::vector<std::unique_ptr<Sink>> sinks_;
+
+  // sinks that the event being handled is exported to
+  std::vector<Sink*> matched_;
 };
 
 } // namespace tcpevents
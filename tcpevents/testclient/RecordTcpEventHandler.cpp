@@ -0,0 +1,36 @@
+#include "RecordTcpEventHandler.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <src/common/RecordFile.h>
+
+DECLARE_double(bpf_connection_sampling_rate);
+
+namespace paths {
+namespace tcpevents {
+
+RecordTcpEventHandler::RecordTcpEventHandler(
+    std::unique_ptr<common::BufferedWriter> writer)
+    : writer_(std::move(writer)) {
+  LOG(INFO) << "Recording raw events, client prefix is not applied";
+  common::writeRecordFileHeader(
+      *writer_,
+      "tcpevents",
+      sizeof(bpf::tcp_event_t),
+      false,
+      FLAGS_bpf_connection_sampling_rate);
+}
+
+bool
+RecordTcpEventHandler::handleRawTcpEvent(const bpf::tcp_event_t& event) {
+  common::writeRecord(*writer_, event);
+  return true;
+}
+
+void
+RecordTcpEventHandler::handleTcpEvent(TcpEventHandle /* event */) {
+  LOG(FATAL) << "Events are consumed by handleRawTcpEvent";
+}
+
+} // namespace tcpevents
+} // namespace paths
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <src/common/BufferedWriter.h>
+#include <src/tcpevents/collector/TcpEventCollector.h>
+
+namespace paths {
+namespace tcpevents {
+
+/**
+ * Writes the raw tcp_event_t of every event (--export_mode=record) for
+ * RecordDecoder, without building TcpEvents or filtering.
+ */
+class RecordTcpEventHandler : public TcpEventCollector::CallbackHandler {
+ public:
+  explicit RecordTcpEventHandler(
+      std::unique_ptr<common::BufferedWriter> writer);
+
+  bool handleRawTcpEvent(const bpf::tcp_event_t& event) override;
+
+  void handleTcpEvent(TcpEventHandle event) override;
+
+ private:
+  const std::unique_ptr<common::BufferedWriter> writer_;
+};
+
+} // namespace tcpevents
+} // namespace paths
@@ -0,0 +1,28 @@
+#include "RingTcpEventHandler.h"
+
+namespace paths {
+namespace tcpevents {
+
+RingTcpEventHandler::RingTcpEventHandler(
+    std::unique_ptr<common::EventRingWriter> ring,
+    std::shared_ptr<TcpEventCollector::CallbackHandler> next)
+    : ring_(std::move(ring)), next_(std::move(next)) {}
+
+bool
+RingTcpEventHandler::handleRawTcpEvent(const bpf::tcp_event_t& event) {
+  ring_->writeRecord(event);
+  return next_->handleRawTcpEvent(event);
+}
+
+void
+RingTcpEventHandler::handleTcpEventView(const TcpEventView& view) {
+  next_->handleTcpEventView(view);
+}
+
+void
+RingTcpEventHandler::handleTcpEvent(TcpEventHandle event) {
+  next_->handleTcpEvent(std::move(event));
+}
+
+} // namespace tcpevents
+} // namespace paths
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <src/common/EventRing.h>
+#include <src/tcpevents/collector/TcpEventCollector.h>
+
+namespace paths {
+namespace tcpevents {
+
+/**
+ * Publishes the raw tcp_event_t of every event to the --event_ring_path ring
+ * for local readers, and then passes the event on to another handler.
+ */
+class RingTcpEventHandler : public TcpEventCollector::CallbackHandler {
+ public:
+  RingTcpEventHandler(
+      std::unique_ptr<common::EventRingWriter> ring,
+      std::shared_ptr<TcpEventCollector::CallbackHandler> next);
+
+  bool handleRawTcpEvent(const bpf::tcp_event_t& event) override;
+
+  void handleTcpEventView(const TcpEventView& view) override;
+
+  void handleTcpEvent(TcpEventHandle event) override;
+
+ private:
+  const std::unique_ptr<common::EventRingWriter> ring_;
+  const std::shared_ptr<TcpEventCollector::CallbackHandler> next_;
+};
+
+} // namespace tcpevents
+} // namespace paths
@@ -0,0 +1,28 @@
+#include "StreamTcpEventHandler.h"
+
+namespace paths {
+namespace tcpevents {
+
+StreamTcpEventHandler::StreamTcpEventHandler(
+    std::unique_ptr<common::EventStreamPublisher<bpf::tcp_event_t>> stream,
+    std::shared_ptr<TcpEventCollector::CallbackHandler> next)
+    : stream_(std::move(stream)), next_(std::move(next)) {}
+
+bool
+StreamTcpEventHandler::handleRawTcpEvent(const bpf::tcp_event_t& event) {
+  stream_->publish(event);
+  return next_->handleRawTcpEvent(event);
+}
+
+void
+StreamTcpEventHandler::handleTcpEventView(const TcpEventView& view) {
+  next_->handleTcpEventView(view);
+}
+
+void
+StreamTcpEventHandler::handleTcpEvent(TcpEventHandle event) {
+  next_->handleTcpEvent(std::move(event));
+}
+
+} // namespace tcpevents
+} // namespace paths
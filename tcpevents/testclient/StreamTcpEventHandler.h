@@ -0,0 +1,32 @@
+#pragma once
+
+#include <src/common/EventStream.h>
+#include <src/tcpevents/collector/TcpEventCollector.h>
+
+namespace paths {
+namespace tcpevents {
+
+/**
+ * Queues the raw tcp_event_t of every event for the subscribers of
+ * --stream_socket_path, and then passes the event on to another handler.
+ */
+class StreamTcpEventHandler : public TcpEventCollector::CallbackHandler {
+ public:
+  StreamTcpEventHandler(
+      std::unique_ptr<common::EventStreamPublisher<bpf::tcp_event_t>> stream,
+      std::shared_ptr<TcpEventCollector::CallbackHandler> next);
+
+  bool handleRawTcpEvent(const bpf::tcp_event_t& event) override;
+
+  void handleTcpEventView(const TcpEventView& view) override;
+
+  void handleTcpEvent(TcpEventHandle event) override;
+
+ private:
+  const std::unique_ptr<common::EventStreamPublisher<bpf::tcp_event_t>>
+      stream_;
+  const std::shared_ptr<TcpEventCollector::CallbackHandler> next_;
+};
+
+} // namespace tcpevents
+} // namespace paths
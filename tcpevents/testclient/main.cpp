@@ -1,7 +1,15 @@
+#include <src/common/ExporterSpec.h>
 #include <src/common/Init.h>
+#include <src/common/PrefixMatcher.h>
 #include <src/common/SignalHandler.h>
 #include <src/tcpevents/collector/TcpEventCollector.h>
+#include <src/tcpevents/handlers/TcpEventSqliteExporter.h>
+#include <src/tcpevents/handlers/TcpEventStreamSchema.h>
 #include <src/tcpevents/testclient/BaseTcpEventHandler.h>
+#include <src/tcpevents/testclient/RecordTcpEventHandler.h>
+#include <src/tcpevents/testclient/RingTcpEventHandler.h>
+#include <src/tcpevents/testclient/StreamTcpEventHandler.h>
+#include <algorithm>
 #include <thread>
 #include <vector>
 
@@ -10,17 +18,13 @@
 #include <folly/gen/Base.h>
 #include <folly/gen/String.h>
 
-static bool
-ValidateClientPrefix(const char *flagname, const std::string& pfx) {
-  const auto cidrnetExpect = folly::IPAddress::tryCreateNetwork(pfx);
-  if(cidrnetExpect.hasError()) {
-    LOG(ERROR) << folly::format("{} is not a prefix", flagname);
-    return false;
-  }
-  return true;
-}
-
-DEFINE_string(export_mode, "txt", "Export mode (options: csv, json, txt)");
+DEFINE_string(
+    export_mode,
+    "txt",
+    "Export mode (options: csv, json, txt, columnar, sqlite, record). "
+    "columnar writes typed record batches; sqlite inserts the events into a "
+    "SQLite database at --export_file_path; record writes the raw events, "
+    "unfiltered, for RecordDecoder");
 DEFINE_string(
     export_file_path,
     "",
@@ -32,7 +36,7 @@ DEFINE_string(
     "List of stats to print for each event, defined as a comma separated list. "
     "Set to 'all' (default) to print all stats");
 DEFINE_string(client_prefix, "10.0.0.0/9", "Prefix of monitored clients");
-DEFINE_validator(client_prefix, &ValidateClientPrefix);
+DEFINE_validator(client_prefix, &paths::common::validateClientPrefix);
 
 using namespace paths::tcpevents;
 
@@ -45,6 +49,70 @@ using folly::gen::order;
 using folly::gen::split;
 using folly::gen::unsplit;
 
+// resolves the name of an event type (--exporters types)
+static TcpEvent::Type
+parseEventType(const std::string& name) {
+  for (int i = 0; i <= (int)TcpEvent::Type::TCP_SNAPSHOT; i++) {
+    const auto type = static_cast<TcpEvent::Type>(i);
+    if (name == fatal::enum_to_string(type, "")) {
+      return type;
+    }
+  }
+  LOG(FATAL) << folly::format("Unknown event type {}", name);
+  return TcpEvent::Type::TCP_SNAPSHOT;
+}
+
+// the stats exported by an exporter (--exporters fields): tcpevents always
+// exports the header, state and detail fields, and fields only selects stats
+static std::unordered_set<std::string>
+parseExporterStats(const std::vector<std::string>& fields) {
+  const auto statNames = TcpEvent::getStatFieldNames();
+  for (const auto& field : fields) {
+    if (std::find(statNames.begin(), statNames.end(), field) ==
+        statNames.end()) {
+      LOG(FATAL) << folly::format(
+          "Unknown stat {} in the fields of an exporter; tcpevents exporters "
+          "select stats only",
+          field);
+    }
+  }
+  return std::unordered_set<std::string>(fields.begin(), fields.end());
+}
+
+static std::shared_ptr<TcpEventExporter>
+makeExporter(
+    const std::string& mode,
+    const std::string& path,
+    const folly::Optional<std::unordered_set<std::string>>& statsToPrintOpt) {
+  // sqlite writes to its own database
+  if (mode == "sqlite") {
+    return std::make_shared<TcpEventSqliteExporter>(path, statsToPrintOpt);
+  }
+
+  // determine the export mode
+  // TODO(bschlinker): Use fatal rich enum to map command line to enum
+  TcpEventExporterType exportMode;
+  if (mode == "csv") {
+    exportMode = TcpEventExporterType::CSV;
+  } else if (mode == "json") {
+    exportMode = TcpEventExporterType::JSON;
+  } else if (mode == "txt") {
+    exportMode = TcpEventExporterType::TXT;
+  } else if (mode == "columnar") {
+    exportMode = TcpEventExporterType::COLUMNAR;
+  } else {
+    LOG(ERROR) << folly::sformat(
+        "Export format {} not known, defaulting to txt", mode);
+    exportMode = TcpEventExporterType::TXT;
+  }
+
+  // setup export file (rotated if --export_rotate_* are set), or stdout
+  return TcpEventExporter::createExporter(
+      exportMode,
+      paths::common::BufferedWriter::createFromFlags(path),
+      statsToPrintOpt);
+}
+
 int
 main(int argc, char* argv[]) {
   paths::init(argc, argv);
@@ -71,41 +139,57 @@ main(int argc, char* argv[]) {
       {TcpEvent::Type::INET_SOCK_SET_STATE, TcpEvent::Type::TCP_SET_CA_STATE});
 
 
-  // determine the export mode
-  // TODO(bschlinker): Use fatal rich enum to map command line to enum
-  TcpEventExporterType exportMode;
-  if (FLAGS_export_mode == "csv") {
-    exportMode = TcpEventExporterType::CSV;
-  } else if (FLAGS_export_mode == "json") {
-    exportMode = TcpEventExporterType::JSON;
-  } else if (FLAGS_export_mode == "txt") {
-    exportMode = TcpEventExporterType::TXT;
-  } else {
-    LOG(ERROR) << folly::sformat(
-        "Export format {} not known, defaulting to txt", FLAGS_export_mode);
-    exportMode = TcpEventExporterType::TXT;
+  // init the handler, with the exporters of --exporters or the single one
+  // of --export_mode
+  const auto specs = paths::common::getExporterSpecsFromFlags();
+  std::shared_ptr<const paths::common::PrefixMatcher> clients =
+      paths::common::PrefixMatcher::createFromFlags(FLAGS_client_prefix);
+  if (!clients) {
+    LOG(FATAL) << "Unable to load the monitored client prefixes";
   }
-
-  // setup export file, if declared
-  folly::Optional<folly::File> exportFile;
-  if (FLAGS_export_file_path.size()) {
-    const auto path = FLAGS_export_file_path;
-    auto fileExpect = folly::File::makeFile(path, O_WRONLY | O_TRUNC | O_CREAT);
-    if (fileExpect.hasError()) {
-      LOG(FATAL) << folly::sformat(
-          "Unable to open file {} for export, error = {}",
-          path,
-          folly::exceptionStr(fileExpect.error()));
-    } else {
-      LOG(ERROR) << folly::sformat("Opened file {} for export", path);
-      exportFile = std::move(fileExpect.value());
+  std::shared_ptr<TcpEventCollector::CallbackHandler> handler;
+  if (specs.empty() && FLAGS_export_mode == "record") {
+    handler = std::make_shared<RecordTcpEventHandler>(
+        paths::common::BufferedWriter::createFromFlags(FLAGS_export_file_path));
+  } else if (specs.empty()) {
+    const auto exporter = makeExporter(
+        FLAGS_export_mode, FLAGS_export_file_path, statsToPrintOpt);
+    handler = std::make_shared<BaseTcpEventHandler>(exporter, clients);
+  } else {
+    std::vector<BaseTcpEventHandler::Output> outputs;
+    for (const auto& spec : specs) {
+      if (spec.mode == "record") {
+        LOG(FATAL) << "Raw events are recorded with --export_mode=record, "
+                      "not with --exporters";
+      }
+      // fields of an exporter replace --stats_to_print
+      auto exporterStatsOpt = statsToPrintOpt;
+      if (!spec.fields.empty()) {
+        exporterStatsOpt = parseExporterStats(spec.fields);
+      }
+      BaseTcpEventHandler::Output output;
+      output.exporter = makeExporter(spec.mode, spec.path, exporterStatsOpt);
+      output.clients = paths::common::getExporterClients(spec, clients);
+      for (const auto& type : spec.types) {
+        output.types.insert(parseEventType(type));
+      }
+      output.queueFull = spec.queueFull;
+      outputs.push_back(std::move(output));
     }
+    handler = std::make_shared<BaseTcpEventHandler>(std::move(outputs));
+  }
+  auto ring = paths::common::EventRingWriter::createFromFlags(
+      "tcpevents", sizeof(bpf::tcp_event_t), false);
+  if (ring) {
+    handler = std::make_shared<RingTcpEventHandler>(std::move(ring), handler);
+  }
+  auto stream =
+      paths::common::EventStreamPublisher<bpf::tcp_event_t>::createFromFlags(
+          "tcpevents", std::make_unique<TcpEventStreamSchema>());
+  if (stream) {
+    handler =
+        std::make_shared<StreamTcpEventHandler>(std::move(stream), handler);
   }
-
-  // init the handler
-  const auto exporter = TcpEventExporter::createExporter(
-      exportMode, std::move(exportFile), statsToPrintOpt);
-  const auto handler = std::make_shared<BaseTcpEventHandler>(exporter, FLAGS_client_prefix);
   TcpEventCollector collector(enabledEvents, handler);
 
   // setup shutdown handler